@@ -14,6 +14,9 @@
 #include "background.h"
 #include "util.h"
 
+static struct background *background_set_find (struct background_set *bg_set,
+                                               time_t when, long *elapsed);
+
 /**
  * Create new background_set.
  */
@@ -56,43 +59,99 @@ background_set_free (struct background_set *bg_set)
 struct background*
 background_set_get_now (struct background_set *bg_set)
 {
-    struct background *bg = bg_set->bg_first;
-
-    int time_overlap = 0;
-    if (! bg_set->bg_first) {
-        /* Nothing to do, no backgrounds. */
-    } else if (! bg_set->bg_first->next) {
-        bg = bg_set->bg_first;
-    } else {
-        int time_elapsed = time (0) - bg_set->time;
-        do {
-            time_elapsed -= bg->duration + bg->transition;
-            if (time_elapsed >= 0) {
-                if (bg->next) {
-                    bg = bg->next;
-                } else {
-                    /* All image durations have been subtracted, remove
-                       total time from start offset to avoid excessive
-                       looping. */
-                    bg = bg_set->bg_first;
-                    bg_set->time += bg_set->total;
-                }
-            }
-        } while (time_elapsed > 0);
+    time_t now = time (0);
 
-        time_overlap = bg->duration + bg->transition + time_elapsed;
+    /* Move start offset forward past complete loops to avoid excessive
+       looping. */
+    if (bg_set->total > 0 && now > bg_set->time) {
+        bg_set->time += ((now - bg_set->time) / bg_set->total) * bg_set->total;
     }
 
-    /* Set duration to duration + transition until transitions are
-       supported */
-    if (bg) {
-        bg_set->duration = bg->duration + bg->transition - time_overlap;
+    /* The background changes when the transition to the next one
+       starts, faded over the transition, and when it ends. */
+    long elapsed;
+    struct background *bg = background_set_find (bg_set, now, &elapsed);
+    if (bg && elapsed < bg->duration) {
+        bg_set->duration = bg->duration - elapsed;
+    } else if (bg) {
+        bg_set->duration = bg->duration + bg->transition - elapsed;
     }
     bg_set->bg_curr = bg;
 
     return bg_set->bg_curr;
 }
 
+/**
+ * Get image from background set to be used at time when without
+ * updating the background set, used to look ahead. If remaining is
+ * non-NULL it is set to the number of seconds the image is shown
+ * after when.
+ */
+struct background*
+background_set_get_at (struct background_set *bg_set, time_t when,
+                       unsigned int *remaining)
+{
+    long elapsed;
+    struct background *bg = background_set_find (bg_set, when, &elapsed);
+    if (remaining) {
+        *remaining = bg ? bg->duration + bg->transition - elapsed : 0;
+    }
+    return bg;
+}
+
+/**
+ * Get background transitioned from at time when, NULL if no transition
+ * is in progress at when. to is set to the background transitioned to
+ * and start to the time the transition started.
+ */
+struct background*
+background_set_get_transition (struct background_set *bg_set, time_t when,
+                               struct background **to, time_t *start)
+{
+    long elapsed;
+    struct background *bg = background_set_find (bg_set, when, &elapsed);
+    if (! bg || bg->transition == 0 || elapsed < bg->duration) {
+        return NULL;
+    }
+
+    *to = bg->next ? bg->next : bg_set->bg_first;
+    *start = when - (elapsed - bg->duration);
+    return bg;
+}
+
+/**
+ * Find background shown at time when, elapsed is set to the number of
+ * seconds it has been shown including its transition.
+ */
+struct background*
+background_set_find (struct background_set *bg_set, time_t when,
+                     long *elapsed)
+{
+    struct background *bg = bg_set->bg_first;
+    *elapsed = 0;
+    if (! bg || bg_set->total == 0) {
+        return bg;
+    }
+
+    *elapsed = (long) (when - bg_set->time) % (long) bg_set->total;
+    if (*elapsed < 0) {
+        *elapsed += bg_set->total;
+    }
+
+    for (; bg; bg = bg->next) {
+        long span = bg->duration + bg->transition;
+        if (*elapsed < span) {
+            break;
+        }
+        *elapsed -= span;
+    }
+    if (! bg) {
+        bg = bg_set->bg_first;
+        *elapsed = 0;
+    }
+    return bg;
+}
+
 /**
  * Add background to background_set.
  */
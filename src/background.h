@@ -11,6 +11,8 @@
 
 #include "config.h"
 
+#include <time.h>
+
 /**
  * Single background, part of a background set.
  */
@@ -43,6 +45,12 @@ extern struct background_set *background_set_new (void);
 extern void background_set_free (struct background_set *bg_set);
 
 extern struct background *background_set_get_now (struct background_set *bg_set);
+extern struct background *background_set_get_at (struct background_set *bg_set,
+                                                 time_t when,
+                                                 unsigned int *remaining);
+extern struct background *background_set_get_transition (
+    struct background_set *bg_set, time_t when, struct background **to,
+    time_t *start);
 
 extern struct background *background_set_add_background (struct background_set *bg_set,
                                                          const char *path,
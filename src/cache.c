@@ -8,22 +8,69 @@
 
 #include "config.h"
 
+#include <stdio.h>
 #include <string.h>
-#include <Imlib2.h>
 
 #include "cache.h"
 #include "util.h"
 
+/** Victim must have a server pixmap. */
+#define CACHE_VICTIM_PIXMAP (1 << 0)
+/** Victim must have a packed copy. */
+#define CACHE_VICTIM_PACKED (1 << 1)
+/** Victim must not be visible. */
+#define CACHE_VICTIM_HIDDEN (1 << 2)
+
+static struct cache_node *cache_node_new (const char *spec, uint64_t digest,
+                                          const char *path,
+                                          Pixmap pixmap, size_t bytes);
+static void cache_node_free (struct cache *cache, struct cache_node *node);
+static void cache_link (struct cache *cache, struct cache_node *node);
+static void cache_unlink (struct cache *cache, struct cache_node *node);
+static void cache_lru_push_front (struct cache *cache,
+                                  struct cache_node *node);
+static void cache_lru_remove (struct cache *cache, struct cache_node *node);
+static int cache_is_over_limit (struct cache *cache);
+static int cache_is_over_packed_limit (struct cache *cache);
+static void cache_trim (struct cache *cache, struct cache_node *keep);
+static struct cache_node *cache_victim (struct cache *cache,
+                                        struct cache_node *keep, int flags);
+static int cache_is_victim (struct cache_node *node, struct cache_node *keep,
+                            int flags);
+static void cache_hit (struct cache *cache, struct cache_node *node);
+static void cache_update_priority (struct cache *cache,
+                                   struct cache_node *node);
+static void cache_demote (struct cache *cache, struct cache_node *node);
+static void cache_drop_packed (struct cache *cache, struct cache_node *node);
+static void cache_evict (struct cache *cache, struct cache_node *node);
+static void cache_remove (struct cache *cache, struct cache_node *node);
+static void cache_ghosts_add (struct cache_ghosts *ghosts, uint64_t digest);
+static int cache_ghosts_remove (struct cache_ghosts *ghosts,
+                                uint64_t digest);
+
 /**
  * Create new cache node.
  */
 struct cache_node*
-cache_node_new (const char *spec, Pixmap pixmap)
+cache_node_new (const char *spec, uint64_t digest, const char *path,
+                Pixmap pixmap, size_t bytes)
 {
     struct cache_node *node = mem_new (sizeof (struct cache_node));
+    node->digest = digest;
     node->spec = str_dup (spec);
+    node->path = path ? str_dup (path) : 0;
     node->pixmap = pixmap;
-    node->next = 0;
+    node->bytes = bytes;
+    node->packed = 0;
+    node->packed_bytes = 0;
+    node->visible = 0;
+    node->hits = 1;
+    node->cost = 0;
+    node->priority = 0.0;
+    node->arc_frequent = 0;
+    node->hash_next = 0;
+    node->lru_prev = 0;
+    node->lru_next = 0;
     return node;
 }
 
@@ -31,20 +78,40 @@ cache_node_new (const char *spec, Pixmap pixmap)
  * Free up resources used by cache node.
  */
 void
-cache_node_free (struct cache_node *node)
+cache_node_free (struct cache *cache, struct cache_node *node)
 {
-    imlib_free_pixmap_and_mask (node->pixmap);
+    if (node->pixmap != None && cache->free_pixmap) {
+        cache->free_pixmap (node->pixmap);
+    }
+    mem_free (node->packed);
+    mem_free (node->path);
     mem_free (node->spec);
     mem_free (node);
 }
 
 /**
- * Create new cache structure.
+ * Create new cache structure, free_pixmap is called for server pixmaps
+ * leaving the cache.
  */
 struct cache*
-cache_new (void)
+cache_new (size_t max_bytes, unsigned int max_entries,
+           size_t max_packed_bytes, enum cache_policy policy,
+           cache_free_pixmap_fn free_pixmap)
 {
     struct cache *cache = mem_new (sizeof (struct cache));
+    cache->max_bytes = max_bytes;
+    cache->max_entries = max_entries;
+    cache->max_packed_bytes = max_packed_bytes;
+    cache->policy = policy;
+    cache->free_pixmap = free_pixmap;
+    cache->bytes = 0;
+    cache->entries = 0;
+    cache->packed_bytes = 0;
+    cache->clock = 0.0;
+    cache->arc_target = 0;
+    memset (&cache->arc_recent_ghosts, 0, sizeof (struct cache_ghosts));
+    memset (&cache->arc_frequent_ghosts, 0, sizeof (struct cache_ghosts));
+    memset (cache->buckets, 0, sizeof (cache->buckets));
     cache->first = 0;
     cache->last = 0;
     return cache;
@@ -56,22 +123,85 @@ cache_new (void)
 void
 cache_free (struct cache *cache)
 {
-    struct cache_node *it = cache->first;
-    for (; it; it = it->next) {
-        cache_node_free (it);
+    struct cache_node *it = cache->first, *it_next;
+    for (; it; it = it_next) {
+        it_next = it->lru_next;
+        cache_node_free (cache, it);
     }
     mem_free (cache);
 }
 
 /**
- * Get pixmap from cache.
+ * Parse policy name, returns 0 if str is not a known policy.
+ */
+int
+cache_policy_from_str (const char *str, enum cache_policy *policy)
+{
+    static const enum cache_policy policies[] = {
+        CACHE_POLICY_LRU, CACHE_POLICY_LFU, CACHE_POLICY_ARC,
+        CACHE_POLICY_SIZE
+    };
+    for (size_t i = 0; i < sizeof (policies) / sizeof (policies[0]); i++) {
+        if (! strcmp (str, cache_policy_to_str (policies[i]))) {
+            *policy = policies[i];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Get name of policy.
+ */
+const char*
+cache_policy_to_str (enum cache_policy policy)
+{
+    switch (policy) {
+    case CACHE_POLICY_LFU:
+        return "lfu";
+    case CACHE_POLICY_ARC:
+        return "arc";
+    case CACHE_POLICY_SIZE:
+        return "size";
+    case CACHE_POLICY_LRU:
+    default:
+        return "lru";
+    }
+}
+
+/**
+ * Check if server pixmaps of bytes and entries can be added without
+ * demoting or evicting anything.
+ */
+int
+cache_fits (struct cache *cache, size_t bytes, unsigned int entries)
+{
+    return (! cache->max_bytes || cache->bytes + bytes <= cache->max_bytes)
+        && (! cache->max_entries
+            || cache->entries + entries <= cache->max_entries);
+}
+
+/**
+ * Check if packed_bytes of packed copies can be added without dropping
+ * any packed copies.
+ */
+int
+cache_fits_packed (struct cache *cache, size_t packed_bytes)
+{
+    return ! cache->max_packed_bytes
+        || cache->packed_bytes + packed_bytes <= cache->max_packed_bytes;
+}
+
+/**
+ * Get pixmap from cache without updating the LRU order.
  */
 struct cache_node*
-cache_get_pixmap (struct cache *cache, const char *spec)
+cache_peek_pixmap (struct cache *cache, const char *spec)
 {
-    struct cache_node *it = cache->first;
-    for (; it != 0; it = it->next) {
-        if (! strcmp (spec, it->spec)) {
+    uint64_t digest = str_digest (spec);
+    struct cache_node *it = cache->buckets[digest & (CACHE_BUCKETS - 1)];
+    for (; it != 0; it = it->hash_next) {
+        if (it->digest == digest && ! strcmp (spec, it->spec)) {
             return it;
         }
     }
@@ -79,17 +209,442 @@ cache_get_pixmap (struct cache *cache, const char *spec)
 }
 
 /**
- * Add pixmap to cache.
+ * Get pixmap from cache, marking it as the most recently used. The
+ * pixmap of the returned node is None if the entry is demoted and
+ * needs to be promoted with cache_promote before use.
+ */
+struct cache_node*
+cache_get_pixmap (struct cache *cache, const char *spec)
+{
+    struct cache_node *node = cache_peek_pixmap (cache, spec);
+    if (node != 0) {
+        cache_lru_remove (cache, node);
+        cache_lru_push_front (cache, node);
+        cache_hit (cache, node);
+    }
+    return node;
+}
+
+/**
+ * Add pixmap to cache, demoting or evicting entries selected by the
+ * policy until the cache is within its limits. The added entry is
+ * never demoted or evicted.
  */
 struct cache_node*
-cache_set_pixmap (struct cache *cache, const char *spec, Pixmap pixmap)
+cache_set_pixmap (struct cache *cache, const char *spec, const char *path,
+                  Pixmap pixmap, size_t bytes)
+{
+    struct cache_node *node =
+        cache_node_new (spec, str_digest (spec), path, pixmap, bytes);
+
+    /* Entries evicted not long ago go straight to the frequent list,
+       adapting the target size of the recent list. */
+    if (cache_ghosts_remove (&cache->arc_recent_ghosts, node->digest)) {
+        cache->arc_target += bytes;
+        if (cache->max_bytes && cache->arc_target > cache->max_bytes) {
+            cache->arc_target = cache->max_bytes;
+        }
+        node->arc_frequent = 1;
+    } else if (cache_ghosts_remove (&cache->arc_frequent_ghosts,
+                                    node->digest)) {
+        cache->arc_target =
+            cache->arc_target > bytes ? cache->arc_target - bytes : 0;
+        node->arc_frequent = 1;
+    }
+
+    cache_update_priority (cache, node);
+    cache_link (cache, node);
+    cache_trim (cache, node);
+    return node;
+}
+
+/**
+ * Set the render cost of node in milliseconds, used by the size
+ * policy.
+ */
+void
+cache_set_cost (struct cache *cache, struct cache_node *node, long cost)
+{
+    node->cost = cost;
+    cache_update_priority (cache, node);
+}
+
+/**
+ * Set packed copy of node, the cache takes ownership of packed.
+ */
+void
+cache_set_packed (struct cache *cache, struct cache_node *node,
+                  unsigned char *packed, size_t packed_bytes)
+{
+    cache->packed_bytes -= node->packed_bytes;
+    mem_free (node->packed);
+
+    node->packed = packed;
+    node->packed_bytes = packed_bytes;
+    cache->packed_bytes += packed_bytes;
+    cache_trim (cache, node);
+}
+
+/**
+ * Set server pixmap of demoted node, moving it back to the hot tier.
+ */
+void
+cache_promote (struct cache *cache, struct cache_node *node, Pixmap pixmap)
+{
+    node->pixmap = pixmap;
+    cache->bytes += node->bytes;
+    cache->entries++;
+    cache_trim (cache, node);
+}
+
+/**
+ * Clear the visible flag of all entries.
+ */
+void
+cache_clear_visible (struct cache *cache)
+{
+    struct cache_node *it = cache->first;
+    for (; it; it = it->lru_next) {
+        it->visible = 0;
+    }
+}
+
+/**
+ * Shrink the cache below max_bytes of server pixmaps and
+ * max_packed_bytes of packed copies, demoting and evicting entries
+ * selected by the policy. Visible entries are kept. Returns the
+ * number of bytes released.
+ */
+size_t
+cache_shrink (struct cache *cache, size_t max_bytes, size_t max_packed_bytes)
 {
-    struct cache_node *node = cache_node_new (spec, pixmap);
-    if (cache->last) {
-        cache->last->next = node;
+    size_t bytes = cache->bytes + cache->packed_bytes;
+
+    struct cache_node *node;
+    while (cache->bytes > max_bytes
+           && (node = cache_victim (cache, 0, CACHE_VICTIM_PIXMAP
+                                    | CACHE_VICTIM_HIDDEN)) != 0) {
+        cache_demote (cache, node);
+    }
+    while (cache->packed_bytes > max_packed_bytes
+           && (node = cache_victim (cache, 0, CACHE_VICTIM_PACKED
+                                    | CACHE_VICTIM_HIDDEN)) != 0) {
+        cache_evict (cache, node);
+    }
+
+    return bytes - cache->bytes - cache->packed_bytes;
+}
+
+/**
+ * Remove all entries rendered from path, returns number of removed
+ * entries.
+ */
+unsigned int
+cache_invalidate_path (struct cache *cache, const char *path)
+{
+    unsigned int num = 0;
+    struct cache_node *it = cache->first, *it_next;
+    for (; it; it = it_next) {
+        it_next = it->lru_next;
+        if (it->path && ! strcmp (it->path, path)) {
+            cache_remove (cache, it);
+            num++;
+        }
+    }
+    return num;
+}
+
+/**
+ * Insert node in hash bucket and first in the LRU list.
+ */
+void
+cache_link (struct cache *cache, struct cache_node *node)
+{
+    struct cache_node **bucket =
+        &cache->buckets[node->digest & (CACHE_BUCKETS - 1)];
+    node->hash_next = *bucket;
+    *bucket = node;
+
+    cache_lru_push_front (cache, node);
+
+    if (node->pixmap != None) {
+        cache->bytes += node->bytes;
+        cache->entries++;
+    }
+    cache->packed_bytes += node->packed_bytes;
+}
+
+/**
+ * Remove node from hash bucket and LRU list, does not free the node.
+ */
+void
+cache_unlink (struct cache *cache, struct cache_node *node)
+{
+    struct cache_node **it =
+        &cache->buckets[node->digest & (CACHE_BUCKETS - 1)];
+    for (; *it; it = &(*it)->hash_next) {
+        if (*it == node) {
+            *it = node->hash_next;
+            break;
+        }
+    }
+
+    cache_lru_remove (cache, node);
+
+    if (node->pixmap != None) {
+        cache->bytes -= node->bytes;
+        cache->entries--;
+    }
+    cache->packed_bytes -= node->packed_bytes;
+}
+
+/**
+ * Put node first in the LRU list.
+ */
+void
+cache_lru_push_front (struct cache *cache, struct cache_node *node)
+{
+    node->lru_prev = 0;
+    node->lru_next = cache->first;
+    if (cache->first) {
+        cache->first->lru_prev = node;
+    } else {
         cache->last = node;
+    }
+    cache->first = node;
+}
+
+/**
+ * Remove node from the LRU list.
+ */
+void
+cache_lru_remove (struct cache *cache, struct cache_node *node)
+{
+    if (node->lru_prev) {
+        node->lru_prev->lru_next = node->lru_next;
     } else {
-        cache->first = cache->last = node;
+        cache->first = node->lru_next;
     }
-    return node;
+    if (node->lru_next) {
+        node->lru_next->lru_prev = node->lru_prev;
+    } else {
+        cache->last = node->lru_prev;
+    }
+    node->lru_prev = 0;
+    node->lru_next = 0;
+}
+
+/**
+ * Check if server pixmaps exceed either the byte budget or entry
+ * limit.
+ */
+int
+cache_is_over_limit (struct cache *cache)
+{
+    return (cache->max_bytes && cache->bytes > cache->max_bytes)
+        || (cache->max_entries && cache->entries > cache->max_entries);
+}
+
+/**
+ * Check if packed copies exceed the packed byte budget.
+ */
+int
+cache_is_over_packed_limit (struct cache *cache)
+{
+    return cache->max_packed_bytes
+        && cache->packed_bytes > cache->max_packed_bytes;
+}
+
+/**
+ * Demote server pixmaps and drop packed copies selected by the policy
+ * until the cache is within its limits, keep is left untouched.
+ */
+void
+cache_trim (struct cache *cache, struct cache_node *keep)
+{
+    struct cache_node *node;
+    while (cache_is_over_limit (cache)
+           && (node = cache_victim (cache, keep, CACHE_VICTIM_PIXMAP)) != 0) {
+        cache_demote (cache, node);
+    }
+    while (cache_is_over_packed_limit (cache)
+           && (node = cache_victim (cache, keep, CACHE_VICTIM_PACKED)) != 0) {
+        if (node->pixmap == None) {
+            cache_evict (cache, node);
+        } else {
+            cache_drop_packed (cache, node);
+        }
+    }
+}
+
+/**
+ * Select the entry to demote or evict next according to the policy,
+ * ties go to the least recently used entry. Returns NULL if no entry
+ * matches flags.
+ */
+struct cache_node*
+cache_victim (struct cache *cache, struct cache_node *keep, int flags)
+{
+    struct cache_node *it, *victim = 0;
+
+    if (cache->policy == CACHE_POLICY_ARC) {
+        /* Take from the recent list while it is above its target
+           size, else from the frequent list. */
+        size_t recent_bytes = 0;
+        int has_frequent = 0;
+        for (it = cache->last; it; it = it->lru_prev) {
+            if (cache_is_victim (it, keep, flags)) {
+                if (it->arc_frequent) {
+                    has_frequent = 1;
+                } else {
+                    recent_bytes += it->bytes;
+                }
+            }
+        }
+        int frequent = has_frequent
+            && (recent_bytes == 0 || recent_bytes <= cache->arc_target);
+        for (it = cache->last; it; it = it->lru_prev) {
+            if (cache_is_victim (it, keep, flags)
+                && it->arc_frequent == frequent) {
+                return it;
+            }
+        }
+        return 0;
+    }
+
+    for (it = cache->last; it; it = it->lru_prev) {
+        if (! cache_is_victim (it, keep, flags)) {
+            continue;
+        }
+        if (cache->policy == CACHE_POLICY_LRU) {
+            return it;
+        } else if (victim == 0
+                   || (cache->policy == CACHE_POLICY_LFU
+                       && it->hits < victim->hits)
+                   || (cache->policy == CACHE_POLICY_SIZE
+                       && it->priority < victim->priority)) {
+            victim = it;
+        }
+    }
+
+    /* Entries added later start from the priority of the victim so old
+       entries eventually age out. */
+    if (victim != 0 && cache->policy == CACHE_POLICY_SIZE) {
+        cache->clock = victim->priority;
+    }
+    return victim;
+}
+
+/**
+ * Check if node matches victim flags.
+ */
+int
+cache_is_victim (struct cache_node *node, struct cache_node *keep, int flags)
+{
+    return node != keep
+        && (! (flags & CACHE_VICTIM_PIXMAP) || node->pixmap != None)
+        && (! (flags & CACHE_VICTIM_PACKED) || node->packed != 0)
+        && (! (flags & CACHE_VICTIM_HIDDEN) || ! node->visible);
+}
+
+/**
+ * Update policy state of node on a cache hit.
+ */
+void
+cache_hit (struct cache *cache, struct cache_node *node)
+{
+    node->hits++;
+    node->arc_frequent = 1;
+    cache_update_priority (cache, node);
+}
+
+/**
+ * Update greedy dual size frequency priority of node, frequently used
+ * entries expensive to render per byte are kept longer.
+ */
+void
+cache_update_priority (struct cache *cache, struct cache_node *node)
+{
+    double cost = node->cost > 0 ? node->cost : 1;
+    double bytes = node->bytes > 0 ? node->bytes : 1;
+    node->priority = cache->clock + node->hits * cost / bytes;
+}
+
+/**
+ * Free the server pixmap of node keeping the packed copy, nodes
+ * without a packed copy are evicted.
+ */
+void
+cache_demote (struct cache *cache, struct cache_node *node)
+{
+    if (node->packed == 0) {
+        cache_evict (cache, node);
+        return;
+    }
+
+    if (cache->free_pixmap) {
+        cache->free_pixmap (node->pixmap);
+    }
+    node->pixmap = None;
+    cache->bytes -= node->bytes;
+    cache->entries--;
+}
+
+/**
+ * Free the packed copy of node keeping the server pixmap.
+ */
+void
+cache_drop_packed (struct cache *cache, struct cache_node *node)
+{
+    cache->packed_bytes -= node->packed_bytes;
+    mem_free (node->packed);
+    node->packed = 0;
+    node->packed_bytes = 0;
+}
+
+/**
+ * Evict node, remembering it for the ARC policy.
+ */
+void
+cache_evict (struct cache *cache, struct cache_node *node)
+{
+    cache_ghosts_add (node->arc_frequent
+                      ? &cache->arc_frequent_ghosts
+                      : &cache->arc_recent_ghosts, node->digest);
+    cache_remove (cache, node);
+}
+
+/**
+ * Remove node from the cache freeing all resources.
+ */
+void
+cache_remove (struct cache *cache, struct cache_node *node)
+{
+    cache_unlink (cache, node);
+    cache_node_free (cache, node);
+}
+
+/**
+ * Remember evicted digest, replacing the oldest.
+ */
+void
+cache_ghosts_add (struct cache_ghosts *ghosts, uint64_t digest)
+{
+    ghosts->digests[ghosts->next] = digest;
+    ghosts->next = (ghosts->next + 1) % CACHE_GHOSTS;
+}
+
+/**
+ * Forget digest, returns 1 if it was remembered.
+ */
+int
+cache_ghosts_remove (struct cache_ghosts *ghosts, uint64_t digest)
+{
+    for (unsigned int i = 0; i < CACHE_GHOSTS; i++) {
+        if (ghosts->digests[i] == digest && digest != 0) {
+            ghosts->digests[i] = 0;
+            return 1;
+        }
+    }
+    return 0;
 }
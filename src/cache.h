@@ -11,36 +11,125 @@
 
 #include "config.h"
 
+#include <stddef.h>
+#include <stdint.h>
 #include <X11/Xlib.h>
 
-#include "wallpaper.h"
+/**
+ * Number of hash buckets, must be a power of two.
+ */
+#define CACHE_BUCKETS 64
+/**
+ * Number of evicted entries remembered by the ARC policy, per list.
+ */
+#define CACHE_GHOSTS 64
+
+/**
+ * Policy selecting which entry to demote or evict first.
+ */
+enum cache_policy {
+    CACHE_POLICY_LRU, /**< Least recently used. */
+    CACHE_POLICY_LFU, /**< Least frequently used. */
+    CACHE_POLICY_ARC, /**< Adaptive replacement cache. */
+    CACHE_POLICY_SIZE /**< Greedy dual size frequency, cost per byte. */
+};
+
+/**
+ * Function freeing a server pixmap.
+ */
+typedef void (*cache_free_pixmap_fn) (Pixmap pixmap);
 
 /**
  * Single node in the cache structure.
  */
 struct cache_node {
+    uint64_t digest;
     char *spec;
-    Pixmap pixmap;
+    char *path; /**< Source image path, NULL if not rendered from a file. */
+    Pixmap pixmap; /**< Server pixmap, None if demoted to packed only. */
+    size_t bytes; /**< Size of the server pixmap. */
+    unsigned char *packed; /**< Compressed client side copy, or NULL. */
+    size_t packed_bytes;
+    int visible; /**< Part of the current root pixmap, kept on shrink. */
+
+    unsigned int hits;
+    long cost; /**< Milliseconds to render, 0 if unknown. */
+    double priority; /**< Greedy dual size frequency priority. */
+    int arc_frequent; /**< Set if in the ARC frequent list. */
 
-    struct cache_node *next;
+    struct cache_node *hash_next;
+    struct cache_node *lru_prev;
+    struct cache_node *lru_next;
+};
+
+/**
+ * Evicted entries remembered by the ARC policy.
+ */
+struct cache_ghosts {
+    uint64_t digests[CACHE_GHOSTS];
+    unsigned int next;
 };
 
 /**
- * Cache structure.
+ * Cache structure, nodes are hashed on the spec digest and kept in
+ * least recently used order with first being the most recently used.
+ *
+ * Entries with a server pixmap make up the hot tier limited by
+ * max_bytes and max_entries. Entries with a packed copy are demoted
+ * to the packed tier, keeping only the packed copy, instead of being
+ * evicted. The policy selects which entry to demote or evict first.
  */
 struct cache {
+    size_t max_bytes; /**< Server pixmap byte budget, 0 for unlimited. */
+    unsigned int max_entries; /**< Server pixmap limit, 0 for unlimited. */
+    size_t max_packed_bytes; /**< Packed byte budget, 0 for unlimited. */
+    enum cache_policy policy;
+    cache_free_pixmap_fn free_pixmap;
+
+    size_t bytes;
+    unsigned int entries;
+    size_t packed_bytes;
+
+    double clock; /**< Priority of last victim, size policy. */
+    size_t arc_target; /**< Target bytes of recent entries, ARC policy. */
+    struct cache_ghosts arc_recent_ghosts;
+    struct cache_ghosts arc_frequent_ghosts;
+
+    struct cache_node *buckets[CACHE_BUCKETS];
     struct cache_node *first;
     struct cache_node *last;
 };
 
 
-extern struct cache *cache_new (void);
+extern struct cache *cache_new (size_t max_bytes, unsigned int max_entries,
+                                size_t max_packed_bytes,
+                                enum cache_policy policy,
+                                cache_free_pixmap_fn free_pixmap);
 extern void cache_free (struct cache *cache);
+extern int cache_policy_from_str (const char *str, enum cache_policy *policy);
+extern const char *cache_policy_to_str (enum cache_policy policy);
 
+extern int cache_fits (struct cache *cache, size_t bytes,
+                       unsigned int entries);
+extern int cache_fits_packed (struct cache *cache, size_t packed_bytes);
+extern struct cache_node *cache_peek_pixmap (struct cache *cache,
+                                             const char *spec);
 extern struct cache_node *cache_get_pixmap (struct cache *cache,
                                             const char *spec);
 extern struct cache_node *cache_set_pixmap (struct cache *cache,
                                             const char *spec,
-                                            Pixmap pixmap);
+                                            const char *path,
+                                            Pixmap pixmap, size_t bytes);
+extern void cache_set_cost (struct cache *cache, struct cache_node *node,
+                            long cost);
+extern void cache_set_packed (struct cache *cache, struct cache_node *node,
+                              unsigned char *packed, size_t packed_bytes);
+extern void cache_promote (struct cache *cache, struct cache_node *node,
+                           Pixmap pixmap);
+extern void cache_clear_visible (struct cache *cache);
+extern size_t cache_shrink (struct cache *cache, size_t max_bytes,
+                           size_t max_packed_bytes);
+extern unsigned int cache_invalidate_path (struct cache *cache,
+                                           const char *path);
 
 #endif /* _CACHE_H_ */
@@ -0,0 +1,251 @@
+/*
+ * cachesim.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+/*
+ * Replays a render cache trace, recorded by wallpaperd with
+ * cache.trace set, against the render cache with different policies
+ * and budgets.
+ */
+
+#include "config.h"
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "trace.h"
+#include "util.h"
+#include "wallpaper_spec.h"
+
+/**
+ * Trace event reduced to what the cache sees.
+ */
+struct sim_access {
+    char *spec; /**< Head spec, the render cache key. */
+    long cost;
+    size_t bytes;
+};
+
+/**
+ * Result of replaying the trace with a single policy and budget.
+ */
+struct sim_result {
+    unsigned long hits;
+    double bytes_sum; /**< Sum of bytes held after each access. */
+    size_t bytes_peak;
+    long long cost_avoided;
+};
+
+static const char *DEFAULT_POLICIES = "lru,lfu,arc,size";
+static const char *DEFAULT_BUDGETS = "64M,128M,256M,512M,1G";
+
+static void usage (const char *name);
+static struct sim_access *sim_read_trace (const char *path,
+                                          size_t *num_ret,
+                                          long long *cost_ret);
+static void sim_run (struct sim_access *accesses, size_t num,
+                     enum cache_policy policy, size_t budget,
+                     struct sim_result *result);
+static void sim_report (enum cache_policy policy, size_t budget,
+                        size_t num, long long cost,
+                        struct sim_result *result);
+
+/**
+ * Print usage information and exit.
+ */
+void
+usage (const char *name)
+{
+    fprintf (stderr, "usage: %s [-hbp] trace\n", name);
+    fprintf (stderr, "\n");
+    fprintf (stderr, "  -b budgets       comma separated cache budgets,"
+             " defaults to %s\n", DEFAULT_BUDGETS);
+    fprintf (stderr, "  -h help          print help information\n");
+    fprintf (stderr, "  -p policies      comma separated cache policies,"
+             " defaults to %s\n", DEFAULT_POLICIES);
+    fprintf (stderr, "\n");
+    exit (1);
+}
+
+/**
+ * Replay trace for all combinations of policies and budgets.
+ */
+int
+main (int argc, char **argv)
+{
+    const char *policies = DEFAULT_POLICIES;
+    const char *budgets = DEFAULT_BUDGETS;
+
+    int opt;
+    while ((opt = getopt (argc, argv, "b:hp:")) != -1) {
+        switch (opt) {
+        case 'b':
+            budgets = optarg;
+            break;
+        case 'p':
+            policies = optarg;
+            break;
+        case 'h':
+        case '?':
+        default:
+            usage (argv[0]);
+            break;
+        }
+    }
+    if (optind + 1 != argc) {
+        usage (argv[0]);
+    }
+
+    size_t num;
+    long long cost;
+    struct sim_access *accesses = sim_read_trace (argv[optind], &num, &cost);
+    if (num == 0) {
+        die ("no events in trace %s", argv[optind]);
+    }
+
+    printf ("%-8s %10s %9s %12s %12s %12s\n",
+            "policy", "budget", "hit rate", "avg held", "peak held",
+            "avoided ms");
+
+    char *policies_dup = str_dup (policies);
+    char *policy_save = NULL;
+    char *policy_str = strtok_r (policies_dup, ",", &policy_save);
+    for (; policy_str; policy_str = strtok_r (NULL, ",", &policy_save)) {
+        enum cache_policy policy;
+        if (! cache_policy_from_str (policy_str, &policy)) {
+            die ("unknown cache policy %s", policy_str);
+        }
+
+        char *budgets_dup = str_dup (budgets);
+        char *budget_save = NULL;
+        char *budget_str = strtok_r (budgets_dup, ",", &budget_save);
+        for (; budget_str; budget_str = strtok_r (NULL, ",", &budget_save)) {
+            size_t budget = str_to_size (budget_str);
+            struct sim_result result;
+            sim_run (accesses, num, policy, budget, &result);
+            sim_report (policy, budget, num, cost, &result);
+        }
+        mem_free (budgets_dup);
+    }
+    mem_free (policies_dup);
+
+    for (size_t i = 0; i < num; i++) {
+        mem_free (accesses[i].spec);
+    }
+    mem_free (accesses);
+
+    return 0;
+}
+
+/**
+ * Read all events of trace at path, building the head specs the same
+ * way as the daemon. Sets num_ret to the number of events and
+ * cost_ret to the total render time of all events.
+ */
+struct sim_access*
+sim_read_trace (const char *path, size_t *num_ret, long long *cost_ret)
+{
+    FILE *fp = fopen (path, "r");
+    if (fp == NULL) {
+        die ("failed to open trace %s", path);
+    }
+
+    struct sim_access *accesses = NULL;
+    size_t num = 0, size = 0;
+    long long cost = 0;
+    unsigned long line = 0;
+
+    struct trace_event event;
+    int status;
+    while ((status = trace_read (fp, &event)) != 0) {
+        line++;
+        if (status == -1) {
+            fprintf (stderr, "%s:%lu: malformed event, skipping\n",
+                     path, line);
+            continue;
+        }
+
+        if (num == size) {
+            size = size ? size * 2 : 1024;
+            accesses = mem_realloc (accesses,
+                                    sizeof (struct sim_access) * size);
+        }
+
+        struct wallpaper_spec spec = { event.type, event.mode, event.spec };
+        char head_spec[4096];
+        wallpaper_head_spec (&spec, event.width, event.height,
+                             head_spec, sizeof (head_spec));
+        accesses[num].spec = str_dup (head_spec);
+        accesses[num].cost = event.cost;
+        accesses[num].bytes = event.bytes;
+        cost += event.cost;
+        num++;
+    }
+    fclose (fp);
+
+    *num_ret = num;
+    *cost_ret = cost;
+    return accesses;
+}
+
+/**
+ * Replay accesses on a cache with policy and budget. Only the server
+ * pixmap tier is simulated, misses insert a render of the recorded
+ * size and cost.
+ */
+void
+sim_run (struct sim_access *accesses, size_t num,
+         enum cache_policy policy, size_t budget, struct sim_result *result)
+{
+    memset (result, 0, sizeof (struct sim_result));
+
+    struct cache *cache = cache_new (budget, 0, 0, policy, NULL);
+    for (size_t i = 0; i < num; i++) {
+        struct cache_node *node = cache_get_pixmap (cache, accesses[i].spec);
+        if (node != NULL) {
+            result->hits++;
+            result->cost_avoided += accesses[i].cost;
+        } else {
+            /* Any pixmap but None, nothing is freed without a free
+               function. */
+            node = cache_set_pixmap (cache, accesses[i].spec, NULL,
+                                     (Pixmap) 1, accesses[i].bytes);
+            cache_set_cost (cache, node, accesses[i].cost);
+        }
+
+        result->bytes_sum += cache->bytes;
+        if (cache->bytes > result->bytes_peak) {
+            result->bytes_peak = cache->bytes;
+        }
+    }
+    cache_free (cache);
+}
+
+/**
+ * Print result of replay as a single table row, sizes in KiB.
+ */
+void
+sim_report (enum cache_policy policy, size_t budget, size_t num,
+            long long cost, struct sim_result *result)
+{
+    printf ("%-8s %9luK %8.1f%% %11luK %11luK %12lld",
+            cache_policy_to_str (policy),
+            (unsigned long) (budget / 1024),
+            100.0 * result->hits / num,
+            (unsigned long) (result->bytes_sum / num / 1024),
+            (unsigned long) (result->bytes_peak / 1024),
+            result->cost_avoided);
+    if (cost > 0) {
+        printf (" (%.1f%%)", 100.0 * result->cost_avoided / cost);
+    }
+    printf ("\n");
+}
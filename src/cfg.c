@@ -27,6 +27,13 @@ static void cfg_add_node (struct config *config,
 static void read_config (struct config *config);
 static enum bg_select_mode read_bg_select_mode (struct config *config);
 static long read_interval (struct config *config);
+static size_t read_size (struct config *config, const char *key,
+                         size_t size_default);
+static long read_long (struct config *config, const char *key,
+                       long value_default);
+static int read_bool (struct config *config, const char *key,
+                      int value_default);
+static void read_placeholders (struct config *config);
 static void read_bg_set (struct config *config);
 static int validate_config (struct config *config);
 
@@ -56,6 +63,31 @@ cfg_new (void)
     config->bg_interval = 0;
     config->_search_path = 0;
 
+    config->cache_max_bytes = 0;
+    config->cache_max_entries = 0;
+    config->cache_packed = 0;
+    config->cache_packed_max_bytes = 0;
+    config->cache_hot_entries = 0;
+    config->cache_image_max_bytes = 0;
+    config->cache_pool_max_bytes = 0;
+    config->cache_disk = 0;
+    config->cache_disk_max_bytes = 0;
+    config->cache_disk_max_age = 0;
+    config->cache_shared_path = 0;
+    config->cache_prewarm = 0;
+    config->cache_predict = 0;
+    config->cache_predict_save = 0;
+    config->cache_policy = CACHE_POLICY_LRU;
+    config->cache_trace_path = 0;
+    config->render_threads = 0;
+    config->render_kernel = 0;
+    config->render_upscale = KERNEL_FILTER_BILINEAR;
+    config->render_stream_threshold = 0;
+    config->render_dither = 0;
+    config->render_num_placeholders = 0;
+    config->render_progressive_budget = 0;
+    config->render_fade_fps = 0;
+
     config->first = 0;
     config->last = 0;
 
@@ -151,6 +183,11 @@ cfg_unload (struct config *config)
         config->bg_set = 0;
     }
 
+    mem_free (config->cache_shared_path);
+    config->cache_shared_path = 0;
+    mem_free (config->cache_trace_path);
+    config->cache_trace_path = 0;
+
     struct cfg_node *it, *it_next;
     for (it = config->first; it; it = it_next) {
         it_next = it->next;
@@ -172,6 +209,59 @@ read_config (struct config *config)
 {
     config->bg_select_mode = read_bg_select_mode (config);
     config->bg_interval = read_interval (config);
+    config->cache_max_bytes =
+        read_size (config, "cache.max_bytes", 256 * 1024 * 1024);
+    config->cache_max_entries = read_long (config, "cache.max_entries", 0);
+    config->cache_packed = read_bool (config, "cache.packed", 1);
+    config->cache_packed_max_bytes =
+        read_size (config, "cache.packed_max_bytes", 256 * 1024 * 1024);
+    config->cache_hot_entries = read_long (config, "cache.hot_entries", 0);
+    config->cache_image_max_bytes =
+        read_size (config, "cache.image_max_bytes", 128 * 1024 * 1024);
+    config->cache_pool_max_bytes =
+        read_size (config, "cache.pool_max_bytes", 128 * 1024 * 1024);
+    config->cache_disk = read_bool (config, "cache.disk", 1);
+    config->cache_disk_max_bytes =
+        read_size (config, "cache.disk_max_bytes", 512 * 1024 * 1024);
+    config->cache_disk_max_age =
+        read_long (config, "cache.disk_max_age", 30 * 86400);
+    const char *shared_path = cfg_get (config, "cache.shared_path");
+    if (shared_path && shared_path[0] != '\0') {
+        config->cache_shared_path = str_dup (shared_path);
+    }
+    config->cache_prewarm = read_bool (config, "cache.prewarm", 1);
+    config->cache_predict = read_bool (config, "cache.predict", 1);
+    config->cache_predict_save = read_bool (config, "cache.predict_save", 1);
+    const char *policy = cfg_get (config, "cache.policy");
+    if (policy && ! cache_policy_from_str (policy, &config->cache_policy)) {
+        fprintf (stderr, "unknown cache policy %s, setting to lru\n", policy);
+        config->cache_policy = CACHE_POLICY_LRU;
+    }
+    const char *trace_path = cfg_get (config, "cache.trace");
+    if (trace_path && trace_path[0] != '\0') {
+        config->cache_trace_path = str_dup (trace_path);
+    }
+    config->render_threads = read_long (config, "render.threads", 0);
+    const char *kernel = cfg_get (config, "render.kernel");
+    config->render_kernel = kernel ? kernel_from_str (kernel) : 0;
+    if (kernel && ! config->render_kernel) {
+        fprintf (stderr, "unsupported render kernel %s, setting to auto\n",
+                 kernel);
+    }
+    config->render_upscale = KERNEL_FILTER_BILINEAR;
+    const char *upscale = cfg_get (config, "render.upscale");
+    if (upscale
+        && ! kernel_filter_type_from_str (upscale, &config->render_upscale)) {
+        fprintf (stderr, "unknown upscale filter %s, setting to bilinear\n",
+                 upscale);
+    }
+    config->render_stream_threshold =
+        read_size (config, "render.stream_threshold", 64 * 1024 * 1024);
+    config->render_dither = read_bool (config, "render.dither", 1);
+    read_placeholders (config);
+    config->render_progressive_budget =
+        read_long (config, "render.progressive_budget", 100);
+    config->render_fade_fps = read_long (config, "render.fade_fps", 10);
 
     if (config->bg_select_mode == MODE_SET) {
         read_bg_set (config);
@@ -221,6 +311,77 @@ read_interval (struct config *config)
     return interval;
 }
 
+/**
+ * Read size option in bytes, accepting K, M and G suffixes.
+ */
+size_t
+read_size (struct config *config, const char *key, size_t size_default)
+{
+    const char *size_str = cfg_get (config, key);
+    return size_str ? str_to_size (size_str) : size_default;
+}
+
+/**
+ * Read numeric option as long.
+ */
+long
+read_long (struct config *config, const char *key, long value_default)
+{
+    const char *value_str = cfg_get (config, key);
+    return value_str ? strtol (value_str, 0, 10) : value_default;
+}
+
+/**
+ * Read boolean option, true, yes and 1 are considered true.
+ */
+int
+read_bool (struct config *config, const char *key, int value_default)
+{
+    const char *value_str = cfg_get (config, key);
+    if (! value_str) {
+        return value_default;
+    }
+    return ! strcasecmp (value_str, "true")
+        || ! strcasecmp (value_str, "yes")
+        || ! strcmp (value_str, "1");
+}
+
+/**
+ * Read comma separated list of placeholder tiers, none disables
+ * progressive rendering.
+ */
+void
+read_placeholders (struct config *config)
+{
+    const char *value = cfg_get (config, "render.progressive");
+    char *tiers = str_dup (value ? value : "thumbnail,reduced,color");
+
+    config->render_num_placeholders = 0;
+    char *saveptr;
+    for (char *tier = strtok_r (tiers, ", ", &saveptr); tier != NULL;
+         tier = strtok_r (NULL, ", ", &saveptr)) {
+        enum wallpaper_placeholder placeholder;
+        if (! strcmp (tier, "thumbnail")) {
+            placeholder = PLACEHOLDER_THUMBNAIL;
+        } else if (! strcmp (tier, "reduced")) {
+            placeholder = PLACEHOLDER_REDUCED;
+        } else if (! strcmp (tier, "color")) {
+            placeholder = PLACEHOLDER_COLOR;
+        } else {
+            if (strcmp (tier, "none")) {
+                fprintf (stderr, "unknown placeholder %s, ignoring\n", tier);
+            }
+            continue;
+        }
+
+        if (config->render_num_placeholders < PLACEHOLDER_MAX) {
+            config->render_placeholders[config->render_num_placeholders++] =
+                placeholder;
+        }
+    }
+    mem_free (tiers);
+}
+
 /**
  * Read background set from configuration file.
  */
@@ -327,6 +488,27 @@ cfg_get_color (struct config *config, long desktop)
     return color;
 }
 
+/**
+ * Get gradient configured for desktop.
+ */
+const char*
+cfg_get_gradient (struct config *config, long desktop)
+{
+    const char *gradient = 0;
+
+    char *gradient_key;
+    if (asprintf (&gradient_key, "wallpaper.%ld.gradient", desktop) != -1) {
+        gradient = cfg_get (config, gradient_key);
+        mem_free (gradient_key);
+    }
+
+    if (! gradient) {
+        gradient = cfg_get (config, "wallpaper.default.gradient");
+    }
+
+    return gradient;
+}
+
 /**
  * Get wallpaper configured for desktop.
  */
@@ -383,6 +565,8 @@ cfg_get_type_from_str (const char *str)
         type = WALLPAPER_TYPE_IMAGE;
     } else if (! strcasecmp (str, "COLOR")) {
         type = WALLPAPER_TYPE_COLOR;
+    } else if (! strcasecmp (str, "GRADIENT")) {
+        type = WALLPAPER_TYPE_GRADIENT;
     }
 
     return type;
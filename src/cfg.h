@@ -12,6 +12,8 @@
 #include "config.h"
 
 #include "background.h"
+#include "cache.h"
+#include "kernel.h"
 #include "wallpaperd.h"
 
 /**
@@ -37,6 +39,33 @@ struct config {
     long bg_interval;
     char **_search_path;
 
+    size_t cache_max_bytes;
+    unsigned int cache_max_entries;
+    int cache_packed;
+    size_t cache_packed_max_bytes;
+    unsigned int cache_hot_entries;
+    size_t cache_image_max_bytes;
+    size_t cache_pool_max_bytes; /**< Idle pixmaps, 0 disables reuse. */
+    int cache_disk;
+    size_t cache_disk_max_bytes;
+    long cache_disk_max_age;
+    char *cache_shared_path; /**< Host wide render cache, NULL if unused. */
+    int cache_prewarm;
+    int cache_predict;
+    int cache_predict_save;
+    enum cache_policy cache_policy;
+    char *cache_trace_path; /**< Render cache access trace, NULL if unused. */
+    unsigned int render_threads; /**< Render pool size, 0 for one per CPU. */
+    const struct kernel *render_kernel; /**< NULL selects the best. */
+    enum kernel_filter_type render_upscale;
+    size_t render_stream_threshold; /**< 0 disables streamed decoding. */
+    int render_dither;
+    /** Placeholders tried in order when a render exceeds the budget. */
+    enum wallpaper_placeholder render_placeholders[PLACEHOLDER_MAX];
+    unsigned int render_num_placeholders; /**< 0 disables placeholders. */
+    long render_progressive_budget; /**< Milliseconds. */
+    unsigned int render_fade_fps; /**< 0 disables cross-fades. */
+
     struct cfg_node *first;
     struct cfg_node *last;
 };
@@ -51,6 +80,7 @@ extern const char *cfg_get (struct config *config, const char *key);
 extern void cfg_set (struct config *config, const char *key, const char *value);
 extern char **cfg_get_search_path (struct config *config);
 extern const char *cfg_get_color (struct config *config, long desktop);
+extern const char *cfg_get_gradient (struct config *config, long desktop);
 extern const char *cfg_get_wallpaper (struct config *config, long desktop);
 extern enum wallpaper_type cfg_get_type (struct config *config, long desktop);
 extern enum wallpaper_mode cfg_get_mode (struct config *config, long desktop);
@@ -0,0 +1,215 @@
+/*
+ * codec.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "codec.h"
+#include "util.h"
+
+/*
+ * Fast lossless codec for ARGB32 pixels, using the same operations
+ * as the QOI format: runs of the previous pixel, lookup of recently
+ * seen pixels and small differences to the previous pixel. Rendered
+ * wallpapers are smooth so most pixels encode to one or two bytes.
+ */
+
+#define OP_INDEX 0x00
+#define OP_DIFF 0x40
+#define OP_LUMA 0x80
+#define OP_RUN 0xc0
+#define OP_RGB 0xfe
+#define OP_ARGB 0xff
+#define OP_MASK 0xc0
+
+#define RUN_MAX 62
+/** Largest encoding of a single pixel. */
+#define PIXEL_MAX 5
+
+#define PX_A(px) ((px) >> 24)
+#define PX_R(px) (((px) >> 16) & 0xff)
+#define PX_G(px) (((px) >> 8) & 0xff)
+#define PX_B(px) ((px) & 0xff)
+#define PX(a, r, g, b) \
+    (((uint32_t) (a) << 24) | ((uint32_t) (r) << 16) \
+     | ((uint32_t) (g) << 8) | (uint32_t) (b))
+#define PX_HASH(px) \
+    ((PX_R(px) * 3 + PX_G(px) * 5 + PX_B(px) * 7 + PX_A(px) * 11) & 63)
+
+/**
+ * Encode width * height pixels, returns allocated buffer with the
+ * size set in size_ret.
+ */
+unsigned char*
+codec_encode (const uint32_t *data, unsigned int width, unsigned int height,
+              size_t *size_ret)
+{
+    size_t num = (size_t) width * height;
+    size_t cap = sizeof (struct codec_header) + num / 2 + PIXEL_MAX;
+    unsigned char *buf = mem_new (cap);
+
+    struct codec_header header = { CODEC_MAGIC, width, height };
+    memcpy (buf, &header, sizeof (header));
+    size_t pos = sizeof (header);
+
+    uint32_t index[64] = {0};
+    uint32_t prev = PX(255, 0, 0, 0);
+    unsigned int run = 0;
+    for (size_t i = 0; i < num; i++) {
+        if (cap - pos < 2 * PIXEL_MAX) {
+            cap *= 2;
+            buf = mem_realloc (buf, cap);
+        }
+
+        uint32_t px = data[i];
+        if (px == prev) {
+            if (++run == RUN_MAX) {
+                buf[pos++] = OP_RUN | (run - 1);
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            buf[pos++] = OP_RUN | (run - 1);
+            run = 0;
+        }
+
+        unsigned int hash = PX_HASH(px);
+        if (index[hash] == px) {
+            buf[pos++] = OP_INDEX | hash;
+        } else if (PX_A(px) == PX_A(prev)) {
+            index[hash] = px;
+            signed char vr = PX_R(px) - PX_R(prev);
+            signed char vg = PX_G(px) - PX_G(prev);
+            signed char vb = PX_B(px) - PX_B(prev);
+            signed char vg_r = vr - vg;
+            signed char vg_b = vb - vg;
+            if (vr > -3 && vr < 2 && vg > -3 && vg < 2
+                && vb > -3 && vb < 2) {
+                buf[pos++] = OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2
+                    | (vb + 2);
+            } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32
+                       && vg_b > -9 && vg_b < 8) {
+                buf[pos++] = OP_LUMA | (vg + 32);
+                buf[pos++] = (vg_r + 8) << 4 | (vg_b + 8);
+            } else {
+                buf[pos++] = OP_RGB;
+                buf[pos++] = PX_R(px);
+                buf[pos++] = PX_G(px);
+                buf[pos++] = PX_B(px);
+            }
+        } else {
+            index[hash] = px;
+            buf[pos++] = OP_ARGB;
+            buf[pos++] = PX_A(px);
+            buf[pos++] = PX_R(px);
+            buf[pos++] = PX_G(px);
+            buf[pos++] = PX_B(px);
+        }
+        prev = px;
+    }
+    if (run > 0) {
+        buf[pos++] = OP_RUN | (run - 1);
+    }
+
+    *size_ret = pos;
+    return mem_realloc (buf, pos);
+}
+
+/**
+ * Read dimensions of encoded buffer, returns 0 if buf is not valid.
+ */
+int
+codec_get_size (const unsigned char *buf, size_t size,
+                unsigned int *width, unsigned int *height)
+{
+    struct codec_header header;
+    if (size < sizeof (header)) {
+        return 0;
+    }
+    memcpy (&header, buf, sizeof (header));
+    if (header.magic != CODEC_MAGIC) {
+        return 0;
+    }
+    *width = header.width;
+    *height = header.height;
+    return 1;
+}
+
+/**
+ * Decode buffer into data which must hold width * height pixels,
+ * returns 0 if the buffer is invalid or of different size.
+ */
+int
+codec_decode (const unsigned char *buf, size_t size, uint32_t *data,
+              unsigned int width, unsigned int height)
+{
+    unsigned int buf_width, buf_height;
+    if (! codec_get_size (buf, size, &buf_width, &buf_height)
+        || buf_width != width || buf_height != height) {
+        return 0;
+    }
+
+    size_t num = (size_t) width * height;
+    size_t pos = sizeof (struct codec_header);
+    uint32_t index[64] = {0};
+    uint32_t px = PX(255, 0, 0, 0);
+    for (size_t i = 0; i < num; ) {
+        if (pos >= size) {
+            return 0;
+        }
+
+        unsigned int op = buf[pos++];
+        if (op == OP_RGB) {
+            if (size - pos < 3) {
+                return 0;
+            }
+            px = PX(PX_A(px), buf[pos], buf[pos + 1], buf[pos + 2]);
+            pos += 3;
+        } else if (op == OP_ARGB) {
+            if (size - pos < 4) {
+                return 0;
+            }
+            px = PX(buf[pos], buf[pos + 1], buf[pos + 2], buf[pos + 3]);
+            pos += 4;
+        } else if ((op & OP_MASK) == OP_INDEX) {
+            data[i++] = px = index[op];
+            continue;
+        } else if ((op & OP_MASK) == OP_DIFF) {
+            px = PX(PX_A(px),
+                    (PX_R(px) + ((op >> 4) & 3) - 2) & 0xff,
+                    (PX_G(px) + ((op >> 2) & 3) - 2) & 0xff,
+                    (PX_B(px) + (op & 3) - 2) & 0xff);
+        } else if ((op & OP_MASK) == OP_LUMA) {
+            if (pos >= size) {
+                return 0;
+            }
+            int vg = (op & 0x3f) - 32;
+            unsigned int op2 = buf[pos++];
+            px = PX(PX_A(px),
+                    (PX_R(px) + vg - 8 + (op2 >> 4)) & 0xff,
+                    (PX_G(px) + vg) & 0xff,
+                    (PX_B(px) + vg - 8 + (op2 & 0x0f)) & 0xff);
+        } else {
+            size_t run = (op & 0x3f) + 1;
+            if (run > num - i) {
+                return 0;
+            }
+            while (run--) {
+                data[i++] = px;
+            }
+            continue;
+        }
+
+        index[PX_HASH(px)] = px;
+        data[i++] = px;
+    }
+
+    return 1;
+}
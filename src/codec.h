@@ -0,0 +1,37 @@
+/*
+ * codec.h for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#ifndef _CODEC_H_
+#define _CODEC_H_
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CODEC_MAGIC 0x31515057 /* WPQ1 */
+
+/**
+ * Header of encoded buffer, followed by the encoded pixels.
+ */
+struct codec_header {
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+};
+
+extern unsigned char *codec_encode (const uint32_t *data,
+                                    unsigned int width, unsigned int height,
+                                    size_t *size_ret);
+extern int codec_get_size (const unsigned char *buf, size_t size,
+                           unsigned int *width, unsigned int *height);
+extern int codec_decode (const unsigned char *buf, size_t size,
+                         uint32_t *data,
+                         unsigned int width, unsigned int height);
+
+#endif /* _CODEC_H_ */
@@ -59,12 +59,16 @@ size_t
 strlcat(char *dst, const char *src, size_t dstsize)
 {
     size_t dst_len = strlen(dst);
+    size_t src_len = strlen(src);
+    if (dst_len + 1 >= dstsize) {
+        return dst_len + src_len;
+    }
     size_t avail = dstsize - dst_len - 1;
-    size_t cpy_len = MIN(avail, dst_len);
+    size_t cpy_len = MIN(avail, src_len);
     if (cpy_len > 0) {
         memcpy(dst + dst_len, src, cpy_len);
         dst[dst_len + cpy_len] = '\0';
     }
-    return dst_len + strlen(src);
+    return dst_len + src_len;
 }
 #endif /* HAVE_STRLCAT */
@@ -0,0 +1,466 @@
+/*
+ * decode.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+/*
+ * Image decoding bypassing Imlib2 where the format allows decoding
+ * less than the full image. JPEG images are decoded at a reduced size
+ * in the DCT domain, which is much faster than decoding the full image
+ * and scaling it down. JPEG and non-interlaced PNG images can be
+ * decoded one row at a time keeping memory use independent of the
+ * image size. Decoding is safe to do from multiple threads.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#ifdef HAVE_PNG
+#include <png.h>
+#endif /* HAVE_PNG */
+#ifdef HAVE_JPEG
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif /* HAVE_JPEG */
+
+#include "decode.h"
+#include "util.h"
+
+static FILE *decode_open (const char *path, enum decode_type *type);
+
+#ifdef HAVE_JPEG
+/**
+ * Error manager returning control to the decoder on errors instead of
+ * exiting.
+ */
+struct decode_jpeg_error {
+    struct jpeg_error_mgr mgr;
+    jmp_buf env;
+};
+
+/**
+ * JPEG stream decoder state.
+ */
+struct decode_jpeg {
+    struct jpeg_decompress_struct cinfo;
+    struct decode_jpeg_error err;
+    JSAMPROW rgb; /**< RGB row, used without libjpeg-turbo extensions. */
+};
+
+static int decode_jpeg_open (struct decode_stream *stream, int reduce);
+static int decode_jpeg_read (struct decode_stream *stream);
+static void decode_jpeg_close (struct decode_stream *stream);
+static void decode_jpeg_error_exit (j_common_ptr cinfo);
+#endif /* HAVE_JPEG */
+
+#ifdef HAVE_PNG
+/**
+ * PNG stream decoder state.
+ */
+struct decode_png {
+    png_structp png;
+    png_infop info;
+};
+
+static int decode_png_open (struct decode_stream *stream);
+static int decode_png_read (struct decode_stream *stream);
+static void decode_png_close (struct decode_stream *stream);
+#endif /* HAVE_PNG */
+
+/**
+ * Read size of JPEG image at path, returns 0 if path is not a JPEG
+ * image.
+ */
+int
+decode_jpeg_size (const char *path, int *width, int *height)
+{
+#ifdef HAVE_JPEG
+    enum decode_type type;
+    FILE *fp = decode_open (path, &type);
+    if (fp == NULL) {
+        return 0;
+    } else if (type != DECODE_TYPE_JPEG) {
+        fclose (fp);
+        return 0;
+    }
+
+    struct jpeg_decompress_struct cinfo;
+    struct decode_jpeg_error err;
+    cinfo.err = jpeg_std_error (&err.mgr);
+    err.mgr.error_exit = decode_jpeg_error_exit;
+    if (setjmp (err.env)) {
+        jpeg_destroy_decompress (&cinfo);
+        fclose (fp);
+        return 0;
+    }
+
+    jpeg_create_decompress (&cinfo);
+    jpeg_stdio_src (&cinfo, fp);
+    jpeg_read_header (&cinfo, TRUE);
+    *width = cinfo.image_width;
+    *height = cinfo.image_height;
+    jpeg_destroy_decompress (&cinfo);
+    fclose (fp);
+    return 1;
+#else /* ! HAVE_JPEG */
+    return 0;
+#endif /* HAVE_JPEG */
+}
+
+/**
+ * Decode JPEG or non-interlaced PNG image at path to ARGB32 pixels.
+ * JPEG images are reduced by reduce, one of 1, 2, 4 or 8, and reduce
+ * is set to 1 for images that can not be reduced. The reduced size is
+ * the full size divided by reduce rounded up. Returns NULL on failure,
+ * free the pixels with mem_free.
+ */
+uint32_t*
+decode_image (const char *path, int *reduce, int *width_ret,
+              int *height_ret, int *has_alpha_ret)
+{
+    struct decode_stream *stream = decode_stream_open (path, *reduce);
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    int width = stream->width;
+    int height = stream->height;
+    uint32_t *data = mem_new ((size_t) width * height * sizeof (uint32_t));
+    for (int y = 0; y < height && ! stream->error; y++) {
+        memcpy (data + (size_t) y * width, decode_stream_row (stream, y),
+                width * sizeof (uint32_t));
+    }
+    if (stream->error) {
+        mem_free (data);
+        data = NULL;
+    }
+    if (stream->type != DECODE_TYPE_JPEG) {
+        *reduce = 1;
+    }
+    *width_ret = width;
+    *height_ret = height;
+    *has_alpha_ret = stream->has_alpha;
+    decode_stream_close (stream);
+
+    return data;
+}
+
+/**
+ * Open image at path for decoding one row at a time, JPEG images are
+ * reduced by reduce. Returns NULL if the image format is not supported
+ * or the image fails to decode.
+ */
+struct decode_stream*
+decode_stream_open (const char *path, int reduce)
+{
+    enum decode_type type;
+    FILE *fp = decode_open (path, &type);
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    struct decode_stream *stream = mem_new (sizeof (struct decode_stream));
+    memset (stream, 0, sizeof (struct decode_stream));
+    stream->type = type;
+    stream->fp = fp;
+
+    int ok = 0;
+    switch (type) {
+#ifdef HAVE_JPEG
+    case DECODE_TYPE_JPEG:
+        ok = decode_jpeg_open (stream, reduce);
+        break;
+#endif /* HAVE_JPEG */
+#ifdef HAVE_PNG
+    case DECODE_TYPE_PNG:
+        ok = decode_png_open (stream);
+        break;
+#endif /* HAVE_PNG */
+    default:
+        break;
+    }
+    if (! ok) {
+        decode_stream_close (stream);
+        return NULL;
+    }
+
+    stream->row = mem_new ((size_t) stream->width * sizeof (uint32_t));
+    return stream;
+}
+
+/**
+ * Decode rows up to row y and get it, rows must be requested top to
+ * bottom. The row is valid until the next call.
+ */
+const uint32_t*
+decode_stream_row (struct decode_stream *stream, int y)
+{
+    for (; stream->y <= y; stream->y++) {
+        if (! stream->error) {
+            switch (stream->type) {
+#ifdef HAVE_JPEG
+            case DECODE_TYPE_JPEG:
+                stream->error = ! decode_jpeg_read (stream);
+                break;
+#endif /* HAVE_JPEG */
+#ifdef HAVE_PNG
+            case DECODE_TYPE_PNG:
+                stream->error = ! decode_png_read (stream);
+                break;
+#endif /* HAVE_PNG */
+            default:
+                stream->error = 1;
+                break;
+            }
+        }
+        if (stream->error) {
+            for (int x = 0; x < stream->width; x++) {
+                stream->row[x] = 0xff000000;
+            }
+        }
+    }
+    return stream->row;
+}
+
+/**
+ * Close stream freeing all resources.
+ */
+void
+decode_stream_close (struct decode_stream *stream)
+{
+    if (stream->decoder) {
+        switch (stream->type) {
+#ifdef HAVE_JPEG
+        case DECODE_TYPE_JPEG:
+            decode_jpeg_close (stream);
+            break;
+#endif /* HAVE_JPEG */
+#ifdef HAVE_PNG
+        case DECODE_TYPE_PNG:
+            decode_png_close (stream);
+            break;
+#endif /* HAVE_PNG */
+        default:
+            break;
+        }
+    }
+    fclose (stream->fp);
+    mem_free (stream->row);
+    mem_free (stream);
+}
+
+/**
+ * Open path for reading if it is an image type supported by the
+ * decoder, detected from the start of the file.
+ */
+FILE*
+decode_open (const char *path, enum decode_type *type)
+{
+    FILE *fp = fopen (path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    unsigned char magic[8];
+    size_t len = fread (magic, 1, sizeof (magic), fp);
+    rewind (fp);
+#ifdef HAVE_JPEG
+    if (len >= 3 && magic[0] == 0xff && magic[1] == 0xd8 && magic[2] == 0xff) {
+        *type = DECODE_TYPE_JPEG;
+        return fp;
+    }
+#endif /* HAVE_JPEG */
+#ifdef HAVE_PNG
+    if (len == sizeof (magic) && ! png_sig_cmp (magic, 0, sizeof (magic))) {
+        *type = DECODE_TYPE_PNG;
+        return fp;
+    }
+#endif /* HAVE_PNG */
+    fclose (fp);
+    return NULL;
+}
+
+#ifdef HAVE_JPEG
+
+/**
+ * Read JPEG header and start decoding reduced by reduce.
+ */
+int
+decode_jpeg_open (struct decode_stream *stream, int reduce)
+{
+    struct decode_jpeg *jpeg = mem_new (sizeof (struct decode_jpeg));
+    memset (jpeg, 0, sizeof (struct decode_jpeg));
+    stream->decoder = jpeg;
+
+    jpeg->cinfo.err = jpeg_std_error (&jpeg->err.mgr);
+    jpeg->err.mgr.error_exit = decode_jpeg_error_exit;
+    if (setjmp (jpeg->err.env)) {
+        return 0;
+    }
+
+    jpeg_create_decompress (&jpeg->cinfo);
+    jpeg_stdio_src (&jpeg->cinfo, stream->fp);
+    jpeg_read_header (&jpeg->cinfo, TRUE);
+    jpeg->cinfo.scale_num = 1;
+    jpeg->cinfo.scale_denom = reduce;
+#ifdef JCS_EXTENSIONS
+    /* libjpeg-turbo writes ARGB32 in host byte order directly. */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    jpeg->cinfo.out_color_space = JCS_EXT_BGRA;
+#else /* ! __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ */
+    jpeg->cinfo.out_color_space = JCS_EXT_ARGB;
+#endif /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ */
+#else /* ! JCS_EXTENSIONS */
+    jpeg->cinfo.out_color_space = JCS_RGB;
+#endif /* JCS_EXTENSIONS */
+    jpeg_start_decompress (&jpeg->cinfo);
+
+    stream->width = jpeg->cinfo.output_width;
+    stream->height = jpeg->cinfo.output_height;
+    stream->has_alpha = 0;
+#ifndef JCS_EXTENSIONS
+    jpeg->rgb = mem_new ((size_t) stream->width * 3);
+#endif /* JCS_EXTENSIONS */
+    return 1;
+}
+
+/**
+ * Decode next JPEG row.
+ */
+int
+decode_jpeg_read (struct decode_stream *stream)
+{
+    struct decode_jpeg *jpeg = stream->decoder;
+    if (setjmp (jpeg->err.env)) {
+        return 0;
+    }
+
+#ifdef JCS_EXTENSIONS
+    JSAMPROW row = (JSAMPROW) stream->row;
+    jpeg_read_scanlines (&jpeg->cinfo, &row, 1);
+#else /* ! JCS_EXTENSIONS */
+    JSAMPROW row = jpeg->rgb;
+    jpeg_read_scanlines (&jpeg->cinfo, &row, 1);
+    for (int x = 0; x < stream->width; x++) {
+        stream->row[x] = 0xff000000 | (uint32_t) row[x * 3] << 16
+            | (uint32_t) row[x * 3 + 1] << 8 | (uint32_t) row[x * 3 + 2];
+    }
+#endif /* JCS_EXTENSIONS */
+    return 1;
+}
+
+/**
+ * Free JPEG decoder, decoding may be stopped before the last row.
+ */
+void
+decode_jpeg_close (struct decode_stream *stream)
+{
+    struct decode_jpeg *jpeg = stream->decoder;
+    jpeg_destroy_decompress (&jpeg->cinfo);
+    mem_free (jpeg->rgb);
+    mem_free (jpeg);
+}
+
+/**
+ * Report error and return to the decoder.
+ */
+void
+decode_jpeg_error_exit (j_common_ptr cinfo)
+{
+    struct decode_jpeg_error *err = (struct decode_jpeg_error*) cinfo->err;
+    (*cinfo->err->output_message) (cinfo);
+    longjmp (err->env, 1);
+}
+
+#endif /* HAVE_JPEG */
+
+#ifdef HAVE_PNG
+
+/**
+ * Read PNG header and set up conversion to ARGB32. Interlaced images
+ * are not supported as they can not be decoded one row at a time.
+ */
+int
+decode_png_open (struct decode_stream *stream)
+{
+    struct decode_png *png = mem_new (sizeof (struct decode_png));
+    memset (png, 0, sizeof (struct decode_png));
+    stream->decoder = png;
+
+    png->png = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL,
+                                       NULL);
+    if (png->png == NULL) {
+        return 0;
+    }
+    png->info = png_create_info_struct (png->png);
+    if (png->info == NULL || setjmp (png_jmpbuf (png->png))) {
+        return 0;
+    }
+
+    png_init_io (png->png, stream->fp);
+    png_read_info (png->png, png->info);
+    if (png_get_interlace_type (png->png, png->info) != PNG_INTERLACE_NONE) {
+        return 0;
+    }
+
+    int color_type = png_get_color_type (png->png, png->info);
+    stream->width = png_get_image_width (png->png, png->info);
+    stream->height = png_get_image_height (png->png, png->info);
+    stream->has_alpha = (color_type & PNG_COLOR_MASK_ALPHA)
+        || png_get_valid (png->png, png->info, PNG_INFO_tRNS);
+
+    png_set_expand (png->png);
+    png_set_strip_16 (png->png);
+    if (! (color_type & PNG_COLOR_MASK_COLOR)) {
+        png_set_gray_to_rgb (png->png);
+    }
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    png_set_bgr (png->png);
+    if (! stream->has_alpha) {
+        png_set_filler (png->png, 0xff, PNG_FILLER_AFTER);
+    }
+#else /* ! __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ */
+    if (stream->has_alpha) {
+        png_set_swap_alpha (png->png);
+    } else {
+        png_set_filler (png->png, 0xff, PNG_FILLER_BEFORE);
+    }
+#endif /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ */
+    png_read_update_info (png->png, png->info);
+
+    return png_get_rowbytes (png->png, png->info)
+        == (size_t) stream->width * sizeof (uint32_t);
+}
+
+/**
+ * Decode next PNG row.
+ */
+int
+decode_png_read (struct decode_stream *stream)
+{
+    struct decode_png *png = stream->decoder;
+    if (setjmp (png_jmpbuf (png->png))) {
+        return 0;
+    }
+    png_read_row (png->png, (png_bytep) stream->row, NULL);
+    return 1;
+}
+
+/**
+ * Free PNG decoder.
+ */
+void
+decode_png_close (struct decode_stream *stream)
+{
+    struct decode_png *png = stream->decoder;
+    if (png->png) {
+        png_destroy_read_struct (&png->png, &png->info, NULL);
+    }
+    mem_free (png);
+}
+
+#endif /* HAVE_PNG */
@@ -0,0 +1,53 @@
+/*
+ * decode.h for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#ifndef _DECODE_H_
+#define _DECODE_H_
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/** Largest reduction supported when decoding JPEG images. */
+#define DECODE_JPEG_MAX_REDUCE 8
+
+enum decode_type {
+    DECODE_TYPE_JPEG,
+    DECODE_TYPE_PNG
+};
+
+/**
+ * Image decoded one row at a time from top to bottom, only a single
+ * row of ARGB32 pixels is kept in memory.
+ */
+struct decode_stream {
+    enum decode_type type;
+    int width;
+    int height;
+    int has_alpha;
+    int error; /**< Set if decoding failed, following rows are black. */
+
+    FILE *fp;
+    int y; /**< Next row to decode. */
+    uint32_t *row;
+    void *decoder; /**< Format specific decoder state. */
+};
+
+extern int decode_jpeg_size (const char *path, int *width, int *height);
+extern uint32_t *decode_image (const char *path, int *reduce,
+                               int *width_ret, int *height_ret,
+                               int *has_alpha_ret);
+
+extern struct decode_stream *decode_stream_open (const char *path,
+                                                 int reduce);
+extern const uint32_t *decode_stream_row (struct decode_stream *stream,
+                                          int y);
+extern void decode_stream_close (struct decode_stream *stream);
+
+#endif /* _DECODE_H_ */
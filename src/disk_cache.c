@@ -0,0 +1,661 @@
+/*
+ * disk_cache.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#include "config.h"
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "disk_cache.h"
+#include "util.h"
+
+/** Temporary files older than this are left overs from a crash. */
+#define DISK_CACHE_TMP_MAX_AGE 3600
+/** Number of source image content digests kept in memory. */
+#define DISK_CACHE_MAX_DIGESTS 256
+
+/**
+ * Cache file information used while pruning.
+ */
+struct disk_cache_file {
+    char *path;
+    time_t mtime;
+    size_t size;
+};
+
+static struct disk_cache *disk_cache_create (const char *dir,
+                                             size_t max_bytes, long max_age,
+                                             int shared);
+static int disk_cache_lock_flags (struct disk_cache *cache, uint64_t key,
+                                  int flags);
+static void disk_cache_prune_lock (const char *path);
+static uint64_t disk_cache_content_digest (struct disk_cache *cache,
+                                           const char *path,
+                                           struct image_id *id);
+static struct disk_cache_digest *disk_cache_find_digest (
+        struct disk_cache *cache, uint64_t path_digest, struct image_id *id);
+static char *disk_cache_entry_path (struct disk_cache *cache, uint64_t key);
+static int disk_cache_is_entry_name (const char *name);
+static int disk_cache_file_cmp (const void *lhs, const void *rhs);
+static int write_all (int fd, const void *data, size_t size);
+static int mkdir_p (const char *path, mode_t mode);
+
+/**
+ * Return cache directory, $XDG_CACHE_HOME/wallpaperd falling back to
+ * ~/.cache/wallpaperd.
+ */
+char*
+disk_cache_get_dir (void)
+{
+    char *dir;
+    const char *xdg_cache_home = getenv ("XDG_CACHE_HOME");
+    if (xdg_cache_home && xdg_cache_home[0] == '/') {
+        if (asprintf (&dir, "%s/wallpaperd", xdg_cache_home) == -1) {
+            die ("failed to construct cache path, aborting");
+        }
+    } else {
+        dir = expand_home ("~/.cache/wallpaperd");
+    }
+    return dir;
+}
+
+/**
+ * Create disk cache in dir, creating the directory if missing and
+ * pruning old entries. Returns NULL if the directory is not usable.
+ */
+struct disk_cache*
+disk_cache_new (const char *dir, size_t max_bytes, long max_age)
+{
+    return disk_cache_create (dir, max_bytes, max_age, 0);
+}
+
+/**
+ * Create disk cache shared between the users of the group owning dir,
+ * if created by wallpaperd the directory is only writable by the group
+ * and has the setgid bit set so entries inherit the group. Returns
+ * NULL if the directory is not usable.
+ */
+struct disk_cache*
+disk_cache_new_shared (const char *dir, size_t max_bytes, long max_age)
+{
+    int is_new = ! file_exists (dir);
+    if (mkdir_p (dir, 0755) == 0 && is_new) {
+        chmod (dir, 02770);
+    }
+    return disk_cache_create (dir, max_bytes, max_age, 1);
+}
+
+/**
+ * Create disk cache structure, see disk_cache_new.
+ */
+struct disk_cache*
+disk_cache_create (const char *dir, size_t max_bytes, long max_age,
+                   int shared)
+{
+    if (mkdir_p (dir, 0700)) {
+        fprintf (stderr, "failed to create cache directory %s: %s\n",
+                 dir, strerror (errno));
+        return NULL;
+    }
+
+    struct disk_cache *cache = mem_new (sizeof (struct disk_cache));
+    cache->dir = str_dup (dir);
+    cache->max_bytes = max_bytes;
+    cache->max_age = max_age;
+    cache->shared = shared;
+    cache->bytes = 0;
+    pthread_mutex_init (&cache->lock, NULL);
+    cache->digests = 0;
+    cache->num_digests = 0;
+
+    disk_cache_prune (cache);
+
+    return cache;
+}
+
+/**
+ * Free resources used by disk cache, files are left on disk.
+ */
+void
+disk_cache_free (struct disk_cache *cache)
+{
+    struct disk_cache_digest *it = cache->digests, *it_next;
+    for (; it; it = it_next) {
+        it_next = it->next;
+        mem_free (it);
+    }
+    pthread_mutex_destroy (&cache->lock);
+    mem_free (cache->dir);
+    mem_free (cache);
+}
+
+/**
+ * Remove entries not used within max_age and then the least recently
+ * used entries until the cache is within max_bytes.
+ */
+void
+disk_cache_prune (struct disk_cache *cache)
+{
+    /* Only a single instance prunes the shared cache at a time, skip
+       pruning if another instance is at it. */
+    int lock = -1;
+    if (cache->shared) {
+        lock = disk_cache_lock_flags (cache, 0, LOCK_EX|LOCK_NB);
+        if (lock == -1) {
+            return;
+        }
+    }
+
+    DIR *dirp = opendir (cache->dir);
+    if (! dirp) {
+        disk_cache_unlock (lock);
+        return;
+    }
+
+    time_t now = time (0);
+    size_t num = 0, size = 16;
+    struct disk_cache_file *files =
+        mem_new (sizeof (struct disk_cache_file) * size);
+
+    pthread_mutex_lock (&cache->lock);
+    cache->bytes = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir (dirp)) != 0) {
+        int is_tmp = str_starts_with (entry->d_name, ".tmp.")
+            || (str_starts_with (entry->d_name, ".lock.")
+                && strcmp (entry->d_name, ".lock.0000000000000000"));
+        if (! is_tmp && ! disk_cache_is_entry_name (entry->d_name)) {
+            continue;
+        }
+
+        char *path;
+        if (asprintf (&path, "%s/%s", cache->dir, entry->d_name) == -1) {
+            continue;
+        }
+
+        struct stat st;
+        if (lstat (path, &st)) {
+            mem_free (path);
+            continue;
+        }
+
+        long age = now - st.st_mtime;
+        if (is_tmp && age > DISK_CACHE_TMP_MAX_AGE
+            && str_starts_with (entry->d_name, ".lock.")) {
+            disk_cache_prune_lock (path);
+            mem_free (path);
+        } else if ((is_tmp && age > DISK_CACHE_TMP_MAX_AGE)
+            || (! is_tmp && cache->max_age > 0 && age > cache->max_age)) {
+            unlink (path);
+            mem_free (path);
+        } else if (is_tmp) {
+            mem_free (path);
+        } else {
+            if (num == size) {
+                size *= 2;
+                files = realloc (files, sizeof (struct disk_cache_file) * size);
+                if (! files) {
+                    die ("memory allocation failed, aborting!");
+                }
+            }
+            files[num].path = path;
+            files[num].mtime = st.st_mtime;
+            files[num].size = st.st_size;
+            cache->bytes += st.st_size;
+            num++;
+        }
+    }
+    closedir (dirp);
+
+    /* Oldest first, remove until within budget. */
+    qsort (files, num, sizeof (struct disk_cache_file), disk_cache_file_cmp);
+    for (size_t i = 0; i < num; i++) {
+        if (cache->max_bytes && cache->bytes > cache->max_bytes) {
+            if (! unlink (files[i].path)) {
+                cache->bytes -= files[i].size;
+            }
+        }
+        mem_free (files[i].path);
+    }
+    mem_free (files);
+    pthread_mutex_unlock (&cache->lock);
+
+    disk_cache_unlock (lock);
+}
+
+/**
+ * Remove lock file at path unless it is locked, it is removed holding
+ * the lock and lockers check that the file they locked is still in
+ * place.
+ */
+void
+disk_cache_prune_lock (const char *path)
+{
+    int fd = open (path, O_RDONLY|O_NOFOLLOW|O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+    if (! flock (fd, LOCK_EX|LOCK_NB)) {
+        unlink (path);
+    }
+    close (fd);
+}
+
+/**
+ * Build cache key from source identity, target geometry, mode and
+ * upscale filter. The shared cache uses the content of the source
+ * image as identity.
+ */
+uint64_t
+disk_cache_key (struct disk_cache *cache, const char *path,
+                struct image_id *id, unsigned int width, unsigned int height,
+                enum wallpaper_mode mode, enum kernel_filter_type upscale)
+{
+    char *key_str;
+    int ret;
+    if (cache->shared) {
+        uint64_t digest = disk_cache_content_digest (cache, path, id);
+        ret = asprintf (&key_str, "%016llx\n%ux%u:%d:%d",
+                        (unsigned long long) digest, width, height, mode,
+                        upscale);
+    } else {
+        ret = asprintf (&key_str, "%s\n%llu:%llu:%lld:%lld\n%ux%u:%d:%d",
+                        path, (unsigned long long) id->dev,
+                        (unsigned long long) id->ino,
+                        (long long) id->mtime, (long long) id->size,
+                        width, height, mode, upscale);
+    }
+    if (ret == -1) {
+        die ("failed to construct cache key, aborting");
+    }
+    uint64_t key = str_digest (key_str);
+    mem_free (key_str);
+    return key;
+}
+
+/**
+ * Take exclusive lock for rendering key in the shared cache, blocking
+ * until any other instance rendering it is done. Returns lock file
+ * descriptor or -1 if the cache is not shared.
+ */
+int
+disk_cache_lock (struct disk_cache *cache, uint64_t key)
+{
+    return disk_cache_lock_flags (cache, key, LOCK_EX);
+}
+
+/**
+ * Lock key with flock flags, returns -1 if the cache is not shared or
+ * on failure.
+ */
+int
+disk_cache_lock_flags (struct disk_cache *cache, uint64_t key, int flags)
+{
+    if (! cache->shared) {
+        return -1;
+    }
+
+    char *path;
+    if (asprintf (&path, "%s/.lock.%016llx", cache->dir,
+                  (unsigned long long) key) == -1) {
+        return -1;
+    }
+
+    /* Retry if the lock file was pruned before it was locked. */
+    int fd;
+    struct stat st_fd, st_path;
+    do {
+        fd = open (path, O_RDONLY|O_CREAT|O_NOFOLLOW|O_CLOEXEC, 0640);
+        if (fd == -1) {
+            break;
+        }
+
+        while (flock (fd, flags) == -1) {
+            if (errno != EINTR) {
+                close (fd);
+                fd = -1;
+                break;
+            }
+        }
+        if (fd != -1
+            && (fstat (fd, &st_fd) || lstat (path, &st_path)
+                || st_fd.st_dev != st_path.st_dev
+                || st_fd.st_ino != st_path.st_ino)) {
+            close (fd);
+            fd = -2;
+        }
+    } while (fd == -2);
+    mem_free (path);
+    return fd;
+}
+
+/**
+ * Release lock taken with disk_cache_lock.
+ */
+void
+disk_cache_unlock (int fd)
+{
+    if (fd != -1) {
+        flock (fd, LOCK_UN);
+        close (fd);
+    }
+}
+
+/**
+ * Get digest of the content of the source image, computed once per
+ * file version. Takes the lock.
+ */
+uint64_t
+disk_cache_content_digest (struct disk_cache *cache, const char *path,
+                           struct image_id *id)
+{
+    uint64_t path_digest = str_digest (path);
+    pthread_mutex_lock (&cache->lock);
+    struct disk_cache_digest *node =
+        disk_cache_find_digest (cache, path_digest, id);
+    uint64_t digest = node != NULL ? node->digest : 0;
+    pthread_mutex_unlock (&cache->lock);
+    if (digest != 0) {
+        return digest;
+    }
+
+    /* Hashed without the lock, large images take a while. */
+    int fd = open (path, O_RDONLY|O_CLOEXEC);
+    if (fd != -1) {
+        void *map = id->size > 0
+            ? mmap (0, id->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (map != MAP_FAILED) {
+            digest = data_digest (map, id->size);
+            munmap (map, id->size);
+        }
+        close (fd);
+    }
+    if (digest == 0) {
+        /* Unreadable, fall back to a per path identity. */
+        return path_digest ^ (uint64_t) id->mtime;
+    }
+
+    pthread_mutex_lock (&cache->lock);
+    if (disk_cache_find_digest (cache, path_digest, id) != NULL) {
+        /* Computed by another thread meanwhile. */
+        pthread_mutex_unlock (&cache->lock);
+        return digest;
+    }
+
+    node = mem_new (sizeof (struct disk_cache_digest));
+    node->path_digest = path_digest;
+    node->id = *id;
+    node->digest = digest;
+    node->next = cache->digests;
+    cache->digests = node;
+
+    if (++cache->num_digests > DISK_CACHE_MAX_DIGESTS) {
+        struct disk_cache_digest **last = &cache->digests;
+        while ((*last)->next) {
+            last = &(*last)->next;
+        }
+        mem_free (*last);
+        *last = 0;
+        cache->num_digests--;
+    }
+    pthread_mutex_unlock (&cache->lock);
+
+    return digest;
+}
+
+/**
+ * Find computed digest of source image path_digest with identity id,
+ * moving it first. Requires the lock.
+ */
+struct disk_cache_digest*
+disk_cache_find_digest (struct disk_cache *cache, uint64_t path_digest,
+                        struct image_id *id)
+{
+    struct disk_cache_digest **it = &cache->digests;
+    for (; *it; it = &(*it)->next) {
+        struct disk_cache_digest *node = *it;
+        if (node->path_digest == path_digest
+            && ! memcmp (&node->id, id, sizeof (struct image_id))) {
+            *it = node->next;
+            node->next = cache->digests;
+            cache->digests = node;
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Map cached render for key, returns NULL if not found or if the
+ * entry does not validate.
+ */
+struct disk_cache_entry*
+disk_cache_get (struct disk_cache *cache, uint64_t key,
+                unsigned int width, unsigned int height)
+{
+    char *path = disk_cache_entry_path (cache, key);
+    int fd = open (path, O_RDONLY|O_NOFOLLOW|O_CLOEXEC);
+    if (fd == -1) {
+        mem_free (path);
+        return NULL;
+    }
+
+    size_t map_size = sizeof (struct disk_cache_header)
+        + (size_t) width * height * sizeof (uint32_t);
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (! fstat (fd, &st) && st.st_size >= 0
+        && (size_t) st.st_size == map_size) {
+        /* Private writable mapping, copy on write protects the file
+           should anyone write to the pixel data. */
+        map = mmap (0, map_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    if (map != MAP_FAILED) {
+        /* Update modification time, used as last use when pruning.
+           Fails on shared entries of other users, which is fine. */
+        futimens (fd, NULL);
+    }
+    close (fd);
+
+    struct disk_cache_header *header = map;
+    if (map == MAP_FAILED
+        || header->magic != DISK_CACHE_MAGIC
+        || header->version != DISK_CACHE_VERSION
+        || header->width != width || header->height != height
+        || header->key != key) {
+        if (map != MAP_FAILED) {
+            munmap (map, map_size);
+        }
+        unlink (path);
+        mem_free (path);
+        return NULL;
+    }
+
+    mem_free (path);
+
+    struct disk_cache_entry *entry =
+        mem_new (sizeof (struct disk_cache_entry));
+    entry->map = map;
+    entry->map_size = map_size;
+    entry->width = width;
+    entry->height = height;
+    entry->data = (uint32_t*) (header + 1);
+    return entry;
+}
+
+/**
+ * Store render in the cache. The file is written to a temporary file
+ * and renamed in place to never leave partial entries behind.
+ */
+int
+disk_cache_put (struct disk_cache *cache, uint64_t key,
+                unsigned int width, unsigned int height,
+                enum wallpaper_mode mode, const uint32_t *data)
+{
+    char *tmp_path;
+    if (asprintf (&tmp_path, "%s/.tmp.XXXXXX", cache->dir) == -1) {
+        return 0;
+    }
+
+    int fd = mkostemp (tmp_path, O_CLOEXEC);
+    if (fd == -1) {
+        fprintf (stderr, "failed to create %s: %s\n",
+                 tmp_path, strerror (errno));
+        mem_free (tmp_path);
+        return 0;
+    }
+
+    struct disk_cache_header header;
+    memset (&header, 0, sizeof (header));
+    header.magic = DISK_CACHE_MAGIC;
+    header.version = DISK_CACHE_VERSION;
+    header.width = width;
+    header.height = height;
+    header.mode = mode;
+    header.key = key;
+
+    /* Shared entries are readable by the group but only writable by
+       the creator. */
+    if (cache->shared) {
+        fchmod (fd, 0640);
+    }
+
+    size_t data_size = (size_t) width * height * sizeof (uint32_t);
+    int ok = write_all (fd, &header, sizeof (header))
+        && write_all (fd, data, data_size)
+        && ! fsync (fd);
+    ok = ! close (fd) && ok;
+
+    char *path = disk_cache_entry_path (cache, key);
+    int do_prune = 0;
+    if (ok && ! rename (tmp_path, path)) {
+        pthread_mutex_lock (&cache->lock);
+        cache->bytes += sizeof (header) + data_size;
+        do_prune = cache->max_bytes && cache->bytes > cache->max_bytes;
+        pthread_mutex_unlock (&cache->lock);
+    } else {
+        fprintf (stderr, "failed to write cache entry %s\n", path);
+        unlink (tmp_path);
+        ok = 0;
+    }
+    mem_free (path);
+    mem_free (tmp_path);
+
+    if (do_prune) {
+        disk_cache_prune (cache);
+    }
+
+    return ok;
+}
+
+/**
+ * Unmap and free entry.
+ */
+void
+disk_cache_entry_free (struct disk_cache_entry *entry)
+{
+    munmap (entry->map, entry->map_size);
+    mem_free (entry);
+}
+
+/**
+ * Get path of entry with key.
+ */
+char*
+disk_cache_entry_path (struct disk_cache *cache, uint64_t key)
+{
+    char *path;
+    if (asprintf (&path, "%s/%016llx", cache->dir,
+                  (unsigned long long) key) == -1) {
+        die ("failed to construct cache path, aborting");
+    }
+    return path;
+}
+
+/**
+ * Check if name is a cache entry, 16 hex digits.
+ */
+int
+disk_cache_is_entry_name (const char *name)
+{
+    int len = 0;
+    for (; name[len] != '\0'; len++) {
+        if (! ((name[len] >= '0' && name[len] <= '9')
+               || (name[len] >= 'a' && name[len] <= 'f'))) {
+            return 0;
+        }
+    }
+    return len == 16;
+}
+
+/**
+ * Sort files by modification time, oldest first.
+ */
+int
+disk_cache_file_cmp (const void *lhs, const void *rhs)
+{
+    const struct disk_cache_file *l = lhs, *r = rhs;
+    return l->mtime < r->mtime ? -1 : (l->mtime > r->mtime ? 1 : 0);
+}
+
+/**
+ * Write all of data to fd, returns 0 on error.
+ */
+int
+write_all (int fd, const void *data, size_t size)
+{
+    const char *p = data;
+    while (size > 0) {
+        ssize_t written = write (fd, p, size);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        p += written;
+        size -= written;
+    }
+    return 1;
+}
+
+/**
+ * Create directory including missing parents with mode, returns 0 on
+ * success.
+ */
+int
+mkdir_p (const char *path, mode_t mode)
+{
+    char *buf = str_dup (path);
+    for (char *p = buf + 1; *p != '\0'; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir (buf, mode) == -1 && errno != EEXIST) {
+                mem_free (buf);
+                return -1;
+            }
+            *p = '/';
+        }
+    }
+    int ret = mkdir (buf, mode);
+    mem_free (buf);
+    return ret == -1 && errno != EEXIST ? -1 : 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * disk_cache.h for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#ifndef _DISK_CACHE_H_
+#define _DISK_CACHE_H_
+
+#include "config.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "image_cache.h"
+#include "kernel.h"
+#include "wallpaperd.h"
+
+#define DISK_CACHE_MAGIC 0x43445057 /* WPDC */
+#define DISK_CACHE_VERSION 1
+
+/**
+ * Header of cache file, followed by width * height ARGB32 pixels in
+ * host byte order.
+ */
+struct disk_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mode;
+    uint32_t reserved;
+    uint64_t key;
+};
+
+/**
+ * Memory mapped render read from the disk cache.
+ */
+struct disk_cache_entry {
+    void *map;
+    size_t map_size;
+
+    unsigned int width;
+    unsigned int height;
+    uint32_t *data;
+};
+
+/**
+ * Content digest of a source image, computed once per file version.
+ */
+struct disk_cache_digest {
+    uint64_t path_digest;
+    struct image_id id;
+    uint64_t digest;
+
+    struct disk_cache_digest *next;
+};
+
+/**
+ * Persistent cache of scaled renders.
+ *
+ * A shared cache is used by all users on the host, entries are keyed
+ * on the content of the source image instead of its path and are
+ * readable by the group of the cache directory. Readers are lock free as entries are renamed
+ * in place, writers hold a per key lock while rendering so concurrent
+ * instances wait for and map the same render.
+ *
+ * The cache is safe to use from multiple threads, lock guards the
+ * digests and size accounting. Digests are computed without it.
+ */
+struct disk_cache {
+    char *dir;
+    size_t max_bytes; /**< Size cap, 0 for unlimited. */
+    long max_age; /**< Seconds since last use before pruning, 0 for none. */
+    int shared;
+
+    size_t bytes;
+    pthread_mutex_t lock;
+
+    struct disk_cache_digest *digests; /**< Most recently computed first. */
+    unsigned int num_digests;
+};
+
+extern char *disk_cache_get_dir (void);
+
+extern struct disk_cache *disk_cache_new (const char *dir, size_t max_bytes,
+                                          long max_age);
+extern struct disk_cache *disk_cache_new_shared (const char *dir,
+                                                 size_t max_bytes,
+                                                 long max_age);
+extern void disk_cache_free (struct disk_cache *cache);
+extern void disk_cache_prune (struct disk_cache *cache);
+
+extern uint64_t disk_cache_key (struct disk_cache *cache,
+                                const char *path, struct image_id *id,
+                                unsigned int width, unsigned int height,
+                                enum wallpaper_mode mode,
+                                enum kernel_filter_type upscale);
+extern int disk_cache_lock (struct disk_cache *cache, uint64_t key);
+extern void disk_cache_unlock (int fd);
+extern struct disk_cache_entry *disk_cache_get (struct disk_cache *cache,
+                                                uint64_t key,
+                                                unsigned int width,
+                                                unsigned int height);
+extern int disk_cache_put (struct disk_cache *cache, uint64_t key,
+                           unsigned int width, unsigned int height,
+                           enum wallpaper_mode mode, const uint32_t *data);
+extern void disk_cache_entry_free (struct disk_cache_entry *entry);
+
+#endif /* _DISK_CACHE_H_ */
@@ -0,0 +1,459 @@
+/*
+ * image_cache.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#include "config.h"
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "decode.h"
+#include "image_cache.h"
+#include "util.h"
+
+static struct image_cache_node *image_cache_node_new (
+        const char *path, uint64_t digest, struct image_id *id,
+        Imlib_Image image);
+static struct image_cache_node *image_cache_node_new_data (
+        const char *path, uint64_t digest, struct image_id *id, int reduce,
+        uint32_t *data, int width, int height, int has_alpha);
+static void image_cache_node_free (struct image_cache_node *node);
+static struct image_cache_node *image_cache_lookup (struct image_cache *cache,
+                                                    const char *path,
+                                                    uint64_t digest,
+                                                    struct image_id *id,
+                                                    int reduce);
+static struct image_cache_node *image_cache_find (struct image_cache *cache,
+                                                  const char *path,
+                                                  uint64_t digest,
+                                                  int reduce);
+static void image_cache_insert (struct image_cache *cache,
+                                struct image_cache_node *node);
+static struct image_cache_node *image_cache_adopt (
+        struct image_cache *cache, struct image_cache_node *node);
+static void image_cache_link (struct image_cache *cache,
+                              struct image_cache_node *node);
+static void image_cache_unlink (struct image_cache *cache,
+                                struct image_cache_node *node);
+static void image_cache_trim (struct image_cache *cache);
+static void image_cache_remove (struct image_cache *cache,
+                                struct image_cache_node *node);
+
+/** Imlib2 keeps global state, serializes all use of it. */
+static pthread_mutex_t IMLIB_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Create new image cache node, takes ownership of image. Requires the
+ * Imlib2 lock.
+ */
+struct image_cache_node*
+image_cache_node_new (const char *path, uint64_t digest, struct image_id *id,
+                      Imlib_Image image)
+{
+    struct image_cache_node *node =
+        mem_new (sizeof (struct image_cache_node));
+    node->digest = digest;
+    node->path = str_dup (path);
+    node->id = *id;
+
+    node->image = image;
+    imlib_context_set_image (image);
+    node->data = imlib_image_get_data_for_reading_only ();
+    node->width = imlib_image_get_width ();
+    node->height = imlib_image_get_height ();
+    node->has_alpha = imlib_image_has_alpha ();
+    node->reduce = 1;
+    node->bytes = (size_t) node->width * node->height * sizeof (DATA32);
+
+    node->refs = 0;
+    node->stale = 0;
+    node->prev = 0;
+    node->next = 0;
+    return node;
+}
+
+/**
+ * Create new image cache node for pixels decoded at reduction reduce,
+ * takes ownership of data.
+ */
+struct image_cache_node*
+image_cache_node_new_data (const char *path, uint64_t digest,
+                           struct image_id *id, int reduce, uint32_t *data,
+                           int width, int height, int has_alpha)
+{
+    struct image_cache_node *node =
+        mem_new (sizeof (struct image_cache_node));
+    node->digest = digest;
+    node->path = str_dup (path);
+    node->id = *id;
+
+    node->image = NULL;
+    node->data = data;
+    node->width = width;
+    node->height = height;
+    node->has_alpha = has_alpha;
+    node->reduce = reduce;
+    node->bytes = (size_t) width * height * sizeof (uint32_t);
+
+    node->refs = 0;
+    node->stale = 0;
+    node->prev = 0;
+    node->next = 0;
+    return node;
+}
+
+/**
+ * Free resources used by node including the decoded image.
+ */
+void
+image_cache_node_free (struct image_cache_node *node)
+{
+    if (node->image) {
+        pthread_mutex_lock (&IMLIB_LOCK);
+        imlib_context_set_image (node->image);
+        imlib_free_image_and_decache ();
+        pthread_mutex_unlock (&IMLIB_LOCK);
+    } else {
+        mem_free (node->data);
+    }
+    mem_free (node->path);
+    mem_free (node);
+}
+
+/**
+ * Create new image cache with memory budget max_bytes, 0 for
+ * unlimited.
+ */
+struct image_cache*
+image_cache_new (size_t max_bytes)
+{
+    struct image_cache *cache = mem_new (sizeof (struct image_cache));
+    cache->max_bytes = max_bytes;
+    cache->bytes = 0;
+    pthread_mutex_init (&cache->lock, NULL);
+    cache->first = 0;
+    cache->last = 0;
+    return cache;
+}
+
+/**
+ * Free image cache, all references must have been released.
+ */
+void
+image_cache_free (struct image_cache *cache)
+{
+    struct image_cache_node *it = cache->first, *it_next;
+    for (; it; it = it_next) {
+        it_next = it->next;
+        image_cache_node_free (it);
+    }
+    pthread_mutex_destroy (&cache->lock);
+    mem_free (cache);
+}
+
+/**
+ * Get referenced decoded image for path, decoding it if not cached or
+ * if the file changed since it was decoded. Returns NULL if the image
+ * fails to load, release the node with image_cache_release.
+ */
+struct image_cache_node*
+image_cache_get (struct image_cache *cache, const char *path)
+{
+    return image_cache_get_reduced (cache, path, 1);
+}
+
+/**
+ * Get referenced decoded image for path reduced at most by reduce, a
+ * power of two. JPEG and non-interlaced PNG images are decoded with
+ * decode.c without holding any lock, JPEG images reduced. Other images
+ * and images failing to decode are decoded at full size with Imlib2.
+ * An already cached image with less reduction is used if available.
+ * Returns NULL if the image fails to load, release the node with
+ * image_cache_release.
+ */
+struct image_cache_node*
+image_cache_get_reduced (struct image_cache *cache, const char *path,
+                         int reduce)
+{
+    struct image_id id;
+    if (! image_id_read (path, &id)) {
+        fprintf (stderr, "failed to stat %s\n", path);
+        return NULL;
+    }
+
+    uint64_t digest = str_digest (path);
+    pthread_mutex_lock (&cache->lock);
+    struct image_cache_node *node =
+        image_cache_lookup (cache, path, digest, &id, reduce);
+    pthread_mutex_unlock (&cache->lock);
+    if (node != NULL) {
+        return node;
+    }
+
+    int width, height, has_alpha;
+    uint32_t *data = decode_image (path, &reduce, &width, &height,
+                                   &has_alpha);
+    if (data != NULL) {
+        node = image_cache_node_new_data (path, digest, &id, reduce, data,
+                                          width, height, has_alpha);
+    } else {
+        pthread_mutex_lock (&IMLIB_LOCK);
+        Imlib_Image image = imlib_load_image_immediately (path);
+        if (image) {
+            node = image_cache_node_new (path, digest, &id, image);
+        }
+        pthread_mutex_unlock (&IMLIB_LOCK);
+        if (node == NULL) {
+            fprintf (stderr, "failed to load %s\n", path);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_lock (&cache->lock);
+    node = image_cache_adopt (cache, node);
+    pthread_mutex_unlock (&cache->lock);
+    return node;
+}
+
+/**
+ * Find referenced node for path reduced at most by reduce, dropping
+ * all nodes of path if the file changed. Requires the cache lock.
+ */
+struct image_cache_node*
+image_cache_lookup (struct image_cache *cache, const char *path,
+                    uint64_t digest, struct image_id *id, int reduce)
+{
+    struct image_cache_node *node =
+        image_cache_find (cache, path, digest, reduce);
+    if (node != NULL && memcmp (&node->id, id, sizeof (struct image_id))) {
+        while ((node = image_cache_find (cache, path, digest,
+                                         DECODE_JPEG_MAX_REDUCE))) {
+            image_cache_remove (cache, node);
+        }
+    }
+    if (node != NULL) {
+        image_cache_unlink (cache, node);
+        image_cache_insert (cache, node);
+    }
+    return node;
+}
+
+/**
+ * Insert node first in the cache with a reference. Requires the cache
+ * lock.
+ */
+void
+image_cache_insert (struct image_cache *cache, struct image_cache_node *node)
+{
+    image_cache_link (cache, node);
+    node->refs++;
+    image_cache_trim (cache);
+}
+
+/**
+ * Insert node decoded without the cache lock with a reference, unless
+ * another thread cached the same image meanwhile in which case node is
+ * freed and the cached one is used. Requires the cache lock.
+ */
+struct image_cache_node*
+image_cache_adopt (struct image_cache *cache, struct image_cache_node *node)
+{
+    struct image_cache_node *other =
+        image_cache_find (cache, node->path, node->digest, node->reduce);
+    if (other != NULL && other->reduce == node->reduce
+        && ! memcmp (&other->id, &node->id, sizeof (struct image_id))) {
+        image_cache_node_free (node);
+        node = other;
+        image_cache_unlink (cache, node);
+    }
+    image_cache_insert (cache, node);
+    return node;
+}
+
+/**
+ * Release reference to node, the node may be freed if the cache is
+ * over budget.
+ */
+void
+image_cache_release (struct image_cache *cache, struct image_cache_node *node)
+{
+    pthread_mutex_lock (&cache->lock);
+    node->refs--;
+    if (node->stale) {
+        if (! node->refs) {
+            image_cache_node_free (node);
+        }
+    } else {
+        image_cache_trim (cache);
+    }
+    pthread_mutex_unlock (&cache->lock);
+}
+
+/**
+ * Lock Imlib2 while using it outside of the cache, render pool threads
+ * may be decoding images with Imlib2. Do not take the cache lock while
+ * holding it.
+ */
+void
+image_cache_imlib_lock (void)
+{
+    pthread_mutex_lock (&IMLIB_LOCK);
+}
+
+/**
+ * Unlock Imlib2 locked with image_cache_imlib_lock.
+ */
+void
+image_cache_imlib_unlock (void)
+{
+    pthread_mutex_unlock (&IMLIB_LOCK);
+}
+
+/**
+ * Drop decoded images for path, used when the file has changed.
+ */
+void
+image_cache_invalidate (struct image_cache *cache, const char *path)
+{
+    pthread_mutex_lock (&cache->lock);
+    uint64_t digest = str_digest (path);
+    struct image_cache_node *node;
+    while ((node = image_cache_find (cache, path, digest,
+                                     DECODE_JPEG_MAX_REDUCE))) {
+        image_cache_remove (cache, node);
+    }
+    pthread_mutex_unlock (&cache->lock);
+}
+
+/**
+ * Free all images not in use, returns number of bytes released.
+ */
+size_t
+image_cache_shrink (struct image_cache *cache)
+{
+    pthread_mutex_lock (&cache->lock);
+    size_t bytes = cache->bytes;
+    struct image_cache_node *it = cache->last, *it_prev;
+    for (; it; it = it_prev) {
+        it_prev = it->prev;
+        if (! it->refs) {
+            image_cache_unlink (cache, it);
+            image_cache_node_free (it);
+        }
+    }
+    bytes -= cache->bytes;
+    pthread_mutex_unlock (&cache->lock);
+    return bytes;
+}
+
+/**
+ * Remove node from the cache, freeing it once no longer referenced.
+ */
+void
+image_cache_remove (struct image_cache *cache, struct image_cache_node *node)
+{
+    image_cache_unlink (cache, node);
+    if (node->refs) {
+        node->stale = 1;
+    } else {
+        image_cache_node_free (node);
+    }
+}
+
+/**
+ * Read identity of file at path, returns 0 if stat fails.
+ */
+int
+image_id_read (const char *path, struct image_id *id)
+{
+    struct stat st;
+    if (stat (path, &st)) {
+        return 0;
+    }
+
+    memset (id, 0, sizeof (struct image_id));
+    id->dev = st.st_dev;
+    id->ino = st.st_ino;
+    id->mtime = st.st_mtime;
+    id->size = st.st_size;
+    return 1;
+}
+
+/**
+ * Find node for path reduced at most by reduce, preferring the most
+ * reduced.
+ */
+struct image_cache_node*
+image_cache_find (struct image_cache *cache, const char *path,
+                  uint64_t digest, int reduce)
+{
+    struct image_cache_node *it = cache->first, *found = 0;
+    for (; it; it = it->next) {
+        if (it->digest == digest && it->reduce <= reduce
+            && (! found || it->reduce > found->reduce)
+            && ! strcmp (it->path, path)) {
+            found = it;
+        }
+    }
+    return found;
+}
+
+/**
+ * Insert node first in the cache.
+ */
+void
+image_cache_link (struct image_cache *cache, struct image_cache_node *node)
+{
+    node->prev = 0;
+    node->next = cache->first;
+    if (cache->first) {
+        cache->first->prev = node;
+    } else {
+        cache->last = node;
+    }
+    cache->first = node;
+    cache->bytes += node->bytes;
+}
+
+/**
+ * Remove node from the cache, does not free the node.
+ */
+void
+image_cache_unlink (struct image_cache *cache, struct image_cache_node *node)
+{
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        cache->first = node->next;
+    }
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        cache->last = node->prev;
+    }
+    node->prev = 0;
+    node->next = 0;
+    cache->bytes -= node->bytes;
+}
+
+/**
+ * Free least recently used unreferenced images until within budget.
+ */
+void
+image_cache_trim (struct image_cache *cache)
+{
+    struct image_cache_node *it = cache->last, *it_prev;
+    for (; it && cache->max_bytes && cache->bytes > cache->max_bytes;
+         it = it_prev) {
+        it_prev = it->prev;
+        if (! it->refs) {
+            image_cache_unlink (cache, it);
+            image_cache_node_free (it);
+        }
+    }
+}
@@ -0,0 +1,90 @@
+/*
+ * image_cache.h for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#ifndef _IMAGE_CACHE_H_
+#define _IMAGE_CACHE_H_
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <Imlib2.h>
+
+/**
+ * Identity of a source image file, changes whenever the file is
+ * replaced or modified.
+ */
+struct image_id {
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    off_t size;
+};
+
+/**
+ * Decoded source image, shared between all users through reference
+ * counting.
+ */
+struct image_cache_node {
+    uint64_t digest;
+    char *path;
+    struct image_id id;
+
+    Imlib_Image image; /**< Decoded by Imlib2, NULL if decoded by decode.c */
+    uint32_t *data; /**< ARGB32 pixels, read only and usable without Imlib2. */
+    int width;
+    int height;
+    int has_alpha;
+    int reduce; /**< Size reduction of the decoded image, 1 for full size. */
+    size_t bytes;
+
+    unsigned int refs;
+    int stale; /**< Source changed, freed when last reference goes. */
+
+    struct image_cache_node *prev;
+    struct image_cache_node *next;
+};
+
+/**
+ * Cache of decoded images with a memory budget, first is the most
+ * recently used. An image can be cached at several reductions.
+ *
+ * The cache is safe to use from multiple threads. Images are decoded
+ * without holding the cache lock, Imlib2 keeps global state so images
+ * falling back to it are decoded one at a time. The pixels of a
+ * referenced node can be read by any thread.
+ */
+struct image_cache {
+    size_t max_bytes;
+    size_t bytes;
+    pthread_mutex_t lock;
+
+    struct image_cache_node *first;
+    struct image_cache_node *last;
+};
+
+extern struct image_cache *image_cache_new (size_t max_bytes);
+extern void image_cache_free (struct image_cache *cache);
+
+extern struct image_cache_node *image_cache_get (struct image_cache *cache,
+                                                 const char *path);
+extern struct image_cache_node *image_cache_get_reduced (
+        struct image_cache *cache, const char *path, int reduce);
+extern void image_cache_release (struct image_cache *cache,
+                                 struct image_cache_node *node);
+extern void image_cache_imlib_lock (void);
+extern void image_cache_imlib_unlock (void);
+extern void image_cache_invalidate (struct image_cache *cache,
+                                    const char *path);
+extern size_t image_cache_shrink (struct image_cache *cache);
+
+extern int image_id_read (const char *path, struct image_id *id);
+
+#endif /* _IMAGE_CACHE_H_ */
@@ -0,0 +1,578 @@
+/*
+ * kernel.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+/*
+ * Scalar reference kernels, filter construction and selection of the
+ * kernel implementation. The SIMD implementations live in kernel_sse2.c,
+ * kernel_avx2.c and kernel_neon.c and must match the scalar output bit
+ * for bit, use render.kernel=scalar to compare.
+ */
+
+#include "config.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#include "kernel.h"
+#include "util.h"
+
+/** Unreferenced filters kept for reuse. */
+#define KERNEL_FILTERS_UNUSED 16
+
+static void kernel_init (void);
+static void kernel_fill (uint32_t *dest, uint32_t pixel, int width);
+static void kernel_blit (uint32_t *dest, const uint32_t *src, int width);
+static void kernel_blend (uint32_t *dest, const uint32_t *src, int width);
+static void kernel_scale_row (uint32_t *dest, const uint32_t *src,
+                              const struct kernel_filter *filter, int first,
+                              int width);
+static void kernel_scale_col (uint32_t *dest, const uint32_t **rows,
+                              const int16_t *weights, int count, int width);
+static void kernel_gradient (uint32_t *dest, const int32_t *start,
+                             const int32_t *step, const int32_t *dither,
+                             int width);
+static void kernel_mix (uint32_t *dest, const uint32_t *a, const uint32_t *b,
+                        int alpha, int width);
+static void kernel_rgb565 (uint16_t *dest, const uint32_t *src,
+                           const uint8_t *dither, int width);
+
+static struct kernel_filter *kernel_filter_new (int src_size, int dest_size,
+                                                enum kernel_filter_type type);
+static void kernel_filter_free (struct kernel_filter *filter);
+static void kernel_filter_area (struct kernel_filter *filter, int i,
+                                double scale, double *weights);
+static void kernel_filter_bilinear (struct kernel_filter *filter, int i,
+                                    double scale, double *weights);
+static void kernel_filter_bicubic (struct kernel_filter *filter, int i,
+                                   double scale, double *weights);
+static double kernel_filter_cubic (double x);
+static void kernel_filter_normalize (int16_t *weights, int count);
+
+const struct kernel KERNEL_SCALAR = {
+    "scalar",
+    kernel_fill,
+    kernel_blit,
+    kernel_blend,
+    kernel_scale_row,
+    kernel_scale_col,
+    kernel_gradient,
+    kernel_mix,
+    kernel_rgb565
+};
+
+static pthread_once_t KERNEL_ONCE = PTHREAD_ONCE_INIT;
+static const struct kernel *KERNEL = 0;
+
+static pthread_mutex_t FILTERS_LOCK = PTHREAD_MUTEX_INITIALIZER;
+/** Cached filters, first is the most recently created. */
+static struct kernel_filter *FILTERS = 0;
+
+/**
+ * Get kernel implementation in use.
+ */
+const struct kernel*
+kernel_get (void)
+{
+    pthread_once (&KERNEL_ONCE, kernel_init);
+    return KERNEL;
+}
+
+/**
+ * Set kernel implementation to use, NULL selects the best supported
+ * by the CPU. Must not be called while rendering.
+ */
+void
+kernel_set (const struct kernel *kernel)
+{
+    pthread_once (&KERNEL_ONCE, kernel_init);
+    KERNEL = kernel ? kernel : kernel_from_str ("auto");
+}
+
+/**
+ * Get kernel implementation by name, auto selects the best supported
+ * by the CPU. Returns NULL if str is unknown or not supported.
+ */
+const struct kernel*
+kernel_from_str (const char *str)
+{
+    int is_auto = ! strcmp (str, "auto");
+#ifdef KERNEL_HAVE_X86
+    __builtin_cpu_init ();
+    if ((is_auto || ! strcmp (str, KERNEL_AVX2.name))
+        && __builtin_cpu_supports ("avx2")) {
+        return &KERNEL_AVX2;
+    }
+    if ((is_auto || ! strcmp (str, KERNEL_SSE2.name))
+        && __builtin_cpu_supports ("sse2")) {
+        return &KERNEL_SSE2;
+    }
+#endif /* KERNEL_HAVE_X86 */
+#ifdef KERNEL_HAVE_NEON
+    if (is_auto || ! strcmp (str, KERNEL_NEON.name)) {
+        return &KERNEL_NEON;
+    }
+#endif /* KERNEL_HAVE_NEON */
+    if (is_auto || ! strcmp (str, KERNEL_SCALAR.name)) {
+        return &KERNEL_SCALAR;
+    }
+    return 0;
+}
+
+/**
+ * Select the best kernel implementation supported by the CPU.
+ */
+void
+kernel_init (void)
+{
+    KERNEL = kernel_from_str ("auto");
+}
+
+/**
+ * Parse upscale filter name, returns 0 if str is not a known filter.
+ */
+int
+kernel_filter_type_from_str (const char *str, enum kernel_filter_type *type)
+{
+    if (! strcmp (str, "bilinear")) {
+        *type = KERNEL_FILTER_BILINEAR;
+    } else if (! strcmp (str, "bicubic")) {
+        *type = KERNEL_FILTER_BICUBIC;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Get filter scaling src_size pixels to dest_size pixels, filters are
+ * shared and must be released with kernel_filter_release.
+ */
+struct kernel_filter*
+kernel_filter_get (int src_size, int dest_size, enum kernel_filter_type type)
+{
+    pthread_mutex_lock (&FILTERS_LOCK);
+    struct kernel_filter *filter;
+    for (filter = FILTERS; filter; filter = filter->next) {
+        if (filter->src_size == src_size && filter->dest_size == dest_size
+            && (filter->type == type || src_size > dest_size)) {
+            filter->refs++;
+            pthread_mutex_unlock (&FILTERS_LOCK);
+            return filter;
+        }
+    }
+    pthread_mutex_unlock (&FILTERS_LOCK);
+
+    /* Built without the lock, another thread may add the same filter
+       which only costs the memory until it is dropped. */
+    filter = kernel_filter_new (src_size, dest_size, type);
+
+    pthread_mutex_lock (&FILTERS_LOCK);
+    filter->next = FILTERS;
+    FILTERS = filter;
+
+    /* Drop the oldest unreferenced filters. */
+    unsigned int unused = 0;
+    for (struct kernel_filter **it = &FILTERS; *it; ) {
+        if ((*it)->refs == 0 && ++unused > KERNEL_FILTERS_UNUSED) {
+            struct kernel_filter *drop = *it;
+            *it = drop->next;
+            kernel_filter_free (drop);
+        } else {
+            it = &(*it)->next;
+        }
+    }
+    pthread_mutex_unlock (&FILTERS_LOCK);
+
+    return filter;
+}
+
+/**
+ * Release reference to filter, it is kept cached for reuse.
+ */
+void
+kernel_filter_release (struct kernel_filter *filter)
+{
+    pthread_mutex_lock (&FILTERS_LOCK);
+    filter->refs--;
+    pthread_mutex_unlock (&FILTERS_LOCK);
+}
+
+/**
+ * Create filter with a single reference.
+ */
+struct kernel_filter*
+kernel_filter_new (int src_size, int dest_size, enum kernel_filter_type type)
+{
+    double scale = (double) src_size / dest_size;
+    int max_count;
+    if (scale > 1.0) {
+        max_count = (int) scale + 2;
+    } else if (type == KERNEL_FILTER_BICUBIC) {
+        max_count = 4;
+    } else {
+        max_count = 2;
+    }
+    max_count = (max_count + KERNEL_TAPS_ALIGN - 1) & ~(KERNEL_TAPS_ALIGN - 1);
+
+    struct kernel_filter *filter = mem_new (sizeof (struct kernel_filter));
+    filter->src_size = src_size;
+    filter->dest_size = dest_size;
+    filter->type = type;
+    filter->start = mem_new (dest_size * sizeof (int));
+    filter->count = mem_new (dest_size * sizeof (int));
+    filter->weights =
+        mem_new ((size_t) dest_size * max_count * sizeof (int16_t));
+    memset (filter->weights, 0,
+            (size_t) dest_size * max_count * sizeof (int16_t));
+    filter->max_count = max_count;
+    filter->refs = 1;
+    filter->next = 0;
+
+    double *weights = mem_new (max_count * sizeof (double));
+    for (int i = 0; i < dest_size; i++) {
+        if (scale > 1.0) {
+            kernel_filter_area (filter, i, scale, weights);
+        } else if (type == KERNEL_FILTER_BICUBIC) {
+            kernel_filter_bicubic (filter, i, scale, weights);
+        } else {
+            kernel_filter_bilinear (filter, i, scale, weights);
+        }
+
+        int16_t *fixed = filter->weights + (size_t) i * max_count;
+        for (int j = 0; j < filter->count[i]; j++) {
+            double w = weights[j] * KERNEL_ONE;
+            fixed[j] = (int16_t) (w < 0.0 ? w - 0.5 : w + 0.5);
+        }
+        kernel_filter_normalize (fixed, filter->count[i]);
+    }
+    mem_free (weights);
+
+    return filter;
+}
+
+/**
+ * Free filter weights.
+ */
+void
+kernel_filter_free (struct kernel_filter *filter)
+{
+    mem_free (filter->weights);
+    mem_free (filter->count);
+    mem_free (filter->start);
+    mem_free (filter);
+}
+
+/**
+ * Area average of the source pixels covered by destination pixel i.
+ */
+void
+kernel_filter_area (struct kernel_filter *filter, int i, double scale,
+                    double *weights)
+{
+    double s0 = i * scale, s1 = s0 + scale;
+    int first = (int) s0;
+    int last = (int) s1;
+    if ((double) last == s1 || last >= filter->src_size) {
+        last--;
+    }
+    filter->start[i] = first;
+    filter->count[i] = last - first + 1;
+    for (int j = first; j <= last; j++) {
+        double lo = j > s0 ? j : s0;
+        double hi = j + 1 < s1 ? j + 1 : s1;
+        weights[j - first] = (hi - lo) / scale;
+    }
+}
+
+/**
+ * Bilinear interpolation between the pixel centers around destination
+ * pixel i.
+ */
+void
+kernel_filter_bilinear (struct kernel_filter *filter, int i, double scale,
+                        double *weights)
+{
+    double center = (i + 0.5) * scale - 0.5;
+    if (center < 0.0) {
+        center = 0.0;
+    }
+    int first = (int) center;
+    double frac = center - first;
+    if (first >= filter->src_size - 1) {
+        first = filter->src_size - 1;
+        frac = 0.0;
+    }
+    filter->start[i] = first;
+    filter->count[i] = frac > 0.0 ? 2 : 1;
+    weights[0] = 1.0 - frac;
+    weights[1] = frac;
+}
+
+/**
+ * Catmull-Rom interpolation of the four pixels around destination
+ * pixel i, pixels outside of the source repeat the edge.
+ */
+void
+kernel_filter_bicubic (struct kernel_filter *filter, int i, double scale,
+                       double *weights)
+{
+    double center = (i + 0.5) * scale - 0.5;
+    int base = (int) center;
+    if (center < base) {
+        base--;
+    }
+    double frac = center - base;
+    if (frac == 0.0) {
+        filter->start[i] = base < 0 ? 0 : base;
+        filter->count[i] = 1;
+        weights[0] = 1.0;
+        return;
+    }
+
+    int first = base - 1 < 0 ? 0 : base - 1;
+    int last = base + 2 >= filter->src_size ? filter->src_size - 1 : base + 2;
+    filter->start[i] = first;
+    filter->count[i] = last - first + 1;
+    for (int j = 0; j < filter->count[i]; j++) {
+        weights[j] = 0.0;
+    }
+    for (int j = base - 1; j <= base + 2; j++) {
+        int pos = j < first ? first : (j > last ? last : j);
+        weights[pos - first] += kernel_filter_cubic (j - center);
+    }
+}
+
+/**
+ * Catmull-Rom cubic at distance x from the sample.
+ */
+double
+kernel_filter_cubic (double x)
+{
+    x = x < 0.0 ? -x : x;
+    if (x < 1.0) {
+        return (1.5 * x - 2.5) * x * x + 1.0;
+    } else if (x < 2.0) {
+        return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+    }
+    return 0.0;
+}
+
+/**
+ * Adjust the largest weight so all weights sum to exactly one,
+ * rounding would otherwise brighten or darken flat areas.
+ */
+void
+kernel_filter_normalize (int16_t *weights, int count)
+{
+    int32_t sum = 0;
+    int max = 0;
+    for (int i = 0; i < count; i++) {
+        sum += weights[i];
+        if (weights[i] > weights[max]) {
+            max = i;
+        }
+    }
+    weights[max] += KERNEL_ONE - sum;
+}
+
+/**
+ * Pack fixed point channels into a pixel, rounding and clamping each
+ * channel to 0-255.
+ */
+uint32_t
+kernel_pack (int32_t a, int32_t r, int32_t g, int32_t b)
+{
+    const int32_t half = KERNEL_ONE / 2;
+    a = (a + half) >> KERNEL_SHIFT;
+    r = (r + half) >> KERNEL_SHIFT;
+    g = (g + half) >> KERNEL_SHIFT;
+    b = (b + half) >> KERNEL_SHIFT;
+    a = a < 0 ? 0 : (a > 255 ? 255 : a);
+    r = r < 0 ? 0 : (r > 255 ? 255 : r);
+    g = g < 0 ? 0 : (g > 255 ? 255 : g);
+    b = b < 0 ? 0 : (b > 255 ? 255 : b);
+    return (uint32_t) a << 24 | (uint32_t) r << 16 | (uint32_t) g << 8
+        | (uint32_t) b;
+}
+
+/**
+ * Blend s onto d using the alpha of s keeping the alpha of d. Divides
+ * by 255 with rounding using shifts so SIMD versions can match it.
+ */
+uint32_t
+kernel_blend_pixel (uint32_t d, uint32_t s)
+{
+    uint32_t a = s >> 24;
+    uint32_t p = d & 0xff000000;
+    for (int shift = 0; shift < 24; shift += 8) {
+        uint32_t sc = (s >> shift) & 0xff;
+        uint32_t dc = (d >> shift) & 0xff;
+        uint32_t t = sc * a + dc * (255 - a) + 128;
+        p |= ((t + (t >> 8)) >> 8) << shift;
+    }
+    return p;
+}
+
+/**
+ * Weighted sum of count pixels starting at src.
+ */
+uint32_t
+kernel_scale_row_pixel (const uint32_t *src, const int16_t *weights,
+                        int count)
+{
+    int32_t a = 0, r = 0, g = 0, b = 0;
+    for (int i = 0; i < count; i++) {
+        a += (int32_t) (src[i] >> 24) * weights[i];
+        r += (int32_t) ((src[i] >> 16) & 0xff) * weights[i];
+        g += (int32_t) ((src[i] >> 8) & 0xff) * weights[i];
+        b += (int32_t) (src[i] & 0xff) * weights[i];
+    }
+    return kernel_pack (a, r, g, b);
+}
+
+/**
+ * Weighted sum of pixel x in count rows.
+ */
+uint32_t
+kernel_scale_col_pixel (const uint32_t **rows, const int16_t *weights,
+                        int count, int x)
+{
+    int32_t a = 0, r = 0, g = 0, b = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t p = rows[i][x];
+        a += (int32_t) (p >> 24) * weights[i];
+        r += (int32_t) ((p >> 16) & 0xff) * weights[i];
+        g += (int32_t) ((p >> 8) & 0xff) * weights[i];
+        b += (int32_t) (p & 0xff) * weights[i];
+    }
+    return kernel_pack (a, r, g, b);
+}
+
+/**
+ * Gradient pixel x, see struct kernel gradient.
+ */
+uint32_t
+kernel_gradient_pixel (const int32_t *start, const int32_t *step,
+                       const int32_t *dither, int x)
+{
+    uint32_t p = 0;
+    for (int c = 0; c < 4; c++) {
+        int32_t v = (start[c] + step[c] * x + dither[(x & 3) * 4 + c])
+            >> KERNEL_GRADIENT_SHIFT;
+        v = v < 0 ? 0 : (v > 255 ? 255 : v);
+        p |= (uint32_t) v << (c * 8);
+    }
+    return p;
+}
+
+/**
+ * Cross-fade pixel a to b, see struct kernel mix.
+ */
+uint32_t
+kernel_mix_pixel (uint32_t a, uint32_t b, int alpha)
+{
+    uint32_t p = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t ac = (a >> shift) & 0xff;
+        uint32_t bc = (b >> shift) & 0xff;
+        p |= ((ac * (256 - alpha) + bc * alpha) >> 8) << shift;
+    }
+    return p;
+}
+
+/**
+ * Convert pixel to RGB565 with the dither of its column added, see
+ * struct kernel rgb565.
+ */
+uint16_t
+kernel_rgb565_pixel (uint32_t p, const uint8_t *dither)
+{
+    uint32_t b = (p & 0xff) + dither[0];
+    uint32_t g = ((p >> 8) & 0xff) + dither[1];
+    uint32_t r = ((p >> 16) & 0xff) + dither[2];
+    b = b > 255 ? 255 : b;
+    g = g > 255 ? 255 : g;
+    r = r > 255 ? 255 : r;
+    return (uint16_t) ((r >> 3) << 11 | (g >> 2) << 5 | b >> 3);
+}
+
+void
+kernel_fill (uint32_t *dest, uint32_t pixel, int width)
+{
+    for (int x = 0; x < width; x++) {
+        dest[x] = pixel;
+    }
+}
+
+void
+kernel_blit (uint32_t *dest, const uint32_t *src, int width)
+{
+    memcpy (dest, src, width * sizeof (uint32_t));
+}
+
+void
+kernel_blend (uint32_t *dest, const uint32_t *src, int width)
+{
+    for (int x = 0; x < width; x++) {
+        uint32_t a = src[x] >> 24;
+        if (a == 255) {
+            dest[x] = (dest[x] & 0xff000000) | (src[x] & 0xffffff);
+        } else if (a) {
+            dest[x] = kernel_blend_pixel (dest[x], src[x]);
+        }
+    }
+}
+
+void
+kernel_scale_row (uint32_t *dest, const uint32_t *src,
+                  const struct kernel_filter *filter, int first, int width)
+{
+    for (int x = 0; x < width; x++) {
+        int i = first + x;
+        dest[x] = kernel_scale_row_pixel (src + filter->start[i],
+                                          filter->weights
+                                          + (size_t) i * filter->max_count,
+                                          filter->count[i]);
+    }
+}
+
+void
+kernel_scale_col (uint32_t *dest, const uint32_t **rows,
+                  const int16_t *weights, int count, int width)
+{
+    for (int x = 0; x < width; x++) {
+        dest[x] = kernel_scale_col_pixel (rows, weights, count, x);
+    }
+}
+
+void
+kernel_gradient (uint32_t *dest, const int32_t *start, const int32_t *step,
+                 const int32_t *dither, int width)
+{
+    for (int x = 0; x < width; x++) {
+        dest[x] = kernel_gradient_pixel (start, step, dither, x);
+    }
+}
+
+void
+kernel_mix (uint32_t *dest, const uint32_t *a, const uint32_t *b, int alpha,
+            int width)
+{
+    for (int x = 0; x < width; x++) {
+        dest[x] = kernel_mix_pixel (a[x], b[x], alpha);
+    }
+}
+
+void
+kernel_rgb565 (uint16_t *dest, const uint32_t *src, const uint8_t *dither,
+               int width)
+{
+    for (int x = 0; x < width; x++) {
+        dest[x] = kernel_rgb565_pixel (src[x], dither + (x & 3) * 4);
+    }
+}
@@ -0,0 +1,132 @@
+/*
+ * kernel.h for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#ifndef _KERNEL_H_
+#define _KERNEL_H_
+
+#include "config.h"
+
+#include <stdint.h>
+
+/** Fixed point precision of filter weights. */
+#define KERNEL_SHIFT 14
+#define KERNEL_ONE (1 << KERNEL_SHIFT)
+/** Weights per destination pixel are padded to a multiple of this. */
+#define KERNEL_TAPS_ALIGN 4
+/** Fixed point precision of gradient channels. */
+#define KERNEL_GRADIENT_SHIFT 16
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KERNEL_HAVE_X86
+#endif /* __x86_64__ || __i386__ */
+#if defined(__aarch64__)
+#define KERNEL_HAVE_NEON
+#endif /* __aarch64__ */
+
+/**
+ * Filter used when upscaling, downscaling always averages the covered
+ * source pixels.
+ */
+enum kernel_filter_type {
+    KERNEL_FILTER_BILINEAR,
+    KERNEL_FILTER_BICUBIC /**< Catmull-Rom. */
+};
+
+/**
+ * Weights scaling one axis, destination pixel i is the weighted sum
+ * of count[i] source pixels starting at start[i]. Filters are cached
+ * and shared, they must not be modified.
+ */
+struct kernel_filter {
+    int src_size;
+    int dest_size;
+    enum kernel_filter_type type;
+
+    int *start;
+    int *count;
+    /** max_count weights per destination pixel, 0 past count[i]. */
+    int16_t *weights;
+    int max_count; /**< Multiple of KERNEL_TAPS_ALIGN. */
+
+    unsigned int refs;
+    struct kernel_filter *next;
+};
+
+/**
+ * Kernels working on rows of ARGB32 pixels, all implementations
+ * produce exactly the same output as the scalar reference.
+ */
+struct kernel {
+    const char *name;
+
+    /** Set width pixels of dest to pixel. */
+    void (*fill) (uint32_t *dest, uint32_t pixel, int width);
+    /** Copy width pixels of src to dest. */
+    void (*blit) (uint32_t *dest, const uint32_t *src, int width);
+    /** Blend width pixels of src onto dest using the src alpha, the
+        dest alpha is kept. */
+    void (*blend) (uint32_t *dest, const uint32_t *src, int width);
+    /** Scale src horizontally into dest, computing width pixels of the
+        filter starting at pixel first. */
+    void (*scale_row) (uint32_t *dest, const uint32_t *src,
+                       const struct kernel_filter *filter, int first,
+                       int width);
+    /** Sum count rows weighted by weights into width pixels of dest. */
+    void (*scale_col) (uint32_t *dest, const uint32_t **rows,
+                       const int16_t *weights, int count, int width);
+    /** Linear gradient of width pixels, channel c of pixel x is
+        start[c] + x * step[c] + dither[(x & 3) * 4 + c] shifted down by
+        KERNEL_GRADIENT_SHIFT and clamped to 0-255. Channels are in
+        blue, green, red, alpha order. */
+    void (*gradient) (uint32_t *dest, const int32_t *start,
+                      const int32_t *step, const int32_t *dither,
+                      int width);
+    /** Cross-fade width pixels of a and b into dest, each channel is
+        (a * (256 - alpha) + b * alpha) >> 8 with alpha 0-256. */
+    void (*mix) (uint32_t *dest, const uint32_t *a, const uint32_t *b,
+                 int alpha, int width);
+    /** Convert width pixels to RGB565, dither[(x & 3) * 4 + c] is added
+        to channel c of pixel x with saturation before truncating.
+        Channels are in blue, green, red, alpha order. */
+    void (*rgb565) (uint16_t *dest, const uint32_t *src,
+                    const uint8_t *dither, int width);
+};
+
+extern const struct kernel KERNEL_SCALAR;
+#ifdef KERNEL_HAVE_X86
+extern const struct kernel KERNEL_SSE2;
+extern const struct kernel KERNEL_AVX2;
+#endif /* KERNEL_HAVE_X86 */
+#ifdef KERNEL_HAVE_NEON
+extern const struct kernel KERNEL_NEON;
+#endif /* KERNEL_HAVE_NEON */
+
+extern const struct kernel *kernel_get (void);
+extern void kernel_set (const struct kernel *kernel);
+extern const struct kernel *kernel_from_str (const char *str);
+
+extern struct kernel_filter *kernel_filter_get (int src_size, int dest_size,
+                                                enum kernel_filter_type type);
+extern void kernel_filter_release (struct kernel_filter *filter);
+extern int kernel_filter_type_from_str (const char *str,
+                                        enum kernel_filter_type *type);
+
+extern uint32_t kernel_pack (int32_t a, int32_t r, int32_t g, int32_t b);
+extern uint32_t kernel_blend_pixel (uint32_t d, uint32_t s);
+extern uint32_t kernel_scale_row_pixel (const uint32_t *src,
+                                        const int16_t *weights, int count);
+extern uint32_t kernel_scale_col_pixel (const uint32_t **rows,
+                                        const int16_t *weights, int count,
+                                        int x);
+extern uint32_t kernel_gradient_pixel (const int32_t *start,
+                                       const int32_t *step,
+                                       const int32_t *dither, int x);
+extern uint32_t kernel_mix_pixel (uint32_t a, uint32_t b, int alpha);
+extern uint16_t kernel_rgb565_pixel (uint32_t p, const uint8_t *dither);
+
+#endif /* _KERNEL_H_ */
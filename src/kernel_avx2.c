@@ -0,0 +1,333 @@
+/*
+ * kernel_avx2.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+/*
+ * AVX2 kernels, same approach as the SSE2 kernels working on twice the
+ * pixels. Horizontal scaling sums four taps per multiply-add, one pair
+ * of taps in each 128 bit lane.
+ */
+
+#include "config.h"
+
+#include "kernel.h"
+
+#ifdef KERNEL_HAVE_X86
+
+#include <string.h>
+#include <immintrin.h>
+
+#define KERNEL_AVX2_FN __attribute__ ((target ("avx2")))
+
+static void kernel_avx2_fill (uint32_t *dest, uint32_t pixel, int width);
+static void kernel_avx2_blit (uint32_t *dest, const uint32_t *src, int width);
+static void kernel_avx2_blend (uint32_t *dest, const uint32_t *src,
+                               int width);
+static void kernel_avx2_scale_row (uint32_t *dest, const uint32_t *src,
+                                   const struct kernel_filter *filter,
+                                   int first, int width);
+static void kernel_avx2_scale_col (uint32_t *dest, const uint32_t **rows,
+                                   const int16_t *weights, int count,
+                                   int width);
+static void kernel_avx2_gradient (uint32_t *dest, const int32_t *start,
+                                  const int32_t *step, const int32_t *dither,
+                                  int width);
+static void kernel_avx2_mix (uint32_t *dest, const uint32_t *a,
+                             const uint32_t *b, int alpha, int width);
+static void kernel_avx2_rgb565 (uint16_t *dest, const uint32_t *src,
+                                const uint8_t *dither, int width);
+
+const struct kernel KERNEL_AVX2 = {
+    "avx2",
+    kernel_avx2_fill,
+    kernel_avx2_blit,
+    kernel_avx2_blend,
+    kernel_avx2_scale_row,
+    kernel_avx2_scale_col,
+    kernel_avx2_gradient,
+    kernel_avx2_mix,
+    kernel_avx2_rgb565
+};
+
+/**
+ * Weights w0 and w1 paired for multiply-add of interleaved pixels.
+ */
+static inline KERNEL_AVX2_FN int32_t
+kernel_avx2_pair (int16_t w0, int16_t w1)
+{
+    return (int32_t) ((uint32_t) (uint16_t) w0
+                      | (uint32_t) (uint16_t) w1 << 16);
+}
+
+/**
+ * Blend four pixels widened to 16 bit channels, divides by 255 with
+ * the same rounding as kernel_blend_pixel.
+ */
+static inline KERNEL_AVX2_FN __m256i
+kernel_avx2_blend16 (__m256i d, __m256i s)
+{
+    const __m256i c255 = _mm256_set1_epi16 (255);
+    const __m256i c128 = _mm256_set1_epi16 (128);
+    __m256i a = _mm256_shufflehi_epi16 (_mm256_shufflelo_epi16 (s, 0xff),
+                                        0xff);
+    __m256i t = _mm256_add_epi16 (
+        _mm256_mullo_epi16 (s, a),
+        _mm256_mullo_epi16 (d, _mm256_sub_epi16 (c255, a)));
+    t = _mm256_add_epi16 (t, c128);
+    return _mm256_srli_epi16 (_mm256_add_epi16 (t, _mm256_srli_epi16 (t, 8)),
+                              8);
+}
+
+KERNEL_AVX2_FN void
+kernel_avx2_fill (uint32_t *dest, uint32_t pixel, int width)
+{
+    __m256i p = _mm256_set1_epi32 ((int32_t) pixel);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        _mm256_storeu_si256 ((__m256i*) (dest + x), p);
+    }
+    for (; x < width; x++) {
+        dest[x] = pixel;
+    }
+}
+
+KERNEL_AVX2_FN void
+kernel_avx2_blit (uint32_t *dest, const uint32_t *src, int width)
+{
+    memcpy (dest, src, width * sizeof (uint32_t));
+}
+
+KERNEL_AVX2_FN void
+kernel_avx2_blend (uint32_t *dest, const uint32_t *src, int width)
+{
+    const __m256i zero = _mm256_setzero_si256 ();
+    const __m256i alpha = _mm256_set1_epi32 ((int32_t) 0xff000000);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i s = _mm256_loadu_si256 ((const __m256i*) (src + x));
+        __m256i sa = _mm256_and_si256 (s, alpha);
+        if (_mm256_movemask_epi8 (_mm256_cmpeq_epi32 (sa, zero)) == -1) {
+            continue;
+        }
+        __m256i d = _mm256_loadu_si256 ((const __m256i*) (dest + x));
+        __m256i p;
+        if (_mm256_movemask_epi8 (_mm256_cmpeq_epi32 (sa, alpha)) == -1) {
+            p = s;
+        } else {
+            __m256i lo = kernel_avx2_blend16 (_mm256_unpacklo_epi8 (d, zero),
+                                              _mm256_unpacklo_epi8 (s, zero));
+            __m256i hi = kernel_avx2_blend16 (_mm256_unpackhi_epi8 (d, zero),
+                                              _mm256_unpackhi_epi8 (s, zero));
+            p = _mm256_packus_epi16 (lo, hi);
+        }
+        p = _mm256_or_si256 (_mm256_andnot_si256 (alpha, p),
+                             _mm256_and_si256 (alpha, d));
+        _mm256_storeu_si256 ((__m256i*) (dest + x), p);
+    }
+    for (; x < width; x++) {
+        dest[x] = kernel_blend_pixel (dest[x], src[x]);
+    }
+}
+
+KERNEL_AVX2_FN void
+kernel_avx2_scale_row (uint32_t *dest, const uint32_t *src,
+                       const struct kernel_filter *filter, int first,
+                       int width)
+{
+    /* Interleave channels of pixels 0 and 1 in the low half and of
+       pixels 2 and 3 in the high half. */
+    const __m128i interleave = _mm_setr_epi8 (0, 4, 1, 5, 2, 6, 3, 7,
+                                              8, 12, 9, 13, 10, 14, 11, 15);
+    const __m128i zero = _mm_setzero_si128 ();
+    const __m128i half = _mm_set1_epi32 (KERNEL_ONE / 2);
+    for (int x = 0; x < width; x++) {
+        int start = filter->start[first + x];
+        const uint32_t *s = src + start;
+        const int16_t *w =
+            filter->weights + (size_t) (first + x) * filter->max_count;
+        int count = filter->count[first + x];
+        __m256i acc4 = _mm256_setzero_si256 ();
+        __m128i acc = zero;
+        int i = 0;
+        /* Weights are padded with zeros to a multiple of four taps, the
+           extra pixels are only read while inside of the source. Two
+           taps are cheaper to sum as a pair. */
+        for (; count > 2 && i < count && start + i + 4 <= filter->src_size;
+             i += 4) {
+            __m128i p = _mm_loadu_si128 ((const __m128i*) (s + i));
+            p = _mm_shuffle_epi8 (p, interleave);
+            __m256i p16 = _mm256_cvtepu8_epi16 (p);
+            __m256i wi = _mm256_inserti128_si256 (
+                _mm256_castsi128_si256 (
+                    _mm_set1_epi32 (kernel_avx2_pair (w[i], w[i + 1]))),
+                _mm_set1_epi32 (kernel_avx2_pair (w[i + 2], w[i + 3])), 1);
+            acc4 = _mm256_add_epi32 (acc4, _mm256_madd_epi16 (p16, wi));
+        }
+        for (; i < count; i += 2) {
+            uint32_t s1 = i + 1 < count ? s[i + 1] : 0;
+            __m128i p = _mm_unpacklo_epi8 (_mm_cvtsi32_si128 ((int32_t) s[i]),
+                                           _mm_cvtsi32_si128 ((int32_t) s1));
+            p = _mm_unpacklo_epi8 (p, zero);
+            __m128i wi = _mm_set1_epi32 (kernel_avx2_pair (w[i], w[i + 1]));
+            acc = _mm_add_epi32 (acc, _mm_madd_epi16 (p, wi));
+        }
+        acc = _mm_add_epi32 (acc, _mm256_castsi256_si128 (acc4));
+        acc = _mm_add_epi32 (acc, _mm256_extracti128_si256 (acc4, 1));
+        acc = _mm_srai_epi32 (_mm_add_epi32 (acc, half), KERNEL_SHIFT);
+        acc = _mm_packs_epi32 (acc, acc);
+        dest[x] = (uint32_t) _mm_cvtsi128_si32 (_mm_packus_epi16 (acc, acc));
+    }
+}
+
+KERNEL_AVX2_FN void
+kernel_avx2_scale_col (uint32_t *dest, const uint32_t **rows,
+                       const int16_t *weights, int count, int width)
+{
+    const __m256i zero = _mm256_setzero_si256 ();
+    const __m256i half = _mm256_set1_epi32 (KERNEL_ONE / 2);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i c0 = zero, c1 = zero, c2 = zero, c3 = zero;
+        for (int i = 0; i < count; i += 2) {
+            __m256i r0 = _mm256_loadu_si256 ((const __m256i*) (rows[i] + x));
+            __m256i r1 = zero;
+            int16_t w1 = 0;
+            if (i + 1 < count) {
+                r1 = _mm256_loadu_si256 ((const __m256i*) (rows[i + 1] + x));
+                w1 = weights[i + 1];
+            }
+            __m256i w = _mm256_set1_epi32 (kernel_avx2_pair (weights[i], w1));
+            __m256i lo = _mm256_unpacklo_epi8 (r0, r1);
+            __m256i hi = _mm256_unpackhi_epi8 (r0, r1);
+            c0 = _mm256_add_epi32 (c0, _mm256_madd_epi16 (
+                                       _mm256_unpacklo_epi8 (lo, zero), w));
+            c1 = _mm256_add_epi32 (c1, _mm256_madd_epi16 (
+                                       _mm256_unpackhi_epi8 (lo, zero), w));
+            c2 = _mm256_add_epi32 (c2, _mm256_madd_epi16 (
+                                       _mm256_unpacklo_epi8 (hi, zero), w));
+            c3 = _mm256_add_epi32 (c3, _mm256_madd_epi16 (
+                                       _mm256_unpackhi_epi8 (hi, zero), w));
+        }
+        c0 = _mm256_srai_epi32 (_mm256_add_epi32 (c0, half), KERNEL_SHIFT);
+        c1 = _mm256_srai_epi32 (_mm256_add_epi32 (c1, half), KERNEL_SHIFT);
+        c2 = _mm256_srai_epi32 (_mm256_add_epi32 (c2, half), KERNEL_SHIFT);
+        c3 = _mm256_srai_epi32 (_mm256_add_epi32 (c3, half), KERNEL_SHIFT);
+        /* Packing works within 128 bit lanes, matching the unpacking. */
+        __m256i p = _mm256_packus_epi16 (_mm256_packs_epi32 (c0, c1),
+                                         _mm256_packs_epi32 (c2, c3));
+        _mm256_storeu_si256 ((__m256i*) (dest + x), p);
+    }
+    for (; x < width; x++) {
+        dest[x] = kernel_scale_col_pixel (rows, weights, count, x);
+    }
+}
+
+KERNEL_AVX2_FN void
+kernel_avx2_gradient (uint32_t *dest, const int32_t *start,
+                      const int32_t *step, const int32_t *dither, int width)
+{
+    /* Two consecutive pixels per register, one in each 128 bit lane. */
+    __m128i start1 = _mm_loadu_si128 ((const __m128i*) start);
+    __m128i step1 = _mm_loadu_si128 ((const __m128i*) step);
+    __m256i acc = _mm256_inserti128_si256 (
+        _mm256_castsi128_si256 (start1), _mm_add_epi32 (start1, step1), 1);
+    __m256i inc = _mm256_inserti128_si256 (
+        _mm256_castsi128_si256 (_mm_add_epi32 (step1, step1)),
+        _mm_add_epi32 (step1, step1), 1);
+    __m256i d01 = _mm256_loadu_si256 ((const __m256i*) dither);
+    __m256i d23 = _mm256_loadu_si256 ((const __m256i*) (dither + 8));
+    /* Packing interleaves the lanes, pixels come out as 0 2 4 6 and
+       1 3 5 7. */
+    const __m256i order = _mm256_setr_epi32 (0, 4, 1, 5, 2, 6, 3, 7);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i p[4];
+        for (int i = 0; i < 4; i++) {
+            p[i] = _mm256_srai_epi32 (
+                _mm256_add_epi32 (acc, i % 2 ? d23 : d01),
+                KERNEL_GRADIENT_SHIFT);
+            acc = _mm256_add_epi32 (acc, inc);
+        }
+        __m256i px = _mm256_packus_epi16 (_mm256_packs_epi32 (p[0], p[1]),
+                                          _mm256_packs_epi32 (p[2], p[3]));
+        px = _mm256_permutevar8x32_epi32 (px, order);
+        _mm256_storeu_si256 ((__m256i*) (dest + x), px);
+    }
+    for (; x < width; x++) {
+        dest[x] = kernel_gradient_pixel (start, step, dither, x);
+    }
+}
+
+KERNEL_AVX2_FN void
+kernel_avx2_mix (uint32_t *dest, const uint32_t *a, const uint32_t *b,
+                 int alpha, int width)
+{
+    /* Unpacking and packing within lanes keeps the pixel order. */
+    const __m256i zero = _mm256_setzero_si256 ();
+    const __m256i wa = _mm256_set1_epi16 (256 - alpha);
+    const __m256i wb = _mm256_set1_epi16 (alpha);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i pa = _mm256_loadu_si256 ((const __m256i*) (a + x));
+        __m256i pb = _mm256_loadu_si256 ((const __m256i*) (b + x));
+        __m256i lo = _mm256_add_epi16 (
+            _mm256_mullo_epi16 (_mm256_unpacklo_epi8 (pa, zero), wa),
+            _mm256_mullo_epi16 (_mm256_unpacklo_epi8 (pb, zero), wb));
+        __m256i hi = _mm256_add_epi16 (
+            _mm256_mullo_epi16 (_mm256_unpackhi_epi8 (pa, zero), wa),
+            _mm256_mullo_epi16 (_mm256_unpackhi_epi8 (pb, zero), wb));
+        _mm256_storeu_si256 ((__m256i*) (dest + x),
+                             _mm256_packus_epi16 (_mm256_srli_epi16 (lo, 8),
+                                                  _mm256_srli_epi16 (hi, 8)));
+    }
+    for (; x < width; x++) {
+        dest[x] = kernel_mix_pixel (a[x], b[x], alpha);
+    }
+}
+
+/**
+ * Convert eight pixels to RGB565 in the low 16 bits of each 32 bit
+ * lane, sign extended so signed packing keeps them.
+ */
+static inline KERNEL_AVX2_FN __m256i
+kernel_avx2_rgb565_8 (__m256i p)
+{
+    __m256i r = _mm256_and_si256 (_mm256_srli_epi32 (p, 8),
+                                  _mm256_set1_epi32 (0xf800));
+    __m256i g = _mm256_and_si256 (_mm256_srli_epi32 (p, 5),
+                                  _mm256_set1_epi32 (0x07e0));
+    __m256i b = _mm256_and_si256 (_mm256_srli_epi32 (p, 3),
+                                  _mm256_set1_epi32 (0x001f));
+    __m256i v = _mm256_or_si256 (_mm256_or_si256 (r, g), b);
+    return _mm256_srai_epi32 (_mm256_slli_epi32 (v, 16), 16);
+}
+
+KERNEL_AVX2_FN void
+kernel_avx2_rgb565 (uint16_t *dest, const uint32_t *src,
+                    const uint8_t *dither, int width)
+{
+    /* The dither pattern repeats every four pixels, once per lane. */
+    __m256i d = _mm256_broadcastsi128_si256 (
+        _mm_loadu_si128 ((const __m128i*) dither));
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i p0 = _mm256_adds_epu8 (
+            _mm256_loadu_si256 ((const __m256i*) (src + x)), d);
+        __m256i p1 = _mm256_adds_epu8 (
+            _mm256_loadu_si256 ((const __m256i*) (src + x + 8)), d);
+        /* Packing interleaves the lanes, restore the pixel order. */
+        __m256i v = _mm256_packs_epi32 (kernel_avx2_rgb565_8 (p0),
+                                        kernel_avx2_rgb565_8 (p1));
+        v = _mm256_permute4x64_epi64 (v, _MM_SHUFFLE (3, 1, 2, 0));
+        _mm256_storeu_si256 ((__m256i*) (dest + x), v);
+    }
+    for (; x < width; x++) {
+        dest[x] = kernel_rgb565_pixel (src[x], dither + (x & 3) * 4);
+    }
+}
+
+#endif /* KERNEL_HAVE_X86 */
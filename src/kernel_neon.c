@@ -0,0 +1,245 @@
+/*
+ * kernel_neon.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+/*
+ * NEON kernels, NEON is always available on AArch64. Channels are
+ * widened to 16 bits and multiply-accumulated into 32 bit channels.
+ */
+
+#include "config.h"
+
+#include "kernel.h"
+
+#ifdef KERNEL_HAVE_NEON
+
+#include <string.h>
+#include <arm_neon.h>
+
+static void kernel_neon_fill (uint32_t *dest, uint32_t pixel, int width);
+static void kernel_neon_blit (uint32_t *dest, const uint32_t *src, int width);
+static void kernel_neon_blend (uint32_t *dest, const uint32_t *src,
+                               int width);
+static void kernel_neon_scale_row (uint32_t *dest, const uint32_t *src,
+                                   const struct kernel_filter *filter,
+                                   int first, int width);
+static void kernel_neon_scale_col (uint32_t *dest, const uint32_t **rows,
+                                   const int16_t *weights, int count,
+                                   int width);
+static void kernel_neon_gradient (uint32_t *dest, const int32_t *start,
+                                  const int32_t *step, const int32_t *dither,
+                                  int width);
+static void kernel_neon_mix (uint32_t *dest, const uint32_t *a,
+                             const uint32_t *b, int alpha, int width);
+static void kernel_neon_rgb565 (uint16_t *dest, const uint32_t *src,
+                                const uint8_t *dither, int width);
+
+const struct kernel KERNEL_NEON = {
+    "neon",
+    kernel_neon_fill,
+    kernel_neon_blit,
+    kernel_neon_blend,
+    kernel_neon_scale_row,
+    kernel_neon_scale_col,
+    kernel_neon_gradient,
+    kernel_neon_mix,
+    kernel_neon_rgb565
+};
+
+/**
+ * Round and shift 32 bit fixed point channels, saturating to 16 bits.
+ */
+static inline int16x4_t
+kernel_neon_round (int32x4_t c)
+{
+    const int32x4_t half = vdupq_n_s32 (KERNEL_ONE / 2);
+    return vqmovn_s32 (vshrq_n_s32 (vaddq_s32 (c, half), KERNEL_SHIFT));
+}
+
+/**
+ * Blend eight channels, divides by 255 with the same rounding as
+ * kernel_blend_pixel.
+ */
+static inline uint8x8_t
+kernel_neon_blend8 (uint8x8_t d, uint8x8_t s, uint8x8_t a)
+{
+    uint16x8_t t = vmull_u8 (s, a);
+    t = vmlal_u8 (t, d, vmvn_u8 (a));
+    t = vaddq_u16 (t, vdupq_n_u16 (128));
+    return vshrn_n_u16 (vaddq_u16 (t, vshrq_n_u16 (t, 8)), 8);
+}
+
+void
+kernel_neon_fill (uint32_t *dest, uint32_t pixel, int width)
+{
+    uint32x4_t p = vdupq_n_u32 (pixel);
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        vst1q_u32 (dest + x, p);
+    }
+    for (; x < width; x++) {
+        dest[x] = pixel;
+    }
+}
+
+void
+kernel_neon_blit (uint32_t *dest, const uint32_t *src, int width)
+{
+    memcpy (dest, src, width * sizeof (uint32_t));
+}
+
+void
+kernel_neon_blend (uint32_t *dest, const uint32_t *src, int width)
+{
+    static const uint8_t alpha_idx[16] = {
+        3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15
+    };
+    const uint8x16_t idx = vld1q_u8 (alpha_idx);
+    const uint8x16_t alpha =
+        vreinterpretq_u8_u32 (vdupq_n_u32 (0xff000000));
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        uint8x16_t s = vreinterpretq_u8_u32 (vld1q_u32 (src + x));
+        uint8x16_t d = vreinterpretq_u8_u32 (vld1q_u32 (dest + x));
+        uint8x16_t a = vqtbl1q_u8 (s, idx);
+        uint8x16_t p = vcombine_u8 (
+            kernel_neon_blend8 (vget_low_u8 (d), vget_low_u8 (s),
+                                vget_low_u8 (a)),
+            kernel_neon_blend8 (vget_high_u8 (d), vget_high_u8 (s),
+                                vget_high_u8 (a)));
+        p = vbslq_u8 (alpha, d, p);
+        vst1q_u32 (dest + x, vreinterpretq_u32_u8 (p));
+    }
+    for (; x < width; x++) {
+        dest[x] = kernel_blend_pixel (dest[x], src[x]);
+    }
+}
+
+void
+kernel_neon_scale_row (uint32_t *dest, const uint32_t *src,
+                       const struct kernel_filter *filter, int first,
+                       int width)
+{
+    for (int x = 0; x < width; x++) {
+        const uint32_t *s = src + filter->start[first + x];
+        const int16_t *w =
+            filter->weights + (size_t) (first + x) * filter->max_count;
+        int32x4_t acc = vdupq_n_s32 (0);
+        for (int i = 0; i < filter->count[first + x]; i++) {
+            uint8x8_t p = vreinterpret_u8_u32 (vdup_n_u32 (s[i]));
+            int16x4_t c =
+                vget_low_s16 (vreinterpretq_s16_u16 (vmovl_u8 (p)));
+            acc = vmlal_n_s16 (acc, c, w[i]);
+        }
+        int16x4_t c = kernel_neon_round (acc);
+        uint8x8_t p = vqmovun_s16 (vcombine_s16 (c, c));
+        dest[x] = vget_lane_u32 (vreinterpret_u32_u8 (p), 0);
+    }
+}
+
+void
+kernel_neon_scale_col (uint32_t *dest, const uint32_t **rows,
+                       const int16_t *weights, int count, int width)
+{
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        int32x4_t c0 = vdupq_n_s32 (0), c1 = c0, c2 = c0, c3 = c0;
+        for (int i = 0; i < count; i++) {
+            uint8x16_t r = vreinterpretq_u8_u32 (vld1q_u32 (rows[i] + x));
+            int16x8_t lo = vreinterpretq_s16_u16 (vmovl_u8 (vget_low_u8 (r)));
+            int16x8_t hi = vreinterpretq_s16_u16 (vmovl_u8 (vget_high_u8 (r)));
+            c0 = vmlal_n_s16 (c0, vget_low_s16 (lo), weights[i]);
+            c1 = vmlal_n_s16 (c1, vget_high_s16 (lo), weights[i]);
+            c2 = vmlal_n_s16 (c2, vget_low_s16 (hi), weights[i]);
+            c3 = vmlal_n_s16 (c3, vget_high_s16 (hi), weights[i]);
+        }
+        uint8x16_t p = vcombine_u8 (
+            vqmovun_s16 (vcombine_s16 (kernel_neon_round (c0),
+                                       kernel_neon_round (c1))),
+            vqmovun_s16 (vcombine_s16 (kernel_neon_round (c2),
+                                       kernel_neon_round (c3))));
+        vst1q_u32 (dest + x, vreinterpretq_u32_u8 (p));
+    }
+    for (; x < width; x++) {
+        dest[x] = kernel_scale_col_pixel (rows, weights, count, x);
+    }
+}
+
+void
+kernel_neon_gradient (uint32_t *dest, const int32_t *start,
+                      const int32_t *step, const int32_t *dither, int width)
+{
+    /* One pixel per register, the four channels in 32 bit lanes. */
+    int32x4_t acc = vld1q_s32 (start);
+    int32x4_t inc = vld1q_s32 (step);
+    int32x4_t d[4];
+    for (int i = 0; i < 4; i++) {
+        d[i] = vld1q_s32 (dither + i * 4);
+    }
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        int16x4_t p[4];
+        for (int i = 0; i < 4; i++) {
+            p[i] = vqmovn_s32 (vshrq_n_s32 (vaddq_s32 (acc, d[i]),
+                                            KERNEL_GRADIENT_SHIFT));
+            acc = vaddq_s32 (acc, inc);
+        }
+        uint8x16_t px = vcombine_u8 (vqmovun_s16 (vcombine_s16 (p[0], p[1])),
+                                     vqmovun_s16 (vcombine_s16 (p[2], p[3])));
+        vst1q_u32 (dest + x, vreinterpretq_u32_u8 (px));
+    }
+    for (; x < width; x++) {
+        dest[x] = kernel_gradient_pixel (start, step, dither, x);
+    }
+}
+
+void
+kernel_neon_mix (uint32_t *dest, const uint32_t *a, const uint32_t *b,
+                 int alpha, int width)
+{
+    uint16x8_t wa = vdupq_n_u16 (256 - alpha);
+    uint16x8_t wb = vdupq_n_u16 (alpha);
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        uint8x16_t pa = vreinterpretq_u8_u32 (vld1q_u32 (a + x));
+        uint8x16_t pb = vreinterpretq_u8_u32 (vld1q_u32 (b + x));
+        uint16x8_t lo = vmlaq_u16 (vmulq_u16 (vmovl_u8 (vget_low_u8 (pa)),
+                                              wa),
+                                   vmovl_u8 (vget_low_u8 (pb)), wb);
+        uint16x8_t hi = vmlaq_u16 (vmulq_u16 (vmovl_u8 (vget_high_u8 (pa)),
+                                              wa),
+                                   vmovl_u8 (vget_high_u8 (pb)), wb);
+        uint8x16_t px = vcombine_u8 (vshrn_n_u16 (lo, 8),
+                                     vshrn_n_u16 (hi, 8));
+        vst1q_u32 (dest + x, vreinterpretq_u32_u8 (px));
+    }
+    for (; x < width; x++) {
+        dest[x] = kernel_mix_pixel (a[x], b[x], alpha);
+    }
+}
+
+void
+kernel_neon_rgb565 (uint16_t *dest, const uint32_t *src,
+                    const uint8_t *dither, int width)
+{
+    /* The dither pattern repeats every four pixels. */
+    uint8x16_t d = vld1q_u8 (dither);
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        uint32x4_t p = vreinterpretq_u32_u8 (
+            vqaddq_u8 (vreinterpretq_u8_u32 (vld1q_u32 (src + x)), d));
+        uint32x4_t r = vandq_u32 (vshrq_n_u32 (p, 8), vdupq_n_u32 (0xf800));
+        uint32x4_t g = vandq_u32 (vshrq_n_u32 (p, 5), vdupq_n_u32 (0x07e0));
+        uint32x4_t b = vandq_u32 (vshrq_n_u32 (p, 3), vdupq_n_u32 (0x001f));
+        vst1_u16 (dest + x, vmovn_u32 (vorrq_u32 (vorrq_u32 (r, g), b)));
+    }
+    for (; x < width; x++) {
+        dest[x] = kernel_rgb565_pixel (src[x], dither + (x & 3) * 4);
+    }
+}
+
+#endif /* KERNEL_HAVE_NEON */
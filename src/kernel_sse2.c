@@ -0,0 +1,315 @@
+/*
+ * kernel_sse2.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+/*
+ * SSE2 kernels. Pixels are widened to 16 bit channels, pairs of taps
+ * are interleaved so a single multiply-add sums two weighted pixels
+ * into 32 bit channels.
+ */
+
+#include "config.h"
+
+#include "kernel.h"
+
+#ifdef KERNEL_HAVE_X86
+
+#include <string.h>
+#include <emmintrin.h>
+
+#define KERNEL_SSE2_FN __attribute__ ((target ("sse2")))
+
+static void kernel_sse2_fill (uint32_t *dest, uint32_t pixel, int width);
+static void kernel_sse2_blit (uint32_t *dest, const uint32_t *src, int width);
+static void kernel_sse2_blend (uint32_t *dest, const uint32_t *src,
+                               int width);
+static void kernel_sse2_scale_row (uint32_t *dest, const uint32_t *src,
+                                   const struct kernel_filter *filter,
+                                   int first, int width);
+static void kernel_sse2_scale_col (uint32_t *dest, const uint32_t **rows,
+                                   const int16_t *weights, int count,
+                                   int width);
+static void kernel_sse2_gradient (uint32_t *dest, const int32_t *start,
+                                  const int32_t *step, const int32_t *dither,
+                                  int width);
+static void kernel_sse2_mix (uint32_t *dest, const uint32_t *a,
+                             const uint32_t *b, int alpha, int width);
+static void kernel_sse2_rgb565 (uint16_t *dest, const uint32_t *src,
+                                const uint8_t *dither, int width);
+
+const struct kernel KERNEL_SSE2 = {
+    "sse2",
+    kernel_sse2_fill,
+    kernel_sse2_blit,
+    kernel_sse2_blend,
+    kernel_sse2_scale_row,
+    kernel_sse2_scale_col,
+    kernel_sse2_gradient,
+    kernel_sse2_mix,
+    kernel_sse2_rgb565
+};
+
+/**
+ * Weights w0 and w1 repeated for multiply-add of interleaved pixels.
+ */
+static inline KERNEL_SSE2_FN __m128i
+kernel_sse2_weights (int16_t w0, int16_t w1)
+{
+    return _mm_set1_epi32 ((int32_t) ((uint32_t) (uint16_t) w0
+                                      | (uint32_t) (uint16_t) w1 << 16));
+}
+
+/**
+ * Round and shift 32 bit fixed point channels of four pixels, packing
+ * them with saturation to 0-255.
+ */
+static inline KERNEL_SSE2_FN __m128i
+kernel_sse2_pack (__m128i c0, __m128i c1, __m128i c2, __m128i c3)
+{
+    const __m128i half = _mm_set1_epi32 (KERNEL_ONE / 2);
+    c0 = _mm_srai_epi32 (_mm_add_epi32 (c0, half), KERNEL_SHIFT);
+    c1 = _mm_srai_epi32 (_mm_add_epi32 (c1, half), KERNEL_SHIFT);
+    c2 = _mm_srai_epi32 (_mm_add_epi32 (c2, half), KERNEL_SHIFT);
+    c3 = _mm_srai_epi32 (_mm_add_epi32 (c3, half), KERNEL_SHIFT);
+    return _mm_packus_epi16 (_mm_packs_epi32 (c0, c1),
+                             _mm_packs_epi32 (c2, c3));
+}
+
+/**
+ * Blend two pixels widened to 16 bit channels, divides by 255 with the
+ * same rounding as kernel_blend_pixel.
+ */
+static inline KERNEL_SSE2_FN __m128i
+kernel_sse2_blend16 (__m128i d, __m128i s)
+{
+    const __m128i c255 = _mm_set1_epi16 (255);
+    const __m128i c128 = _mm_set1_epi16 (128);
+    __m128i a = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (s, 0xff), 0xff);
+    __m128i t = _mm_add_epi16 (_mm_mullo_epi16 (s, a),
+                               _mm_mullo_epi16 (d, _mm_sub_epi16 (c255, a)));
+    t = _mm_add_epi16 (t, c128);
+    return _mm_srli_epi16 (_mm_add_epi16 (t, _mm_srli_epi16 (t, 8)), 8);
+}
+
+/**
+ * Convert four pixels to RGB565 in the low 16 bits of each 32 bit
+ * lane, sign extended so signed packing keeps them.
+ */
+static inline KERNEL_SSE2_FN __m128i
+kernel_sse2_rgb565_4 (__m128i p)
+{
+    __m128i r = _mm_and_si128 (_mm_srli_epi32 (p, 8),
+                               _mm_set1_epi32 (0xf800));
+    __m128i g = _mm_and_si128 (_mm_srli_epi32 (p, 5),
+                               _mm_set1_epi32 (0x07e0));
+    __m128i b = _mm_and_si128 (_mm_srli_epi32 (p, 3),
+                               _mm_set1_epi32 (0x001f));
+    __m128i v = _mm_or_si128 (_mm_or_si128 (r, g), b);
+    return _mm_srai_epi32 (_mm_slli_epi32 (v, 16), 16);
+}
+
+KERNEL_SSE2_FN void
+kernel_sse2_fill (uint32_t *dest, uint32_t pixel, int width)
+{
+    __m128i p = _mm_set1_epi32 ((int32_t) pixel);
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        _mm_storeu_si128 ((__m128i*) (dest + x), p);
+    }
+    for (; x < width; x++) {
+        dest[x] = pixel;
+    }
+}
+
+KERNEL_SSE2_FN void
+kernel_sse2_blit (uint32_t *dest, const uint32_t *src, int width)
+{
+    memcpy (dest, src, width * sizeof (uint32_t));
+}
+
+KERNEL_SSE2_FN void
+kernel_sse2_blend (uint32_t *dest, const uint32_t *src, int width)
+{
+    const __m128i zero = _mm_setzero_si128 ();
+    const __m128i alpha = _mm_set1_epi32 ((int32_t) 0xff000000);
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i s = _mm_loadu_si128 ((const __m128i*) (src + x));
+        __m128i sa = _mm_and_si128 (s, alpha);
+        int mask = _mm_movemask_epi8 (_mm_cmpeq_epi32 (sa, zero));
+        if (mask == 0xffff) {
+            continue;
+        }
+        __m128i d = _mm_loadu_si128 ((const __m128i*) (dest + x));
+        __m128i p;
+        if (_mm_movemask_epi8 (_mm_cmpeq_epi32 (sa, alpha)) == 0xffff) {
+            p = s;
+        } else {
+            __m128i lo = kernel_sse2_blend16 (_mm_unpacklo_epi8 (d, zero),
+                                              _mm_unpacklo_epi8 (s, zero));
+            __m128i hi = kernel_sse2_blend16 (_mm_unpackhi_epi8 (d, zero),
+                                              _mm_unpackhi_epi8 (s, zero));
+            p = _mm_packus_epi16 (lo, hi);
+        }
+        p = _mm_or_si128 (_mm_andnot_si128 (alpha, p),
+                          _mm_and_si128 (alpha, d));
+        _mm_storeu_si128 ((__m128i*) (dest + x), p);
+    }
+    for (; x < width; x++) {
+        dest[x] = kernel_blend_pixel (dest[x], src[x]);
+    }
+}
+
+KERNEL_SSE2_FN void
+kernel_sse2_scale_row (uint32_t *dest, const uint32_t *src,
+                       const struct kernel_filter *filter, int first,
+                       int width)
+{
+    const __m128i zero = _mm_setzero_si128 ();
+    const __m128i half = _mm_set1_epi32 (KERNEL_ONE / 2);
+    for (int x = 0; x < width; x++) {
+        const uint32_t *s = src + filter->start[first + x];
+        const int16_t *w =
+            filter->weights + (size_t) (first + x) * filter->max_count;
+        int count = filter->count[first + x];
+        __m128i acc = zero;
+        int i = 0;
+        for (; i + 2 <= count; i += 2) {
+            __m128i p = _mm_unpacklo_epi8 (
+                _mm_cvtsi32_si128 ((int32_t) s[i]),
+                _mm_cvtsi32_si128 ((int32_t) s[i + 1]));
+            p = _mm_unpacklo_epi8 (p, zero);
+            __m128i wi = kernel_sse2_weights (w[i], w[i + 1]);
+            acc = _mm_add_epi32 (acc, _mm_madd_epi16 (p, wi));
+        }
+        if (i < count) {
+            __m128i p = _mm_unpacklo_epi8 (_mm_cvtsi32_si128 ((int32_t) s[i]),
+                                           zero);
+            p = _mm_unpacklo_epi8 (p, zero);
+            __m128i wi = kernel_sse2_weights (w[i], 0);
+            acc = _mm_add_epi32 (acc, _mm_madd_epi16 (p, wi));
+        }
+        acc = _mm_srai_epi32 (_mm_add_epi32 (acc, half), KERNEL_SHIFT);
+        acc = _mm_packs_epi32 (acc, acc);
+        dest[x] = (uint32_t) _mm_cvtsi128_si32 (_mm_packus_epi16 (acc, acc));
+    }
+}
+
+KERNEL_SSE2_FN void
+kernel_sse2_scale_col (uint32_t *dest, const uint32_t **rows,
+                       const int16_t *weights, int count, int width)
+{
+    const __m128i zero = _mm_setzero_si128 ();
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i c0 = zero, c1 = zero, c2 = zero, c3 = zero;
+        for (int i = 0; i < count; i += 2) {
+            __m128i r0 = _mm_loadu_si128 ((const __m128i*) (rows[i] + x));
+            __m128i r1, w;
+            if (i + 1 < count) {
+                r1 = _mm_loadu_si128 ((const __m128i*) (rows[i + 1] + x));
+                w = kernel_sse2_weights (weights[i], weights[i + 1]);
+            } else {
+                r1 = zero;
+                w = kernel_sse2_weights (weights[i], 0);
+            }
+            __m128i lo = _mm_unpacklo_epi8 (r0, r1);
+            __m128i hi = _mm_unpackhi_epi8 (r0, r1);
+            c0 = _mm_add_epi32 (c0, _mm_madd_epi16 (
+                                    _mm_unpacklo_epi8 (lo, zero), w));
+            c1 = _mm_add_epi32 (c1, _mm_madd_epi16 (
+                                    _mm_unpackhi_epi8 (lo, zero), w));
+            c2 = _mm_add_epi32 (c2, _mm_madd_epi16 (
+                                    _mm_unpacklo_epi8 (hi, zero), w));
+            c3 = _mm_add_epi32 (c3, _mm_madd_epi16 (
+                                    _mm_unpackhi_epi8 (hi, zero), w));
+        }
+        _mm_storeu_si128 ((__m128i*) (dest + x),
+                          kernel_sse2_pack (c0, c1, c2, c3));
+    }
+    for (; x < width; x++) {
+        dest[x] = kernel_scale_col_pixel (rows, weights, count, x);
+    }
+}
+
+KERNEL_SSE2_FN void
+kernel_sse2_gradient (uint32_t *dest, const int32_t *start,
+                      const int32_t *step, const int32_t *dither, int width)
+{
+    /* One pixel per register, the four channels in 32 bit lanes. */
+    __m128i acc = _mm_loadu_si128 ((const __m128i*) start);
+    __m128i inc = _mm_loadu_si128 ((const __m128i*) step);
+    __m128i d[4];
+    for (int i = 0; i < 4; i++) {
+        d[i] = _mm_loadu_si128 ((const __m128i*) (dither + i * 4));
+    }
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i p[4];
+        for (int i = 0; i < 4; i++) {
+            p[i] = _mm_srai_epi32 (_mm_add_epi32 (acc, d[i]),
+                                   KERNEL_GRADIENT_SHIFT);
+            acc = _mm_add_epi32 (acc, inc);
+        }
+        __m128i px = _mm_packus_epi16 (_mm_packs_epi32 (p[0], p[1]),
+                                       _mm_packs_epi32 (p[2], p[3]));
+        _mm_storeu_si128 ((__m128i*) (dest + x), px);
+    }
+    for (; x < width; x++) {
+        dest[x] = kernel_gradient_pixel (start, step, dither, x);
+    }
+}
+
+KERNEL_SSE2_FN void
+kernel_sse2_mix (uint32_t *dest, const uint32_t *a, const uint32_t *b,
+                 int alpha, int width)
+{
+    /* Weighted sums fit 16 bits, at most 255 * 256. */
+    const __m128i zero = _mm_setzero_si128 ();
+    const __m128i wa = _mm_set1_epi16 (256 - alpha);
+    const __m128i wb = _mm_set1_epi16 (alpha);
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i pa = _mm_loadu_si128 ((const __m128i*) (a + x));
+        __m128i pb = _mm_loadu_si128 ((const __m128i*) (b + x));
+        __m128i lo = _mm_add_epi16 (
+            _mm_mullo_epi16 (_mm_unpacklo_epi8 (pa, zero), wa),
+            _mm_mullo_epi16 (_mm_unpacklo_epi8 (pb, zero), wb));
+        __m128i hi = _mm_add_epi16 (
+            _mm_mullo_epi16 (_mm_unpackhi_epi8 (pa, zero), wa),
+            _mm_mullo_epi16 (_mm_unpackhi_epi8 (pb, zero), wb));
+        _mm_storeu_si128 ((__m128i*) (dest + x),
+                          _mm_packus_epi16 (_mm_srli_epi16 (lo, 8),
+                                            _mm_srli_epi16 (hi, 8)));
+    }
+    for (; x < width; x++) {
+        dest[x] = kernel_mix_pixel (a[x], b[x], alpha);
+    }
+}
+
+KERNEL_SSE2_FN void
+kernel_sse2_rgb565 (uint16_t *dest, const uint32_t *src,
+                    const uint8_t *dither, int width)
+{
+    /* The dither pattern repeats every four pixels. */
+    __m128i d = _mm_loadu_si128 ((const __m128i*) dither);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i p0 = _mm_adds_epu8 (
+            _mm_loadu_si128 ((const __m128i*) (src + x)), d);
+        __m128i p1 = _mm_adds_epu8 (
+            _mm_loadu_si128 ((const __m128i*) (src + x + 4)), d);
+        _mm_storeu_si128 ((__m128i*) (dest + x),
+                          _mm_packs_epi32 (kernel_sse2_rgb565_4 (p0),
+                                           kernel_sse2_rgb565_4 (p1)));
+    }
+    for (; x < width; x++) {
+        dest[x] = kernel_rgb565_pixel (src[x], dither + (x & 3) * 4);
+    }
+}
+
+#endif /* KERNEL_HAVE_X86 */
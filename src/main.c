@@ -22,21 +22,26 @@
 #include <errno.h>
 
 #include <X11/Xlib.h>
-#ifdef HAVE_XRANDR
-#include <X11/extensions/Xrandr.h>
-#endif /* HAVE_XRANDR */
 
+#include "background.h"
 #include "cfg.h"
 #include "compat.h"
+#include "predict.h"
+#include "prewarm.h"
+#include "pressure.h"
 #include "wallpaper.h"
 #include "wallpaperd.h"
 #include "util.h"
+#include "watch.h"
 #include "x11.h"
 
 #define IS_CONFIG_TIMED_MODE() \
     (CONFIG->bg_select_mode == MODE_SET \
      || (CONFIG->bg_select_mode == MODE_RANDOM && CONFIG->bg_interval > 0))
 
+/** Minimum milliseconds to wait for events in timed modes. */
+#define MIN_EVENT_WAIT 100
+
 static void parse_options (int argc, char **argv, struct options *options);
 static void usage (const char *name);
 static void do_start (void);
@@ -51,15 +56,28 @@ static void clean_pid_file (void);
 static void main_loop (void);
 static void main_loop_set_interval (time_t *next_interval);
 static void main_loop_check_change_interval (time_t *next_interval);
+static time_t main_loop_get_prefetch_time (time_t next_interval);
 static int get_next_event_wait (time_t next_interval);
 static void handle_property_event (XEvent *ev);
-static void handle_xrandr_event (XEvent *ev, int ev_xrandr);
+static void handle_xrandr_event (void);
+static void handle_watch_events (void);
+static void handle_pressure_event (void);
+static void start_predictor (void);
+static void handle_watch_path (const char *path);
+static void watch_search_path (void);
 
 static void set_wallpaper_for_current_desktop (void);
+static void fade_wallpaper_for_current_desktop (void);
+static void prefetch_wallpaper_for_current_desktop (time_t when);
 
 static int do_reload_flag = 0;
 static int do_next_flag = 0;
 static int do_shutdown_flag = 0;
+static int next_prefetched = 0;
+/** Desktop shown, used to record desktop switches. */
+static int current_desktop = -1;
+static int watch_root_changed = 0;
+static int watch_changed = 0;
 
 struct options *OPTIONS = 0;
 struct config *CONFIG = 0;
@@ -91,9 +109,11 @@ parse_options (int argc, char **argv, struct options *options)
     options->image = NULL;
     options->mode = MODE_UNKNOWN;
     options->workspace = "default";
+    options->prewarm = 0;
+    options->program = argv[0];
 
     int opt;
-    while ((opt = getopt (argc, argv, "fhi:m:sw:")) != -1) {
+    while ((opt = getopt (argc, argv, "fhi:m:psw:")) != -1) {
         switch (opt) {
 
         case 'f':
@@ -105,6 +125,9 @@ parse_options (int argc, char **argv, struct options *options)
         case 'm':
             options->mode = cfg_get_mode_from_str (optarg);
             break;
+        case 'p':
+            options->prewarm = 1;
+            break;
         case 's':
             options->stop = 1;
             break;
@@ -126,12 +149,14 @@ parse_options (int argc, char **argv, struct options *options)
 void
 usage (const char *name)
 {
-    fprintf (stderr, "usage: %s [-fhimsw]\n", name);
+    fprintf (stderr, "usage: %s [-fhimpsw]\n", name);
     fprintf (stderr, "\n");
     fprintf (stderr, "  -f foreground    do not go into background\n");
     fprintf (stderr, "  -h help          print help information\n");
     fprintf (stderr, "  -i image         set image for workspace\n");
     fprintf (stderr, "  -m mode          set image mode for workspace\n");
+    fprintf (stderr, "  -p prewarm       render pre-warm jobs read from stdin,"
+             " used internally\n");
     fprintf (stderr, "  -s stop          stop running daemon\n");
     fprintf (stderr, "  -w workspace     workspace image applies on, defaults"
              " to default\n");
@@ -155,7 +180,9 @@ main (int argc, char **argv)
         usage (argv[0]);
     }
 
-    if (OPTIONS->stop) {
+    if (OPTIONS->prewarm) {
+        prewarm_child_main ();
+    } else if (OPTIONS->stop) {
         do_stop (1);
     } else {
         do_start ();
@@ -208,6 +235,8 @@ do_start (void)
         signal (SIGINT, &sighandler_hup_int_usr1);
         signal (SIGHUP, &sighandler_hup_int_usr1);
         signal (SIGUSR1, &sighandler_hup_int_usr1);
+        /* Write errors to an exited pre-warm process are handled. */
+        signal (SIGPIPE, SIG_IGN);
 
         /* Go into background */
         if (! OPTIONS->foreground) {
@@ -215,10 +244,20 @@ do_start (void)
         }
 
         x11_init_event_listeners ();
+        watch_search_path ();
+        pressure_init ();
+        start_predictor ();
+        wallpaper_layout_changed ();
 
         set_wallpaper_for_current_desktop ();
+        fade_wallpaper_for_current_desktop ();
+        prewarm_start (CONFIG->bg_select_mode);
         main_loop ();
 
+        prewarm_stop ();
+        predict_free ();
+        pressure_free ();
+        watch_free ();
         wallpaper_cache_clear (0);
         x11_close_display ();
 
@@ -280,12 +319,17 @@ do_reload (void)
         /* Configuration successfully loaded, replace current configuration
            and reset the background image. */
         if (CONFIG) {
-            wallpaper_cache_clear(1);
+            wallpaper_cache_clear(0);
             cfg_free (CONFIG);
         }
         CONFIG = config;
+        wallpaper_match_reset ();
 
+        watch_search_path ();
         set_wallpaper_for_current_desktop ();
+        fade_wallpaper_for_current_desktop ();
+        prewarm_start (CONFIG->bg_select_mode);
+        next_prefetched = 0;
     } else {
         fprintf (stderr, "reload of configuration from %s, keeping current.\n",
                  cfg_path);
@@ -358,9 +402,28 @@ main_loop (void)
     main_loop_set_interval (&next_interval);
 
     XEvent ev;
-    int ev_status, ev_xrandr;
+    int ev_status;
     while (! do_shutdown_flag) {
-        ev_status = x11_next_event (&ev, get_next_event_wait (next_interval));
+        struct pollfd fds[4];
+        fds[0].fd = prewarm_get_fd ();
+        fds[0].events = POLLIN;
+        fds[1].fd = watch_get_fd ();
+        fds[1].events = POLLIN;
+        fds[2].fd = pressure_get_fd ();
+        fds[2].events = POLLPRI;
+        fds[3].fd = wallpaper_get_fd ();
+        fds[3].events = POLLIN;
+
+        int wait = get_next_event_wait (next_interval);
+        int fade_wait = wallpaper_fade_get_wait ();
+        if (fade_wait != -1 && (wait == -1 || fade_wait < wait)) {
+            wait = fade_wait;
+        }
+        ev_status = x11_next_event (&ev, wait, fds, 4);
+
+        if (fds[2].revents) {
+            handle_pressure_event ();
+        }
 
         if (do_reload_flag) {
             do_reload ();
@@ -375,26 +438,43 @@ main_loop (void)
         if (ev_status) {
             if (ev.type == PropertyNotify) {
                 handle_property_event (&ev);
-            } else if (ev.type == ConfigureNotify
-                       && ev.xconfigurerequest.window == x11_get_root_window ()) {
-                handle_xrandr_event (&ev, ConfigureNotify);
-            } else if ((ev_xrandr = x11_is_xrandr_event (&ev)) != 0) {
-                handle_xrandr_event (&ev, ev_xrandr);
+            } else if (x11_is_screen_event (&ev)) {
+                handle_xrandr_event ();
             }
         }
+
+        if (fds[3].revents) {
+            wallpaper_process ();
+        }
+
+        if (fds[1].revents) {
+            handle_watch_events ();
+        }
+
+        /* Pre-warm renders are loaded one at a time after handling
+           events to never delay a desktop switch. */
+        if (fds[0].revents) {
+            prewarm_process ();
+        }
+
+        if (wallpaper_fade_get_wait () == 0) {
+            wallpaper_fade_frame ();
+        }
     }
 }
 
 /**
- * Get number of seconds to wait for next event, -1 if bg_select_mode
- * does not change at timed intervals.
+ * Get number of milliseconds to wait for next event, -1 if
+ * bg_select_mode does not change at timed intervals.
  */
 int
 get_next_event_wait (time_t next_interval)
 {
     if (IS_CONFIG_TIMED_MODE()) {
-        time_t next = next_interval - time (0);
-        return next > 0 ? next : 1;
+        time_t next = next_prefetched
+            ? next_interval : main_loop_get_prefetch_time (next_interval);
+        int64_t wait = (int64_t) next * 1000 - time_ms ();
+        return wait > MIN_EVENT_WAIT ? wait : MIN_EVENT_WAIT;
     } else {
         return -1;
     }
@@ -407,21 +487,54 @@ main_loop_set_interval (time_t *next_interval)
     if (CONFIG->bg_select_mode == MODE_RANDOM) {
         *next_interval = time (0) + CONFIG->bg_interval;
     } else if (CONFIG->bg_select_mode == MODE_SET) {
-        *next_interval += CONFIG->bg_set->duration;
+        /* duration is the time left of the current background from now,
+           adding it to a passed deadline would leave it in the past. */
+        *next_interval = time (0) + CONFIG->bg_set->duration;
     }
 }
 
 /**
  * Check if background change interval has been reached, if so set a
  * new background and update next_interval.
+ *
+ * The next background is prefetched ahead of the interval so it is
+ * ready to be set once the interval is reached.
  */
 void
 main_loop_check_change_interval (time_t *next_interval)
 {
-    if (IS_CONFIG_TIMED_MODE() && (time (0) > *next_interval)) {
+    if (! IS_CONFIG_TIMED_MODE()) {
+        return;
+    }
+
+    time_t now = time (0);
+    if (now >= *next_interval) {
+        prewarm_finish ();
         set_wallpaper_for_current_desktop ();
+        fade_wallpaper_for_current_desktop ();
         main_loop_set_interval (next_interval);
+        next_prefetched = 0;
+    } else if (! next_prefetched
+               && now >= main_loop_get_prefetch_time (*next_interval)) {
+        prefetch_wallpaper_for_current_desktop (*next_interval);
+        next_prefetched = 1;
+    }
+}
+
+/**
+ * Get time to start prefetching the background for next_interval,
+ * twice the measured render time for all heads ahead with a minimum
+ * of one second. Defaults to 10 seconds until a render is measured.
+ */
+time_t
+main_loop_get_prefetch_time (time_t next_interval)
+{
+    long render_time = wallpaper_get_render_time ();
+    long lead = 10;
+    if (render_time > 0) {
+        lead = (render_time * x11_get_num_heads () * 2) / 1000 + 1;
     }
+    return next_interval - lead;
 }
 
 /**
@@ -434,8 +547,15 @@ handle_property_event (XEvent *ev)
         return;
     }
 
-    int do_update = 0;
+    int do_update = 0, is_switch = 0;
     if (ev->xproperty.atom == ATOM_DESKTOP) {
+        int desktop =
+            x11_get_atom_value_long (x11_get_root_window (), ATOM_DESKTOP);
+        if (CONFIG->cache_predict && desktop != current_desktop) {
+            predict_switch (current_desktop, desktop);
+            is_switch = 1;
+        }
+        current_desktop = desktop;
         do_update = 1;
     } else if (ev->xproperty.atom == ATOM_DESKTOP_NAMES) {
         x11_get_desktop_names (1);
@@ -445,31 +565,132 @@ handle_property_event (XEvent *ev)
     if (do_update && CONFIG->bg_select_mode != MODE_RANDOM && CONFIG->bg_select_mode != MODE_STATIC) {
         set_wallpaper_for_current_desktop ();
     }
+
+    /* Speculatively render the desktops most likely switched to next. */
+    if (is_switch && (CONFIG->bg_select_mode == MODE_NUMBER
+                      || CONFIG->bg_select_mode == MODE_NAME)) {
+        prewarm_start (CONFIG->bg_select_mode);
+    }
+}
+
+/**
+ * Start desktop switch predictor, loading the saved model.
+ */
+void
+start_predictor (void)
+{
+    current_desktop =
+        x11_get_atom_value_long (x11_get_root_window (), ATOM_DESKTOP);
+
+    char *path = CONFIG->cache_predict_save ? predict_get_path () : NULL;
+    predict_init (path);
+    mem_free (path);
+}
+
+/**
+ * Handle screen configuration events, re-sets the background image for
+ * the new head layout. Cached head renders are kept as they are keyed
+ * on head size.
+ */
+void
+handle_xrandr_event (void)
+{
+    if (wallpaper_layout_changed ()) {
+        set_wallpaper_for_current_desktop ();
+        prewarm_start (CONFIG->bg_select_mode);
+    }
+}
+
+/**
+ * Handle changed files in watched directories, re-rendering the
+ * current background if it was rendered from a changed file.
+ */
+void
+handle_watch_events (void)
+{
+    watch_root_changed = watch_changed = 0;
+    watch_process (&handle_watch_path);
+
+    if (watch_root_changed) {
+        wallpaper_refresh ();
+    } else if (watch_changed
+               && (CONFIG->bg_select_mode == MODE_NUMBER
+                   || CONFIG->bg_select_mode == MODE_NAME
+                   || CONFIG->bg_select_mode == MODE_STATIC)) {
+        /* New files may change what matches the current desktop. */
+        set_wallpaper_for_current_desktop ();
+    }
+}
+
+/**
+ * Shrink caches on memory pressure, an event is at least low pressure
+ * even if the averages have not caught up yet.
+ */
+void
+handle_pressure_event (void)
+{
+    enum pressure_level level = pressure_read ();
+    if (level == PRESSURE_NONE) {
+        level = PRESSURE_LOW;
+    }
+
+    size_t bytes = wallpaper_shrink (level);
+    fprintf (stderr, "memory pressure %s, released %lu bytes\n",
+             pressure_level_name (level), (unsigned long) bytes);
 }
 
 /**
- * Handle xrandr events, this invalidates the cache and re-sets the
- * background image.
+ * Invalidate cached renders of changed file.
  */
 void
-handle_xrandr_event (XEvent *ev, int ev_xrandr)
+handle_watch_path (const char *path)
 {
-#ifdef HAVE_XRANDR
-    if (ev_xrandr == RRNotify) {
-        XRRNotifyEvent *ev_notify = (XRRNotifyEvent*) ev;
-        if (ev_notify->subtype == RRNotify_OutputChange) {
-        } else if (ev_notify->subtype == RRNotify_CrtcChange) {
-        } else if (ev_notify->subtype == RRNotify_OutputProperty) {
+    if (is_image_file_ext (path)) {
+        watch_changed = 1;
+        if (wallpaper_invalidate (path)) {
+            watch_root_changed = 1;
         }
-    } else if (ev_xrandr == RRScreenChangeNotify) {
-        XRRUpdateConfiguration (ev);
-    } else if (ev_xrandr == ConfigureNotify) {
-        XRRUpdateConfiguration (ev);
     }
-#endif /* HAVE_XRANDR */
+}
+
+/**
+ * (Re)start watching the image search path.
+ */
+void
+watch_search_path (void)
+{
+    watch_init ();
 
-    wallpaper_cache_clear (0);
-    set_wallpaper_for_current_desktop ();
+    char **search_path = cfg_get_search_path (CONFIG);
+    for (int i = 0; search_path[i] != 0; i++) {
+        watch_add_dir (search_path[i]);
+    }
+}
+
+/**
+ * Render background image for current desktop as it will be at time
+ * when. If a background set transition is in progress at when, the
+ * background transitioned to is rendered as the cross-fade starting
+ * then needs it.
+ */
+void
+prefetch_wallpaper_for_current_desktop (time_t when)
+{
+    if (CONFIG->bg_select_mode == MODE_SET && CONFIG->bg_set) {
+        struct background *to;
+        time_t start;
+        struct background *from =
+            background_set_get_transition (CONFIG->bg_set, when, &to, &start);
+        if (from != NULL) {
+            when = start + from->transition;
+        }
+    }
+
+    int ws = x11_get_atom_value_long (x11_get_root_window (), ATOM_DESKTOP);
+
+    struct wallpaper_filter filter =
+        { CONFIG->bg_select_mode, ws, x11_get_desktop_name (ws), -1, when };
+    prewarm_prefetch (&filter);
 }
 
 /**
@@ -481,6 +702,33 @@ set_wallpaper_for_current_desktop (void)
     int ws = x11_get_atom_value_long (x11_get_root_window (), ATOM_DESKTOP);
 
     struct wallpaper_filter filter =
-        { CONFIG->bg_select_mode, ws, x11_get_desktop_name (ws), -1 };
+        { CONFIG->bg_select_mode, ws, x11_get_desktop_name (ws), -1, 0 };
     wallpaper_set(&filter);
 }
+
+/**
+ * Start cross-fade to the next background of the background set if a
+ * transition is in progress.
+ */
+void
+fade_wallpaper_for_current_desktop (void)
+{
+    if (CONFIG->bg_select_mode != MODE_SET || ! CONFIG->bg_set) {
+        return;
+    }
+
+    struct background *to;
+    time_t start;
+    struct background *from =
+        background_set_get_transition (CONFIG->bg_set, time (0), &to, &start);
+    if (from == NULL) {
+        return;
+    }
+
+    int ws = x11_get_atom_value_long (x11_get_root_window (), ATOM_DESKTOP);
+    struct wallpaper_filter filter =
+        { CONFIG->bg_select_mode, ws, x11_get_desktop_name (ws), -1,
+          start + from->transition };
+    wallpaper_fade_start (&filter, (int64_t) start * 1000,
+                          from->transition * 1000L);
+}
@@ -0,0 +1,159 @@
+/*
+ * pixmap_pool.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#include "config.h"
+
+#include "pixmap_pool.h"
+#include "util.h"
+#include "x11.h"
+
+static struct pixmap_pool_node *pixmap_pool_unlink (
+        struct pixmap_pool_node **list, Pixmap pixmap,
+        int width, int height, int depth);
+static void pixmap_pool_free_list (struct pixmap_pool_node *node);
+
+/**
+ * Create new pool keeping at most max_bytes of idle pixmaps.
+ */
+struct pixmap_pool*
+pixmap_pool_new (size_t max_bytes)
+{
+    struct pixmap_pool *pool = mem_new (sizeof (struct pixmap_pool));
+    pool->max_bytes = max_bytes;
+    pool->bytes = 0;
+    pool->hits = 0;
+    pool->misses = 0;
+    pool->used = 0;
+    pool->idle = 0;
+    return pool;
+}
+
+/**
+ * Free pool and the idle pixmaps, pixmaps in use are left to their
+ * users and freed as any other pixmap when returned.
+ */
+void
+pixmap_pool_free (struct pixmap_pool *pool)
+{
+    pixmap_pool_free_list (pool->idle);
+    struct pixmap_pool_node *it = pool->used, *it_next;
+    for (; it; it = it_next) {
+        it_next = it->next;
+        mem_free (it);
+    }
+    mem_free (pool);
+}
+
+/**
+ * Get width x height pixmap at root window depth, reusing an idle
+ * pixmap if available. The content of the pixmap is undefined.
+ */
+Pixmap
+pixmap_pool_get (struct pixmap_pool *pool, int width, int height)
+{
+    int depth = x11_get_depth ();
+    struct pixmap_pool_node *node =
+        pixmap_pool_unlink (&pool->idle, None, width, height, depth);
+    if (node) {
+        pool->bytes -= node->bytes;
+        pool->hits++;
+    } else {
+        node = mem_new (sizeof (struct pixmap_pool_node));
+        node->pixmap = x11_create_pixmap (width, height);
+        node->width = width;
+        node->height = height;
+        node->depth = depth;
+        node->bytes = x11_get_pixmap_size (width, height);
+        pool->misses++;
+    }
+
+    node->next = pool->used;
+    pool->used = node;
+    return node->pixmap;
+}
+
+/**
+ * Return pixmap to the pool, the least recently returned idle pixmaps
+ * are freed to stay within the budget. Pixmaps not created by the
+ * pool are freed, None is ignored.
+ */
+void
+pixmap_pool_put (struct pixmap_pool *pool, Pixmap pixmap)
+{
+    if (pixmap == None) {
+        return;
+    }
+
+    struct pixmap_pool_node *node =
+        pixmap_pool_unlink (&pool->used, pixmap, 0, 0, 0);
+    if (node == NULL || node->bytes > pool->max_bytes) {
+        x11_free_pixmap (pixmap);
+        mem_free (node);
+        return;
+    }
+
+    node->next = pool->idle;
+    pool->idle = node;
+    pool->bytes += node->bytes;
+    pixmap_pool_shrink (pool, pool->max_bytes);
+}
+
+/**
+ * Free the least recently returned idle pixmaps until at most
+ * max_bytes remain, returns the number of bytes freed.
+ */
+size_t
+pixmap_pool_shrink (struct pixmap_pool *pool, size_t max_bytes)
+{
+    size_t bytes = pool->bytes;
+    struct pixmap_pool_node **it = &pool->idle;
+    size_t kept = 0;
+    for (; *it && kept + (*it)->bytes <= max_bytes; it = &(*it)->next) {
+        kept += (*it)->bytes;
+    }
+    pixmap_pool_free_list (*it);
+    *it = 0;
+    pool->bytes = kept;
+    return bytes - kept;
+}
+
+/**
+ * Remove and return node of pixmap from list or, if pixmap is None,
+ * the first node of width x height at depth. Returns NULL if there is
+ * no such node.
+ */
+struct pixmap_pool_node*
+pixmap_pool_unlink (struct pixmap_pool_node **list, Pixmap pixmap,
+                    int width, int height, int depth)
+{
+    for (struct pixmap_pool_node **it = list; *it; it = &(*it)->next) {
+        struct pixmap_pool_node *node = *it;
+        if (pixmap != None
+            ? node->pixmap == pixmap
+            : (node->width == width && node->height == height
+               && node->depth == depth)) {
+            *it = node->next;
+            node->next = 0;
+            return node;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Free pixmaps and nodes of list.
+ */
+void
+pixmap_pool_free_list (struct pixmap_pool_node *node)
+{
+    for (struct pixmap_pool_node *it = node, *it_next; it; it = it_next) {
+        it_next = it->next;
+        x11_free_pixmap (it->pixmap);
+        mem_free (it);
+    }
+}
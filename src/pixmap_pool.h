@@ -0,0 +1,55 @@
+/*
+ * pixmap_pool.h for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#ifndef _PIXMAP_POOL_H_
+#define _PIXMAP_POOL_H_
+
+#include "config.h"
+
+#include <stddef.h>
+#include <X11/Xlib.h>
+
+/**
+ * Server pixmap created by the pool, either in use or idle.
+ */
+struct pixmap_pool_node {
+    Pixmap pixmap;
+    int width;
+    int height;
+    int depth;
+    size_t bytes;
+
+    struct pixmap_pool_node *next;
+};
+
+/**
+ * Pool of server pixmaps, pixmaps returned to the pool are kept idle
+ * and handed out again for the same width, height and depth instead
+ * of creating a new pixmap. Idle pixmaps are limited by max_bytes and
+ * the most recently returned is first.
+ */
+struct pixmap_pool {
+    size_t max_bytes; /**< Idle pixmap byte budget, 0 disables reuse. */
+    size_t bytes; /**< Bytes of idle pixmaps. */
+    unsigned int hits;
+    unsigned int misses;
+
+    struct pixmap_pool_node *used;
+    struct pixmap_pool_node *idle;
+};
+
+extern struct pixmap_pool *pixmap_pool_new (size_t max_bytes);
+extern void pixmap_pool_free (struct pixmap_pool *pool);
+
+extern Pixmap pixmap_pool_get (struct pixmap_pool *pool,
+                               int width, int height);
+extern void pixmap_pool_put (struct pixmap_pool *pool, Pixmap pixmap);
+extern size_t pixmap_pool_shrink (struct pixmap_pool *pool,
+                                  size_t max_bytes);
+
+#endif /* _PIXMAP_POOL_H_ */
@@ -0,0 +1,225 @@
+/*
+ * pool.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#include "config.h"
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "util.h"
+
+static void *pool_worker (void *arg);
+
+/**
+ * Get number of online CPUs, at least 1.
+ */
+unsigned int
+pool_get_num_cpus (void)
+{
+    long num = sysconf (_SC_NPROCESSORS_ONLN);
+    return num > 0 ? num : 1;
+}
+
+/**
+ * Create new pool with num_threads workers, 0 for one per online CPU.
+ * With a single worker no threads are created and jobs run on the
+ * submitting thread.
+ */
+struct pool*
+pool_new (unsigned int num_threads)
+{
+    struct pool *pool = mem_new (sizeof (struct pool));
+    pthread_mutex_init (&pool->lock, NULL);
+    pthread_cond_init (&pool->job_cond, NULL);
+    pthread_cond_init (&pool->done_cond, NULL);
+    pool->first = 0;
+    pool->last = 0;
+    pool->pending = 0;
+    pool->stop = 0;
+
+    if (num_threads == 0) {
+        num_threads = pool_get_num_cpus ();
+    }
+    pool->threads = 0;
+    pool->num_threads = 0;
+    if (num_threads < 2) {
+        return pool;
+    }
+
+    pool->threads = mem_new (sizeof (pthread_t) * num_threads);
+    for (unsigned int i = 0; i < num_threads; i++) {
+        int err = pthread_create (&pool->threads[i], NULL, pool_worker, pool);
+        if (err) {
+            fprintf (stderr, "failed to create render thread: %s\n",
+                     strerror (err));
+            break;
+        }
+        pool->num_threads++;
+    }
+    return pool;
+}
+
+/**
+ * Wait for all jobs to complete, stop and free the pool.
+ */
+void
+pool_free (struct pool *pool)
+{
+    pool_wait (pool);
+
+    pthread_mutex_lock (&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast (&pool->job_cond);
+    pthread_mutex_unlock (&pool->lock);
+    for (unsigned int i = 0; i < pool->num_threads; i++) {
+        pthread_join (pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy (&pool->done_cond);
+    pthread_cond_destroy (&pool->job_cond);
+    pthread_mutex_destroy (&pool->lock);
+    mem_free (pool->threads);
+    mem_free (pool);
+}
+
+/**
+ * Queue fn to be run with arg by the next idle worker as part of
+ * group, or NULL.
+ */
+void
+pool_submit (struct pool *pool, struct pool_group *group, pool_fn fn,
+             void *arg)
+{
+    if (pool->num_threads == 0) {
+        fn (arg);
+        return;
+    }
+
+    struct pool_job *job = mem_new (sizeof (struct pool_job));
+    job->fn = fn;
+    job->arg = arg;
+    job->group = group;
+    job->next = 0;
+
+    pthread_mutex_lock (&pool->lock);
+    if (group) {
+        group->pending++;
+    }
+    if (pool->last) {
+        pool->last->next = job;
+    } else {
+        pool->first = job;
+    }
+    pool->last = job;
+    pool->pending++;
+    pthread_cond_signal (&pool->job_cond);
+    pthread_mutex_unlock (&pool->lock);
+}
+
+/**
+ * Wait for all submitted jobs to complete.
+ */
+void
+pool_wait (struct pool *pool)
+{
+    pthread_mutex_lock (&pool->lock);
+    while (pool->pending) {
+        pthread_cond_wait (&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock (&pool->lock);
+}
+
+/**
+ * Wait for all submitted jobs of group to complete.
+ */
+void
+pool_wait_group (struct pool *pool, struct pool_group *group)
+{
+    pthread_mutex_lock (&pool->lock);
+    while (group->pending) {
+        pthread_cond_wait (&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock (&pool->lock);
+}
+
+/**
+ * Remove jobs of group not yet started from the queue, running jobs
+ * are left to complete. Returns the number of jobs removed.
+ */
+unsigned int
+pool_cancel_group (struct pool *pool, struct pool_group *group)
+{
+    unsigned int num = 0;
+    pthread_mutex_lock (&pool->lock);
+    struct pool_job **it = &pool->first, *last = 0;
+    while (*it) {
+        struct pool_job *job = *it;
+        if (job->group == group) {
+            *it = job->next;
+            mem_free (job);
+            num++;
+        } else {
+            last = job;
+            it = &job->next;
+        }
+    }
+    pool->last = last;
+    pool->pending -= num;
+    group->pending -= num;
+    if (num && (! pool->pending || ! group->pending)) {
+        pthread_cond_broadcast (&pool->done_cond);
+    }
+    pthread_mutex_unlock (&pool->lock);
+    return num;
+}
+
+/**
+ * Worker thread, runs queued jobs until the pool is stopped.
+ */
+void*
+pool_worker (void *arg)
+{
+    struct pool *pool = arg;
+
+    pthread_mutex_lock (&pool->lock);
+    for (;;) {
+        while (! pool->first && ! pool->stop) {
+            pthread_cond_wait (&pool->job_cond, &pool->lock);
+        }
+        if (! pool->first) {
+            break;
+        }
+
+        struct pool_job *job = pool->first;
+        pool->first = job->next;
+        if (! pool->first) {
+            pool->last = 0;
+        }
+        pthread_mutex_unlock (&pool->lock);
+
+        struct pool_group *group = job->group;
+        job->fn (job->arg);
+        mem_free (job);
+
+        pthread_mutex_lock (&pool->lock);
+        int done = --pool->pending == 0;
+        if (group && --group->pending == 0) {
+            done = 1;
+        }
+        if (done) {
+            pthread_cond_broadcast (&pool->done_cond);
+        }
+    }
+    pthread_mutex_unlock (&pool->lock);
+
+    return NULL;
+}
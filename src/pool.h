@@ -0,0 +1,71 @@
+/*
+ * pool.h for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include "config.h"
+
+#include <pthread.h>
+
+/**
+ * Function run by a worker, arg is owned by the submitter.
+ */
+typedef void (*pool_fn) (void *arg);
+
+/**
+ * Jobs waited for or cancelled together, zero initialized before the
+ * first job is submitted.
+ */
+struct pool_group {
+    unsigned int pending; /**< Queued and running jobs of the group. */
+};
+
+/**
+ * Queued job.
+ */
+struct pool_job {
+    pool_fn fn;
+    void *arg;
+    struct pool_group *group; /**< Group of the job, or NULL. */
+
+    struct pool_job *next;
+};
+
+/**
+ * Fixed size pool of worker threads running jobs in submit order. A
+ * pool without threads runs jobs on the submitting thread.
+ */
+struct pool {
+    pthread_t *threads;
+    unsigned int num_threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t job_cond; /**< Signaled when a job is queued or on stop. */
+    pthread_cond_t done_cond; /**< Signaled when pending, or the pending
+                                   jobs of a group, reaches 0. */
+
+    struct pool_job *first;
+    struct pool_job *last;
+    unsigned int pending; /**< Queued and running jobs. */
+    int stop;
+};
+
+extern unsigned int pool_get_num_cpus (void);
+
+extern struct pool *pool_new (unsigned int num_threads);
+extern void pool_free (struct pool *pool);
+
+extern void pool_submit (struct pool *pool, struct pool_group *group,
+                         pool_fn fn, void *arg);
+extern void pool_wait (struct pool *pool);
+extern void pool_wait_group (struct pool *pool, struct pool_group *group);
+extern unsigned int pool_cancel_group (struct pool *pool,
+                                       struct pool_group *group);
+
+#endif /* _POOL_H_ */
@@ -0,0 +1,301 @@
+/*
+ * predict.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#include "config.h"
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "disk_cache.h"
+#include "predict.h"
+#include "util.h"
+
+/*
+ * First order Markov model of desktop switches, counts of switches
+ * between each pair of desktops. Rows are halved once their total
+ * grows large so the model follows changes in habits.
+ *
+ * Predictions are scored against what a plain LRU would have kept,
+ * the PREDICT_TOP most recently visited desktops.
+ */
+
+#define PREDICT_MAGIC "wallpaperd-predict 1"
+/** Row total where counts are halved. */
+#define PREDICT_ROW_MAX 1024
+/** Switches between hit rate reports. */
+#define PREDICT_REPORT_INTERVAL 100
+
+static unsigned int COUNTS[PREDICT_MAX_DESKTOPS][PREDICT_MAX_DESKTOPS];
+/** Desktops in most recently visited order, -1 for unused. */
+static int RECENT[PREDICT_MAX_DESKTOPS];
+static char *PATH = 0;
+
+static unsigned long SWITCHES = 0;
+static unsigned long HITS = 0;
+static unsigned long LRU_HITS = 0;
+
+static void predict_load (void);
+static void predict_save (void);
+static int predict_is_valid (int desktop);
+static int predict_lru_next (int from, int *desktops, int max);
+static void predict_touch (int desktop);
+static int predict_contains (int *desktops, int num, int desktop);
+
+/**
+ * Initialize predictor, loading the model from path if set. The model
+ * is saved to path when freed.
+ */
+void
+predict_init (const char *path)
+{
+    memset (COUNTS, 0, sizeof (COUNTS));
+    for (int i = 0; i < PREDICT_MAX_DESKTOPS; i++) {
+        RECENT[i] = -1;
+    }
+    SWITCHES = HITS = LRU_HITS = 0;
+
+    mem_free (PATH);
+    PATH = path ? str_dup (path) : 0;
+    if (PATH) {
+        predict_load ();
+    }
+}
+
+/**
+ * Report hit rate and save the model.
+ */
+void
+predict_free (void)
+{
+    predict_report ();
+    if (PATH) {
+        predict_save ();
+        mem_free (PATH);
+        PATH = 0;
+    }
+}
+
+/**
+ * Get default path of the saved model, in the cache directory.
+ */
+char*
+predict_get_path (void)
+{
+    char *dir = disk_cache_get_dir ();
+    char *path;
+    if (asprintf (&path, "%s/transitions", dir) == -1) {
+        die ("failed to construct predictor path, aborting");
+    }
+    mem_free (dir);
+    return path;
+}
+
+/**
+ * Record switch between desktops, scoring the previous prediction.
+ */
+void
+predict_switch (int from, int to)
+{
+    if (! predict_is_valid (from) || ! predict_is_valid (to) || from == to) {
+        return;
+    }
+
+    int predicted[PREDICT_TOP], lru[PREDICT_TOP];
+    int num = predict_next (from, predicted, PREDICT_TOP);
+    int num_lru = predict_lru_next (from, lru, PREDICT_TOP);
+    SWITCHES++;
+    HITS += predict_contains (predicted, num, to);
+    LRU_HITS += predict_contains (lru, num_lru, to);
+
+    unsigned int *row = COUNTS[from];
+    if (++row[to] > PREDICT_ROW_MAX / 2) {
+        unsigned int total = 0;
+        for (int i = 0; i < PREDICT_MAX_DESKTOPS; i++) {
+            total += row[i];
+        }
+        if (total > PREDICT_ROW_MAX) {
+            for (int i = 0; i < PREDICT_MAX_DESKTOPS; i++) {
+                row[i] /= 2;
+            }
+        }
+    }
+
+    predict_touch (from);
+    predict_touch (to);
+
+    if (SWITCHES % PREDICT_REPORT_INTERVAL == 0) {
+        predict_report ();
+    }
+}
+
+/**
+ * Get up to max most likely desktops to switch to from desktop, most
+ * likely first. Returns number of desktops set.
+ */
+int
+predict_next (int from, int *desktops, int max)
+{
+    if (! predict_is_valid (from)) {
+        return 0;
+    }
+
+    int num = 0;
+    for (; num < max; num++) {
+        int best = -1;
+        for (int i = 0; i < PREDICT_MAX_DESKTOPS; i++) {
+            if (COUNTS[from][i] > 0
+                && ! predict_contains (desktops, num, i)
+                && (best == -1 || COUNTS[from][i] > COUNTS[from][best])) {
+                best = i;
+            }
+        }
+        if (best == -1) {
+            break;
+        }
+        desktops[num] = best;
+    }
+    return num;
+}
+
+/**
+ * Print predictor hit rate compared to LRU.
+ */
+void
+predict_report (void)
+{
+    if (SWITCHES == 0) {
+        return;
+    }
+    fprintf (stderr, "desktop predictor hit rate %lu%%, LRU %lu%%, "
+             "%lu switches\n",
+             HITS * 100 / SWITCHES, LRU_HITS * 100 / SWITCHES, SWITCHES);
+}
+
+/**
+ * Load model from PATH, a missing or invalid file leaves it empty.
+ */
+void
+predict_load (void)
+{
+    FILE *fp = fopen (PATH, "r");
+    if (fp == 0) {
+        return;
+    }
+
+    char magic[64];
+    if (fgets (magic, sizeof (magic), fp) == 0
+        || strncmp (magic, PREDICT_MAGIC, strlen (PREDICT_MAGIC)) != 0) {
+        fprintf (stderr, "ignoring invalid predictor model %s\n", PATH);
+        fclose (fp);
+        return;
+    }
+
+    int from, to;
+    unsigned int count;
+    while (fscanf (fp, "%d %d %u", &from, &to, &count) == 3) {
+        if (predict_is_valid (from) && predict_is_valid (to)) {
+            COUNTS[from][to] = count;
+        }
+    }
+    fclose (fp);
+}
+
+/**
+ * Save model to PATH, written to a temporary file renamed in place.
+ */
+void
+predict_save (void)
+{
+    char *tmp_path;
+    if (asprintf (&tmp_path, "%s.tmp", PATH) == -1) {
+        return;
+    }
+
+    FILE *fp = fopen (tmp_path, "w");
+    if (fp == 0) {
+        perror ("failed to save predictor model");
+        mem_free (tmp_path);
+        return;
+    }
+
+    fprintf (fp, "%s\n", PREDICT_MAGIC);
+    for (int from = 0; from < PREDICT_MAX_DESKTOPS; from++) {
+        for (int to = 0; to < PREDICT_MAX_DESKTOPS; to++) {
+            if (COUNTS[from][to] > 0) {
+                fprintf (fp, "%d %d %u\n", from, to, COUNTS[from][to]);
+            }
+        }
+    }
+
+    if (fclose (fp) || rename (tmp_path, PATH)) {
+        perror ("failed to save predictor model");
+        unlink (tmp_path);
+    }
+    mem_free (tmp_path);
+}
+
+/**
+ * Check if desktop is tracked by the predictor.
+ */
+int
+predict_is_valid (int desktop)
+{
+    return desktop >= 0 && desktop < PREDICT_MAX_DESKTOPS;
+}
+
+/**
+ * Get up to max most recently visited desktops other than from.
+ */
+int
+predict_lru_next (int from, int *desktops, int max)
+{
+    int num = 0;
+    for (int i = 0; i < PREDICT_MAX_DESKTOPS && num < max; i++) {
+        if (RECENT[i] == -1) {
+            break;
+        }
+        if (RECENT[i] != from) {
+            desktops[num++] = RECENT[i];
+        }
+    }
+    return num;
+}
+
+/**
+ * Mark desktop as the most recently visited.
+ */
+void
+predict_touch (int desktop)
+{
+    int i = 0;
+    for (; i < PREDICT_MAX_DESKTOPS - 1; i++) {
+        if (RECENT[i] == desktop || RECENT[i] == -1) {
+            break;
+        }
+    }
+    memmove (RECENT + 1, RECENT, sizeof (int) * i);
+    RECENT[0] = desktop;
+}
+
+/**
+ * Check if desktop is among the num first desktops.
+ */
+int
+predict_contains (int *desktops, int num, int desktop)
+{
+    for (int i = 0; i < num; i++) {
+        if (desktops[i] == desktop) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,27 @@
+/*
+ * predict.h for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#ifndef _PREDICT_H_
+#define _PREDICT_H_
+
+#include "config.h"
+
+/** Number of desktops tracked by the predictor. */
+#define PREDICT_MAX_DESKTOPS 32
+/** Number of predicted desktops rendered speculatively. */
+#define PREDICT_TOP 2
+
+extern void predict_init (const char *path);
+extern void predict_free (void);
+extern char *predict_get_path (void);
+
+extern void predict_switch (int from, int to);
+extern int predict_next (int from, int *desktops, int max);
+extern void predict_report (void);
+
+#endif /* _PREDICT_H_ */
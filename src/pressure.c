@@ -0,0 +1,254 @@
+/*
+ * pressure.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#include "config.h"
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pressure.h"
+#include "util.h"
+
+/*
+ * Memory pressure is detected with a PSI trigger on
+ * /proc/pressure/memory, falling back to the memory.events file of the
+ * cgroup if PSI is not available. Both signal POLLPRI. The level is
+ * computed from the PSI averages and the usage of the closest cgroup
+ * with a memory.max limit.
+ */
+
+#define PSI_PATH "/proc/pressure/memory"
+/** Trigger on 150ms of stall in a 2s window, the smallest window
+    allowed for unprivileged users. */
+#define PSI_TRIGGER "some 150000 2000000"
+#define CGROUP_ROOT "/sys/fs/cgroup"
+
+static int FD = -1;
+/** Set if FD is memory.events and needs to be read to re-arm. */
+static int FD_IS_EVENTS = 0;
+/** cgroup directory with memory.max set, NULL if unlimited. */
+static char *CGROUP_DIR = 0;
+
+static char *pressure_find_cgroup (void);
+static int pressure_read_file (const char *path, char *buf, size_t size);
+static int pressure_read_psi (double *some, double *full);
+static double pressure_read_cgroup_usage (void);
+
+/**
+ * Open PSI trigger or cgroup memory events, does nothing if neither is
+ * available.
+ */
+void
+pressure_init (void)
+{
+    pressure_free ();
+
+    CGROUP_DIR = pressure_find_cgroup ();
+
+    FD = open (PSI_PATH, O_RDWR|O_NONBLOCK|O_CLOEXEC);
+    if (FD != -1 && write (FD, PSI_TRIGGER, strlen (PSI_TRIGGER) + 1) == -1) {
+        close (FD);
+        FD = -1;
+    }
+
+    if (FD == -1 && CGROUP_DIR) {
+        char path[4096];
+        snprintf (path, sizeof (path), "%s/memory.events", CGROUP_DIR);
+        FD = open (path, O_RDONLY|O_NONBLOCK|O_CLOEXEC);
+        FD_IS_EVENTS = FD != -1;
+    }
+
+    if (FD == -1) {
+        fprintf (stderr, "memory pressure monitoring not available\n");
+    }
+}
+
+/**
+ * Close pressure file descriptor.
+ */
+void
+pressure_free (void)
+{
+    if (FD != -1) {
+        close (FD);
+        FD = -1;
+    }
+    FD_IS_EVENTS = 0;
+    mem_free (CGROUP_DIR);
+    CGROUP_DIR = 0;
+}
+
+/**
+ * Get file descriptor signaling POLLPRI on memory pressure, -1 if not
+ * available.
+ */
+int
+pressure_get_fd (void)
+{
+    return FD;
+}
+
+/**
+ * Read current memory pressure level.
+ */
+enum pressure_level
+pressure_read (void)
+{
+    if (FD_IS_EVENTS) {
+        char buf[512];
+        lseek (FD, 0, SEEK_SET);
+        if (read (FD, buf, sizeof (buf)) == -1) {
+            perror ("failed to read memory.events");
+        }
+    }
+
+    double some = 0.0, full = 0.0;
+    pressure_read_psi (&some, &full);
+    double usage = pressure_read_cgroup_usage ();
+
+    if (full >= 10.0 || usage >= 0.95) {
+        return PRESSURE_CRITICAL;
+    } else if (full >= 1.0 || some >= 20.0 || usage >= 0.90) {
+        return PRESSURE_MEDIUM;
+    } else if (some > 0.0 || usage >= 0.80) {
+        return PRESSURE_LOW;
+    }
+    return PRESSURE_NONE;
+}
+
+/**
+ * Get name of pressure level.
+ */
+const char*
+pressure_level_name (enum pressure_level level)
+{
+    switch (level) {
+    case PRESSURE_LOW:
+        return "low";
+    case PRESSURE_MEDIUM:
+        return "medium";
+    case PRESSURE_CRITICAL:
+        return "critical";
+    case PRESSURE_NONE:
+    default:
+        return "none";
+    }
+}
+
+/**
+ * Find the closest cgroup v2 directory of the process with a memory
+ * limit, returns NULL if there is none.
+ */
+char*
+pressure_find_cgroup (void)
+{
+    char buf[4096];
+    if (! pressure_read_file ("/proc/self/cgroup", buf, sizeof (buf))) {
+        return 0;
+    }
+
+    char *line = buf;
+    if (strncmp (line, "0::", 3) != 0) {
+        line = strstr (buf, "\n0::");
+        if (line == 0) {
+            return 0;
+        }
+        line++;
+    }
+    line += 3;
+    line[strcspn (line, "\n")] = '\0';
+
+    char dir[4096];
+    snprintf (dir, sizeof (dir), "%s%s", CGROUP_ROOT, line);
+    size_t root_len = strlen (CGROUP_ROOT);
+    while (strlen (dir) > root_len) {
+        char path[4096 + 16], max[64];
+        snprintf (path, sizeof (path), "%s/memory.max", dir);
+        if (pressure_read_file (path, max, sizeof (max))
+            && strncmp (max, "max", 3) != 0) {
+            return str_dup (dir);
+        }
+
+        char *slash = strrchr (dir, '/');
+        if (slash == 0) {
+            break;
+        }
+        *slash = '\0';
+    }
+    return 0;
+}
+
+/**
+ * Read file into nul terminated buf, returns 0 on failure.
+ */
+int
+pressure_read_file (const char *path, char *buf, size_t size)
+{
+    int fd = open (path, O_RDONLY|O_CLOEXEC);
+    if (fd == -1) {
+        return 0;
+    }
+    ssize_t len = read (fd, buf, size - 1);
+    close (fd);
+    if (len <= 0) {
+        return 0;
+    }
+    buf[len] = '\0';
+    return 1;
+}
+
+/**
+ * Read 10 second PSI averages, in percent of time stalled.
+ */
+int
+pressure_read_psi (double *some, double *full)
+{
+    char buf[512];
+    if (! pressure_read_file (PSI_PATH, buf, sizeof (buf))) {
+        return 0;
+    }
+
+    const char *line = strstr (buf, "some avg10=");
+    if (line) {
+        *some = strtod (line + strlen ("some avg10="), 0);
+    }
+    line = strstr (buf, "full avg10=");
+    if (line) {
+        *full = strtod (line + strlen ("full avg10="), 0);
+    }
+    return 1;
+}
+
+/**
+ * Read usage of the cgroup memory limit as a fraction, 0 if unknown.
+ */
+double
+pressure_read_cgroup_usage (void)
+{
+    if (CGROUP_DIR == 0) {
+        return 0.0;
+    }
+
+    char path[4096 + 16], buf[64];
+    snprintf (path, sizeof (path), "%s/memory.max", CGROUP_DIR);
+    if (! pressure_read_file (path, buf, sizeof (buf))) {
+        return 0.0;
+    }
+    double max = strtod (buf, 0);
+
+    snprintf (path, sizeof (path), "%s/memory.current", CGROUP_DIR);
+    if (! pressure_read_file (path, buf, sizeof (buf)) || max <= 0.0) {
+        return 0.0;
+    }
+    return strtod (buf, 0) / max;
+}
@@ -0,0 +1,31 @@
+/*
+ * pressure.h for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#ifndef _PRESSURE_H_
+#define _PRESSURE_H_
+
+#include "config.h"
+
+/**
+ * Memory pressure level, higher levels release more of the caches.
+ */
+enum pressure_level {
+    PRESSURE_NONE,
+    PRESSURE_LOW,
+    PRESSURE_MEDIUM,
+    PRESSURE_CRITICAL
+};
+
+extern void pressure_init (void);
+extern void pressure_free (void);
+extern int pressure_get_fd (void);
+
+extern enum pressure_level pressure_read (void);
+extern const char *pressure_level_name (enum pressure_level level);
+
+#endif /* _PRESSURE_H_ */
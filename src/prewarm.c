@@ -0,0 +1,594 @@
+/*
+ * prewarm.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#include "config.h"
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cfg.h"
+#include "pool.h"
+#include "predict.h"
+#include "prewarm.h"
+#include "util.h"
+#include "wallpaper.h"
+#include "x11.h"
+
+/**
+ * Render of spec for a single head on a desktop not currently shown.
+ */
+struct prewarm_job {
+    struct geometry head;
+    struct wallpaper_spec *spec;
+    int evict; /**< Load even if entries have to be evicted. */
+};
+
+/**
+ * Start of the jobs sent to the helper process.
+ */
+struct prewarm_header {
+    int is_prefetch;
+    int num_jobs;
+};
+
+/**
+ * Job sent to the helper process, followed by len bytes of spec.
+ */
+struct prewarm_job_msg {
+    int width;
+    int height;
+    int type;
+    int mode;
+    size_t len;
+};
+
+/**
+ * Completed job report from the child process.
+ */
+struct prewarm_msg {
+    int job;
+    int rendered; /**< Set if not already available on disk. */
+    long ms;
+};
+
+static struct prewarm_job *JOBS = 0;
+static int NUM_JOBS = 0;
+static int IS_PREFETCH = 0;
+static pid_t PID = -1;
+static int FD = -1;
+/** Report pipe of the child process. */
+static int CHILD_FD = -1;
+
+static int prewarm_add_jobs (enum bg_select_mode mode, int desktop,
+                             struct geometry **heads, size_t *bytes,
+                             unsigned int *entries, int evict);
+static int prewarm_is_queued (struct geometry *head,
+                              struct wallpaper_spec *spec);
+static void prewarm_add_job (struct geometry *head,
+                             struct wallpaper_spec *spec, int evict);
+static void prewarm_spawn (void);
+static int prewarm_write_jobs (int fd);
+static int prewarm_read_jobs (int fd);
+static int prewarm_write (int fd, const void *buf, size_t len);
+static int prewarm_read (int fd, void *buf, size_t len);
+static void prewarm_child_job (void *arg);
+static void prewarm_set_idle_priority (void);
+
+/**
+ * Start pre-warming the cache with the wallpapers of all desktops but
+ * the current one. Desktops predicted to be switched to next are
+ * rendered first, even if other entries have to be evicted, followed
+ * by the nearest desktops within the cache budget.
+ *
+ * Decoding and scaling is done in a child process at idle priority
+ * writing to the disk cache, the renders are then loaded into the
+ * cache by prewarm_process as they complete.
+ */
+void
+prewarm_start (enum bg_select_mode mode)
+{
+    prewarm_stop ();
+
+    /* Only desktop dependent modes benefit from pre-warming. */
+    if (! CONFIG->cache_prewarm
+        || (mode != MODE_NUMBER && mode != MODE_NAME)
+        || ! wallpaper_has_disk_cache ()) {
+        return;
+    }
+
+    Window root = x11_get_root_window ();
+    int num = x11_get_atom_value_long (root, ATOM_NUMBER_OF_DESKTOPS);
+    int current = x11_get_atom_value_long (root, ATOM_DESKTOP);
+    if (num < 2) {
+        return;
+    }
+
+    int predicted[PREDICT_TOP];
+    int num_predicted = 0;
+    if (CONFIG->cache_predict) {
+        num_predicted = predict_next (current, predicted, PREDICT_TOP);
+    }
+
+    struct geometry **heads = x11_get_heads ();
+    size_t bytes = 0;
+    unsigned int entries = 0;
+    for (int i = 0; i < num_predicted; i++) {
+        if (predicted[i] < num) {
+            prewarm_add_jobs (mode, predicted[i], heads, &bytes, &entries, 1);
+        }
+    }
+    for (int i = 1; i < num; i++) {
+        if (! prewarm_add_jobs (mode, (current + i) % num, heads,
+                                &bytes, &entries, 0)) {
+            break;
+        }
+    }
+    for (int i = 0; heads[i]; i++) {
+        mem_free (heads[i]);
+    }
+    mem_free (heads);
+
+    prewarm_spawn ();
+}
+
+/**
+ * Render the wallpaper of filter, looking ahead to filter->time, so it
+ * is cached once the time is reached.
+ *
+ * Rendering is done in a child process at normal priority if the disk
+ * cache is in use, else it is done on the render pool.
+ */
+void
+prewarm_prefetch (struct wallpaper_filter *filter)
+{
+    prewarm_stop ();
+
+    struct geometry **heads = x11_get_heads ();
+    int num;
+    for (num = 0; heads[num]; num++)
+        ;
+    struct wallpaper_spec **specs =
+        mem_new (sizeof (struct wallpaper_spec*) * (num + 1));
+    int num_specs = 0;
+    for (int i = 0; i < num; i++) {
+        filter->head = i;
+        specs[i] = wallpaper_match (filter);
+        if (specs[i] == NULL) {
+            continue;
+        }
+
+        if (specs[i]->type != WALLPAPER_TYPE_IMAGE
+            || wallpaper_is_cached (heads[i], specs[i])
+            || prewarm_is_queued (heads[i], specs[i])) {
+            wallpaper_spec_free (specs[i]);
+            specs[i] = NULL;
+        } else if (wallpaper_has_disk_cache ()) {
+            prewarm_add_job (heads[i], specs[i], 1);
+            specs[i] = NULL;
+        } else {
+            num_specs++;
+        }
+    }
+    specs[num] = NULL;
+
+    if (num_specs > 0) {
+        wallpaper_prefetch (heads, specs);
+    }
+    for (int i = 0; i < num; i++) {
+        if (specs[i]) {
+            wallpaper_spec_free (specs[i]);
+        }
+        mem_free (heads[i]);
+    }
+    mem_free (specs);
+    mem_free (heads);
+
+    IS_PREFETCH = 1;
+    prewarm_spawn ();
+}
+
+/**
+ * Wait for all pending prefetch renders to complete, pre-warming of
+ * other desktops is stopped right away.
+ */
+void
+prewarm_finish (void)
+{
+    if (! IS_PREFETCH) {
+        prewarm_stop ();
+    }
+    while (FD != -1) {
+        prewarm_process ();
+    }
+}
+
+/**
+ * Stop pre-warming, terminating the child process if running.
+ */
+void
+prewarm_stop (void)
+{
+    if (PID != -1) {
+        kill (PID, SIGTERM);
+        while (waitpid (PID, 0, 0) == -1 && errno == EINTR)
+            ;
+        PID = -1;
+    }
+    if (FD != -1) {
+        close (FD);
+        FD = -1;
+    }
+
+    for (int i = 0; i < NUM_JOBS; i++) {
+        wallpaper_spec_free (JOBS[i].spec);
+    }
+    mem_free (JOBS);
+    JOBS = 0;
+    NUM_JOBS = 0;
+    IS_PREFETCH = 0;
+}
+
+/**
+ * Get file descriptor readable when a pre-warm render is completed,
+ * -1 if not pre-warming.
+ */
+int
+prewarm_get_fd (void)
+{
+    return FD;
+}
+
+/**
+ * Load a single completed render into the cache, stops pre-warming
+ * once all jobs are done or the cache is full. Prefetched and
+ * predicted renders are loaded even if other entries have to be
+ * evicted.
+ */
+void
+prewarm_process (void)
+{
+    struct prewarm_msg msg;
+    ssize_t len = read (FD, &msg, sizeof (msg));
+    if (len == -1 && errno == EINTR) {
+        return;
+    }
+
+    if (len != sizeof (msg) || msg.job < 0 || msg.job >= NUM_JOBS) {
+        prewarm_stop ();
+        return;
+    }
+
+    if (msg.rendered) {
+        wallpaper_add_render_time (msg.ms);
+    }
+    if (! wallpaper_load_from_disk (&JOBS[msg.job].head, JOBS[msg.job].spec,
+                                    JOBS[msg.job].evict)) {
+        prewarm_stop ();
+    }
+}
+
+/**
+ * Add jobs for all heads of desktop, returns 0 once the cache budget
+ * is used up. Evicting jobs are added regardless of the budget.
+ */
+int
+prewarm_add_jobs (enum bg_select_mode mode, int desktop,
+                  struct geometry **heads, size_t *bytes,
+                  unsigned int *entries, int evict)
+{
+    for (int i = 0; heads[i]; i++) {
+        struct wallpaper_filter filter =
+            { mode, desktop, x11_get_desktop_name (desktop), i, 0 };
+        struct wallpaper_spec *spec = wallpaper_match (&filter);
+        if (spec == NULL) {
+            continue;
+        }
+        /* Evicting jobs are queued even if cached, loading them
+           promotes packed renders. */
+        if (spec->type != WALLPAPER_TYPE_IMAGE
+            || (! evict && wallpaper_is_cached (heads[i], spec))
+            || prewarm_is_queued (heads[i], spec)) {
+            wallpaper_spec_free (spec);
+            continue;
+        }
+
+        size_t head_bytes =
+            x11_get_pixmap_size (heads[i]->width, heads[i]->height);
+        if (! evict
+            && ! wallpaper_cache_fits (*bytes + head_bytes, *entries + 1)) {
+            wallpaper_spec_free (spec);
+            return 0;
+        }
+        *bytes += head_bytes;
+        *entries += 1;
+
+        prewarm_add_job (heads[i], spec, evict);
+    }
+    return 1;
+}
+
+/**
+ * Queue render of spec for head, takes ownership of spec.
+ */
+void
+prewarm_add_job (struct geometry *head, struct wallpaper_spec *spec,
+                 int evict)
+{
+    JOBS = realloc (JOBS, sizeof (struct prewarm_job) * (NUM_JOBS + 1));
+    if (! JOBS) {
+        die ("memory allocation failed, aborting!");
+    }
+    JOBS[NUM_JOBS].head = *head;
+    JOBS[NUM_JOBS].spec = spec;
+    JOBS[NUM_JOBS].evict = evict;
+    NUM_JOBS++;
+}
+
+/**
+ * Start helper process rendering the queued jobs, the jobs are written
+ * to its stdin and completed jobs are reported on its stdout. The
+ * helper is a new wallpaperd process, forking the daemon is not safe
+ * while render pool threads may hold locks.
+ */
+void
+prewarm_spawn (void)
+{
+    if (! NUM_JOBS) {
+        prewarm_stop ();
+        return;
+    }
+
+    int job_fds[2], msg_fds[2];
+    if (pipe2 (job_fds, O_CLOEXEC) == -1) {
+        perror ("failed to create pre-warm pipe");
+        prewarm_stop ();
+        return;
+    }
+    if (pipe2 (msg_fds, O_CLOEXEC) == -1) {
+        perror ("failed to create pre-warm pipe");
+        close (job_fds[0]);
+        close (job_fds[1]);
+        prewarm_stop ();
+        return;
+    }
+
+    /* Other descriptors are close-on-exec and not inherited. */
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init (&actions);
+    posix_spawn_file_actions_adddup2 (&actions, job_fds[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2 (&actions, msg_fds[1], STDOUT_FILENO);
+    char *argv[] = { OPTIONS->program, "-p", NULL };
+    int err = posix_spawn (&PID, "/proc/self/exe", &actions, NULL,
+                           argv, environ);
+    if (err == ENOENT) {
+        err = posix_spawnp (&PID, OPTIONS->program, &actions, NULL,
+                            argv, environ);
+    }
+    posix_spawn_file_actions_destroy (&actions);
+    close (job_fds[0]);
+    close (msg_fds[1]);
+    FD = msg_fds[0];
+
+    if (err != 0) {
+        errno = err;
+        perror ("failed to start pre-warm process");
+        PID = -1;
+        close (job_fds[1]);
+        prewarm_stop ();
+    } else if (! prewarm_write_jobs (job_fds[1])) {
+        perror ("failed to send pre-warm jobs");
+        close (job_fds[1]);
+        prewarm_stop ();
+    } else {
+        close (job_fds[1]);
+    }
+}
+
+/**
+ * Check if the same render already is queued.
+ */
+int
+prewarm_is_queued (struct geometry *head, struct wallpaper_spec *spec)
+{
+    for (int i = 0; i < NUM_JOBS; i++) {
+        if (JOBS[i].head.width == head->width
+            && JOBS[i].head.height == head->height
+            && JOBS[i].spec->mode == spec->mode
+            && ! strcmp (JOBS[i].spec->spec, spec->spec)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Pre-warm helper process started by prewarm_spawn, reads the jobs
+ * from stdin and renders them into the disk cache on a render pool of
+ * its own, reporting each completed job on stdout. Never connects to
+ * the X server.
+ */
+int
+prewarm_child_main (void)
+{
+    char *cfg_path = cfg_get_path ();
+    if (! cfg_load (CONFIG, cfg_path)) {
+        die ("failed to load configuration from %s, aborting!", cfg_path);
+    }
+    mem_free (cfg_path);
+    if (! prewarm_read_jobs (STDIN_FILENO)) {
+        die ("failed to read pre-warm jobs, aborting!");
+    }
+
+    /* Prefetching has a deadline, only pre-warming runs idle. */
+    if (! IS_PREFETCH) {
+        prewarm_set_idle_priority ();
+    }
+
+    /* Start the pool after lowering the priority so the workers
+       inherit it. */
+    wallpaper_init_render ();
+    CHILD_FD = STDOUT_FILENO;
+    struct pool *pool = pool_new (CONFIG->render_threads);
+    for (int i = 0; i < NUM_JOBS; i++) {
+        pool_submit (pool, NULL, prewarm_child_job, &JOBS[i]);
+    }
+    pool_free (pool);
+    wallpaper_cache_clear (0);
+    return 0;
+}
+
+/**
+ * Write the queued jobs to the helper process on fd, returns 0 on
+ * failure.
+ */
+int
+prewarm_write_jobs (int fd)
+{
+    struct prewarm_header header = { IS_PREFETCH, NUM_JOBS };
+    if (! prewarm_write (fd, &header, sizeof (header))) {
+        return 0;
+    }
+    for (int i = 0; i < NUM_JOBS; i++) {
+        struct prewarm_job_msg msg;
+        msg.width = JOBS[i].head.width;
+        msg.height = JOBS[i].head.height;
+        msg.type = JOBS[i].spec->type;
+        msg.mode = JOBS[i].spec->mode;
+        msg.len = strlen (JOBS[i].spec->spec);
+        if (! prewarm_write (fd, &msg, sizeof (msg))
+            || ! prewarm_write (fd, JOBS[i].spec->spec, msg.len)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Read the jobs written by prewarm_write_jobs from fd in the helper
+ * process, returns 0 on failure.
+ */
+int
+prewarm_read_jobs (int fd)
+{
+    struct prewarm_header header;
+    if (! prewarm_read (fd, &header, sizeof (header))
+        || header.num_jobs < 0) {
+        return 0;
+    }
+    IS_PREFETCH = header.is_prefetch;
+    for (int i = 0; i < header.num_jobs; i++) {
+        struct prewarm_job_msg msg;
+        if (! prewarm_read (fd, &msg, sizeof (msg))
+            || msg.len >= PATH_MAX) {
+            return 0;
+        }
+
+        struct wallpaper_spec *spec = wallpaper_spec_new ();
+        spec->type = msg.type;
+        spec->mode = msg.mode;
+        spec->spec = mem_new (msg.len + 1);
+        if (! prewarm_read (fd, spec->spec, msg.len)) {
+            wallpaper_spec_free (spec);
+            return 0;
+        }
+        spec->spec[msg.len] = '\0';
+
+        struct geometry head = { 0, 0, msg.width, msg.height, 0 };
+        prewarm_add_job (&head, spec, 0);
+    }
+    return 1;
+}
+
+/**
+ * Write all of buf to fd, returns 0 on failure.
+ */
+int
+prewarm_write (int fd, const void *buf, size_t len)
+{
+    const char *pos = buf;
+    while (len > 0) {
+        ssize_t num = write (fd, pos, len);
+        if (num == -1 && errno == EINTR) {
+            continue;
+        } else if (num <= 0) {
+            return 0;
+        }
+        pos += num;
+        len -= num;
+    }
+    return 1;
+}
+
+/**
+ * Read len bytes from fd into buf, returns 0 on failure or end of file.
+ */
+int
+prewarm_read (int fd, void *buf, size_t len)
+{
+    char *pos = buf;
+    while (len > 0) {
+        ssize_t num = read (fd, pos, len);
+        if (num == -1 && errno == EINTR) {
+            continue;
+        } else if (num <= 0) {
+            return 0;
+        }
+        pos += num;
+        len -= num;
+    }
+    return 1;
+}
+
+/**
+ * Render a single job in the child process and report it, reports
+ * are smaller than PIPE_BUF so writes from workers do not interleave.
+ */
+void
+prewarm_child_job (void *arg)
+{
+    struct prewarm_job *job = arg;
+    struct prewarm_msg msg;
+    int64_t start = time_monotonic_ms ();
+    msg.job = job - JOBS;
+    msg.rendered = wallpaper_render_to_disk (&job->head, job->spec);
+    msg.ms = time_monotonic_ms () - start;
+    if (write (CHILD_FD, &msg, sizeof (msg)) != sizeof (msg)) {
+        perror ("failed to report pre-warm render");
+    }
+}
+
+/**
+ * Run at the lowest possible priority, SCHED_IDLE where available.
+ */
+void
+prewarm_set_idle_priority (void)
+{
+    if (setpriority (PRIO_PROCESS, 0, 19) == -1) {
+        perror ("failed to set pre-warm nice level");
+    }
+#ifdef SCHED_IDLE
+    struct sched_param param;
+    memset (&param, 0, sizeof (param));
+    if (sched_setscheduler (0, SCHED_IDLE, &param) == -1) {
+        perror ("failed to set pre-warm scheduling policy");
+    }
+#endif /* SCHED_IDLE */
+}
@@ -0,0 +1,25 @@
+/*
+ * prewarm.h for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#ifndef _PREWARM_H_
+#define _PREWARM_H_
+
+#include "config.h"
+
+#include "wallpaperd.h"
+#include "wallpaper_match.h"
+
+extern void prewarm_start (enum bg_select_mode mode);
+extern void prewarm_prefetch (struct wallpaper_filter *filter);
+extern void prewarm_finish (void);
+extern void prewarm_stop (void);
+extern int prewarm_get_fd (void);
+extern void prewarm_process (void);
+extern int prewarm_child_main (void);
+
+#endif /* _PREWARM_H_ */
@@ -1,216 +1,772 @@
 /*
- * wallpaper.c for wallpaperd
+ * render.c for wallpaperd
  * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
  *
  * This program is licensed under the MIT license.
  * See the LICENSE file for more information.
  */
 
+/*
+ * Rendering works on plain pixel buffers using the kernels of kernel.c,
+ * all functions are safe to call from multiple threads at once. The
+ * upscale filter is set at startup.
+ */
+
 #include "config.h"
 
 #include <stdio.h>
-#include <Imlib2.h>
+#include <string.h>
 
+#include "kernel.h"
 #include "render.h"
 #include "util.h"
 
+static void render_scaled_size (int dest_width, int dest_height,
+                                int width, int height, int cover,
+                                int *width_ret, int *height_ret);
+static void render_letterbox (struct render_buf *dest, int dest_x, int dest_y,
+                              int width, int height, int has_alpha);
+static void render_scale_source (struct render_buf *dest, int dest_x,
+                                 int dest_y, int width, int height,
+                                 struct render_source *source, int blend);
+static const uint32_t *render_buf_row (void *data, int y);
+static void render_gradient_row (uint32_t *dest, int width, double u,
+                                 double du,
+                                 const struct render_gradient *gradient,
+                                 const int32_t *dither);
+static void render_gradient_dither (const struct render_gradient *gradient,
+                                    int y, int32_t *dither);
+
+/** 4x4 ordered dither thresholds. */
+static const int BAYER[4][4] = {
+    { 0, 8, 2, 10 },
+    { 12, 4, 14, 6 },
+    { 3, 11, 1, 9 },
+    { 15, 7, 13, 5 }
+};
+
+static enum kernel_filter_type UPSCALE = KERNEL_FILTER_BILINEAR;
+
+/**
+ * Set filter used when upscaling images, must not be called while
+ * rendering.
+ */
+void
+render_set_upscale (enum kernel_filter_type type)
+{
+    UPSCALE = type;
+}
+
+/**
+ * Get filter used when upscaling images.
+ */
+enum kernel_filter_type
+render_get_upscale (void)
+{
+    return UPSCALE;
+}
+
+/**
+ * Allocate width x height pixels for buf, contents are undefined.
+ */
+void
+render_buf_init (struct render_buf *buf, int width, int height)
+{
+    buf->width = width;
+    buf->height = height;
+    buf->has_alpha = 0;
+    buf->data = mem_new ((size_t) width * height * sizeof (uint32_t));
+}
+
+/**
+ * Free pixels of buf.
+ */
+void
+render_buf_free (struct render_buf *buf)
+{
+    mem_free (buf->data);
+    buf->data = 0;
+}
+
+/**
+ * Fill dest with a single color.
+ */
+void
+render_color (struct render_buf *dest, struct color *color)
+{
+    uint32_t pixel = 0xff000000
+        | (uint32_t) (unsigned char) color->r << 16
+        | (uint32_t) (unsigned char) color->g << 8
+        | (uint32_t) (unsigned char) color->b;
+    render_fill_rect (dest, 0, 0, dest->width, dest->height, pixel);
+}
+
+/**
+ * Get average color of buf, sampling a grid of at most 64x64 pixels.
+ */
+void
+render_average (struct render_buf *buf, struct color *color)
+{
+    int step_x = buf->width > 64 ? buf->width / 64 : 1;
+    int step_y = buf->height > 64 ? buf->height / 64 : 1;
+    uint64_t r = 0, g = 0, b = 0, n = 0;
+    for (int y = step_y / 2; y < buf->height; y += step_y) {
+        const uint32_t *row = buf->data + (size_t) y * buf->width;
+        for (int x = step_x / 2; x < buf->width; x += step_x) {
+            r += (row[x] >> 16) & 0xff;
+            g += (row[x] >> 8) & 0xff;
+            b += row[x] & 0xff;
+            n++;
+        }
+    }
+    if (n == 0) {
+        n = 1;
+    }
+    color->r = (r + n / 2) / n;
+    color->g = (g + n / 2) / n;
+    color->b = (b + n / 2) / n;
+}
+
+/**
+ * Cross-fade a and b into dest, all of the same size, alpha 0-256
+ * goes from a to b.
+ */
+void
+render_mix (struct render_buf *dest, const struct render_buf *a,
+            const struct render_buf *b, int alpha)
+{
+    const struct kernel *kernel = kernel_get ();
+    for (int y = 0; y < dest->height; y++) {
+        size_t offset = (size_t) y * dest->width;
+        kernel->mix (dest->data + offset, a->data + offset, b->data + offset,
+                     alpha, dest->width);
+    }
+}
+
+/**
+ * Get the largest difference of any color channel between a and b,
+ * both of the same size.
+ */
+int
+render_max_diff (const struct render_buf *a, const struct render_buf *b)
+{
+    int max_diff = 0;
+    size_t size = (size_t) a->width * a->height;
+    for (size_t i = 0; i < size && max_diff < 255; i++) {
+        uint32_t pa = a->data[i], pb = b->data[i];
+        if (pa == pb) {
+            continue;
+        }
+        for (int shift = 0; shift < 24; shift += 8) {
+            int diff = (int) ((pa >> shift) & 0xff)
+                - (int) ((pb >> shift) & 0xff);
+            diff = diff < 0 ? -diff : diff;
+            max_diff = diff > max_diff ? diff : max_diff;
+        }
+    }
+    return max_diff;
+}
+
 /**
- * Render image for current screen using a single color.
+ * Convert buf to RGB565 pixels in dest, with 4x4 ordered dithering of
+ * the dropped bits if dither is set.
  */
-Imlib_Image
-render_color (struct geometry *geometry, const char *color_str)
+void
+render_rgb565 (uint16_t *dest, const struct render_buf *buf, int dither)
 {
-    struct color color;
-    x11_parse_color (color_str, &color);
+    const struct kernel *kernel = kernel_get ();
+    uint8_t row_dither[4][16] = { { 0 } };
+    if (dither) {
+        /* Thresholds centered in the 8 and 4 levels dropped from
+           the 5 bit blue and red, and 6 bit green channels. */
+        for (int y = 0; y < 4; y++) {
+            for (int x = 0; x < 4; x++) {
+                int threshold = 2 * BAYER[y][x] + 1;
+                row_dither[y][x * 4] = threshold / 4;
+                row_dither[y][x * 4 + 1] = threshold / 8;
+                row_dither[y][x * 4 + 2] = threshold / 4;
+            }
+        }
+    }
+
+    for (int y = 0; y < buf->height; y++) {
+        size_t offset = (size_t) y * buf->width;
+        kernel->rgb565 (dest + offset, buf->data + offset,
+                        row_dither[y & 3], buf->width);
+    }
+}
 
-    Imlib_Image image =
-        render_new_color (geometry->width, geometry->height, &color);
+/**
+ * Render gradient laid out over width x height pixels into dest, dest
+ * covers the top left part of it. Vertical and horizontal gradients
+ * only need a strip of the size from render_gradient_size that is
+ * repeated.
+ */
+void
+render_gradient (struct render_buf *dest,
+                 const struct render_gradient *gradient,
+                 int width, int height)
+{
+    double steps = gradient->num_colors - 1;
+    double du_x = 0.0, du_y = 0.0;
+    switch (gradient->type) {
+    case RENDER_GRADIENT_HORIZONTAL:
+        du_x = steps / (width > 1 ? width - 1 : 1);
+        break;
+    case RENDER_GRADIENT_DIAGONAL:
+        du_x = steps / 2 / (width > 1 ? width - 1 : 1);
+        du_y = steps / 2 / (height > 1 ? height - 1 : 1);
+        break;
+    case RENDER_GRADIENT_VERTICAL:
+    default:
+        du_y = steps / (height > 1 ? height - 1 : 1);
+        break;
+    }
 
-    return image;
+    int32_t dither[16];
+    for (int y = 0; y < dest->height; y++) {
+        uint32_t *row = dest->data + (size_t) y * dest->width;
+        if (y >= 4 && du_y == 0.0) {
+            /* Only the dither pattern differs between rows. */
+            memcpy (row, row - 4 * dest->width,
+                    dest->width * sizeof (uint32_t));
+        } else {
+            render_gradient_dither (gradient, y, dither);
+            render_gradient_row (row, dest->width, y * du_y, du_x, gradient,
+                                 dither);
+        }
+    }
 }
 
 /**
- * Render image for current screen with specified mode.
+ * Get size of gradient laid out over width x height that needs to be
+ * rendered, the rest repeats it.
  */
-Imlib_Image
-render_image (struct geometry *geometry,
-              const char *path, enum wallpaper_mode mode)
+void
+render_gradient_size (const struct render_gradient *gradient,
+                      int width, int height, int *width_ret, int *height_ret)
 {
-    Imlib_Image image = imlib_load_image (path);
-    if (! image) {
-        fprintf (stderr, "failed to load %s\n", path);
-        return NULL;
+    /* The dither pattern repeats every four pixels. */
+    int repeat = 1;
+    for (int i = 0; i < 3; i++) {
+        if (gradient->bits[i] < 8) {
+            repeat = 4;
+        }
+    }
+
+    *width_ret = width;
+    *height_ret = height;
+    if (gradient->type == RENDER_GRADIENT_VERTICAL && width > repeat) {
+        *width_ret = repeat;
+    } else if (gradient->type == RENDER_GRADIENT_HORIZONTAL
+               && height > repeat) {
+        *height_ret = repeat;
     }
+}
 
-    Imlib_Image image_rendered;
+/**
+ * Render decoded image into dest with specified mode, image is left
+ * untouched.
+ */
+void
+render_image (struct render_buf *dest, struct render_buf *image,
+              enum wallpaper_mode mode)
+{
     switch (mode) {
     case MODE_TILED:
-        image_rendered = render_tiled (geometry, image);
+        render_tiled (dest, image);
         break;
     case MODE_FILL:
-        image_rendered = render_fill (geometry, image);
+        render_fill (dest, image);
         break;
     case MODE_ZOOM:
-        image_rendered = render_zoom (geometry, image);
+        render_zoom (dest, image);
         break;
     case MODE_SCALED:
-        image_rendered = render_scaled (geometry, image);
+        render_scaled (dest, image);
         break;
     case MODE_CENTERED:
     default:
-        image_rendered = render_centered (geometry, image);
+        render_centered (dest, image);
         break;
     }
+}
 
-    imlib_context_set_image (image);
-    imlib_free_image ();
+/**
+ * Render image provided one row at a time into dest with specified
+ * mode, only a few rows of the image are kept in memory. Returns 0 if
+ * mode requires the full image.
+ */
+int
+render_image_source (struct render_buf *dest, struct render_source *source,
+                     enum wallpaper_mode mode)
+{
+    if (mode == MODE_TILED) {
+        return 0;
+    }
 
-    return image_rendered;
+    int width, height;
+    render_image_size (dest->width, dest->height, source->width,
+                       source->height, mode, &width, &height);
+    if (mode == MODE_FILL) {
+        render_scale_source (dest, 0, 0, width, height, source, 0);
+    } else {
+        int dest_x = (dest->width - width) / 2;
+        int dest_y = (dest->height - height) / 2;
+        render_letterbox (dest, dest_x, dest_y, width, height,
+                          source->has_alpha);
+        render_scale_source (dest, dest_x, dest_y, width, height, source, 1);
+    }
+    return 1;
 }
 
 /**
- * Fill image on new image without keeping aspect ratio.
+ * Fill image on dest without keeping aspect ratio.
  */
-Imlib_Image
-render_fill (struct geometry *geometry, Imlib_Image image)
+void
+render_fill (struct render_buf *dest, struct render_buf *image)
 {
-    imlib_context_set_image (image);
-    int s_width = imlib_image_get_width ();
-    int s_height = imlib_image_get_height ();
+    render_scale (dest, image);
+}
 
-    Imlib_Image image_dest = imlib_create_cropped_scaled_image (
-            0, 0, s_width, s_height, geometry->width, geometry->height);
+/**
+ * Fill image on dest keeping aspect ratio, only the visible part of
+ * the image is scaled.
+ */
+void
+render_zoom (struct render_buf *dest, struct render_buf *image)
+{
+    int width, height;
+    render_scaled_size (dest->width, dest->height, image->width,
+                        image->height, 1, &width, &height);
+    render_place (dest, (dest->width - width) / 2,
+                  (dest->height - height) / 2, width, height, image);
+}
 
-    return image_dest;
+/**
+ * Scale image on dest keeping aspect ratio.
+ */
+void
+render_scaled (struct render_buf *dest, struct render_buf *image)
+{
+    int width, height;
+    render_scaled_size (dest->width, dest->height, image->width,
+                        image->height, 0, &width, &height);
+    render_place (dest, (dest->width - width) / 2,
+                  (dest->height - height) / 2, width, height, image);
 }
 
 /**
- * Fill image on new image keeping aspect ratio.
+ * Render image centered on dest, filling the rest with black.
  */
-Imlib_Image
-render_zoom (struct geometry *geometry, Imlib_Image image)
+void
+render_centered (struct render_buf *dest, struct render_buf *image)
 {
-    imlib_context_set_image (image);
-    float s_width = imlib_image_get_width ();
-    float s_height = imlib_image_get_height ();
+    render_place (dest, (dest->width - image->width) / 2,
+                  (dest->height - image->height) / 2,
+                  image->width, image->height, image);
+}
 
-    float s_aspect = s_width / s_height;
-    float d_aspect = (float) geometry->width / geometry->height;
+/**
+ * Tile image onto dest blending it on black. The first row of tiles is
+ * built one row at a time, repeating the tile by copying the already
+ * tiled part of the row, and is then repeated in the same way down
+ * dest.
+ */
+void
+render_tiled (struct render_buf *dest, struct render_buf *image)
+{
+    if (dest->width <= 0 || dest->height <= 0) {
+        return;
+    }
 
-    int d_width, d_height;
-    if (s_aspect > d_aspect) {
-        d_width = geometry->height * (s_width / s_height);
-        d_height = geometry->height;
-    } else {
-        d_width = geometry->width;
-        d_height = geometry->width * (s_height / s_width);
+    const struct kernel *kernel = kernel_get ();
+    int width = image->width < dest->width ? image->width : dest->width;
+    int height = image->height < dest->height ? image->height : dest->height;
+    for (int y = 0; y < height; y++) {
+        uint32_t *dst = dest->data + (size_t) y * dest->width;
+        const uint32_t *src = image->data + (size_t) y * image->width;
+        if (image->has_alpha) {
+            kernel->fill (dst, 0xff000000, width);
+            kernel->blend (dst, src, width);
+        } else {
+            kernel->blit (dst, src, width);
+        }
+        for (int x = width; x < dest->width; x *= 2) {
+            int count = x < dest->width - x ? x : dest->width - x;
+            memcpy (dst + x, dst, count * sizeof (uint32_t));
+        }
     }
 
-    Imlib_Image image_zoom = imlib_create_cropped_scaled_image (
-            0, 0, s_width, s_height, d_width, d_height);
+    size_t tiled = (size_t) height * dest->width;
+    size_t size = (size_t) dest->height * dest->width;
+    for (size_t pos = tiled; pos < size; pos *= 2) {
+        size_t count = pos < size - pos ? pos : size - pos;
+        memcpy (dest->data + pos, dest->data, count * sizeof (uint32_t));
+    }
+}
 
-    Imlib_Image image_dest = render_centered (geometry, image_zoom);
+/**
+ * Scale image to the size of dest. Downscaling averages the covered
+ * source pixels, upscaling interpolates with the upscale filter.
+ */
+void
+render_scale (struct render_buf *dest, struct render_buf *image)
+{
+    render_scale_rect (dest, 0, 0, dest->width, dest->height, image, 0);
+}
 
-    imlib_context_set_image (image_zoom);
-    imlib_free_image ();
+/**
+ * Render image scaled to width x height at dest_x, dest_y on dest
+ * blending it on black, parts of dest not covered are filled with
+ * black.
+ */
+void
+render_place (struct render_buf *dest, int dest_x, int dest_y,
+              int width, int height, struct render_buf *image)
+{
+    render_letterbox (dest, dest_x, dest_y, width, height, image->has_alpha);
+    if (width == image->width && height == image->height) {
+        render_blend (dest, dest_x, dest_y, image);
+    } else {
+        render_scale_rect (dest, dest_x, dest_y, width, height, image, 1);
+    }
+}
 
-    return image_dest;
+/**
+ * Fill the parts of dest around a width x height image at dest_x,
+ * dest_y with black, all of dest if the image has alpha.
+ */
+void
+render_letterbox (struct render_buf *dest, int dest_x, int dest_y,
+                  int width, int height, int has_alpha)
+{
+    const uint32_t black = 0xff000000;
+    if (has_alpha) {
+        render_fill_rect (dest, 0, 0, dest->width, dest->height, black);
+    } else {
+        /* Bars above, below, left and right of the image. */
+        int top = dest_y + height;
+        int right = dest_x + width;
+        render_fill_rect (dest, 0, 0, dest->width, dest_y, black);
+        render_fill_rect (dest, 0, top, dest->width, dest->height - top,
+                          black);
+        render_fill_rect (dest, 0, dest_y, dest_x, height, black);
+        render_fill_rect (dest, right, dest_y, dest->width - right, height,
+                          black);
+    }
 }
 
 /**
- * Scale image on new image keeping aspect ratio.
+ * Scale image to width x height placing it at dest_x, dest_y on dest,
+ * only the part inside of dest is computed. The scaled pixels replace
+ * dest unless blend is set and the image has alpha.
  */
-Imlib_Image
-render_scaled (struct geometry *geometry, Imlib_Image image)
+void
+render_scale_rect (struct render_buf *dest, int dest_x, int dest_y,
+                   int width, int height, struct render_buf *image,
+                   int blend)
 {
-    imlib_context_set_image (image);
-    float s_width = imlib_image_get_width ();
-    float s_height = imlib_image_get_height ();
+    struct render_source source = {
+        image->width, image->height, image->has_alpha, render_buf_row, image
+    };
+    render_scale_source (dest, dest_x, dest_y, width, height, &source,
+                         blend);
+}
 
-    float s_aspect = s_width / s_height;
-    float d_aspect = (float) geometry->width / geometry->height;
+/**
+ * Get row y of the render_buf data.
+ */
+const uint32_t*
+render_buf_row (void *data, int y)
+{
+    struct render_buf *buf = data;
+    return buf->data + (size_t) y * buf->width;
+}
 
-    int d_width, d_height;
-    if (s_aspect < d_aspect) {
-        d_width = geometry->height * (s_width / s_height);
-        d_height = geometry->height;
-    } else {
-        d_width = geometry->width;
-        d_height = geometry->width * (s_height / s_width);
+/**
+ * Scale source as render_scale_rect, source rows are requested top to
+ * bottom and each row only once.
+ */
+void
+render_scale_source (struct render_buf *dest, int dest_x, int dest_y,
+                     int width, int height, struct render_source *source,
+                     int blend)
+{
+    int x0 = dest_x < 0 ? -dest_x : 0;
+    int y0 = dest_y < 0 ? -dest_y : 0;
+    int x1 = dest_x + width > dest->width ? dest->width - dest_x : width;
+    int y1 = dest_y + height > dest->height ? dest->height - dest_y : height;
+    if (x0 >= x1 || y0 >= y1) {
+        return;
     }
+    int visible = x1 - x0;
+
+    const struct kernel *kernel = kernel_get ();
+    struct kernel_filter *filter_x =
+        kernel_filter_get (source->width, width, UPSCALE);
+    struct kernel_filter *filter_y =
+        kernel_filter_get (source->height, height, UPSCALE);
+
+    /* Horizontally scaled source rows, consecutive destination rows
+       share source rows so they are kept in a ring indexed by source
+       row. Filter windows only move down, rows leaving the ring are not
+       needed again. */
+    int ring_size = filter_y->max_count;
+    uint32_t *ring =
+        mem_new ((size_t) ring_size * visible * sizeof (uint32_t));
+    int *ring_row = mem_new (ring_size * sizeof (int));
+    for (int i = 0; i < ring_size; i++) {
+        ring_row[i] = -1;
+    }
+    const uint32_t **rows = mem_new (ring_size * sizeof (uint32_t*));
+    uint32_t *blend_row =
+        blend && source->has_alpha ? mem_new (visible * sizeof (uint32_t)) : 0;
+
+    for (int y = y0; y < y1; y++) {
+        int start = filter_y->start[y];
+        for (int i = 0; i < filter_y->count[y]; i++) {
+            int row = start + i;
+            uint32_t *ring_data =
+                ring + (size_t) (row % ring_size) * visible;
+            if (ring_row[row % ring_size] != row) {
+                kernel->scale_row (ring_data,
+                                   source->row (source->data, row),
+                                   filter_x, x0, visible);
+                ring_row[row % ring_size] = row;
+            }
+            rows[i] = ring_data;
+        }
 
-    Imlib_Image image_zoom = imlib_create_cropped_scaled_image (
-            0, 0, s_width, s_height, d_width, d_height);
+        const int16_t *weights =
+            filter_y->weights + (size_t) y * filter_y->max_count;
+        uint32_t *dst =
+            dest->data + (size_t) (dest_y + y) * dest->width + dest_x + x0;
+        if (blend_row) {
+            kernel->scale_col (blend_row, rows, weights, filter_y->count[y],
+                               visible);
+            kernel->blend (dst, blend_row, visible);
+        } else {
+            kernel->scale_col (dst, rows, weights, filter_y->count[y],
+                               visible);
+        }
+    }
 
-    Imlib_Image image_dest = render_centered (geometry, image_zoom);
+    mem_free (blend_row);
+    mem_free (rows);
+    mem_free (ring_row);
+    mem_free (ring);
+    kernel_filter_release (filter_y);
+    kernel_filter_release (filter_x);
+}
 
-    imlib_context_set_image (image_zoom);
-    imlib_free_image ();
+/**
+ * Blend image onto dest at dest_x, dest_y using the image alpha, the
+ * alpha of dest is kept. Images without alpha are copied as is. Parts
+ * outside of dest are clipped.
+ */
+void
+render_blend (struct render_buf *dest, int dest_x, int dest_y,
+              struct render_buf *image)
+{
+    int src_x = dest_x < 0 ? -dest_x : 0;
+    int src_y = dest_y < 0 ? -dest_y : 0;
+    int width = image->width - src_x;
+    int height = image->height - src_y;
+    dest_x += src_x;
+    dest_y += src_y;
+    if (dest_x + width > dest->width) {
+        width = dest->width - dest_x;
+    }
+    if (dest_y + height > dest->height) {
+        height = dest->height - dest_y;
+    }
+    if (width <= 0 || height <= 0) {
+        return;
+    }
 
-    return image_dest;
+    const struct kernel *kernel = kernel_get ();
+    for (int y = 0; y < height; y++) {
+        const uint32_t *src =
+            image->data + (size_t) (src_y + y) * image->width + src_x;
+        uint32_t *dst =
+            dest->data + (size_t) (dest_y + y) * dest->width + dest_x;
+        if (image->has_alpha) {
+            kernel->blend (dst, src, width);
+        } else {
+            kernel->blit (dst, src, width);
+        }
+    }
 }
 
 /**
- * Render image centered on geometry sized image.
+ * Fill width x height pixels at x, y with pixel, parts outside of dest
+ * are clipped.
  */
-Imlib_Image
-render_centered (struct geometry *geometry, Imlib_Image image)
+void
+render_fill_rect (struct render_buf *dest, int x, int y, int width,
+                  int height, uint32_t pixel)
 {
-    imlib_context_set_image (image);
-    int s_width = imlib_image_get_width ();
-    int s_height = imlib_image_get_height ();
-
-    Imlib_Image image_dest = imlib_create_image (
-            geometry->width, geometry->height);
-    imlib_context_set_image (image_dest);
-    imlib_context_set_color (0, 0, 0, 255);
-    imlib_image_fill_rectangle (
-            0, 0, imlib_image_get_width (), imlib_image_get_height ());
+    if (x < 0) {
+        width += x;
+        x = 0;
+    }
+    if (y < 0) {
+        height += y;
+        y = 0;
+    }
+    if (x + width > dest->width) {
+        width = dest->width - x;
+    }
+    if (y + height > dest->height) {
+        height = dest->height - y;
+    }
+    if (width <= 0 || height <= 0) {
+        return;
+    }
 
-    int dest_x = (geometry->width - s_width) / 2;
-    int dest_y = (geometry->height - s_height) / 2;
-    imlib_blend_image_onto_image (
-            image, 0,
-            0, 0, s_width, s_height, dest_x, dest_y, s_width, s_height);
+    const struct kernel *kernel = kernel_get ();
+    for (int row = y; row < y + height; row++) {
+        kernel->fill (dest->data + (size_t) row * dest->width + x, pixel,
+                      width);
+    }
+}
 
-    return image_dest;
+/**
+ * Get size a width x height image is scaled to when rendered on a
+ * dest_width x dest_height buffer with mode.
+ */
+void
+render_image_size (int dest_width, int dest_height, int width, int height,
+                   enum wallpaper_mode mode, int *width_ret, int *height_ret)
+{
+    switch (mode) {
+    case MODE_FILL:
+        *width_ret = dest_width;
+        *height_ret = dest_height;
+        break;
+    case MODE_ZOOM:
+    case MODE_SCALED:
+        render_scaled_size (dest_width, dest_height, width, height,
+                            mode == MODE_ZOOM, width_ret, height_ret);
+        break;
+    case MODE_TILED:
+    case MODE_CENTERED:
+    default:
+        *width_ret = width;
+        *height_ret = height;
+        break;
+    }
 }
 
 /**
- * Tile image onto new image.
+ * Get size of width x height image scaled to dest keeping aspect
+ * ratio, covering dest if cover is set else fitting inside it.
  */
-Imlib_Image
-render_tiled (struct geometry *geometry, Imlib_Image image)
+void
+render_scaled_size (int dest_width, int dest_height, int width, int height,
+                    int cover, int *width_ret, int *height_ret)
 {
-    imlib_context_set_image (image);
-    int s_width = imlib_image_get_width ();
-    int s_height = imlib_image_get_height ();
+    float s_width = width;
+    float s_height = height;
 
-    Imlib_Image image_dest = imlib_create_image (geometry->width,
-                                                 geometry->height);
-    imlib_context_set_image (image_dest);
+    float s_aspect = s_width / s_height;
+    float d_aspect = (float) dest_width / dest_height;
 
-    for (int x = 0; x < geometry->width; x += s_width) {
-        for (int y = 0; y < geometry->height; y += s_height) {
-            imlib_blend_image_onto_image (
-                    image, 0, 0, 0, s_width, s_height, x, y, s_width, s_height);
-        }
+    if (cover ? s_aspect > d_aspect : s_aspect < d_aspect) {
+        *width_ret = dest_height * (s_width / s_height);
+        *height_ret = dest_height;
+    } else {
+        *width_ret = dest_width;
+        *height_ret = dest_width * (s_height / s_width);
+    }
+    if (*width_ret < 1) {
+        *width_ret = 1;
+    }
+    if (*height_ret < 1) {
+        *height_ret = 1;
     }
-
-    return image_dest;
 }
 
 /**
- * Create new image filled with black of width/height dimensions.
+ * Render width pixels of a gradient row, pixel x is at u + x * du
+ * where the integer part of u is the index of the color the gradient
+ * goes from.
  */
-Imlib_Image
-render_new_color (unsigned int width, unsigned int height, struct color *color)
+void
+render_gradient_row (uint32_t *dest, int width, double u, double du,
+                     const struct render_gradient *gradient,
+                     const int32_t *dither)
 {
-    Imlib_Image image = imlib_create_image (width, height);
+    const struct kernel *kernel = kernel_get ();
+    const double one = 1 << KERNEL_GRADIENT_SHIFT;
+    int last = gradient->num_colors - 1;
+    int x = 0;
+    while (x < width) {
+        double ux = u + du * x;
+        int k = ux < last ? (int) ux : last - 1;
+        if (k < 0) {
+            k = 0;
+        }
+        double f = ux - k;
+        int end = width;
+        if (du > 0.0 && k + 1 < last) {
+            /* Pixels up to the next color. */
+            double left = (k + 1 - ux) / du;
+            if (left < width - x) {
+                end = x + (int) left;
+                end += end < x + left || end == x;
+            }
+        }
 
-    imlib_context_set_image (image);
-    imlib_context_set_color (color->r, color->g, color->b, 255);
-    imlib_image_fill_rectangle (0, 0, width, height);
+        const struct color *c0 = &gradient->colors[k];
+        const struct color *c1 = &gradient->colors[last > 0 ? k + 1 : k];
+        const double from[4] = {
+            (unsigned char) c0->b, (unsigned char) c0->g,
+            (unsigned char) c0->r, 255
+        };
+        const double to[4] = {
+            (unsigned char) c1->b, (unsigned char) c1->g,
+            (unsigned char) c1->r, 255
+        };
+        int32_t start[4], step[4], dither_x[16];
+        for (int c = 0; c < 4; c++) {
+            double diff = to[c] - from[c];
+            double s = diff * du * one;
+            start[c] = (int32_t) ((from[c] + diff * f) * one + 0.5);
+            step[c] = (int32_t) (s < 0.0 ? s - 0.5 : s + 0.5);
+        }
+        for (int i = 0; i < 16; i++) {
+            dither_x[i] = dither[((x + i / 4) & 3) * 4 + i % 4];
+        }
+        kernel->gradient (dest + x, start, step, dither_x, end - x);
+        x = end;
+    }
+}
 
-    return image;
+/**
+ * Get dither thresholds of gradient row y, channels with 8 bits are
+ * rounded.
+ */
+void
+render_gradient_dither (const struct render_gradient *gradient, int y,
+                        int32_t *dither)
+{
+    const int32_t one = 1 << KERNEL_GRADIENT_SHIFT;
+    for (int x = 0; x < 4; x++) {
+        for (int c = 0; c < 4; c++) {
+            /* Channels are blue, green, red and alpha. */
+            int bits = c < 3 ? gradient->bits[2 - c] : 8;
+            if (bits >= 8) {
+                dither[x * 4 + c] = one / 2;
+            } else {
+                /* Spread evenly over the truncated step of the display
+                   channel. */
+                int32_t quantum = one << (8 - bits);
+                dither[x * 4 + c] =
+                    (int32_t) ((2 * BAYER[y & 3][x] + 1) * (int64_t) quantum
+                               / 32);
+            }
+        }
+    }
 }
@@ -1,5 +1,5 @@
 /*
- * wallpaper.h for wallpaperd
+ * render.h for wallpaperd
  * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
  *
  * This program is licensed under the MIT license.
@@ -11,21 +11,100 @@
 
 #include "config.h"
 
-#include <Imlib2.h>
+#include <stdint.h>
 
+#include "kernel.h"
 #include "wallpaperd.h"
 #include "x11.h"
 
-extern Imlib_Image render_color (struct geometry *geometry,
-                                 const char *color_str);
-extern Imlib_Image render_image (struct geometry *geometry,
-                                 const char *path, enum wallpaper_mode mode);
-extern Imlib_Image render_centered (struct geometry *geometry, Imlib_Image image);
-extern Imlib_Image render_tiled (struct geometry *geometry, Imlib_Image image);
-extern Imlib_Image render_fill (struct geometry *geometry, Imlib_Image image);
-extern Imlib_Image render_zoom (struct geometry *geometry, Imlib_Image image);
-extern Imlib_Image render_scaled (struct geometry *geometry, Imlib_Image image);
-extern Imlib_Image render_new_color (unsigned int width, unsigned int height,
-                                     struct color *color);
+/**
+ * ARGB32 pixels in host byte order, the layout used by Imlib2 and the
+ * disk cache.
+ */
+struct render_buf {
+    int width;
+    int height;
+    uint32_t *data;
+    int has_alpha; /**< Set if any pixel may be translucent. */
+};
+
+/** Most colors of a gradient. */
+#define RENDER_GRADIENT_MAX_COLORS 16
+
+enum render_gradient_type {
+    RENDER_GRADIENT_VERTICAL,
+    RENDER_GRADIENT_HORIZONTAL,
+    RENDER_GRADIENT_DIAGONAL /**< Top left to bottom right. */
+};
+
+/**
+ * Linear gradient between evenly spaced colors.
+ */
+struct render_gradient {
+    enum render_gradient_type type;
+    int num_colors;
+    struct color colors[RENDER_GRADIENT_MAX_COLORS];
+    /** Red, green and blue bits of the display, channels with fewer
+        than 8 bits get ordered dithering. */
+    int bits[3];
+};
+
+/**
+ * Image providing one row of ARGB32 pixels at a time, rows are
+ * requested from top to bottom and may skip rows.
+ */
+struct render_source {
+    int width;
+    int height;
+    int has_alpha;
+    const uint32_t *(*row) (void *data, int y);
+    void *data;
+};
+
+extern void render_set_upscale (enum kernel_filter_type type);
+extern enum kernel_filter_type render_get_upscale (void);
+
+extern void render_buf_init (struct render_buf *buf, int width, int height);
+extern void render_buf_free (struct render_buf *buf);
+
+extern void render_color (struct render_buf *dest, struct color *color);
+extern void render_average (struct render_buf *buf, struct color *color);
+extern void render_mix (struct render_buf *dest, const struct render_buf *a,
+                        const struct render_buf *b, int alpha);
+extern int render_max_diff (const struct render_buf *a,
+                            const struct render_buf *b);
+extern void render_rgb565 (uint16_t *dest, const struct render_buf *buf,
+                           int dither);
+extern void render_gradient (struct render_buf *dest,
+                             const struct render_gradient *gradient,
+                             int width, int height);
+extern void render_gradient_size (const struct render_gradient *gradient,
+                                  int width, int height,
+                                  int *width_ret, int *height_ret);
+extern void render_image (struct render_buf *dest, struct render_buf *image,
+                          enum wallpaper_mode mode);
+extern int render_image_source (struct render_buf *dest,
+                                struct render_source *source,
+                                enum wallpaper_mode mode);
+extern void render_centered (struct render_buf *dest,
+                             struct render_buf *image);
+extern void render_tiled (struct render_buf *dest, struct render_buf *image);
+extern void render_fill (struct render_buf *dest, struct render_buf *image);
+extern void render_zoom (struct render_buf *dest, struct render_buf *image);
+extern void render_scaled (struct render_buf *dest, struct render_buf *image);
+extern void render_scale (struct render_buf *dest, struct render_buf *image);
+extern void render_place (struct render_buf *dest, int dest_x, int dest_y,
+                          int width, int height, struct render_buf *image);
+extern void render_scale_rect (struct render_buf *dest, int dest_x,
+                               int dest_y, int width, int height,
+                               struct render_buf *image, int blend);
+extern void render_image_size (int dest_width, int dest_height,
+                               int width, int height,
+                               enum wallpaper_mode mode,
+                               int *width_ret, int *height_ret);
+extern void render_fill_rect (struct render_buf *dest, int x, int y,
+                              int width, int height, uint32_t pixel);
+extern void render_blend (struct render_buf *dest, int dest_x, int dest_y,
+                          struct render_buf *image);
 
 #endif /* _RENDER_H_ */
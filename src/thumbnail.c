@@ -0,0 +1,217 @@
+/*
+ * thumbnail.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ *
+ * Lookup of thumbnails stored by file managers and image viewers
+ * following the freedesktop.org thumbnail specification, thumbnails
+ * are named after the MD5 digest of the image file URI.
+ */
+
+#include "config.h"
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "thumbnail.h"
+#include "util.h"
+
+/** Thumbnail size directories, largest first. */
+static const char *THUMBNAIL_SIZES[] = {
+    "xx-large", "x-large", "large", "normal", NULL
+};
+
+static const uint32_t MD5_K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+    0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+    0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+    0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+    0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const int MD5_SHIFT[16] = {
+    7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21
+};
+
+static char *thumbnail_get_dir (void);
+static char *thumbnail_uri (const char *path);
+static void thumbnail_md5 (const char *str, char *hex);
+static void thumbnail_md5_block (uint32_t *state, const unsigned char *block);
+
+/**
+ * Find up to date thumbnail of the image at absolute path, preferring
+ * the largest size. Returns the thumbnail path or NULL if there is no
+ * thumbnail. Safe to call from any thread.
+ */
+char*
+thumbnail_find (const char *path)
+{
+    struct stat image_st;
+    if (path[0] != '/' || stat (path, &image_st) == -1) {
+        return NULL;
+    }
+
+    char *uri = thumbnail_uri (path);
+    char name[33];
+    thumbnail_md5 (uri, name);
+    mem_free (uri);
+
+    char *dir = thumbnail_get_dir ();
+    char *thumbnail = NULL;
+    for (int i = 0; THUMBNAIL_SIZES[i] && thumbnail == NULL; i++) {
+        if (asprintf (&thumbnail, "%s/%s/%s.png",
+                      dir, THUMBNAIL_SIZES[i], name) == -1) {
+            die ("failed to construct thumbnail path, aborting");
+        }
+
+        /* Thumbnails older than the image are stale. */
+        struct stat st;
+        if (stat (thumbnail, &st) == -1
+            || st.st_mtime < image_st.st_mtime) {
+            mem_free (thumbnail);
+            thumbnail = NULL;
+        }
+    }
+    mem_free (dir);
+    return thumbnail;
+}
+
+/**
+ * Return thumbnail directory, $XDG_CACHE_HOME/thumbnails falling back
+ * to ~/.cache/thumbnails.
+ */
+char*
+thumbnail_get_dir (void)
+{
+    char *dir;
+    const char *xdg_cache_home = getenv ("XDG_CACHE_HOME");
+    if (xdg_cache_home && xdg_cache_home[0] == '/') {
+        if (asprintf (&dir, "%s/thumbnails", xdg_cache_home) == -1) {
+            die ("failed to construct thumbnail path, aborting");
+        }
+    } else {
+        dir = expand_home ("~/.cache/thumbnails");
+    }
+    return dir;
+}
+
+/**
+ * Create file URI of absolute path, escaping the same characters as
+ * GLib does.
+ */
+char*
+thumbnail_uri (const char *path)
+{
+    static const char *HEX = "0123456789ABCDEF";
+    char *uri = mem_new (strlen ("file://") + strlen (path) * 3 + 1);
+    char *p = uri + sprintf (uri, "file://");
+    for (; *path; path++) {
+        unsigned char c = *path;
+        if (isalnum (c) || strchr ("-._~!$&'()*+,=:@/", c)) {
+            *p++ = c;
+        } else {
+            *p++ = '%';
+            *p++ = HEX[c >> 4];
+            *p++ = HEX[c & 0xf];
+        }
+    }
+    *p = '\0';
+    return uri;
+}
+
+/**
+ * Write MD5 digest of str as 32 lower case hex digits to hex.
+ */
+void
+thumbnail_md5 (const char *str, char *hex)
+{
+    uint32_t state[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+
+    /* Message padded with 0x80, zeros and the bit length to a multiple
+       of 64 bytes. */
+    size_t len = strlen (str);
+    size_t padded_len = (len + 8) / 64 * 64 + 64;
+    unsigned char *msg = mem_new (padded_len);
+    memcpy (msg, str, len);
+    memset (msg + len, 0, padded_len - len);
+    msg[len] = 0x80;
+    uint64_t bits = (uint64_t) len * 8;
+    for (int i = 0; i < 8; i++) {
+        msg[padded_len - 8 + i] = bits >> (i * 8);
+    }
+
+    for (size_t i = 0; i < padded_len; i += 64) {
+        thumbnail_md5_block (state, msg + i);
+    }
+    mem_free (msg);
+
+    for (int i = 0; i < 16; i++) {
+        sprintf (hex + i * 2, "%02x", (state[i / 4] >> (i % 4 * 8)) & 0xff);
+    }
+}
+
+/**
+ * Process a single 64 byte block of the MD5 message.
+ */
+void
+thumbnail_md5_block (uint32_t *state, const unsigned char *block)
+{
+    uint32_t m[16];
+    for (int i = 0; i < 16; i++) {
+        m[i] = (uint32_t) block[i * 4]
+            | (uint32_t) block[i * 4 + 1] << 8
+            | (uint32_t) block[i * 4 + 2] << 16
+            | (uint32_t) block[i * 4 + 3] << 24;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    for (int i = 0; i < 64; i++) {
+        uint32_t f;
+        int g;
+        if (i < 16) {
+            f = (b & c) | (~b & d);
+            g = i;
+        } else if (i < 32) {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+        } else if (i < 48) {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        } else {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+
+        int s = MD5_SHIFT[i / 16 * 4 + i % 4];
+        f += a + MD5_K[i] + m[g];
+        a = d;
+        d = c;
+        c = b;
+        b += (f << s) | (f >> (32 - s));
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
@@ -0,0 +1,16 @@
+/*
+ * thumbnail.h for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#ifndef _THUMBNAIL_H_
+#define _THUMBNAIL_H_
+
+#include "config.h"
+
+extern char *thumbnail_find (const char *path);
+
+#endif /* _THUMBNAIL_H_ */
@@ -0,0 +1,108 @@
+/*
+ * trace.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+static FILE *FP = NULL;
+
+/**
+ * Open trace file at path for appending, returns 0 on failure.
+ */
+int
+trace_open (const char *path)
+{
+    trace_close ();
+
+    FP = fopen (path, "ae");
+    if (FP == NULL) {
+        perror ("failed to open cache trace");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Close trace file if open.
+ */
+void
+trace_close (void)
+{
+    if (FP != NULL) {
+        fclose (FP);
+        FP = NULL;
+    }
+}
+
+/**
+ * Check if a trace file is open.
+ */
+int
+trace_is_open (void)
+{
+    return FP != NULL;
+}
+
+/**
+ * Append event to the trace file, flushed right away so the trace is
+ * usable while the daemon is running.
+ */
+void
+trace_write (struct trace_event *event)
+{
+    if (FP == NULL) {
+        return;
+    }
+
+    fprintf (FP, "%lld\t%d\t%016llx\t%d\t%d\t%d\t%d\t%ld\t%lu\t%s\n",
+             (long long) event->time, event->desktop,
+             (unsigned long long) event->layout,
+             event->width, event->height, event->mode, event->type,
+             event->cost, (unsigned long) event->bytes, event->spec);
+    fflush (FP);
+}
+
+/**
+ * Read next event from fp, returns 1 on success, 0 at end of file and
+ * -1 if the line is malformed.
+ */
+int
+trace_read (FILE *fp, struct trace_event *event)
+{
+    char line[sizeof (event->spec) + 128];
+    if (fgets (line, sizeof (line), fp) == NULL) {
+        return 0;
+    }
+    line[strcspn (line, "\n")] = '\0';
+
+    long long time;
+    unsigned long long layout;
+    int mode, type;
+    unsigned long bytes;
+    int pos = 0;
+    if (sscanf (line, "%lld\t%d\t%llx\t%d\t%d\t%d\t%d\t%ld\t%lu\t%n",
+                &time, &event->desktop, &layout,
+                &event->width, &event->height, &mode, &type,
+                &event->cost, &bytes, &pos) != 9
+        || pos == 0 || line[pos] == '\0') {
+        return -1;
+    }
+
+    event->time = time;
+    event->layout = layout;
+    event->mode = mode;
+    event->type = type;
+    event->bytes = bytes;
+    snprintf (event->spec, sizeof (event->spec), "%s", line + pos);
+    return 1;
+}
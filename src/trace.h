@@ -0,0 +1,43 @@
+/*
+ * trace.h for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "wallpaperd.h"
+
+/**
+ * Single render cache access, written as a tab separated line with the
+ * spec last as it may contain tabs.
+ */
+struct trace_event {
+    int64_t time; /**< Wall clock milliseconds. */
+    int desktop;
+    uint64_t layout; /**< Head layout signature. */
+    int width; /**< Head size. */
+    int height;
+    enum wallpaper_mode mode;
+    enum wallpaper_type type;
+    long cost; /**< Milliseconds to render, measured or estimated. */
+    size_t bytes; /**< Size of the server pixmap. */
+    char spec[4096]; /**< Image path or color. */
+};
+
+extern int trace_open (const char *path);
+extern void trace_close (void);
+extern int trace_is_open (void);
+extern void trace_write (struct trace_event *event);
+extern int trace_read (FILE *fp, struct trace_event *event);
+
+#endif /* _TRACE_H_ */
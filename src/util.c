@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "util.h"
@@ -50,6 +51,19 @@ mem_new (size_t size)
     return ptr;
 }
 
+/**
+ * Wrapper for realloc, dies if the allocation fails.
+ */
+void*
+mem_realloc (void *data, size_t size)
+{
+    void *ptr = realloc (data, size);
+    if (ptr == 0) {
+        die ("memory allocation of %d bytes failed, aborting!", size);
+    }
+    return ptr;
+}
+
 /**
  * Wrapper for free, sets the pointer to null.
  */
@@ -72,6 +86,28 @@ file_exists (const char *path)
     return err ? false : true;
 }
 
+/**
+ * Get current wall clock time in milliseconds.
+ */
+int64_t
+time_ms (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Get monotonic time in milliseconds, used for measuring durations.
+ */
+int64_t
+time_monotonic_ms (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 /**
  * Get absolute path.
  */
@@ -206,3 +242,60 @@ str_ends_with (const char *str, const char *end)
         return strcmp (str + str_len - end_len, end) == 0;
     }
 }
+
+/**
+ * Return 64-bit FNV-1a digest of str.
+ */
+uint64_t
+str_digest (const char *str)
+{
+    uint64_t digest = 0xcbf29ce484222325ULL;
+    for (; *str != '\0'; str++) {
+        digest ^= (unsigned char) *str;
+        digest *= 0x100000001b3ULL;
+    }
+    return digest;
+}
+
+/**
+ * Get 64-bit FNV-1a digest of size bytes of data.
+ */
+uint64_t
+data_digest (const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    uint64_t digest = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        digest ^= p[i];
+        digest *= 0x100000001b3ULL;
+    }
+    return digest;
+}
+
+/**
+ * Parse size string with optional K, M or G suffix into number of
+ * bytes.
+ */
+size_t
+str_to_size (const char *str)
+{
+    char *end;
+    unsigned long long size = strtoull (str, &end, 10);
+    switch (*end) {
+    case 'G':
+    case 'g':
+        size *= 1024;
+        /* fall through */
+    case 'M':
+    case 'm':
+        size *= 1024;
+        /* fall through */
+    case 'K':
+    case 'k':
+        size *= 1024;
+        break;
+    default:
+        break;
+    }
+    return size;
+}
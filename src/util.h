@@ -13,14 +13,19 @@
 
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 extern void die (const char *msg, ...);
 
 extern void *mem_new (size_t size);
+extern void *mem_realloc (void *data, size_t size);
 extern void mem_free (void *data);
 
 extern bool file_exists (const char *path);
 
+extern int64_t time_ms (void);
+extern int64_t time_monotonic_ms (void);
+
 extern char *expand_abs (const char *path);
 extern char *expand_home (const char *str);
 
@@ -29,5 +34,8 @@ extern const char *str_first_of (const char *str, const char *of);
 extern const char *str_first_not_of (const char *str, const char *not_of);
 extern int str_starts_with (const char *str, const char *start);
 extern int str_ends_with (const char *str, const char *end);
+extern uint64_t str_digest (const char *str);
+extern uint64_t data_digest (const void *data, size_t size);
+extern size_t str_to_size (const char *str);
 
 #endif /* _UTIL_H_ */
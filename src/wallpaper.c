@@ -8,26 +8,265 @@
 
 #include "config.h"
 
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 #include <strings.h>
+#include <unistd.h>
 #include <Imlib2.h>
 #include <X11/Xatom.h>
 
 #include "cache.h"
+#include "codec.h"
 #include "compat.h"
+#include "decode.h"
+#include "disk_cache.h"
+#include "image_cache.h"
+#include "pixmap_pool.h"
+#include "pool.h"
 #include "render.h"
+#include "thumbnail.h"
+#include "trace.h"
 #include "wallpaper.h"
+#include "wallpaper_spec.h"
 #include "util.h"
+#include "watch.h"
 #include "x11.h"
 
+/**
+ * Render or unpack of a single head. Jobs are prepared and completed
+ * on the main thread and run on the render pool, running a job does
+ * not touch the X11 connection, Imlib2 or the render cache.
+ */
+struct wallpaper_job {
+    struct geometry *head;
+    struct wallpaper_spec *spec;
+    struct color color; /**< Color of color specs or average of images. */
+    struct render_gradient gradient; /**< Parsed gradient specs. */
+    const unsigned char *packed_src; /**< Packed render to unpack, or NULL. */
+    size_t packed_src_bytes;
+    unsigned char *packed_src_copy; /**< Owned copy of packed_src, or NULL. */
+    int placeholder; /**< Set to render a placeholder, not cached. */
+    struct wallpaper_async *async; /**< Render notified when done, or NULL. */
+    struct wallpaper_fade *fade; /**< Cross-fade notified when done, or NULL. */
+    int has_average; /**< Set if color is the average of the image. */
+
+    struct render_buf buf; /**< Result, data is NULL if the job failed. */
+    struct disk_cache_entry *entry; /**< Disk cache entry buf maps, or NULL. */
+    unsigned char *packed; /**< Packed copy of buf, or NULL. */
+    size_t packed_bytes;
+    int rendered; /**< Set if rendered from source. */
+    long ms;
+};
+
+/** Number of image average colors kept for placeholders. */
+#define WALLPAPER_AVERAGES 64
+
+/**
+ * Average color of an image render, used as placeholder.
+ */
+struct wallpaper_average {
+    uint64_t digest; /**< Digest of the image path, 0 if unused. */
+    struct color color;
+};
+
+/**
+ * Cross-fade of a single head, both renders are kept for the whole
+ * fade and blended into the frame.
+ */
+struct wallpaper_fade_head {
+    struct geometry head;
+    struct wallpaper_job from;
+    struct wallpaper_job to;
+    struct render_buf frame;
+};
+
+/**
+ * Cross-fade in progress, the renders faded between are done on the
+ * render pool and frames are drawn onto the root pixmap once they are
+ * done. A cancelled fade is freed once its running jobs are done.
+ */
+struct wallpaper_fade {
+    struct wallpaper_fade_head *heads; /**< Owns copies of the specs. */
+    int num_heads;
+    struct pool_group group;
+    int done; /**< Jobs done, counted from the pipe. */
+    int ready; /**< Set once all renders are done and frames are drawn. */
+    int cancelled;
+    int64_t start; /**< Start time in milliseconds. */
+    long length; /**< Length in milliseconds. */
+    int step; /**< Smallest alpha step changing the 8-bit colors. */
+    int alpha; /**< Alpha of the last drawn frame. */
+    int64_t next; /**< Time of the next frame. */
+};
+
+/**
+ * Composition of the root pixmap from per head renders.
+ */
+struct wallpaper_compose {
+    struct geometry **heads;
+    struct wallpaper_spec **specs;
+    int placeholder; /**< Set to draw placeholders, nothing is cached. */
+    uint64_t *digests;
+    int *same; /**< Head drawn with the same render, or -1. */
+    struct wallpaper_job **head_jobs; /**< Job of each head, or NULL. */
+    struct wallpaper_job *jobs;
+    int num_jobs;
+    struct pool_group group;
+};
+
+/**
+ * Render run on the render pool, the full quality render while
+ * placeholders are shown or a prefetch, completed on the main thread
+ * once all jobs are done. A cancelled render is freed once its running
+ * jobs are done, without using the renders.
+ */
+struct wallpaper_async {
+    struct wallpaper_compose compose; /**< Owns copies of heads and specs. */
+    int set_root; /**< Set as root once done. */
+    int cancelled;
+    int done; /**< Jobs done, counted from the pipe. */
+};
+
 static struct cache *CACHE = 0;
+static struct image_cache *IMAGE_CACHE = 0;
+static struct disk_cache *DISK_CACHE = 0;
+static struct pool *POOL = 0;
+/** Server pixmaps reused between renders and cache evictions. */
+static struct pixmap_pool *PIXMAP_POOL = 0;
 static char CACHE_SPEC[4096] = { '\0' };
+static Pixmap ROOT_PIXMAP = None;
+/** Conservative estimate of the packed render compression ratio. */
+static const size_t PACKED_RATIO = 2;
+/** Signature of the head layout last rendered. */
+static uint64_t LAYOUT = 0;
+/** Heads and specs the current root pixmap was rendered from. */
+static struct geometry **ROOT_HEADS = 0;
+static struct wallpaper_spec **ROOT_SPECS = 0;
+/** Average time in milliseconds to render a head, 0 if unknown. */
+static long RENDER_TIME = 0;
+/** Desktop the root pixmap is rendered for, recorded in the trace. */
+static int DESKTOP = 0;
+/** Average image colors, direct mapped on the path digest. */
+static struct wallpaper_average AVERAGES[WALLPAPER_AVERAGES];
+static struct wallpaper_fade *FADE = NULL;
+/** Written with each job done on the render pool, -1 until created. */
+static int ASYNC_FDS[2] = { -1, -1 };
+static struct wallpaper_async *ASYNC_ROOT = NULL;
+static struct wallpaper_async *ASYNC_PREFETCH = NULL;
 
-static char *wallpaper_render_spec (struct wallpaper_filter *filter);
-static Imlib_Image wallpaper_render (struct wallpaper_filter *filter);
+static void wallpaper_render_spec (struct geometry **heads,
+                                   struct wallpaper_spec **specs,
+                                   char *buf, size_t size);
+static void wallpaper_set_root (struct geometry **heads,
+                                struct wallpaper_spec **specs);
+static struct wallpaper_spec *wallpaper_render_single (
+    struct geometry **heads, struct wallpaper_spec **specs);
+static Pixmap wallpaper_render_tile (struct wallpaper_spec *spec);
+static Pixmap wallpaper_render_gradient (struct wallpaper_spec *spec,
+                                         int width, int height);
+static int wallpaper_gradient_repeats (struct wallpaper_spec *spec);
+static int wallpaper_gradient_parse (const char *spec,
+                                     struct render_gradient *gradient);
+static Pixmap wallpaper_create_root_pixmap (struct render_buf *buf,
+                                            int dither);
+static Pixmap wallpaper_get_pixmap (int width, int height);
+static Pixmap wallpaper_tile_display (Pixmap tile);
+static int wallpaper_use_placeholder (struct geometry **heads,
+                                      struct wallpaper_spec **specs);
+static Pixmap wallpaper_render (struct geometry **heads,
+                                struct wallpaper_spec **specs,
+                                int placeholder);
+static void wallpaper_compose_init (struct wallpaper_compose *compose,
+                                    struct geometry **heads,
+                                    struct wallpaper_spec **specs,
+                                    int placeholder,
+                                    struct wallpaper_async *async);
+static Pixmap wallpaper_compose_pixmap (struct wallpaper_compose *compose);
+static void wallpaper_compose_draw (struct wallpaper_compose *compose,
+                                    Pixmap pixmap);
+static void wallpaper_compose_free (struct wallpaper_compose *compose);
+static struct wallpaper_async *wallpaper_async_start (
+        struct geometry **heads, struct wallpaper_spec **specs,
+        int set_root);
+static int wallpaper_async_pipe (void);
+static void wallpaper_async_job_run (void *arg);
+static void wallpaper_async_cancel (struct wallpaper_async **async);
+static int wallpaper_async_uses (struct wallpaper_async *async,
+                                 const char *path);
+static void wallpaper_async_complete (struct wallpaper_async *async);
+static void wallpaper_async_free (struct wallpaper_async *async);
+static int wallpaper_render_find_same (struct geometry **heads,
+                                       struct wallpaper_spec **specs,
+                                       uint64_t *digests, int num);
+static int wallpaper_heads_overlap (struct geometry *h1, struct geometry *h2);
+static struct wallpaper_job *wallpaper_render_find_job (
+        struct wallpaper_job *jobs, int num_jobs,
+        struct geometry *head, struct wallpaper_spec *spec);
+static struct cache_node *wallpaper_render_head (struct geometry *head,
+                                                 struct wallpaper_spec *spec,
+                                                 struct wallpaper_job *job);
+static void wallpaper_draw_placeholder (Pixmap pixmap, struct geometry *head,
+                                        struct wallpaper_spec *spec,
+                                        struct wallpaper_job *job);
+static void wallpaper_job_init (struct wallpaper_job *job,
+                                struct geometry *head,
+                                struct wallpaper_spec *spec,
+                                struct cache_node *node);
+static void wallpaper_job_run (void *arg);
+static void wallpaper_job_free (struct wallpaper_job *job);
+static void wallpaper_render_source (struct wallpaper_job *job);
+static void wallpaper_render_placeholder (struct wallpaper_job *job);
+static int wallpaper_placeholder_decode (struct wallpaper_job *job,
+                                         const char *path, int reduce);
+static int wallpaper_get_average (struct wallpaper_spec *spec,
+                                  struct color *color);
+static void wallpaper_set_average (struct wallpaper_spec *spec,
+                                   struct render_buf *buf);
+static void wallpaper_render_image (struct wallpaper_job *job, uint64_t key);
+static int wallpaper_render_stream (struct wallpaper_job *job, int reduce);
+static const uint32_t *wallpaper_stream_row (void *data, int y);
+static int wallpaper_image_reduce (struct wallpaper_job *job);
+static struct disk_cache_entry *wallpaper_disk_cache_get (
+        struct geometry *head, struct wallpaper_spec *spec, uint64_t *key_ret);
+static struct cache_node *wallpaper_cache_data (const char *head_spec,
+                                                struct geometry *head,
+                                                struct wallpaper_spec *spec,
+                                                uint32_t *data,
+                                                unsigned char *packed,
+                                                size_t packed_bytes);
+static int wallpaper_cache_promote (struct cache_node *node,
+                                    struct geometry *head,
+                                    struct wallpaper_spec *spec,
+                                    struct wallpaper_job *job);
+static void wallpaper_trace (struct geometry *head, struct wallpaper_spec *spec,
+                             long cost);
+static int wallpaper_fade_init_head (struct wallpaper_fade_head *fade_head,
+                                     struct geometry *head,
+                                     struct wallpaper_spec *from,
+                                     struct wallpaper_spec *to);
+static void wallpaper_fade_init_job (struct wallpaper_job *job,
+                                     struct geometry *head,
+                                     struct wallpaper_spec *spec);
+static void wallpaper_fade_ready (struct wallpaper_fade *fade);
+static void wallpaper_fade_free (struct wallpaper_fade *fade);
+static void wallpaper_fade_draw (struct wallpaper_fade_head *fade_head,
+                                 int alpha);
+static void wallpaper_free_pixmap (Pixmap pixmap);
+static void wallpaper_free_root_specs (void);
+static void wallpaper_free_specs (struct geometry **heads,
+                                  struct wallpaper_spec **specs);
 static void wallpaper_set_x11 (Pixmap pixmap);
-static Pixmap wallpaper_create_x11_pixmap (Imlib_Image image);
+static void wallpaper_set_x11_pixel (unsigned long pixel);
+static Pixmap wallpaper_create_x11_pixmap (struct geometry *head,
+                                           uint32_t *data, int dither);
+static int wallpaper_dither (struct wallpaper_spec *spec);
+static void wallpaper_put_native (Drawable drawable, int x, int y,
+                                  int width, int height, uint32_t *data,
+                                  int dither);
 
 /**
  * Set wallpaper from image path.
@@ -39,31 +278,180 @@ wallpaper_set (struct wallpaper_filter *filter)
         wallpaper_cache_clear (1);
     }
 
-    /* Build specification for filter to check if cache is ok. */
-    char *cache_spec = wallpaper_render_spec (filter);
-    if (strcmp (CACHE_SPEC, cache_spec) == 0) {
-        mem_free (cache_spec);
+    /* Match wallpaper once per head, the same specs are used for
+       building the cache spec and rendering. */
+    struct geometry **heads = x11_get_heads ();
+    int num;
+    for (num = 0; heads[num]; num++)
+        ;
+    struct wallpaper_spec **specs =
+        mem_new (sizeof (struct wallpaper_spec*) * (num + 1));
+    for (int i = 0; i < num; i++) {
+        filter->head = i;
+        specs[i] = wallpaper_match (filter);
+    }
+    specs[num] = 0;
+    DESKTOP = filter->desktop;
+
+    /* Build specification for filter to check if root is up to date. */
+    char cache_spec[sizeof (CACHE_SPEC)];
+    wallpaper_render_spec (heads, specs, cache_spec, sizeof (cache_spec));
+    if (strcmp (CACHE_SPEC, cache_spec) != 0) {
+        wallpaper_set_root (heads, specs);
+        snprintf (CACHE_SPEC, sizeof (CACHE_SPEC), "%s", cache_spec);
+    }
+
+    /* Keep specs used for the root, used to refresh it. */
+    wallpaper_free_root_specs ();
+    ROOT_HEADS = heads;
+    ROOT_SPECS = specs;
+}
+
+/**
+ * Check if the head layout changed since last called, renders are
+ * cached per head size so they are kept across layout changes and
+ * reused when returning to a previously seen layout.
+ */
+int
+wallpaper_layout_changed (void)
+{
+    struct geometry **heads = x11_get_heads ();
+    uint64_t layout = x11_get_layout_signature (heads);
+    for (int i = 0; heads[i]; i++) {
+        mem_free (heads[i]);
+    }
+    mem_free (heads);
+
+    if (layout == LAYOUT) {
+        return 0;
+    }
+    LAYOUT = layout;
+    return 1;
+}
+
+/**
+ * Drop cached renders of path, returns 1 if the current root pixmap
+ * was rendered from path.
+ */
+int
+wallpaper_invalidate (const char *path)
+{
+    /* Renders of the old file in progress are not cached. */
+    if (wallpaper_async_uses (ASYNC_ROOT, path)) {
+        wallpaper_async_cancel (&ASYNC_ROOT);
+    }
+    if (wallpaper_async_uses (ASYNC_PREFETCH, path)) {
+        wallpaper_async_cancel (&ASYNC_PREFETCH);
+    }
+
+    unsigned int num = 0;
+    if (CACHE) {
+        num = cache_invalidate_path (CACHE, path);
+    }
+    if (IMAGE_CACHE) {
+        image_cache_invalidate (IMAGE_CACHE, path);
+    }
+    uint64_t digest = str_digest (path);
+    if (AVERAGES[digest % WALLPAPER_AVERAGES].digest == digest) {
+        AVERAGES[digest % WALLPAPER_AVERAGES].digest = 0;
+    }
+
+    int is_root = 0;
+    for (int i = 0; ROOT_SPECS && ROOT_HEADS[i]; i++) {
+        if (ROOT_SPECS[i] && ROOT_SPECS[i]->type == WALLPAPER_TYPE_IMAGE
+            && ! strcmp (ROOT_SPECS[i]->spec, path)) {
+            is_root = 1;
+        }
+    }
+
+    if (num > 0 || is_root) {
+        fprintf (stderr, "%s changed, dropped %u cached renders\n", path, num);
+    }
+    return is_root;
+}
+
+/**
+ * Re-render the root pixmap from the specs it was last rendered from.
+ */
+void
+wallpaper_refresh (void)
+{
+    if (! ROOT_SPECS) {
         return;
     }
+    if (! CACHE) {
+        wallpaper_cache_clear (1);
+    }
 
-    Pixmap pixmap = None;
-    struct cache_node *node = cache_get_pixmap (CACHE, cache_spec);
-    if (node == NULL) {
-        Imlib_Image image = wallpaper_render (filter);
-        pixmap = wallpaper_create_x11_pixmap (image);
-        imlib_context_set_image (image);
-        imlib_free_image ();
-        node = cache_set_pixmap (CACHE, cache_spec, pixmap);
-    } else {
-        pixmap = node->pixmap;
+    wallpaper_set_root (ROOT_HEADS, ROOT_SPECS);
+}
+
+/**
+ * Release cached renders and decoded images according to memory
+ * pressure level, renders part of the current root pixmap are kept.
+ * The caches shrink progressively, the least valuable hidden renders
+ * first. Low pressure demotes server pixmaps down to 3/4 of their
+ * current size. Medium pressure shrinks server and packed renders to
+ * half and drops unused decoded images. Critical pressure drops all.
+ * Idle pooled pixmaps shrink with the server pixmaps. Returns the
+ * number of bytes released.
+ */
+size_t
+wallpaper_shrink (enum pressure_level level)
+{
+    if (CACHE == NULL || level == PRESSURE_NONE) {
+        return 0;
     }
 
-    if (pixmap != None) {
-        wallpaper_set_x11 (pixmap);
+    /* Quarters kept of the current size. */
+    size_t keep = 0;
+    if (level == PRESSURE_LOW) {
+        keep = 3;
+    } else if (level == PRESSURE_MEDIUM) {
+        keep = 2;
     }
 
-    snprintf (CACHE_SPEC, sizeof(CACHE_SPEC), "%s", cache_spec);
-    mem_free (cache_spec);
+    size_t max_packed_bytes = CACHE->packed_bytes;
+    if (level != PRESSURE_LOW) {
+        max_packed_bytes = max_packed_bytes / 4 * keep;
+    }
+    size_t bytes = cache_shrink (CACHE, CACHE->bytes / 4 * keep,
+                                 max_packed_bytes);
+    if (level != PRESSURE_LOW) {
+        bytes += image_cache_shrink (IMAGE_CACHE);
+    }
+    if (PIXMAP_POOL) {
+        bytes += pixmap_pool_shrink (PIXMAP_POOL,
+                                     PIXMAP_POOL->bytes / 4 * keep);
+    }
+    return bytes;
+}
+
+/**
+ * Free heads and specs of the current root pixmap.
+ */
+void
+wallpaper_free_root_specs (void)
+{
+    wallpaper_free_specs (ROOT_HEADS, ROOT_SPECS);
+    ROOT_SPECS = 0;
+    ROOT_HEADS = 0;
+}
+
+/**
+ * Free heads and the specs matched for them.
+ */
+static void
+wallpaper_free_specs (struct geometry **heads, struct wallpaper_spec **specs)
+{
+    for (int i = 0; heads && heads[i]; i++) {
+        if (specs[i]) {
+            wallpaper_spec_free (specs[i]);
+        }
+        mem_free (heads[i]);
+    }
+    mem_free (specs);
+    mem_free (heads);
 }
 
 /**
@@ -72,113 +460,1871 @@ wallpaper_set (struct wallpaper_filter *filter)
 void
 wallpaper_cache_clear (int do_alloc)
 {
+    wallpaper_async_cancel (&ASYNC_ROOT);
+    wallpaper_async_cancel (&ASYNC_PREFETCH);
+    wallpaper_fade_stop ();
+    if (POOL != 0) {
+        /* Jobs use the caches, reap the cancelled renders. */
+        pool_wait (POOL);
+        wallpaper_process ();
+    }
     if (CACHE != 0) {
         cache_free (CACHE);
         CACHE = 0;
     }
+    trace_close ();
+    if (IMAGE_CACHE != 0) {
+        image_cache_free (IMAGE_CACHE);
+        IMAGE_CACHE = 0;
+    }
+    if (DISK_CACHE != 0) {
+        disk_cache_free (DISK_CACHE);
+        DISK_CACHE = 0;
+    }
+    if (POOL != 0) {
+        pool_free (POOL);
+        POOL = 0;
+    }
+    if (PIXMAP_POOL != 0 && ! do_alloc) {
+        fprintf (stderr, "pixmap pool reused %u of %u pixmaps\n",
+                 PIXMAP_POOL->hits,
+                 PIXMAP_POOL->hits + PIXMAP_POOL->misses);
+        pixmap_pool_free (PIXMAP_POOL);
+        PIXMAP_POOL = 0;
+    }
     if (do_alloc) {
-        CACHE = cache_new ();
+        if (PIXMAP_POOL == 0) {
+            PIXMAP_POOL = pixmap_pool_new (CONFIG->cache_pool_max_bytes);
+        }
+        wallpaper_init_render ();
+        POOL = pool_new (CONFIG->render_threads);
+        unsigned int max_entries = CONFIG->cache_max_entries;
+        size_t max_packed_bytes = 0;
+        if (CONFIG->cache_packed) {
+            if (CONFIG->cache_hot_entries
+                && (! max_entries || CONFIG->cache_hot_entries < max_entries)) {
+                max_entries = CONFIG->cache_hot_entries;
+            }
+            max_packed_bytes = CONFIG->cache_packed_max_bytes;
+        }
+        CACHE = cache_new (CONFIG->cache_max_bytes, max_entries,
+                           max_packed_bytes, CONFIG->cache_policy,
+                           wallpaper_free_pixmap);
+        if (CONFIG->cache_trace_path) {
+            trace_open (CONFIG->cache_trace_path);
+        }
     }
     CACHE_SPEC[0] = '\0';
 }
 
 /**
- * Create spec string for filter.
+ * Set up rendering of images into the disk cache, the subset of
+ * wallpaper_cache_clear not depending on the X11 connection. Used on
+ * its own by the pre-warm helper process.
  */
-char*
-wallpaper_render_spec (struct wallpaper_filter *filter)
+void
+wallpaper_init_render (void)
 {
-    char buf[4096] = {0};
+    kernel_set (CONFIG->render_kernel);
+    render_set_upscale (CONFIG->render_upscale);
+    IMAGE_CACHE = image_cache_new (CONFIG->cache_image_max_bytes);
+    if (CONFIG->cache_disk && CONFIG->cache_shared_path) {
+        DISK_CACHE = disk_cache_new_shared (CONFIG->cache_shared_path,
+                                            CONFIG->cache_disk_max_bytes,
+                                            CONFIG->cache_disk_max_age);
+    } else if (CONFIG->cache_disk) {
+        char *dir = disk_cache_get_dir ();
+        DISK_CACHE = disk_cache_new (dir, CONFIG->cache_disk_max_bytes,
+                                     CONFIG->cache_disk_max_age);
+        mem_free (dir);
+    }
+}
 
-    int heads = x11_get_num_heads ();
-    for (int i = 0; i < heads; i++) {
-        struct wallpaper_spec *spec = wallpaper_match (filter);
-        if (spec == NULL) {
-            strlcat(buf, "UNDEFINED", sizeof(buf));
-        } else {
-            size_t pos = strlen(buf);
-            snprintf(buf + pos, sizeof(buf) - pos, "%s-%d-%d",
-                     spec->spec, spec->mode, spec->type);
-            wallpaper_spec_free (spec);
+/**
+ * Create spec string for all heads, including head placement.
+ */
+void
+wallpaper_render_spec (struct geometry **heads, struct wallpaper_spec **specs,
+                       char *buf, size_t size)
+{
+    char head_spec[4096];
+
+    snprintf (buf, size, "%016llx;",
+              (unsigned long long) x11_get_layout_signature (heads));
+    for (int i = 0; heads[i]; i++) {
+        size_t pos = strlen (buf);
+        snprintf (buf + pos, size - pos, "%d:", i);
+        wallpaper_head_spec (specs[i], heads[i]->width, heads[i]->height,
+                             head_spec, sizeof (head_spec));
+        strlcat (buf, head_spec, size);
+        strlcat (buf, ";", size);
+    }
+}
+
+/**
+ * Set root background from per head specs. When every head shows the
+ * whole display with the same solid color, tiled image or gradient,
+ * only a single pixel, the tile or a strip of the gradient is sent to
+ * the X server which repeats it into a display sized root pixmap.
+ *
+ * Images expected to take longer than the progressive budget to render
+ * are shown as placeholders while the full quality render is done on
+ * the render pool, it is set by wallpaper_process.
+ */
+static void
+wallpaper_set_root (struct geometry **heads, struct wallpaper_spec **specs)
+{
+    /* Renders in progress yield to the new root, not waited for. */
+    wallpaper_async_cancel (&ASYNC_ROOT);
+    wallpaper_async_cancel (&ASYNC_PREFETCH);
+    wallpaper_fade_stop ();
+    cache_clear_visible (CACHE);
+    LAYOUT = x11_get_layout_signature (heads);
+
+    struct wallpaper_spec *spec = wallpaper_render_single (heads, specs);
+    if (spec != NULL && spec->type == WALLPAPER_TYPE_COLOR) {
+        struct color color;
+        x11_parse_color (spec->spec, &color);
+        wallpaper_set_x11_pixel (x11_get_pixel (&color));
+        return;
+    }
+
+    Pixmap pixmap = None;
+    if (spec != NULL && spec->type == WALLPAPER_TYPE_GRADIENT) {
+        pixmap = wallpaper_render_gradient (spec, heads[0]->width,
+                                            heads[0]->height);
+    } else if (spec != NULL) {
+        pixmap = wallpaper_render_tile (spec);
+    }
+    if (pixmap != None) {
+        pixmap = wallpaper_tile_display (pixmap);
+    }
+    if (pixmap == None && wallpaper_use_placeholder (heads, specs)) {
+        wallpaper_set_x11 (wallpaper_render (heads, specs, 1));
+        x11_flush ();
+        ASYNC_ROOT = wallpaper_async_start (heads, specs, 1);
+        return;
+    }
+    if (pixmap == None) {
+        pixmap = wallpaper_render (heads, specs, 0);
+    }
+    wallpaper_set_x11 (pixmap);
+}
+
+/**
+ * Get spec shown on the whole display if it is a color, gradient or a
+ * tiled image shown the same on every head, else NULL.
+ */
+static struct wallpaper_spec*
+wallpaper_render_single (struct geometry **heads,
+                         struct wallpaper_spec **specs)
+{
+    struct geometry *disp = x11_get_geometry ();
+    struct wallpaper_spec *spec = specs[0];
+    for (int i = 0; spec && heads[i]; i++) {
+        if (specs[i] == NULL
+            || heads[i]->x != 0 || heads[i]->y != 0
+            || heads[i]->width != disp->width
+            || heads[i]->height != disp->height
+            || specs[i]->type != spec->type
+            || specs[i]->mode != spec->mode
+            || strcmp (specs[i]->spec, spec->spec)) {
+            spec = NULL;
         }
     }
+    mem_free (disp);
 
-    return str_dup(buf);
+    if (spec == NULL
+        || (spec->type == WALLPAPER_TYPE_IMAGE && spec->mode != MODE_TILED)) {
+        return NULL;
+    }
+    return spec;
 }
 
 /**
- * Render image on all available heads.
+ * Create pixmap holding a single tile of the tiled image spec, blended
+ * on black. Returns None if the image fails to load or the tile is not
+ * smaller than the display in pixels.
  */
-static Imlib_Image
-wallpaper_render (struct wallpaper_filter *filter)
+static Pixmap
+wallpaper_render_tile (struct wallpaper_spec *spec)
 {
+    struct image_cache_node *source = image_cache_get (IMAGE_CACHE,
+                                                       spec->spec);
+    if (source == NULL) {
+        return None;
+    }
+
     struct geometry *disp = x11_get_geometry ();
-    struct color black = { 0, 0, 0 };
-    Imlib_Image image_disp =
-        render_new_color (disp->width, disp->height, &black);
+    Pixmap pixmap = None;
+    if ((size_t) source->width * source->height
+        < (size_t) disp->width * disp->height) {
+        struct render_buf image = { source->width, source->height,
+                                    source->data, source->has_alpha };
+        struct render_buf tile;
+        render_buf_init (&tile, source->width, source->height);
+        render_tiled (&tile, &image);
+
+        pixmap = wallpaper_create_root_pixmap (&tile,
+                                               wallpaper_dither (spec));
+        render_buf_free (&tile);
+        watch_add_file (spec->spec);
+    }
     mem_free (disp);
+    image_cache_release (IMAGE_CACHE, source);
+    return pixmap;
+}
 
-    struct geometry **heads = x11_get_heads ();
-    for (int i = 0; heads[i]; i++) {
-        filter->head = i;
-        struct wallpaper_spec *spec = wallpaper_match (filter);
-        if (spec != NULL) {
-            Imlib_Image image_head;
-            if (spec->type == WALLPAPER_TYPE_COLOR) {
-                image_head = render_color (heads[i], spec->spec);
-            } else {
-                image_head = render_image (heads[i], spec->spec, spec->mode);
-            }
+/**
+ * Create pixmap holding the strip of the gradient spec laid out over
+ * width x height the X server repeats over the rest. Returns None if
+ * the gradient does not repeat.
+ */
+static Pixmap
+wallpaper_render_gradient (struct wallpaper_spec *spec, int width,
+                           int height)
+{
+    struct render_gradient gradient;
+    wallpaper_gradient_parse (spec->spec, &gradient);
+    if (gradient.type == RENDER_GRADIENT_DIAGONAL) {
+        return None;
+    }
 
-            imlib_context_set_image (image_disp);
-            imlib_blend_image_onto_image (
-                image_head, 0,
-                0, 0, heads[i]->width, heads[i]->height,
-                heads[i]->x, heads[i]->y, heads[i]->width, heads[i]->height);
+    int strip_width, strip_height;
+    render_gradient_size (&gradient, width, height,
+                          &strip_width, &strip_height);
+    struct render_buf strip;
+    render_buf_init (&strip, strip_width, strip_height);
+    render_gradient (&strip, &gradient, width, height);
+    Pixmap pixmap = wallpaper_create_root_pixmap (&strip,
+                                                  wallpaper_dither (spec));
+    render_buf_free (&strip);
+    return pixmap;
+}
 
-            imlib_context_set_image (image_head);
-            imlib_free_image ();
+/**
+ * Check if spec is a gradient repeating a strip.
+ */
+static int
+wallpaper_gradient_repeats (struct wallpaper_spec *spec)
+{
+    struct render_gradient gradient;
+    return spec->type == WALLPAPER_TYPE_GRADIENT
+        && wallpaper_gradient_parse (spec->spec, &gradient)
+        && gradient.type != RENDER_GRADIENT_DIAGONAL;
+}
 
-            wallpaper_spec_free (spec);
-        }
-        mem_free (heads[i]);
+/**
+ * Parse gradient spec, a direction followed by two or more colors, and
+ * set the bits to dither to from the display. Returns 0 if spec is
+ * invalid, gradient is then a vertical black gradient.
+ */
+static int
+wallpaper_gradient_parse (const char *spec, struct render_gradient *gradient)
+{
+    memset (gradient, 0, sizeof (struct render_gradient));
+    gradient->type = RENDER_GRADIENT_VERTICAL;
+    gradient->num_colors = 2;
+    int bits[3] = { 8, 8, 8 };
+    if (CONFIG->render_dither) {
+        x11_get_visual_bits (&bits[0], &bits[1], &bits[2]);
     }
-    mem_free (heads);
+    for (int i = 0; i < 3; i++) {
+        /* Visuals without color masks are not dithered. */
+        gradient->bits[i] = bits[i] > 0 && bits[i] < 8 ? bits[i] : 8;
+    }
+
+    char *str = str_dup (spec);
+    char *save;
+    char *tok = strtok_r (str, " ,", &save);
+    int ok = 1;
+    if (tok && ! strcasecmp (tok, "vertical")) {
+        gradient->type = RENDER_GRADIENT_VERTICAL;
+    } else if (tok && ! strcasecmp (tok, "horizontal")) {
+        gradient->type = RENDER_GRADIENT_HORIZONTAL;
+    } else if (tok && ! strcasecmp (tok, "diagonal")) {
+        gradient->type = RENDER_GRADIENT_DIAGONAL;
+    } else {
+        ok = 0;
+    }
+
+    int num = 0;
+    while (ok && (tok = strtok_r (NULL, " ,", &save)) != NULL) {
+        ok = num < RENDER_GRADIENT_MAX_COLORS
+            && x11_parse_color (tok, &gradient->colors[num++]);
+    }
+    mem_free (str);
 
-    return image_disp;
+    if (ok && num >= 2) {
+        gradient->num_colors = num;
+        return 1;
+    }
+    memset (gradient->colors, 0, sizeof (gradient->colors));
+    return 0;
 }
 
 /**
- * Render image as X11 background.
+ * Upload buf to a pixmap used as root pixmap or tile.
  */
-void
-wallpaper_set_x11 (Pixmap pixmap)
+static Pixmap
+wallpaper_create_root_pixmap (struct render_buf *buf, int dither)
+{
+    struct geometry size = { 0, 0, buf->width, buf->height, 0 };
+    return wallpaper_create_x11_pixmap (&size, buf->data, dither);
+}
+
+/**
+ * Repeat tile over a display sized pixmap server side, tile is freed.
+ */
+static Pixmap
+wallpaper_tile_display (Pixmap tile)
 {
-    static Pixmap last_pixmap = 0;
-    if (last_pixmap != pixmap) {
-        last_pixmap = pixmap;
+    struct geometry *disp = x11_get_geometry ();
+    Pixmap pixmap = wallpaper_get_pixmap (disp->width, disp->height);
+    x11_tile_rectangle (pixmap, tile, 0, 0, disp->width, disp->height);
+    mem_free (disp);
+    wallpaper_free_pixmap (tile);
+    return pixmap;
+}
 
-        x11_set_atom_value_long (x11_get_root_window (), ATOM_ROOTPMAP_ID,
-                                 XA_PIXMAP, pixmap);
-        x11_set_background_pixmap (x11_get_root_window (), pixmap);
+/**
+ * Get width x height pixmap from the pixmap pool, freed with
+ * wallpaper_free_pixmap.
+ */
+static Pixmap
+wallpaper_get_pixmap (int width, int height)
+{
+    if (PIXMAP_POOL) {
+        return pixmap_pool_get (PIXMAP_POOL, width, height);
     }
+    return x11_create_pixmap (width, height);
 }
 
 /**
- * Create Pixmap from from image.
+ * Check if placeholders should be shown while rendering specs, true
+ * if any image is neither cached nor packed and the average render
+ * time exceeds the budget.
  */
-Pixmap
-wallpaper_create_x11_pixmap (Imlib_Image image)
+static int
+wallpaper_use_placeholder (struct geometry **heads,
+                           struct wallpaper_spec **specs)
 {
-    imlib_context_set_display (x11_get_display ());
-    imlib_context_set_visual (x11_get_visual ());
-    imlib_context_set_colormap (x11_get_colormap ());
-    imlib_context_set_image (image);
-    imlib_context_set_drawable (x11_get_root_window ());
+    if (CONFIG->render_num_placeholders == 0
+        || (RENDER_TIME != 0
+            && RENDER_TIME <= CONFIG->render_progressive_budget)) {
+        return 0;
+    }
+
+    char head_spec[4096];
+    for (int i = 0; heads[i]; i++) {
+        if (specs[i] == NULL || specs[i]->type != WALLPAPER_TYPE_IMAGE) {
+            continue;
+        }
+        wallpaper_head_spec (specs[i], heads[i]->width, heads[i]->height,
+                             head_spec, sizeof (head_spec));
+        struct cache_node *node = cache_peek_pixmap (CACHE, head_spec);
+        if (node == NULL
+            || (node->pixmap == None && node->packed == NULL)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Compose root pixmap from per head renders, all composition is done
+ * server side. With placeholder set, placeholders are rendered instead
+ * and nothing is added to the cache.
+ */
+static Pixmap
+wallpaper_render (struct geometry **heads, struct wallpaper_spec **specs,
+                  int placeholder)
+{
+    struct wallpaper_compose compose;
+    wallpaper_compose_init (&compose, heads, specs, placeholder, NULL);
+    pool_wait_group (POOL, &compose.group);
+    Pixmap pixmap = wallpaper_compose_pixmap (&compose);
+    wallpaper_compose_free (&compose);
+    return pixmap;
+}
+
+/**
+ * Prepare composition of heads, jobs of heads not ready in the cache
+ * are submitted to the render pool. Heads with the same spec and size,
+ * such as mirrored outputs, are rendered once and copied from the first
+ * head. With async set, completed jobs notify wallpaper_process and
+ * own the packed renders they unpack as the cache may drop them before
+ * the composition completes.
+ */
+static void
+wallpaper_compose_init (struct wallpaper_compose *compose,
+                        struct geometry **heads,
+                        struct wallpaper_spec **specs, int placeholder,
+                        struct wallpaper_async *async)
+{
+    int num;
+    for (num = 0; heads[num]; num++)
+        ;
+    compose->heads = heads;
+    compose->specs = specs;
+    compose->placeholder = placeholder;
+    compose->digests = mem_new (sizeof (uint64_t) * (num + 1));
+    compose->same = mem_new (sizeof (int) * (num + 1));
+    compose->head_jobs = mem_new (sizeof (struct wallpaper_job*) * (num + 1));
+    compose->jobs = mem_new (sizeof (struct wallpaper_job) * (num + 1));
+    compose->num_jobs = 0;
+    compose->group.pending = 0;
+
+    uint64_t *digests = compose->digests;
+    int *same = compose->same;
+    struct wallpaper_job **head_jobs = compose->head_jobs;
+    char head_spec[4096];
+
+    for (int i = 0; heads[i]; i++) {
+        digests[i] = 0;
+        same[i] = -1;
+        head_jobs[i] = NULL;
+        if (specs[i] == NULL) {
+            continue;
+        }
+
+        wallpaper_head_spec (specs[i], heads[i]->width, heads[i]->height,
+                             head_spec, sizeof (head_spec));
+        digests[i] = str_digest (head_spec);
+        if (specs[i]->type == WALLPAPER_TYPE_COLOR
+            || wallpaper_gradient_repeats (specs[i])) {
+            continue;
+        }
+
+        same[i] = wallpaper_render_find_same (heads, specs, digests, i);
+        if (same[i] != -1) {
+            continue;
+        }
+
+        head_jobs[i] = wallpaper_render_find_job (compose->jobs,
+                                                  compose->num_jobs,
+                                                  heads[i], specs[i]);
+        struct cache_node *node = cache_peek_pixmap (CACHE, head_spec);
+        if (head_jobs[i] == NULL && (node == NULL || node->pixmap == None)) {
+            head_jobs[i] = &compose->jobs[compose->num_jobs++];
+            wallpaper_job_init (head_jobs[i], heads[i], specs[i], node);
+            if (placeholder) {
+                head_jobs[i]->placeholder = 1;
+                head_jobs[i]->has_average =
+                    wallpaper_get_average (specs[i], &head_jobs[i]->color);
+            }
+        }
+    }
 
-    Pixmap pixmap = 0, mask = 0;
-    imlib_render_pixmaps_for_whole_image (&pixmap, &mask);
-    x11_set_background_pixmap (x11_get_root_window (), pixmap);
+    pool_fn fn = async ? wallpaper_async_job_run : wallpaper_job_run;
+    for (int i = 0; i < compose->num_jobs; i++) {
+        struct wallpaper_job *job = &compose->jobs[i];
+        job->async = async;
+        if (async && job->packed_src != NULL) {
+            job->packed_src_copy = mem_new (job->packed_src_bytes);
+            memcpy (job->packed_src_copy, job->packed_src,
+                    job->packed_src_bytes);
+            job->packed_src = job->packed_src_copy;
+        }
+        pool_submit (POOL, &compose->group, fn, job);
+    }
+}
+
+/**
+ * Draw completed composition onto a new display sized pixmap.
+ */
+static Pixmap
+wallpaper_compose_pixmap (struct wallpaper_compose *compose)
+{
+    struct geometry *disp = x11_get_geometry ();
+    Pixmap pixmap = wallpaper_get_pixmap (disp->width, disp->height);
+    x11_fill_rectangle (pixmap, 0, 0, disp->width, disp->height);
+    mem_free (disp);
+    wallpaper_compose_draw (compose, pixmap);
     return pixmap;
 }
 
+/**
+ * Draw completed composition onto pixmap in head order, caching the
+ * head renders. With pixmap None only the renders of heads with a job
+ * are cached.
+ */
+static void
+wallpaper_compose_draw (struct wallpaper_compose *compose, Pixmap pixmap)
+{
+    struct geometry **heads = compose->heads;
+    struct wallpaper_spec **specs = compose->specs;
+    int *same = compose->same;
+
+    for (int i = 0; heads[i]; i++) {
+        if (specs[i] == NULL) {
+            continue;
+        }
+
+        if (pixmap == None) {
+            if (compose->head_jobs[i] != NULL && ! compose->placeholder) {
+                wallpaper_render_head (heads[i], specs[i],
+                                       compose->head_jobs[i]);
+            }
+            continue;
+        }
+
+        if (specs[i]->type == WALLPAPER_TYPE_COLOR) {
+            struct color color;
+            x11_parse_color (specs[i]->spec, &color);
+            x11_fill_rectangle_pixel (pixmap, x11_get_pixel (&color),
+                                      heads[i]->x, heads[i]->y,
+                                      heads[i]->width, heads[i]->height);
+            continue;
+        }
+        if (wallpaper_gradient_repeats (specs[i])) {
+            Pixmap strip = wallpaper_render_gradient (specs[i],
+                                                      heads[i]->width,
+                                                      heads[i]->height);
+            x11_tile_rectangle (pixmap, strip, heads[i]->x, heads[i]->y,
+                                heads[i]->width, heads[i]->height);
+            wallpaper_free_pixmap (strip);
+            continue;
+        }
+
+        if (same[i] != -1) {
+            if (heads[same[i]]->x != heads[i]->x
+                || heads[same[i]]->y != heads[i]->y) {
+                x11_copy_area (pixmap, pixmap,
+                               heads[same[i]]->x, heads[same[i]]->y,
+                               heads[i]->width, heads[i]->height,
+                               heads[i]->x, heads[i]->y);
+            }
+            continue;
+        }
+
+        if (compose->placeholder) {
+            wallpaper_draw_placeholder (pixmap, heads[i], specs[i],
+                                        compose->head_jobs[i]);
+            continue;
+        }
+
+        struct cache_node *node =
+            wallpaper_render_head (heads[i], specs[i], compose->head_jobs[i]);
+        if (node != NULL) {
+            node->visible = 1;
+            x11_copy_area (node->pixmap, pixmap, 0, 0,
+                           heads[i]->width, heads[i]->height,
+                           heads[i]->x, heads[i]->y);
+        }
+    }
+}
+
+/**
+ * Free resources used by composition, its jobs must be completed.
+ */
+static void
+wallpaper_compose_free (struct wallpaper_compose *compose)
+{
+    for (int i = 0; i < compose->num_jobs; i++) {
+        wallpaper_job_free (&compose->jobs[i]);
+    }
+    mem_free (compose->jobs);
+    mem_free (compose->head_jobs);
+    mem_free (compose->same);
+    mem_free (compose->digests);
+}
+
+/**
+ * Start full quality render of heads on the render pool, cached and
+ * with set_root set as root by wallpaper_process once all jobs are
+ * done. The heads and specs are copied as the root specs may be
+ * replaced before then. Returns the render in progress, or NULL if it
+ * is already done.
+ */
+static struct wallpaper_async*
+wallpaper_async_start (struct geometry **heads,
+                       struct wallpaper_spec **specs, int set_root)
+{
+    if (! wallpaper_async_pipe ()) {
+        Pixmap pixmap = wallpaper_render (heads, specs, 0);
+        if (set_root) {
+            wallpaper_set_x11 (pixmap);
+        } else {
+            wallpaper_free_pixmap (pixmap);
+        }
+        return NULL;
+    }
+
+    int num;
+    for (num = 0; heads[num]; num++)
+        ;
+    struct geometry **heads_copy =
+        mem_new (sizeof (struct geometry*) * (num + 1));
+    struct wallpaper_spec **specs_copy =
+        mem_new (sizeof (struct wallpaper_spec*) * (num + 1));
+    for (int i = 0; i < num; i++) {
+        heads_copy[i] = mem_new (sizeof (struct geometry));
+        *heads_copy[i] = *heads[i];
+        specs_copy[i] = specs[i] ? wallpaper_spec_copy (specs[i]) : NULL;
+    }
+    heads_copy[num] = 0;
+    specs_copy[num] = 0;
+
+    struct wallpaper_async *async = mem_new (sizeof (struct wallpaper_async));
+    async->set_root = set_root;
+    async->cancelled = 0;
+    async->done = 0;
+    wallpaper_compose_init (&async->compose, heads_copy, specs_copy, 0,
+                            async);
+    if (async->compose.num_jobs == 0) {
+        wallpaper_async_complete (async);
+        return NULL;
+    }
+    return async;
+}
+
+/**
+ * Create the pipe jobs notify the main thread through, returns 0 on
+ * failure.
+ */
+static int
+wallpaper_async_pipe (void)
+{
+    if (ASYNC_FDS[0] != -1) {
+        return 1;
+    }
+    if (pipe (ASYNC_FDS) == -1) {
+        perror ("failed to create render pipe");
+        return 0;
+    }
+    fcntl (ASYNC_FDS[0], F_SETFD, FD_CLOEXEC);
+    fcntl (ASYNC_FDS[1], F_SETFD, FD_CLOEXEC);
+    fcntl (ASYNC_FDS[0], F_SETFL, O_NONBLOCK);
+    return 1;
+}
+
+/**
+ * Run job of a render or cross-fade on the render pool, notifying the
+ * main thread.
+ */
+static void
+wallpaper_async_job_run (void *arg)
+{
+    struct wallpaper_job *job = arg;
+    wallpaper_job_run (job);
+    /* Writes smaller than PIPE_BUF are atomic, reads see whole
+       pointers. */
+    while (write (ASYNC_FDS[1], &job, sizeof (job)) == -1 && errno == EINTR)
+        ;
+}
+
+/**
+ * Cancel render in progress on the render pool without waiting for
+ * it, jobs not started are dropped and the renders of running jobs are
+ * discarded by wallpaper_process. async is set to NULL.
+ */
+static void
+wallpaper_async_cancel (struct wallpaper_async **async)
+{
+    if (*async == NULL) {
+        return;
+    }
+
+    struct wallpaper_async *cancel = *async;
+    *async = NULL;
+    cancel->cancelled = 1;
+    cancel->done += pool_cancel_group (POOL, &cancel->compose.group);
+    if (cancel->done >= cancel->compose.num_jobs) {
+        wallpaper_async_free (cancel);
+    }
+}
+
+/**
+ * Check if render in progress async, or NULL, renders the image at
+ * path.
+ */
+static int
+wallpaper_async_uses (struct wallpaper_async *async, const char *path)
+{
+    for (int i = 0; async && async->compose.heads[i]; i++) {
+        struct wallpaper_spec *spec = async->compose.specs[i];
+        if (spec && spec->type == WALLPAPER_TYPE_IMAGE
+            && ! strcmp (spec->spec, path)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Cache the renders of the completed render async, setting it as root
+ * if requested, and free it.
+ */
+static void
+wallpaper_async_complete (struct wallpaper_async *async)
+{
+    if (async->set_root) {
+        wallpaper_set_x11 (wallpaper_compose_pixmap (&async->compose));
+    } else {
+        wallpaper_compose_draw (&async->compose, None);
+    }
+    wallpaper_async_free (async);
+}
+
+/**
+ * Free render async, all its jobs must be done.
+ */
+static void
+wallpaper_async_free (struct wallpaper_async *async)
+{
+    /* The last job notifies just before it leaves the pool. */
+    pool_wait_group (POOL, &async->compose.group);
+    wallpaper_compose_free (&async->compose);
+    wallpaper_free_specs (async->compose.heads, async->compose.specs);
+    mem_free (async);
+}
+
+/**
+ * Get file descriptor readable when renders on the render pool have
+ * jobs done, -1 if none has been started.
+ */
+int
+wallpaper_get_fd (void)
+{
+    return ASYNC_FDS[0];
+}
+
+/**
+ * Count jobs done of the renders and cross-fades on the render pool,
+ * completing the ones with all jobs done and freeing cancelled ones.
+ */
+void
+wallpaper_process (void)
+{
+    struct wallpaper_job *done[16];
+    ssize_t num;
+    while (ASYNC_FDS[0] != -1
+           && (num = read (ASYNC_FDS[0], done, sizeof (done))) > 0) {
+        for (ssize_t i = 0; i < num / (ssize_t) sizeof (done[0]); i++) {
+            struct wallpaper_fade *fade = done[i]->fade;
+            if (fade != NULL) {
+                if (++fade->done < fade->num_heads * 2) {
+                    continue;
+                } else if (fade->cancelled) {
+                    wallpaper_fade_free (fade);
+                } else {
+                    wallpaper_fade_ready (fade);
+                }
+                continue;
+            }
+
+            struct wallpaper_async *async = done[i]->async;
+            if (++async->done < async->compose.num_jobs) {
+                continue;
+            }
+            if (async->cancelled) {
+                wallpaper_async_free (async);
+                continue;
+            }
+            if (async == ASYNC_ROOT) {
+                ASYNC_ROOT = NULL;
+            } else if (async == ASYNC_PREFETCH) {
+                ASYNC_PREFETCH = NULL;
+            }
+            wallpaper_async_complete (async);
+        }
+    }
+}
+
+/**
+ * Find head rendered before head num with the same spec and size whose
+ * area has not been drawn over by a later head, returns -1 if there is
+ * none.
+ */
+static int
+wallpaper_render_find_same (struct geometry **heads,
+                            struct wallpaper_spec **specs,
+                            uint64_t *digests, int num)
+{
+    for (int i = 0; i < num; i++) {
+        if (digests[i] != digests[num] || digests[i] == 0
+            || heads[i]->width != heads[num]->width
+            || heads[i]->height != heads[num]->height
+            || specs[i]->mode != specs[num]->mode
+            || specs[i]->type != specs[num]->type
+            || strcmp (specs[i]->spec, specs[num]->spec)) {
+            continue;
+        }
+
+        int j;
+        for (j = i + 1; j < num; j++) {
+            int is_mirror = digests[j] == digests[i]
+                && heads[j]->x == heads[i]->x && heads[j]->y == heads[i]->y;
+            if (digests[j] != 0 && ! is_mirror
+                && wallpaper_heads_overlap (heads[i], heads[j])) {
+                break;
+            }
+        }
+        if (j == num) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Check if the areas of two heads overlap.
+ */
+static int
+wallpaper_heads_overlap (struct geometry *h1, struct geometry *h2)
+{
+    return h1->x < h2->x + h2->width && h2->x < h1->x + h1->width
+        && h1->y < h2->y + h2->height && h2->y < h1->y + h1->height;
+}
+
+/**
+ * Find job rendering spec at the size of head.
+ */
+static struct wallpaper_job*
+wallpaper_render_find_job (struct wallpaper_job *jobs, int num_jobs,
+                           struct geometry *head, struct wallpaper_spec *spec)
+{
+    for (int i = 0; i < num_jobs; i++) {
+        if (jobs[i].head->width == head->width
+            && jobs[i].head->height == head->height
+            && jobs[i].spec->mode == spec->mode
+            && jobs[i].spec->type == spec->type
+            && ! strcmp (jobs[i].spec->spec, spec->spec)) {
+            return &jobs[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Get head sized render of spec from the cache, rendering it if not
+ * cached. job is a completed job rendering or unpacking spec, or NULL
+ * to render on the calling thread.
+ */
+static struct cache_node*
+wallpaper_render_head (struct geometry *head, struct wallpaper_spec *spec,
+                       struct wallpaper_job *job)
+{
+    char head_spec[4096];
+    wallpaper_head_spec (spec, head->width, head->height,
+                         head_spec, sizeof (head_spec));
+
+    struct cache_node *node = cache_get_pixmap (CACHE, head_spec);
+    if (node != NULL
+        && (node->pixmap != None
+            || wallpaper_cache_promote (node, head, spec, job))) {
+        wallpaper_trace (head, spec, node->cost ? node->cost : RENDER_TIME);
+        return node;
+    }
+
+    struct wallpaper_job job_local;
+    if (job == NULL || job->packed_src != NULL) {
+        wallpaper_job_init (&job_local, head, spec, NULL);
+        wallpaper_job_run (&job_local);
+        job = &job_local;
+    }
+
+    if (job->buf.data != NULL) {
+        int64_t start = time_monotonic_ms ();
+        node = wallpaper_cache_data (head_spec, head, spec, job->buf.data,
+                                     job->packed, job->packed_bytes);
+        job->packed = NULL;
+        if (job->rendered) {
+            wallpaper_add_render_time (job->ms);
+        }
+        cache_set_cost (CACHE, node,
+                        job->ms + time_monotonic_ms () - start);
+        wallpaper_trace (head, spec, node->cost);
+        if (spec->type == WALLPAPER_TYPE_IMAGE) {
+            wallpaper_set_average (spec, &job->buf);
+        }
+    }
+
+    if (job == &job_local) {
+        wallpaper_job_free (&job_local);
+    }
+    return node;
+}
+
+/**
+ * Draw placeholder of head onto pixmap. job is the completed
+ * placeholder job of the head, or NULL if the head is cached.
+ */
+static void
+wallpaper_draw_placeholder (Pixmap pixmap, struct geometry *head,
+                            struct wallpaper_spec *spec,
+                            struct wallpaper_job *job)
+{
+    if (job == NULL) {
+        /* Peek to not count the access twice in the cache. */
+        char head_spec[4096];
+        wallpaper_head_spec (spec, head->width, head->height,
+                             head_spec, sizeof (head_spec));
+        struct cache_node *node = cache_peek_pixmap (CACHE, head_spec);
+        if (node != NULL && node->pixmap != None) {
+            x11_copy_area (node->pixmap, pixmap, 0, 0,
+                           head->width, head->height, head->x, head->y);
+        }
+    } else if (job->buf.data != NULL) {
+        Pixmap head_pixmap = wallpaper_create_x11_pixmap (
+            head, job->buf.data, wallpaper_dither (spec));
+        x11_copy_area (head_pixmap, pixmap, 0, 0, head->width, head->height,
+                       head->x, head->y);
+        wallpaper_free_pixmap (head_pixmap);
+    }
+}
+
+/**
+ * Prepare job rendering spec for head, unpacking the packed copy of
+ * node instead if it is demoted.
+ */
+static void
+wallpaper_job_init (struct wallpaper_job *job, struct geometry *head,
+                    struct wallpaper_spec *spec, struct cache_node *node)
+{
+    memset (job, 0, sizeof (struct wallpaper_job));
+    job->head = head;
+    job->spec = spec;
+    if (node != NULL && node->pixmap == None && node->packed != NULL) {
+        job->packed_src = node->packed;
+        job->packed_src_bytes = node->packed_bytes;
+    } else if (spec != NULL && spec->type == WALLPAPER_TYPE_COLOR) {
+        x11_parse_color (spec->spec, &job->color);
+    } else if (spec != NULL && spec->type == WALLPAPER_TYPE_GRADIENT) {
+        wallpaper_gradient_parse (spec->spec, &job->gradient);
+    }
+}
+
+/**
+ * Run job, safe to call from any thread.
+ */
+static void
+wallpaper_job_run (void *arg)
+{
+    struct wallpaper_job *job = arg;
+    int64_t start = time_monotonic_ms ();
+
+    if (job->packed_src != NULL) {
+        render_buf_init (&job->buf, job->head->width, job->head->height);
+        if (! codec_decode (job->packed_src, job->packed_src_bytes,
+                            job->buf.data, job->buf.width, job->buf.height)) {
+            render_buf_free (&job->buf);
+        }
+    } else if (job->placeholder
+               && job->spec->type == WALLPAPER_TYPE_IMAGE) {
+        wallpaper_render_placeholder (job);
+    } else {
+        if (job->spec->type == WALLPAPER_TYPE_COLOR) {
+            render_buf_init (&job->buf, job->head->width, job->head->height);
+            render_color (&job->buf, &job->color);
+        } else if (job->spec->type == WALLPAPER_TYPE_GRADIENT) {
+            render_buf_init (&job->buf, job->head->width, job->head->height);
+            render_gradient (&job->buf, &job->gradient, job->head->width,
+                             job->head->height);
+        } else {
+            wallpaper_render_source (job);
+        }
+        if (job->buf.data != NULL && CONFIG->cache_packed
+            && ! job->placeholder) {
+            job->packed = codec_encode (job->buf.data, job->buf.width,
+                                        job->buf.height, &job->packed_bytes);
+        }
+    }
+
+    job->ms = time_monotonic_ms () - start;
+}
+
+/**
+ * Free resources used by job.
+ */
+static void
+wallpaper_job_free (struct wallpaper_job *job)
+{
+    if (job->entry != NULL) {
+        disk_cache_entry_free (job->entry);
+    } else {
+        render_buf_free (&job->buf);
+    }
+    mem_free (job->packed);
+    mem_free (job->packed_src_copy);
+}
+
+/**
+ * Record access of the head render of spec in the cache trace, if
+ * enabled.
+ */
+static void
+wallpaper_trace (struct geometry *head, struct wallpaper_spec *spec, long cost)
+{
+    if (! trace_is_open ()) {
+        return;
+    }
+
+    struct trace_event event;
+    event.time = time_ms ();
+    event.desktop = DESKTOP;
+    event.layout = LAYOUT;
+    event.width = head->width;
+    event.height = head->height;
+    event.mode = spec->mode;
+    event.type = spec->type;
+    event.cost = cost;
+    event.bytes = x11_get_pixmap_size (head->width, head->height);
+    snprintf (event.spec, sizeof (event.spec), "%s", spec->spec);
+    trace_write (&event);
+}
+
+/**
+ * Render image spec of job at head size into the job buffer. Renders
+ * are read from and stored in the disk cache, on a disk cache hit the
+ * buffer uses the mapped job entry. Safe to call from any thread.
+ */
+static void
+wallpaper_render_source (struct wallpaper_job *job)
+{
+    uint64_t key = 0;
+    job->entry = wallpaper_disk_cache_get (job->head, job->spec, &key);
+
+    /* With a shared cache another instance may be rendering the same
+       image, wait for it and use its render. */
+    if (job->entry == NULL) {
+        int lock = key != 0 ? disk_cache_lock (DISK_CACHE, key) : -1;
+        if (lock != -1) {
+            job->entry = disk_cache_get (DISK_CACHE, key, job->head->width,
+                                         job->head->height);
+        }
+        if (job->entry == NULL) {
+            wallpaper_render_image (job, key);
+        }
+        disk_cache_unlock (lock);
+    }
+
+    if (job->entry != NULL) {
+        job->buf.width = job->entry->width;
+        job->buf.height = job->entry->height;
+        job->buf.data = job->entry->data;
+    }
+}
+
+/**
+ * Render placeholder of the image spec of job, trying the configured
+ * placeholders in order. Renders in the disk cache are used as they
+ * are. Safe to call from any thread.
+ */
+static void
+wallpaper_render_placeholder (struct wallpaper_job *job)
+{
+    uint64_t key;
+    job->entry = wallpaper_disk_cache_get (job->head, job->spec, &key);
+    if (job->entry != NULL) {
+        job->buf.width = job->entry->width;
+        job->buf.height = job->entry->height;
+        job->buf.data = job->entry->data;
+        return;
+    }
+
+    for (unsigned int i = 0;
+         i < CONFIG->render_num_placeholders && job->buf.data == NULL; i++) {
+        switch (CONFIG->render_placeholders[i]) {
+        case PLACEHOLDER_THUMBNAIL: {
+            char *path = thumbnail_find (job->spec->spec);
+            if (path != NULL) {
+                wallpaper_placeholder_decode (job, path, 1);
+                mem_free (path);
+            }
+            break;
+        }
+        case PLACEHOLDER_REDUCED:
+            wallpaper_placeholder_decode (job, job->spec->spec,
+                                          DECODE_JPEG_MAX_REDUCE);
+            break;
+        case PLACEHOLDER_COLOR:
+            if (job->has_average) {
+                render_buf_init (&job->buf, job->head->width,
+                                 job->head->height);
+                render_color (&job->buf, &job->color);
+            }
+            break;
+        case PLACEHOLDER_MAX:
+            break;
+        }
+    }
+}
+
+/**
+ * Render image at path scaled into the job buffer decoding it at
+ * reduce, returns 0 if the image can not be rendered. Only JPEG images
+ * are decoded reduced, others are skipped if reduce is above 1.
+ */
+static int
+wallpaper_placeholder_decode (struct wallpaper_job *job, const char *path,
+                              int reduce)
+{
+    struct decode_stream *stream = decode_stream_open (path, reduce);
+    if (stream == NULL) {
+        return 0;
+    } else if (reduce > 1 && stream->type != DECODE_TYPE_JPEG) {
+        decode_stream_close (stream);
+        return 0;
+    }
+
+    struct render_source source = {
+        stream->width, stream->height, stream->has_alpha,
+        wallpaper_stream_row, stream
+    };
+    render_buf_init (&job->buf, job->head->width, job->head->height);
+    int ok = render_image_source (&job->buf, &source, job->spec->mode)
+        && ! stream->error;
+    decode_stream_close (stream);
+    if (! ok) {
+        render_buf_free (&job->buf);
+    }
+    return ok;
+}
+
+/**
+ * Get average color of the last render of image spec, returns 0 if
+ * unknown.
+ */
+static int
+wallpaper_get_average (struct wallpaper_spec *spec, struct color *color)
+{
+    uint64_t digest = str_digest (spec->spec);
+    struct wallpaper_average *average =
+        &AVERAGES[digest % WALLPAPER_AVERAGES];
+    if (average->digest != digest) {
+        return 0;
+    }
+    *color = average->color;
+    return 1;
+}
+
+/**
+ * Record average color of buf rendered from image spec.
+ */
+static void
+wallpaper_set_average (struct wallpaper_spec *spec, struct render_buf *buf)
+{
+    uint64_t digest = str_digest (spec->spec);
+    struct wallpaper_average *average =
+        &AVERAGES[digest % WALLPAPER_AVERAGES];
+    average->digest = digest;
+    render_average (buf, &average->color);
+}
+
+/**
+ * Render decoded source image of job, storing the render in the disk
+ * cache under key unless 0.
+ */
+static void
+wallpaper_render_image (struct wallpaper_job *job, uint64_t key)
+{
+    int reduce = wallpaper_image_reduce (job);
+    if (! wallpaper_render_stream (job, reduce)) {
+        struct image_cache_node *source =
+            image_cache_get_reduced (IMAGE_CACHE, job->spec->spec, reduce);
+        if (source == NULL) {
+            return;
+        }
+
+        struct render_buf image = { source->width, source->height,
+                                    source->data, source->has_alpha };
+        render_buf_init (&job->buf, job->head->width, job->head->height);
+        render_image (&job->buf, &image, job->spec->mode);
+        image_cache_release (IMAGE_CACHE, source);
+    }
+    job->rendered = 1;
+
+    if (key != 0) {
+        disk_cache_put (DISK_CACHE, key, job->buf.width, job->buf.height,
+                        job->spec->mode, job->buf.data);
+    }
+}
+
+/**
+ * Render source image of job decoding it one row at a time, keeping
+ * images larger than the stream threshold out of memory and the image
+ * cache. Returns 0 if the image is not rendered streamed.
+ */
+static int
+wallpaper_render_stream (struct wallpaper_job *job, int reduce)
+{
+    if (CONFIG->render_stream_threshold == 0
+        || job->spec->mode == MODE_TILED) {
+        return 0;
+    }
+
+    struct decode_stream *stream =
+        decode_stream_open (job->spec->spec, reduce);
+    if (stream == NULL) {
+        return 0;
+    } else if ((size_t) stream->width * stream->height * sizeof (uint32_t)
+               < CONFIG->render_stream_threshold) {
+        decode_stream_close (stream);
+        return 0;
+    }
+
+    struct render_source source = {
+        stream->width, stream->height, stream->has_alpha,
+        wallpaper_stream_row, stream
+    };
+    render_buf_init (&job->buf, job->head->width, job->head->height);
+    render_image_source (&job->buf, &source, job->spec->mode);
+
+    /* Broken images are rendered as far as possible by Imlib2. */
+    int ok = ! stream->error;
+    decode_stream_close (stream);
+    if (! ok) {
+        render_buf_free (&job->buf);
+    }
+    return ok;
+}
+
+/**
+ * Get row y of the decode stream data.
+ */
+static const uint32_t*
+wallpaper_stream_row (void *data, int y)
+{
+    return decode_stream_row (data, y);
+}
+
+/**
+ * Get the largest reduction the source image of job can be decoded at
+ * while still being at least as large as it is rendered, 1 if the
+ * image can not be decoded reduced.
+ */
+static int
+wallpaper_image_reduce (struct wallpaper_job *job)
+{
+    int width, height;
+    if (! decode_jpeg_size (job->spec->spec, &width, &height)) {
+        return 1;
+    }
+
+    int target_width, target_height;
+    render_image_size (job->head->width, job->head->height, width, height,
+                       job->spec->mode, &target_width, &target_height);
+    int reduce = DECODE_JPEG_MAX_REDUCE;
+    for (; reduce > 1; reduce /= 2) {
+        if ((width + reduce - 1) / reduce >= target_width
+            && (height + reduce - 1) / reduce >= target_height) {
+            break;
+        }
+    }
+    return reduce;
+}
+
+/**
+ * Lookup image render in the disk cache, key_ret is set to the cache
+ * key or 0 if the disk cache is not in use.
+ */
+static struct disk_cache_entry*
+wallpaper_disk_cache_get (struct geometry *head, struct wallpaper_spec *spec,
+                          uint64_t *key_ret)
+{
+    struct image_id id;
+    *key_ret = 0;
+    if (DISK_CACHE == NULL || ! image_id_read (spec->spec, &id)) {
+        return NULL;
+    }
+
+    *key_ret = disk_cache_key (DISK_CACHE, spec->spec, &id,
+                               head->width, head->height, spec->mode,
+                               render_get_upscale ());
+    return disk_cache_get (DISK_CACHE, *key_ret, head->width, head->height);
+}
+
+/**
+ * Start cross-fade of the root from the current specs to the specs
+ * matching filter, starting at start and lasting length milliseconds.
+ * Only image heads fade, the renders faded between are done on the
+ * render pool and frames are drawn once both are done, without waiting
+ * for them. Cached renders are unpacked instead of rendered. The
+ * render faded to is added to the cache to be set once the fade is
+ * done.
+ */
+void
+wallpaper_fade_start (struct wallpaper_filter *filter, int64_t start,
+                      long length)
+{
+    wallpaper_fade_stop ();
+    if (CONFIG->render_fade_fps == 0 || length <= 0 || ! ROOT_SPECS
+        || wallpaper_render_single (ROOT_HEADS, ROOT_SPECS) != NULL
+        || ! wallpaper_async_pipe ()) {
+        return;
+    }
+
+    int num;
+    for (num = 0; ROOT_HEADS[num]; num++)
+        ;
+    FADE = mem_new (sizeof (struct wallpaper_fade));
+    memset (FADE, 0, sizeof (struct wallpaper_fade));
+    FADE->heads = mem_new (sizeof (struct wallpaper_fade_head) * (num + 1));
+    FADE->start = start;
+    FADE->length = length;
+    for (int i = 0; i < num; i++) {
+        filter->head = i;
+        struct wallpaper_spec *spec = wallpaper_match (filter);
+        if (wallpaper_fade_init_head (&FADE->heads[FADE->num_heads],
+                                      ROOT_HEADS[i], ROOT_SPECS[i], spec)) {
+            FADE->num_heads++;
+        }
+        if (spec) {
+            wallpaper_spec_free (spec);
+        }
+    }
+
+    /* Jobs are submitted once all heads are set up, as they are
+       counted as done against num_heads. */
+    for (int i = 0; i < FADE->num_heads; i++) {
+        pool_submit (POOL, &FADE->group, wallpaper_async_job_run,
+                     &FADE->heads[i].from);
+        pool_submit (POOL, &FADE->group, wallpaper_async_job_run,
+                     &FADE->heads[i].to);
+    }
+    if (FADE->num_heads == 0) {
+        wallpaper_fade_free (FADE);
+        FADE = NULL;
+    }
+}
+
+/**
+ * Prepare cross-fade of head from spec from to spec to, copying the
+ * specs as the root specs may be replaced before the renders are done.
+ * Returns 0 if the head does not fade.
+ */
+static int
+wallpaper_fade_init_head (struct wallpaper_fade_head *fade_head,
+                          struct geometry *head, struct wallpaper_spec *from,
+                          struct wallpaper_spec *to)
+{
+    if (from == NULL || to == NULL || from->type != WALLPAPER_TYPE_IMAGE
+        || to->type != WALLPAPER_TYPE_IMAGE
+        || (from->mode == to->mode && ! strcmp (from->spec, to->spec))) {
+        return 0;
+    }
+
+    fade_head->head = *head;
+    memset (&fade_head->frame, 0, sizeof (struct render_buf));
+    wallpaper_fade_init_job (&fade_head->from, &fade_head->head,
+                             wallpaper_spec_copy (from));
+    wallpaper_fade_init_job (&fade_head->to, &fade_head->head,
+                             wallpaper_spec_copy (to));
+    return 1;
+}
+
+/**
+ * Prepare job rendering spec for head of the cross-fade, unpacking a
+ * copy of the packed render if spec is cached.
+ */
+static void
+wallpaper_fade_init_job (struct wallpaper_job *job, struct geometry *head,
+                         struct wallpaper_spec *spec)
+{
+    wallpaper_job_init (job, head, spec, NULL);
+    job->fade = FADE;
+
+    char head_spec[4096];
+    wallpaper_head_spec (spec, head->width, head->height,
+                         head_spec, sizeof (head_spec));
+    struct cache_node *node = cache_peek_pixmap (CACHE, head_spec);
+    if (node != NULL && node->packed != NULL) {
+        job->packed_src_copy = mem_new (node->packed_bytes);
+        memcpy (job->packed_src_copy, node->packed, node->packed_bytes);
+        job->packed_src = job->packed_src_copy;
+        job->packed_src_bytes = node->packed_bytes;
+    }
+}
+
+/**
+ * Start drawing frames of fade once all its renders are done, caching
+ * the render faded to.
+ */
+static void
+wallpaper_fade_ready (struct wallpaper_fade *fade)
+{
+    int max_diff = 0;
+    for (int i = 0; i < fade->num_heads; i++) {
+        struct wallpaper_fade_head *fade_head = &fade->heads[i];
+        if (fade_head->from.buf.data == NULL
+            || fade_head->to.buf.data == NULL) {
+            /* Failed heads are kept without a frame, not drawn. */
+            continue;
+        }
+
+        /* Unpacked renders are already cached. */
+        if (fade_head->to.packed_src == NULL) {
+            wallpaper_render_head (&fade_head->head, fade_head->to.spec,
+                                   &fade_head->to);
+        }
+        int diff = render_max_diff (&fade_head->from.buf,
+                                    &fade_head->to.buf);
+        max_diff = diff > max_diff ? diff : max_diff;
+        render_buf_init (&fade_head->frame, fade_head->head.width,
+                         fade_head->head.height);
+    }
+
+    /* Frames in between the 8-bit colors of the largest change are not
+       visible and are skipped. */
+    if (max_diff == 0) {
+        wallpaper_fade_stop ();
+        return;
+    }
+    fade->step = 256 / max_diff;
+    fade->alpha = 0;
+    fade->next = time_ms ();
+    fade->ready = 1;
+}
+
+/**
+ * Stop cross-fade in progress without waiting for its renders, the
+ * last drawn frame is kept.
+ */
+void
+wallpaper_fade_stop (void)
+{
+    if (FADE == NULL) {
+        return;
+    }
+
+    struct wallpaper_fade *fade = FADE;
+    FADE = NULL;
+    fade->cancelled = 1;
+    fade->done += pool_cancel_group (POOL, &fade->group);
+    if (fade->done >= fade->num_heads * 2) {
+        wallpaper_fade_free (fade);
+    }
+}
+
+/**
+ * Free cross-fade, all its jobs must be done.
+ */
+static void
+wallpaper_fade_free (struct wallpaper_fade *fade)
+{
+    /* The last job notifies just before it leaves the pool. */
+    pool_wait_group (POOL, &fade->group);
+    for (int i = 0; i < fade->num_heads; i++) {
+        struct wallpaper_fade_head *fade_head = &fade->heads[i];
+        wallpaper_spec_free (fade_head->from.spec);
+        wallpaper_spec_free (fade_head->to.spec);
+        wallpaper_job_free (&fade_head->from);
+        wallpaper_job_free (&fade_head->to);
+        render_buf_free (&fade_head->frame);
+    }
+    mem_free (fade->heads);
+    mem_free (fade);
+}
+
+/**
+ * Get number of milliseconds until the next cross-fade frame is due,
+ * -1 if not fading.
+ */
+int
+wallpaper_fade_get_wait (void)
+{
+    if (FADE == NULL || ! FADE->ready) {
+        return -1;
+    }
+    int64_t wait = FADE->next - time_ms ();
+    return wait > 0 ? wait : 0;
+}
+
+/**
+ * Draw cross-fade frame for the current time if it differs from the
+ * last drawn frame. Frames are never drawn for past times, frames
+ * running late under load are dropped. The next frame is scheduled
+ * when the colors change next, at most at the configured frame rate.
+ */
+void
+wallpaper_fade_frame (void)
+{
+    if (FADE == NULL || ! FADE->ready) {
+        return;
+    }
+
+    int64_t now = time_ms ();
+    int64_t elapsed = now - FADE->start;
+    int alpha = 256;
+    if (elapsed < FADE->length) {
+        alpha = elapsed > 0 ? elapsed * 256 / FADE->length : 0;
+        alpha = alpha / FADE->step * FADE->step;
+    }
+
+    if (alpha != FADE->alpha) {
+        for (int i = 0; i < FADE->num_heads; i++) {
+            wallpaper_fade_draw (&FADE->heads[i], alpha);
+        }
+        x11_set_background_pixmap (x11_get_root_window (), ROOT_PIXMAP);
+        FADE->alpha = alpha;
+    }
+    if (alpha == 256) {
+        wallpaper_fade_stop ();
+        return;
+    }
+
+    int64_t next = FADE->start
+        + (int64_t) (alpha + FADE->step) * FADE->length / 256;
+    int64_t min_next = time_ms () + 1000 / CONFIG->render_fade_fps;
+    FADE->next = next > min_next ? next : min_next;
+}
+
+/**
+ * Blend frame of fade_head at alpha and draw it onto the root pixmap,
+ * heads that failed to render are not drawn.
+ */
+static void
+wallpaper_fade_draw (struct wallpaper_fade_head *fade_head, int alpha)
+{
+    if (fade_head->frame.data == NULL) {
+        return;
+    }
+
+    render_mix (&fade_head->frame, &fade_head->from.buf, &fade_head->to.buf,
+                alpha);
+
+    if (x11_get_format () != X11_FORMAT_NONE) {
+        wallpaper_put_native (ROOT_PIXMAP, fade_head->head.x,
+                              fade_head->head.y, fade_head->head.width,
+                              fade_head->head.height, fade_head->frame.data,
+                              CONFIG->render_dither);
+        return;
+    }
+
+    image_cache_imlib_lock ();
+    Imlib_Image image = imlib_create_image_using_data (
+        fade_head->head.width, fade_head->head.height,
+        fade_head->frame.data);
+    imlib_context_set_display (x11_get_display ());
+    imlib_context_set_visual (x11_get_visual ());
+    imlib_context_set_colormap (x11_get_colormap ());
+    imlib_context_set_image (image);
+    imlib_context_set_drawable (ROOT_PIXMAP);
+    imlib_render_image_on_drawable (fade_head->head.x, fade_head->head.y);
+    imlib_free_image ();
+    image_cache_imlib_unlock ();
+}
+
+/**
+ * Return server pixmap leaving the render cache, or replaced as root
+ * pixmap, to the pixmap pool.
+ */
+static void
+wallpaper_free_pixmap (Pixmap pixmap)
+{
+    if (PIXMAP_POOL) {
+        pixmap_pool_put (PIXMAP_POOL, pixmap);
+    } else {
+        x11_free_pixmap (pixmap);
+    }
+}
+
+/**
+ * Upload head sized data to a server side pixmap and add it to the
+ * cache, the cache takes ownership of packed. data is packed here if
+ * packed is NULL and the packed tier is enabled. Source images are
+ * watched for changes.
+ */
+static struct cache_node*
+wallpaper_cache_data (const char *head_spec, struct geometry *head,
+                      struct wallpaper_spec *spec, uint32_t *data,
+                      unsigned char *packed, size_t packed_bytes)
+{
+    Pixmap pixmap = wallpaper_create_x11_pixmap (head, data,
+                                                 wallpaper_dither (spec));
+    if (packed == NULL && CONFIG->cache_packed) {
+        packed = codec_encode (data, head->width, head->height,
+                               &packed_bytes);
+    }
+
+    const char *path = NULL;
+    if (spec->type == WALLPAPER_TYPE_IMAGE) {
+        path = spec->spec;
+        watch_add_file (path);
+    }
+
+    struct cache_node *node =
+        cache_set_pixmap (CACHE, head_spec, path, pixmap,
+                          x11_get_pixmap_size (head->width, head->height));
+    if (packed != NULL) {
+        cache_set_packed (CACHE, node, packed, packed_bytes);
+    }
+    return node;
+}
+
+/**
+ * Upload the packed copy of a demoted node rendering spec to a new
+ * server pixmap, using the result of job if it unpacked it. Returns 0
+ * if the packed copy could not be decoded.
+ */
+static int
+wallpaper_cache_promote (struct cache_node *node, struct geometry *head,
+                         struct wallpaper_spec *spec,
+                         struct wallpaper_job *job)
+{
+    if (node->packed == NULL) {
+        return 0;
+    }
+
+    struct wallpaper_job job_local;
+    if (job == NULL || job->packed_src != node->packed) {
+        wallpaper_job_init (&job_local, head, NULL, node);
+        wallpaper_job_run (&job_local);
+        job = &job_local;
+    }
+
+    int ok = job->buf.data != NULL;
+    if (ok) {
+        cache_promote (CACHE, node,
+                       wallpaper_create_x11_pixmap (head, job->buf.data,
+                                                    wallpaper_dither (spec)));
+    } else {
+        fprintf (stderr, "failed to decode packed render %s\n", node->spec);
+    }
+
+    if (job == &job_local) {
+        wallpaper_job_free (&job_local);
+    }
+    return ok;
+}
+
+/**
+ * Check if spec is rendered for head in the cache.
+ */
+int
+wallpaper_is_cached (struct geometry *head, struct wallpaper_spec *spec)
+{
+    char head_spec[4096];
+    wallpaper_head_spec (spec, head->width, head->height,
+                         head_spec, sizeof (head_spec));
+    return CACHE != NULL && cache_peek_pixmap (CACHE, head_spec) != NULL;
+}
+
+/**
+ * Check if bytes and entries can be added to the cache without
+ * evicting any entries, with the packed tier enabled the packed budget
+ * is checked as entries loaded from disk are only packed.
+ */
+int
+wallpaper_cache_fits (size_t bytes, unsigned int entries)
+{
+    if (CACHE == NULL) {
+        return 0;
+    } else if (CONFIG->cache_packed) {
+        return cache_fits_packed (CACHE, bytes / PACKED_RATIO);
+    }
+    return cache_fits (CACHE, bytes, entries);
+}
+
+/**
+ * Check if the disk cache is in use.
+ */
+int
+wallpaper_has_disk_cache (void)
+{
+    return DISK_CACHE != NULL;
+}
+
+/**
+ * Render image spec for head into the disk cache only, does not
+ * require the X11 connection and is safe to call from any thread.
+ * Returns 0 if the render already was available on disk.
+ */
+int
+wallpaper_render_to_disk (struct geometry *head, struct wallpaper_spec *spec)
+{
+    struct wallpaper_job job;
+    wallpaper_job_init (&job, head, spec, NULL);
+    wallpaper_render_source (&job);
+    int rendered = job.entry == NULL;
+    wallpaper_job_free (&job);
+    return rendered;
+}
+
+/**
+ * Load render of spec for head from the disk cache into the cache,
+ * returns 0 if the cache has no room left for it unless do_evict is
+ * set. Without do_evict the render is only packed, if the packed tier
+ * is enabled, to not push out server pixmaps in use.
+ */
+int
+wallpaper_load_from_disk (struct geometry *head, struct wallpaper_spec *spec,
+                          int do_evict)
+{
+    char head_spec[4096];
+    wallpaper_head_spec (spec, head->width, head->height,
+                         head_spec, sizeof (head_spec));
+    struct cache_node *node = CACHE ? cache_peek_pixmap (CACHE, head_spec) : 0;
+    if (node != NULL) {
+        if (do_evict && node->pixmap == None) {
+            wallpaper_cache_promote (node, head, spec, NULL);
+        }
+        return 1;
+    }
+    if (! do_evict
+        && ! wallpaper_cache_fits (x11_get_pixmap_size (head->width,
+                                                        head->height), 1)) {
+        return 0;
+    }
+
+    uint64_t key;
+    struct disk_cache_entry *entry =
+        wallpaper_disk_cache_get (head, spec, &key);
+    if (entry == NULL) {
+        return 1;
+    }
+
+    if (! do_evict && CONFIG->cache_packed) {
+        size_t packed_bytes;
+        unsigned char *packed = codec_encode (entry->data, head->width,
+                                              head->height, &packed_bytes);
+        watch_add_file (spec->spec);
+        node = cache_set_pixmap (CACHE, head_spec, spec->spec, None,
+                                 x11_get_pixmap_size (head->width,
+                                                      head->height));
+        cache_set_packed (CACHE, node, packed, packed_bytes);
+    } else {
+        wallpaper_cache_data (head_spec, head, spec, entry->data, NULL, 0);
+    }
+    disk_cache_entry_free (entry);
+    return 1;
+}
+
+/**
+ * Render image as X11 background, freeing the previously set root
+ * pixmap.
+ */
+void
+wallpaper_set_x11 (Pixmap pixmap)
+{
+    if (ROOT_PIXMAP != pixmap) {
+        x11_set_atom_value_long (x11_get_root_window (), ATOM_ROOTPMAP_ID,
+                                 XA_PIXMAP, pixmap);
+        x11_set_background_pixmap (x11_get_root_window (), pixmap);
+
+        wallpaper_free_pixmap (ROOT_PIXMAP);
+        ROOT_PIXMAP = pixmap;
+    }
+}
+
+/**
+ * Set solid color X11 background. Pseudo-transparent clients copy the
+ * root pixmap at screen coordinates, so a display sized pixmap filled
+ * with the color server side is set as the root pixmap.
+ */
+void
+wallpaper_set_x11_pixel (unsigned long pixel)
+{
+    struct geometry *disp = x11_get_geometry ();
+    Pixmap pixmap = wallpaper_get_pixmap (disp->width, disp->height);
+    x11_fill_rectangle_pixel (pixmap, pixel, 0, 0, disp->width,
+                              disp->height);
+    mem_free (disp);
+
+    x11_set_atom_value_long (x11_get_root_window (), ATOM_ROOTPMAP_ID,
+                             XA_PIXMAP, pixmap);
+    x11_set_background_pixel (x11_get_root_window (), pixel);
+
+    wallpaper_free_pixmap (ROOT_PIXMAP);
+    ROOT_PIXMAP = pixmap;
+}
+
+/**
+ * Create Pixmap from head sized data at the depth of the root window,
+ * dropped color bits are dithered if dither is set. The pixmap is
+ * drawn into a pooled pixmap when one of the same size is idle.
+ */
+Pixmap
+wallpaper_create_x11_pixmap (struct geometry *head, uint32_t *data,
+                             int dither)
+{
+    Pixmap pixmap = wallpaper_get_pixmap (head->width, head->height);
+    if (x11_get_format () != X11_FORMAT_NONE) {
+        wallpaper_put_native (pixmap, 0, 0, head->width, head->height,
+                              data, dither);
+        return pixmap;
+    }
+
+    /* Render pool jobs may be decoding images with Imlib2. */
+    image_cache_imlib_lock ();
+    Imlib_Image image =
+        imlib_create_image_using_data (head->width, head->height, data);
+
+    imlib_context_set_display (x11_get_display ());
+    imlib_context_set_visual (x11_get_visual ());
+    imlib_context_set_colormap (x11_get_colormap ());
+    imlib_context_set_image (image);
+    imlib_context_set_drawable (pixmap);
+    imlib_render_image_on_drawable (0, 0);
+    imlib_free_image ();
+    image_cache_imlib_unlock ();
+    return pixmap;
+}
+
+/**
+ * Check if renders of spec should be dithered when converted to the
+ * root window depth, gradients are dithered as they are rendered.
+ */
+static int
+wallpaper_dither (struct wallpaper_spec *spec)
+{
+    return CONFIG->render_dither
+        && (spec == NULL || spec->type != WALLPAPER_TYPE_GRADIENT);
+}
+
+/**
+ * Convert data to the root window pixel format and upload it to x, y
+ * of drawable, the format must not be X11_FORMAT_NONE.
+ */
+static void
+wallpaper_put_native (Drawable drawable, int x, int y, int width,
+                      int height, uint32_t *data, int dither)
+{
+    if (x11_get_format () == X11_FORMAT_ARGB32) {
+        x11_put_image (drawable, data, x, y, width, height);
+        return;
+    }
+
+    struct render_buf buf = { width, height, data, 0 };
+    uint16_t *native = mem_new (sizeof (uint16_t) * width * height);
+    render_rgb565 (native, &buf, dither);
+    x11_put_image (drawable, native, x, y, width, height);
+    mem_free (native);
+}
+
+/**
+ * Render specs for heads into the cache on the render pool without
+ * setting them, heads without a spec are skipped. A prefetch in
+ * progress is cancelled, a full quality render of the root continues
+ * alongside.
+ */
+void
+wallpaper_prefetch (struct geometry **heads, struct wallpaper_spec **specs)
+{
+    if (! CACHE) {
+        wallpaper_cache_clear (1);
+    }
+    wallpaper_async_cancel (&ASYNC_PREFETCH);
+    ASYNC_PREFETCH = wallpaper_async_start (heads, specs, 0);
+}
+
+/**
+ * Add measured head render time, kept as a moving average.
+ */
+void
+wallpaper_add_render_time (long ms)
+{
+    RENDER_TIME = RENDER_TIME ? (RENDER_TIME * 3 + ms) / 4 : ms;
+}
+
+/**
+ * Get average time in milliseconds to render a single head, 0 if no
+ * render has been measured.
+ */
+long
+wallpaper_get_render_time (void)
+{
+    return RENDER_TIME;
+}
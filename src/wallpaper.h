@@ -11,10 +11,43 @@
 
 #include "config.h"
 
+#include <stdint.h>
+
+#include "pressure.h"
 #include "wallpaperd.h"
 #include "wallpaper_match.h"
+#include "x11.h"
 
 extern void wallpaper_set (struct wallpaper_filter *filter);
 extern void wallpaper_cache_clear (int do_alloc);
+extern void wallpaper_init_render (void);
+extern int wallpaper_layout_changed (void);
+extern int wallpaper_invalidate (const char *path);
+extern void wallpaper_refresh (void);
+extern size_t wallpaper_shrink (enum pressure_level level);
+
+extern int wallpaper_is_cached (struct geometry *head,
+                                struct wallpaper_spec *spec);
+extern int wallpaper_cache_fits (size_t bytes, unsigned int entries);
+extern int wallpaper_has_disk_cache (void);
+extern int wallpaper_render_to_disk (struct geometry *head,
+                                     struct wallpaper_spec *spec);
+extern int wallpaper_load_from_disk (struct geometry *head,
+                                     struct wallpaper_spec *spec,
+                                     int do_evict);
+extern void wallpaper_prefetch (struct geometry **heads,
+                               struct wallpaper_spec **specs);
+
+extern int wallpaper_get_fd (void);
+extern void wallpaper_process (void);
+
+extern void wallpaper_fade_start (struct wallpaper_filter *filter,
+                                  int64_t start, long length);
+extern void wallpaper_fade_stop (void);
+extern int wallpaper_fade_get_wait (void);
+extern void wallpaper_fade_frame (void);
+
+extern void wallpaper_add_render_time (long ms);
+extern long wallpaper_get_render_time (void);
 
 #endif /* _WALLPAPER_H_ */
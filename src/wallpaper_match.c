@@ -23,9 +23,13 @@
 #include "util.h"
 #include "x11.h"
 
+#define RANDOM_AHEAD_HEADS 16
+
 static const char *IMAGE_EXTS[] = {"png", "jpg", 0};
 
-static struct wallpaper_spec *wallpaper_spec_new (void);
+/** Random images selected ahead of time, per head. */
+static char *RANDOM_AHEAD[RANDOM_AHEAD_HEADS] = { 0 };
+
 static struct wallpaper_spec *wallpaper_match_name (
         struct wallpaper_filter *filter);
 static struct wallpaper_spec *wallpaper_match_number (
@@ -44,7 +48,6 @@ static int count_and_select_image_in_search_path (int image_select,
                                                   char **path_ret);
 static void select_image (int num, int image_select,
                           const char *path, const char *name, char **path_ret);
-static int is_image_file_ext (const char *name);
 
 /**
  * Find matching wallpaper specification from filter.
@@ -83,7 +86,10 @@ wallpaper_match (struct wallpaper_filter *filter)
     return spec;
 }
 
-static struct wallpaper_spec*
+/**
+ * Create empty spec, freed with wallpaper_spec_free.
+ */
+struct wallpaper_spec*
 wallpaper_spec_new (void)
 {
     struct wallpaper_spec *spec = mem_new(sizeof(struct wallpaper_spec));
@@ -93,6 +99,32 @@ wallpaper_spec_new (void)
     return spec;
 }
 
+/**
+ * Drop random images reserved ahead of time, the configuration they
+ * were selected from is being replaced.
+ */
+void
+wallpaper_match_reset (void)
+{
+    for (int i = 0; i < RANDOM_AHEAD_HEADS; i++) {
+        mem_free (RANDOM_AHEAD[i]);
+        RANDOM_AHEAD[i] = NULL;
+    }
+}
+
+/**
+ * Create copy of spec, freed with wallpaper_spec_free.
+ */
+struct wallpaper_spec*
+wallpaper_spec_copy (struct wallpaper_spec *spec)
+{
+    struct wallpaper_spec *copy = wallpaper_spec_new ();
+    copy->type = spec->type;
+    copy->mode = spec->mode;
+    copy->spec = spec->spec ? str_dup (spec->spec) : NULL;
+    return copy;
+}
+
 /**
  * Free resources used by spec.
  */
@@ -118,6 +150,9 @@ wallpaper_match_name (struct wallpaper_filter *filter)
     if (spec->type == WALLPAPER_TYPE_COLOR) {
         const char *color = cfg_get_color (CONFIG, -1);
         spec->spec = str_dup (color);
+    } else if (spec->type == WALLPAPER_TYPE_GRADIENT) {
+        const char *gradient = cfg_get_gradient (CONFIG, -1);
+        spec->spec = str_dup (gradient ? gradient : "");
     } else {
         if (filter->desktop_name) {
             spec->spec = find_wallpaper_by_name (filter->desktop_name);
@@ -144,6 +179,9 @@ wallpaper_match_number (struct wallpaper_filter *filter)
     if (spec->type == WALLPAPER_TYPE_COLOR) {
         const char *color = cfg_get_color (CONFIG, filter->desktop);
         spec->spec = str_dup (color);
+    } else if (spec->type == WALLPAPER_TYPE_GRADIENT) {
+        const char *gradient = cfg_get_gradient (CONFIG, filter->desktop);
+        spec->spec = str_dup (gradient ? gradient : "");
     } else {
         const char *name = cfg_get_wallpaper (CONFIG, filter->desktop);
         spec->spec = find_wallpaper (name);
@@ -154,6 +192,9 @@ wallpaper_match_number (struct wallpaper_filter *filter)
 
 /**
  * Get wallpaper selecting random from the search path.
+ *
+ * When looking ahead the selected image is reserved for the head and
+ * returned by the next match without look ahead.
  */
 struct wallpaper_spec*
 wallpaper_match_random (struct wallpaper_filter *filter)
@@ -161,7 +202,25 @@ wallpaper_match_random (struct wallpaper_filter *filter)
     struct wallpaper_spec *spec = wallpaper_spec_new ();
     spec->type = cfg_get_type (CONFIG, -1);
     spec->mode = cfg_get_mode (CONFIG, -1);
-    spec->spec = find_wallpaper_random ();
+
+    char **ahead = NULL;
+    if (filter->head >= 0 && filter->head < RANDOM_AHEAD_HEADS) {
+        ahead = &RANDOM_AHEAD[filter->head];
+    }
+
+    if (ahead == NULL) {
+        spec->spec = find_wallpaper_random ();
+    } else if (filter->time) {
+        mem_free (*ahead);
+        *ahead = find_wallpaper_random ();
+        spec->spec = *ahead ? str_dup (*ahead) : NULL;
+    } else if (*ahead) {
+        spec->spec = *ahead;
+        *ahead = NULL;
+    } else {
+        spec->spec = find_wallpaper_random ();
+    }
+
     return spec;
 }
 
@@ -173,7 +232,12 @@ wallpaper_match_set (struct wallpaper_filter *filter)
 {
     struct wallpaper_spec *spec = wallpaper_spec_new ();
 
-    struct background *bg = background_set_get_now (CONFIG->bg_set);
+    struct background *bg;
+    if (filter->time) {
+        bg = background_set_get_at (CONFIG->bg_set, filter->time, NULL);
+    } else {
+        bg = background_set_get_now (CONFIG->bg_set);
+    }
     if (bg) {
         spec->type = cfg_get_type (CONFIG, -1);
         spec->mode = cfg_get_mode (CONFIG, -1);
@@ -11,6 +11,8 @@
 
 #include "config.h"
 
+#include <time.h>
+
 #include "wallpaperd.h"
 
 /**
@@ -21,6 +23,7 @@ struct wallpaper_filter {
     int desktop; /**< Workspace number. */
     const char *desktop_name; /**< Name of the workspace. */
     int head; /**< xrandr screen/output. */
+    time_t time; /**< Look ahead to this time, 0 for now. */
 };
 
 /**
@@ -33,6 +36,10 @@ struct wallpaper_spec {
 };
 
 struct wallpaper_spec *wallpaper_match (struct wallpaper_filter *filter);
+void wallpaper_match_reset (void);
+struct wallpaper_spec *wallpaper_spec_new (void);
+struct wallpaper_spec *wallpaper_spec_copy (struct wallpaper_spec *spec);
 void wallpaper_spec_free (struct wallpaper_spec *spec);
+int is_image_file_ext (const char *name);
 
 #endif /* _WALLPAPER_MATCH_H_ */
@@ -0,0 +1,29 @@
+/*
+ * wallpaper_spec.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+
+#include "wallpaper_spec.h"
+
+/**
+ * Create spec string for a single head of width and height, used as
+ * key in the render cache.
+ */
+void
+wallpaper_head_spec (struct wallpaper_spec *spec, int width, int height,
+                     char *buf, size_t size)
+{
+    if (spec == NULL) {
+        snprintf (buf, size, "UNDEFINED");
+    } else {
+        snprintf (buf, size, "%s-%d-%d-%dx%d",
+                  spec->spec, spec->mode, spec->type, width, height);
+    }
+}
@@ -0,0 +1,22 @@
+/*
+ * wallpaper_spec.h for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#ifndef _WALLPAPER_SPEC_H_
+#define _WALLPAPER_SPEC_H_
+
+#include "config.h"
+
+#include <stddef.h>
+
+#include "wallpaper_match.h"
+
+extern void wallpaper_head_spec (struct wallpaper_spec *spec,
+                                 int width, int height,
+                                 char *buf, size_t size);
+
+#endif /* _WALLPAPER_SPEC_H_ */
@@ -28,7 +28,18 @@ enum bg_select_mode {
 enum wallpaper_type {
     WALLPAPER_TYPE_UNKNOWN,
     WALLPAPER_TYPE_COLOR,
-    WALLPAPER_TYPE_IMAGE
+    WALLPAPER_TYPE_IMAGE,
+    WALLPAPER_TYPE_GRADIENT
+};
+
+/**
+ * Placeholders shown while an image is rendered at full quality.
+ */
+enum wallpaper_placeholder {
+    PLACEHOLDER_THUMBNAIL, /**< freedesktop.org thumbnail of the image. */
+    PLACEHOLDER_REDUCED, /**< JPEG decoded at 1/8 size. */
+    PLACEHOLDER_COLOR, /**< Average color of a previous render. */
+    PLACEHOLDER_MAX
 };
 
 /**
@@ -53,6 +64,8 @@ struct options {
     char *image;
     enum wallpaper_mode mode;
     const char *workspace;
+    int prewarm; /**< Run as pre-warm helper process. */
+    char *program; /**< argv[0], used to start helper processes. */
 };
 
 #include "cfg.h"
@@ -0,0 +1,235 @@
+/*
+ * watch.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#include "config.h"
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif /* HAVE_SYS_INOTIFY_H */
+
+#include "util.h"
+#include "watch.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+
+#define WATCH_MASK (IN_CLOSE_WRITE|IN_MOVED_TO|IN_MOVED_FROM|IN_DELETE)
+
+/**
+ * Watched directory, files are watched through their directory to
+ * detect files being replaced by rename.
+ */
+struct watch_dir {
+    int wd;
+    char *dir;
+
+    struct watch_dir *next;
+};
+
+static int FD = -1;
+static struct watch_dir *DIRS = 0;
+
+static struct watch_dir *watch_find_wd (int wd);
+static void watch_remove_wd (int wd);
+
+/**
+ * Initialize inotify, any previous watches are removed.
+ */
+void
+watch_init (void)
+{
+    watch_free ();
+
+    FD = inotify_init1 (IN_NONBLOCK|IN_CLOEXEC);
+    if (FD == -1) {
+        perror ("failed to initialize inotify");
+    }
+}
+
+/**
+ * Remove all watches and close the inotify file descriptor.
+ */
+void
+watch_free (void)
+{
+    struct watch_dir *it = DIRS, *it_next;
+    for (; it; it = it_next) {
+        it_next = it->next;
+        mem_free (it->dir);
+        mem_free (it);
+    }
+    DIRS = 0;
+
+    if (FD != -1) {
+        close (FD);
+        FD = -1;
+    }
+}
+
+/**
+ * Get inotify file descriptor, -1 if not available.
+ */
+int
+watch_get_fd (void)
+{
+    return FD;
+}
+
+/**
+ * Watch files in dir for changes.
+ */
+void
+watch_add_dir (const char *dir)
+{
+    if (FD == -1) {
+        return;
+    }
+
+    int wd = inotify_add_watch (FD, dir, WATCH_MASK|IN_ONLYDIR);
+    if (wd == -1) {
+        if (errno != ENOENT) {
+            fprintf (stderr, "failed to watch %s: %s\n", dir, strerror (errno));
+        }
+        return;
+    }
+
+    /* Adding an already watched directory returns the existing wd. */
+    if (watch_find_wd (wd) == NULL) {
+        struct watch_dir *watch = mem_new (sizeof (struct watch_dir));
+        watch->wd = wd;
+        watch->dir = str_dup (dir);
+        watch->next = DIRS;
+        DIRS = watch;
+    }
+}
+
+/**
+ * Watch file at path for changes, done by watching its directory.
+ */
+void
+watch_add_file (const char *path)
+{
+    const char *sep = strrchr (path, '/');
+    if (sep == NULL || sep == path) {
+        watch_add_dir (sep ? "/" : ".");
+    } else {
+        char *dir = str_dup (path);
+        dir[sep - path] = '\0';
+        watch_add_dir (dir);
+        mem_free (dir);
+    }
+}
+
+/**
+ * Read pending events, calling callback for each changed file.
+ */
+void
+watch_process (watch_callback callback)
+{
+    char buf[4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+
+    ssize_t len;
+    while ((len = read (FD, buf, sizeof (buf))) > 0) {
+        char *p = buf;
+        while (p < buf + len) {
+            struct inotify_event *ev = (struct inotify_event*) p;
+            p += sizeof (struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_IGNORED) {
+                watch_remove_wd (ev->wd);
+                continue;
+            }
+
+            struct watch_dir *watch = watch_find_wd (ev->wd);
+            if (watch == NULL || ! ev->len) {
+                continue;
+            }
+
+            char *path;
+            if (asprintf (&path, "%s/%s", watch->dir, ev->name) != -1) {
+                callback (path);
+                mem_free (path);
+            }
+        }
+    }
+}
+
+/**
+ * Find watched directory from watch descriptor.
+ */
+struct watch_dir*
+watch_find_wd (int wd)
+{
+    struct watch_dir *it = DIRS;
+    for (; it; it = it->next) {
+        if (it->wd == wd) {
+            return it;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Forget watch descriptor removed by the kernel.
+ */
+void
+watch_remove_wd (int wd)
+{
+    struct watch_dir **it = &DIRS;
+    for (; *it; it = &(*it)->next) {
+        if ((*it)->wd == wd) {
+            struct watch_dir *watch = *it;
+            *it = watch->next;
+            mem_free (watch->dir);
+            mem_free (watch);
+            return;
+        }
+    }
+}
+
+#else /* ! HAVE_SYS_INOTIFY_H */
+
+void
+watch_init (void)
+{
+}
+
+void
+watch_free (void)
+{
+}
+
+int
+watch_get_fd (void)
+{
+    return -1;
+}
+
+void
+watch_add_dir (const char *dir)
+{
+}
+
+void
+watch_add_file (const char *path)
+{
+}
+
+void
+watch_process (watch_callback callback)
+{
+}
+
+#endif /* HAVE_SYS_INOTIFY_H */
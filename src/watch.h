@@ -0,0 +1,27 @@
+/*
+ * watch.h for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ */
+
+#ifndef _WATCH_H_
+#define _WATCH_H_
+
+#include "config.h"
+
+/**
+ * Callback for changed files, called with the full path.
+ */
+typedef void (*watch_callback) (const char *path);
+
+extern void watch_init (void);
+extern void watch_free (void);
+extern int watch_get_fd (void);
+
+extern void watch_add_dir (const char *dir);
+extern void watch_add_file (const char *path);
+extern void watch_process (watch_callback callback);
+
+#endif /* _WATCH_H_ */
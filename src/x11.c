@@ -8,11 +8,12 @@
 
 #include "config.h"
 
-#include <sys/select.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
+#include <X11/Xutil.h>
 
 #ifdef HAVE_XRANDR
 #include <X11/extensions/Xrandr.h>
@@ -22,12 +23,32 @@
 #include "x11.h"
 #include "cache.h"
 
+/** Number of allocated colormap pixels kept for reuse. */
+#define X11_PIXELS 32
+
+/**
+ * Pixel allocated in the colormap for a color.
+ */
+struct x11_pixel {
+    int used;
+    int pinned; /**< Root window background, never freed. */
+    unsigned char r, g, b;
+    unsigned long pixel;
+};
+
 static Display *DISPLAY = 0;
 static int XRANDR_EVENT_BASE = 0;
 static int XRANDR_ERROR_EVENT_BASE = 0;
 static char **DESKTOP_NAMES = 0;
+static GC GC_COPY = 0;
+static enum x11_format FORMAT = X11_FORMAT_NONE;
+static bool FORMAT_DETECTED = false;
+/** Allocated pixels, the oldest not pinned is freed when full. */
+static struct x11_pixel PIXELS[X11_PIXELS];
+static int PIXELS_NEXT = 0;
 
 Atom ATOM_DESKTOP = 0;
+Atom ATOM_NUMBER_OF_DESKTOPS = 0;
 Atom ATOM_DESKTOP_NAMES = 0;
 Atom ATOM_ROOTPMAP_ID = 0;
 Atom ATOM_UTF8_STRING = 0;
@@ -40,6 +61,8 @@ static Bool x11_get_atom_value (Window window, Atom atom, Atom type,
                                 unsigned long *actual);
 
 static struct geometry **x11_get_fake_heads (void);
+static GC x11_get_gc (void);
+static void x11_pin_pixel (Window window, unsigned long pixel, bool pin);
 
 /**
  * Open a connection to the X11 display if not already open.
@@ -55,6 +78,8 @@ x11_open_display (void)
     if (DISPLAY == 0) {
         die ("failed to open display, shutting down!");
     }
+    /* Not inherited by the pre-warm helper process. */
+    fcntl (ConnectionNumber (DISPLAY), F_SETFD, FD_CLOEXEC);
 
     x11_init_atoms ();
     x11_get_desktop_names (1);
@@ -72,6 +97,7 @@ void
 x11_init_atoms (void)
 {
     ATOM_DESKTOP = x11_get_atom ("_NET_CURRENT_DESKTOP");
+    ATOM_NUMBER_OF_DESKTOPS = x11_get_atom ("_NET_NUMBER_OF_DESKTOPS");
     ATOM_DESKTOP_NAMES = x11_get_atom ("_NET_DESKTOP_NAMES");
     ATOM_ROOTPMAP_ID = x11_get_atom ("_XROOTPMAP_ID");
     ATOM_UTF8_STRING = x11_get_atom("UTF8_STRING");
@@ -87,6 +113,14 @@ x11_close_display (void)
         return;
     }
 
+    if (GC_COPY) {
+        XFreeGC (DISPLAY, GC_COPY);
+        GC_COPY = 0;
+    }
+    FORMAT_DETECTED = false;
+    /* Allocated pixels are freed with the connection. */
+    memset (PIXELS, 0, sizeof (PIXELS));
+    PIXELS_NEXT = 0;
     XCloseDisplay (DISPLAY);
     DISPLAY = 0;
 }
@@ -135,6 +169,18 @@ x11_get_visual (void)
     return DefaultVisual (DISPLAY, DefaultScreen (DISPLAY));
 }
 
+/**
+ * Get number of bits of each color in the default visual.
+ */
+void
+x11_get_visual_bits (int *red, int *green, int *blue)
+{
+    Visual *visual = x11_get_visual ();
+    *red = __builtin_popcountl (visual->red_mask);
+    *green = __builtin_popcountl (visual->green_mask);
+    *blue = __builtin_popcountl (visual->blue_mask);
+}
+
 /**
  * Return the Colormap for the current display.
  */
@@ -144,6 +190,70 @@ x11_get_colormap (void)
     return DefaultColormap (DISPLAY, DefaultScreen (DISPLAY));
 }
 
+/**
+ * Return the depth of the root window.
+ */
+int
+x11_get_depth (void)
+{
+    return DefaultDepth (DISPLAY, DefaultScreen (DISPLAY));
+}
+
+/**
+ * Return number of bytes used by a width x height Pixmap at root
+ * window depth.
+ */
+size_t
+x11_get_pixmap_size (int width, int height)
+{
+    int depth = x11_get_depth ();
+    size_t bpp = depth > 16 ? 4 : (depth > 8 ? 2 : 1);
+    return (size_t) width * height * bpp;
+}
+
+/**
+ * Return the pixel format of the root window visual, X11_FORMAT_NONE
+ * if it is not one of the supported TrueColor layouts.
+ */
+enum x11_format
+x11_get_format (void)
+{
+    if (FORMAT_DETECTED) {
+        return FORMAT;
+    }
+    FORMAT_DETECTED = true;
+    FORMAT = X11_FORMAT_NONE;
+
+    Visual *visual = x11_get_visual ();
+    if (visual->class != TrueColor) {
+        return FORMAT;
+    }
+
+    int depth = x11_get_depth ();
+    int bpp = 0;
+    int num_formats;
+    XPixmapFormatValues *formats = XListPixmapFormats (DISPLAY, &num_formats);
+    for (int i = 0; i < num_formats; i++) {
+        if (formats[i].depth == depth) {
+            bpp = formats[i].bits_per_pixel;
+        }
+    }
+    if (formats) {
+        XFree (formats);
+    }
+
+    if (bpp == 32 && (depth == 24 || depth == 32)
+        && visual->red_mask == 0xff0000 && visual->green_mask == 0xff00
+        && visual->blue_mask == 0xff) {
+        FORMAT = X11_FORMAT_ARGB32;
+    } else if (bpp == 16 && depth == 16
+               && visual->red_mask == 0xf800 && visual->green_mask == 0x07e0
+               && visual->blue_mask == 0x1f) {
+        FORMAT = X11_FORMAT_RGB565;
+    }
+    return FORMAT;
+}
+
 /**
  * Return an array with head geometries, the first head is the
  * combined geometry of the display and the last entry is identified
@@ -231,6 +341,23 @@ x11_get_heads (void)
 #endif /* HAVE_XRANDR */
 }
 
+/**
+ * Get signature of the head layout, identical for identical sets of
+ * head geometries.
+ */
+uint64_t
+x11_get_layout_signature (struct geometry **heads)
+{
+    char buf[1024] = {0};
+    size_t pos = 0;
+    for (int i = 0; heads[i] && pos < sizeof (buf); i++) {
+        pos += snprintf (buf + pos, sizeof (buf) - pos, "%d,%d,%dx%d;",
+                         heads[i]->x, heads[i]->y,
+                         heads[i]->width, heads[i]->height);
+    }
+    return str_digest (buf);
+}
+
 /**
  * Update geometry.
  */
@@ -245,23 +372,33 @@ x11_set_geometry_size(struct geometry *geometry, int x, int y,
 }
 
 /**
- * Return XRANDR event.
+ * Check if ev may change the head layout, a ConfigureNotify of the
+ * root window or an XRANDR event. The screen configuration known to
+ * Xlib is updated from configure and screen change events.
  */
 int
-x11_is_xrandr_event (XEvent *ev)
+x11_is_screen_event (XEvent *ev)
 {
+    if (ev->type == ConfigureNotify
+        && ev->xconfigure.window == x11_get_root_window ()) {
+#ifdef HAVE_XRANDR
+        XRRUpdateConfiguration (ev);
+#endif /* HAVE_XRANDR */
+        return 1;
+    }
+
 #ifdef HAVE_XRANDR
     switch (ev->type - XRANDR_EVENT_BASE) {
-    case RRNotify:
-        return RRNotify;
     case RRScreenChangeNotify:
-        return RRScreenChangeNotify;
+        XRRUpdateConfiguration (ev);
+        return 1;
+    case RRNotify:
+        return 1;
     default:
-        return 0;
+        break;
     }
-#else /* ! HAVE_XRANDR */
-    return 0;
 #endif /* HAVE_XRANDR */
+    return 0;
 }
 
 const char*
@@ -340,16 +477,208 @@ x11_parse_color (const char *color_str, struct color *color_ret)
     return parse_ok;
 }
 
+/**
+ * Get pixel value of color in the default colormap, black if the
+ * color can not be allocated. Pixels are allocated once per color, on
+ * visuals without a fixed colormap each allocation takes a colormap
+ * cell.
+ */
+unsigned long
+x11_get_pixel (struct color *color)
+{
+    unsigned char r = color->r, g = color->g, b = color->b;
+    for (int i = 0; i < X11_PIXELS; i++) {
+        if (PIXELS[i].used
+            && PIXELS[i].r == r && PIXELS[i].g == g && PIXELS[i].b == b) {
+            return PIXELS[i].pixel;
+        }
+    }
+
+    XColor xcolor;
+    xcolor.red = r * 0x101;
+    xcolor.green = g * 0x101;
+    xcolor.blue = b * 0x101;
+    xcolor.flags = DoRed | DoGreen | DoBlue;
+    if (! XAllocColor (DISPLAY, x11_get_colormap (), &xcolor)) {
+        return BlackPixel (DISPLAY, DefaultScreen (DISPLAY));
+    }
+
+    /* Only the root background is pinned, skipping one slot is enough. */
+    if (PIXELS[PIXELS_NEXT].pinned) {
+        PIXELS_NEXT = (PIXELS_NEXT + 1) % X11_PIXELS;
+    }
+    struct x11_pixel *slot = &PIXELS[PIXELS_NEXT];
+    if (slot->used) {
+        XFreeColors (DISPLAY, x11_get_colormap (), &slot->pixel, 1, 0);
+    }
+    slot->used = 1;
+    slot->r = r;
+    slot->g = g;
+    slot->b = b;
+    slot->pixel = xcolor.pixel;
+    PIXELS_NEXT = (PIXELS_NEXT + 1) % X11_PIXELS;
+    return xcolor.pixel;
+}
+
 /**
  * Set the background Pixmap of Window.
  */
 void
 x11_set_background_pixmap (Window window, Pixmap pixmap)
 {
+    x11_pin_pixel (window, 0, false);
     XSetWindowBackgroundPixmap (DISPLAY, window, pixmap);
     XClearWindow (DISPLAY, window);
 }
 
+/**
+ * Set the background of Window to a solid pixel, a pixel set on the
+ * root window is kept allocated while in use.
+ */
+void
+x11_set_background_pixel (Window window, unsigned long pixel)
+{
+    x11_pin_pixel (window, pixel, true);
+    XSetWindowBackground (DISPLAY, window, pixel);
+    XClearWindow (DISPLAY, window);
+}
+
+/**
+ * Pin allocated pixel if set on the root window, unpinning the pixel
+ * previously pinned.
+ */
+void
+x11_pin_pixel (Window window, unsigned long pixel, bool pin)
+{
+    if (window != x11_get_root_window ()) {
+        return;
+    }
+    for (int i = 0; i < X11_PIXELS; i++) {
+        PIXELS[i].pinned = pin && PIXELS[i].used && PIXELS[i].pixel == pixel;
+    }
+}
+
+/**
+ * Flush queued requests to the X server.
+ */
+void
+x11_flush (void)
+{
+    XFlush (DISPLAY);
+}
+
+/**
+ * Create Pixmap at root window depth.
+ */
+Pixmap
+x11_create_pixmap (int width, int height)
+{
+    return XCreatePixmap (DISPLAY, x11_get_root_window (),
+                          width, height, x11_get_depth ());
+}
+
+/**
+ * Free Pixmap, ignores None.
+ */
+void
+x11_free_pixmap (Pixmap pixmap)
+{
+    if (pixmap != None) {
+        XFreePixmap (DISPLAY, pixmap);
+    }
+}
+
+/**
+ * Fill rectangle of drawable with black.
+ */
+void
+x11_fill_rectangle (Drawable drawable, int x, int y, int width, int height)
+{
+    x11_fill_rectangle_pixel (drawable,
+                              BlackPixel (DISPLAY, DefaultScreen (DISPLAY)),
+                              x, y, width, height);
+}
+
+/**
+ * Fill rectangle of drawable with pixel.
+ */
+void
+x11_fill_rectangle_pixel (Drawable drawable, unsigned long pixel,
+                          int x, int y, int width, int height)
+{
+    GC gc = x11_get_gc ();
+    XSetForeground (DISPLAY, gc, pixel);
+    XFillRectangle (DISPLAY, drawable, gc, x, y, width, height);
+}
+
+/**
+ * Fill rectangle of drawable repeating tile, starting with the top left
+ * corner of tile at x, y.
+ */
+void
+x11_tile_rectangle (Drawable drawable, Pixmap tile, int x, int y,
+                    int width, int height)
+{
+    GC gc = x11_get_gc ();
+    XSetTile (DISPLAY, gc, tile);
+    XSetTSOrigin (DISPLAY, gc, x, y);
+    XSetFillStyle (DISPLAY, gc, FillTiled);
+    XFillRectangle (DISPLAY, drawable, gc, x, y, width, height);
+    XSetFillStyle (DISPLAY, gc, FillSolid);
+}
+
+/**
+ * Upload width x height pixels in the x11_get_format format, in host
+ * byte order without row padding, to x, y of drawable.
+ */
+void
+x11_put_image (Drawable drawable, const void *data,
+               int x, int y, int width, int height)
+{
+    int bpp = x11_get_format () == X11_FORMAT_RGB565 ? 16 : 32;
+    XImage *image = XCreateImage (DISPLAY, x11_get_visual (),
+                                  x11_get_depth (), ZPixmap, 0,
+                                  (char*) data, width, height, bpp,
+                                  width * (bpp / 8));
+    if (image == NULL) {
+        die ("failed to create %dx%d image, aborting", width, height);
+    }
+
+    uint16_t order = 1;
+    image->byte_order = *(uint8_t*) &order ? LSBFirst : MSBFirst;
+    XPutImage (DISPLAY, drawable, x11_get_gc (), image,
+               0, 0, x, y, width, height);
+
+    /* data is owned by the caller. */
+    image->data = NULL;
+    XDestroyImage (image);
+}
+
+/**
+ * Copy width x height area at src_x, src_y in src to dest_x, dest_y
+ * in dest, all done server side.
+ */
+void
+x11_copy_area (Drawable src, Drawable dest, int src_x, int src_y,
+               int width, int height, int dest_x, int dest_y)
+{
+    XCopyArea (DISPLAY, src, dest, x11_get_gc (),
+               src_x, src_y, width, height, dest_x, dest_y);
+}
+
+/**
+ * Get GC used for server side composition, created on first use.
+ */
+GC
+x11_get_gc (void)
+{
+    if (! GC_COPY) {
+        GC_COPY = XCreateGC (DISPLAY, x11_get_root_window (), 0, 0);
+        XSetGraphicsExposures (DISPLAY, GC_COPY, False);
+    }
+    return GC_COPY;
+}
+
 /**
  * Select input on the root window.
  */
@@ -367,29 +696,38 @@ x11_init_event_listeners (void)
 
 /**
  * Get the next event, return 1 if event was retrived before interrupted.
+ *
+ * Waits at most timeout milliseconds, forever if negative, while also
+ * polling the nfds file descriptors in fds which have revents set on
+ * return.
  */
 int
-x11_next_event (XEvent *ev, int timeout)
+x11_next_event (XEvent *ev, int timeout, struct pollfd *fds, nfds_t nfds)
 {
-    if (XPending (DISPLAY) > 0) {
-        XNextEvent (DISPLAY, ev);
-        return 1;
+    struct pollfd pfds[nfds + 1];
+    pfds[0].fd = ConnectionNumber (DISPLAY);
+    pfds[0].events = POLLIN;
+    pfds[0].revents = 0;
+    for (nfds_t i = 0; i < nfds; i++) {
+        pfds[i + 1] = fds[i];
+        pfds[i + 1].revents = 0;
     }
-    XFlush (DISPLAY);
 
-    int fd = ConnectionNumber (DISPLAY);
-    fd_set rfds;
-    FD_ZERO (&rfds);
-    FD_SET (fd, &rfds);
+    int pending = XPending (DISPLAY) > 0;
+    if (! pending) {
+        XFlush (DISPLAY);
+    }
 
-    struct timeval timeout_tv = { timeout, 0 };
+    int ret = poll (pfds, nfds + 1, pending ? 0 : timeout);
+    for (nfds_t i = 0; i < nfds; i++) {
+        fds[i].revents = ret > 0 ? pfds[i + 1].revents : 0;
+    }
 
-    int ret = select (fd + 1, &rfds, 0, 0, timeout > 0 ? &timeout_tv : 0);
-    if (ret > 0) {
+    if (pending || (ret > 0 && pfds[0].revents && XPending (DISPLAY) > 0)) {
         XNextEvent (DISPLAY, ev);
+        return 1;
     }
-
-    return ret > 0;
+    return 0;
 }
 
 /**
@@ -12,7 +12,9 @@
 #include "config.h"
 
 #include <X11/Xlib.h>
+#include <poll.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /**
  * Geometry specification (list).
@@ -26,6 +28,16 @@ struct geometry {
     struct geometry *next;
 };
 
+/**
+ * Pixel formats of the root window visual wallpaperd converts to
+ * itself, other visuals are rendered by Imlib2.
+ */
+enum x11_format {
+    X11_FORMAT_NONE,
+    X11_FORMAT_ARGB32, /**< 32 bits per pixel, 8 bits per channel. */
+    X11_FORMAT_RGB565 /**< 16 bits per pixel, 5-6-5 bits. */
+};
+
 /**
  * Single RGB color specification.
  */
@@ -36,6 +48,7 @@ struct color {
 };
 
 extern Atom ATOM_DESKTOP;
+extern Atom ATOM_NUMBER_OF_DESKTOPS;
 extern Atom ATOM_DESKTOP_NAMES;
 extern Atom ATOM_ROOTPMAP_ID;
 extern Atom ATOM_UTF8_STRING;
@@ -48,17 +61,39 @@ extern Window x11_get_root_window (void);
 extern Display *x11_get_display (void);
 extern Visual *x11_get_visual (void);
 extern Colormap x11_get_colormap (void);
+extern int x11_get_depth (void);
+extern void x11_get_visual_bits (int *red, int *green, int *blue);
+extern size_t x11_get_pixmap_size (int width, int height);
+extern enum x11_format x11_get_format (void);
 extern struct geometry *x11_get_geometry (void);
 extern struct geometry **x11_get_heads (void);
 extern unsigned int x11_get_num_heads (void);
+extern uint64_t x11_get_layout_signature (struct geometry **heads);
 
 extern bool x11_parse_color (const char *color_str, struct color *color_ret);
 
+extern unsigned long x11_get_pixel (struct color *color);
+
 extern void x11_set_background_pixmap (Window window, Pixmap pixmap);
+extern void x11_set_background_pixel (Window window, unsigned long pixel);
+extern void x11_flush (void);
+extern Pixmap x11_create_pixmap (int width, int height);
+extern void x11_free_pixmap (Pixmap pixmap);
+extern void x11_fill_rectangle (Drawable drawable, int x, int y,
+                                int width, int height);
+extern void x11_fill_rectangle_pixel (Drawable drawable, unsigned long pixel,
+                                      int x, int y, int width, int height);
+extern void x11_tile_rectangle (Drawable drawable, Pixmap tile,
+                                int x, int y, int width, int height);
+extern void x11_put_image (Drawable drawable, const void *data,
+                           int x, int y, int width, int height);
+extern void x11_copy_area (Drawable src, Drawable dest, int src_x, int src_y,
+                           int width, int height, int dest_x, int dest_y);
 
 extern void x11_init_event_listeners (void);
-extern int x11_next_event (XEvent *ev, int timeout);
-extern int x11_is_xrandr_event (XEvent *ev);
+extern int x11_next_event (XEvent *ev, int timeout,
+                           struct pollfd *fds, nfds_t nfds);
+extern int x11_is_screen_event (XEvent *ev);
 extern const char *x11_get_desktop_name (int desktop);
 extern char **x11_get_desktop_names (int do_refresh);
 extern Atom x11_get_atom (const char *atom_name);
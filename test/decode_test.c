@@ -0,0 +1,470 @@
+/*
+ * decode_test.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ *
+ * Decode sample JPEG and PNG images both streamed, one row at a time,
+ * and all at once and compare the results. The samples are written to
+ * a temporary directory with libjpeg and libpng.
+ */
+
+#include "config.h"
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_PNG
+#include <png.h>
+#endif /* HAVE_PNG */
+#ifdef HAVE_JPEG
+#include <jpeglib.h>
+#endif /* HAVE_JPEG */
+
+#include "decode.h"
+#include "kernel.h"
+#include "render.h"
+#include "util.h"
+
+/** Sample image sizes, odd sizes exercise the scaler edges. */
+static const int SIZES[][2] = { { 1, 1 }, { 67, 33 }, { 257, 131 } };
+#define NUM_SIZES ((int) (sizeof (SIZES) / sizeof (SIZES[0])))
+
+/** Render target sizes, both down and upscaling the samples. */
+static const int DEST_SIZES[][2] = { { 31, 17 }, { 120, 90 }, { 300, 77 } };
+#define NUM_DEST_SIZES \
+    ((int) (sizeof (DEST_SIZES) / sizeof (DEST_SIZES[0])))
+
+static const enum wallpaper_mode MODES[] = {
+    MODE_CENTERED, MODE_FILL, MODE_ZOOM, MODE_SCALED
+};
+#define NUM_MODES ((int) (sizeof (MODES) / sizeof (MODES[0])))
+
+static int ERRORS = 0;
+
+static uint32_t *test_image (int width, int height, int has_alpha);
+static void test_compare (const char *path, const char *what,
+                          const uint32_t *expected, const uint32_t *got,
+                          int width, int height, int tolerance);
+static uint32_t *test_decode_full (const char *path, int reduce,
+                                   int *width_ret, int *height_ret,
+                                   int *has_alpha_ret);
+static void test_render (const char *path, int reduce);
+static const uint32_t *test_stream_row (void *data, int y);
+#ifdef HAVE_JPEG
+static int test_write_jpeg (const char *path, const uint32_t *data,
+                            int width, int height, int gray);
+static uint32_t *test_read_jpeg (const char *path, int reduce,
+                                 int *width_ret, int *height_ret);
+static void test_jpeg (const char *dir, int width, int height, int gray);
+#endif /* HAVE_JPEG */
+#ifdef HAVE_PNG
+static int test_write_png (const char *path, const uint32_t *data,
+                           int width, int height, int color_type);
+static void test_png (const char *dir, int width, int height,
+                      int color_type);
+#endif /* HAVE_PNG */
+
+int
+main (void)
+{
+    char dir[] = "/tmp/decode_test.XXXXXX";
+    if (mkdtemp (dir) == NULL) {
+        perror ("failed to create sample directory");
+        return 1;
+    }
+
+    srand (1);
+    for (int i = 0; i < NUM_SIZES; i++) {
+#ifdef HAVE_JPEG
+        test_jpeg (dir, SIZES[i][0], SIZES[i][1], 0);
+        test_jpeg (dir, SIZES[i][0], SIZES[i][1], 1);
+#endif /* HAVE_JPEG */
+#ifdef HAVE_PNG
+        test_png (dir, SIZES[i][0], SIZES[i][1], PNG_COLOR_TYPE_RGB);
+        test_png (dir, SIZES[i][0], SIZES[i][1], PNG_COLOR_TYPE_RGB_ALPHA);
+        test_png (dir, SIZES[i][0], SIZES[i][1], PNG_COLOR_TYPE_GRAY);
+#endif /* HAVE_PNG */
+    }
+    rmdir (dir);
+
+    if (ERRORS) {
+        printf ("%d errors\n", ERRORS);
+        return 1;
+    }
+    printf ("ok\n");
+    return 0;
+}
+
+/**
+ * Create image with a smooth gradient and noise, fully opaque unless
+ * has_alpha is set.
+ */
+uint32_t*
+test_image (int width, int height, int has_alpha)
+{
+    uint32_t *data = mem_new ((size_t) width * height * sizeof (uint32_t));
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint32_t r = (x * 255) / width;
+            uint32_t g = (y * 255) / height;
+            uint32_t b = rand () & 0xff;
+            uint32_t a = has_alpha ? (uint32_t) rand () & 0xff : 0xff;
+            data[y * width + x] = a << 24 | r << 16 | g << 8 | b;
+        }
+    }
+    return data;
+}
+
+/**
+ * Compare width x height pixels, each channel may differ by at most
+ * tolerance.
+ */
+void
+test_compare (const char *path, const char *what, const uint32_t *expected,
+              const uint32_t *got, int width, int height, int tolerance)
+{
+    for (int i = 0; i < width * height; i++) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            int e = (expected[i] >> shift) & 0xff;
+            int g = (got[i] >> shift) & 0xff;
+            if (abs (e - g) > tolerance) {
+                printf ("%s: %s %dx%d differs at %d,%d: "
+                        "expected %08x got %08x\n",
+                        path, what, width, height, i % width, i / width,
+                        expected[i], got[i]);
+                ERRORS++;
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * Decode image at path all at once through the stream, returns NULL
+ * on failure.
+ */
+uint32_t*
+test_decode_full (const char *path, int reduce, int *width_ret,
+                  int *height_ret, int *has_alpha_ret)
+{
+    struct decode_stream *stream = decode_stream_open (path, reduce);
+    if (stream == NULL) {
+        return NULL;
+    }
+
+    size_t row_size = (size_t) stream->width * sizeof (uint32_t);
+    uint32_t *data = mem_new (row_size * stream->height);
+    for (int y = 0; y < stream->height; y++) {
+        memcpy (data + (size_t) y * stream->width,
+                decode_stream_row (stream, y), row_size);
+    }
+    *width_ret = stream->width;
+    *height_ret = stream->height;
+    *has_alpha_ret = stream->has_alpha;
+    if (stream->error) {
+        mem_free (data);
+        data = NULL;
+    }
+    decode_stream_close (stream);
+    return data;
+}
+
+/**
+ * Render image at path in every mode and size both from the fully
+ * decoded image and streamed, the results must be identical.
+ */
+void
+test_render (const char *path, int reduce)
+{
+    struct render_buf image;
+    image.data = test_decode_full (path, reduce, &image.width,
+                                   &image.height, &image.has_alpha);
+    if (image.data == NULL) {
+        printf ("%s: failed to decode\n", path);
+        ERRORS++;
+        return;
+    }
+
+    for (int i = 0; i < NUM_DEST_SIZES; i++) {
+        for (int j = 0; j < NUM_MODES; j++) {
+            struct render_buf full, streamed;
+            render_buf_init (&full, DEST_SIZES[i][0], DEST_SIZES[i][1]);
+            render_buf_init (&streamed, DEST_SIZES[i][0], DEST_SIZES[i][1]);
+            render_image (&full, &image, MODES[j]);
+
+            struct decode_stream *stream = decode_stream_open (path, reduce);
+            struct render_source source = {
+                stream->width, stream->height, stream->has_alpha,
+                test_stream_row, stream
+            };
+            render_image_source (&streamed, &source, MODES[j]);
+            decode_stream_close (stream);
+
+            char what[64];
+            snprintf (what, sizeof (what), "render mode %d", MODES[j]);
+            test_compare (path, what, full.data, streamed.data,
+                          full.width, full.height, 0);
+            render_buf_free (&streamed);
+            render_buf_free (&full);
+        }
+    }
+    mem_free (image.data);
+}
+
+/**
+ * Get row y of the decode stream data.
+ */
+const uint32_t*
+test_stream_row (void *data, int y)
+{
+    return decode_stream_row (data, y);
+}
+
+#ifdef HAVE_JPEG
+
+/**
+ * Write data as JPEG image to path, returns 0 on failure.
+ */
+int
+test_write_jpeg (const char *path, const uint32_t *data, int width,
+                 int height, int gray)
+{
+    FILE *fp = fopen (path, "wb");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr err;
+    cinfo.err = jpeg_std_error (&err);
+    jpeg_create_compress (&cinfo);
+    jpeg_stdio_dest (&cinfo, fp);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = gray ? 1 : 3;
+    cinfo.in_color_space = gray ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults (&cinfo);
+    jpeg_set_quality (&cinfo, 90, TRUE);
+    jpeg_start_compress (&cinfo, TRUE);
+
+    JSAMPLE *row = mem_new ((size_t) width * 3);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint32_t p = data[y * width + x];
+            if (gray) {
+                row[x] = (p >> 8) & 0xff;
+            } else {
+                row[x * 3] = (p >> 16) & 0xff;
+                row[x * 3 + 1] = (p >> 8) & 0xff;
+                row[x * 3 + 2] = p & 0xff;
+            }
+        }
+        jpeg_write_scanlines (&cinfo, &row, 1);
+    }
+    mem_free (row);
+
+    jpeg_finish_compress (&cinfo);
+    jpeg_destroy_compress (&cinfo);
+    return fclose (fp) == 0;
+}
+
+/**
+ * Decode JPEG image at path reduced by reduce directly with libjpeg,
+ * reading all scanlines at once.
+ */
+uint32_t*
+test_read_jpeg (const char *path, int reduce, int *width_ret,
+                int *height_ret)
+{
+    FILE *fp = fopen (path, "rb");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr err;
+    cinfo.err = jpeg_std_error (&err);
+    jpeg_create_decompress (&cinfo);
+    jpeg_stdio_src (&cinfo, fp);
+    jpeg_read_header (&cinfo, TRUE);
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = reduce;
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress (&cinfo);
+
+    int width = cinfo.output_width;
+    int height = cinfo.output_height;
+    JSAMPLE *rgb = mem_new ((size_t) width * height * 3);
+    JSAMPROW *rows = mem_new (sizeof (JSAMPROW) * height);
+    for (int y = 0; y < height; y++) {
+        rows[y] = rgb + (size_t) y * width * 3;
+    }
+    while (cinfo.output_scanline < cinfo.output_height) {
+        jpeg_read_scanlines (&cinfo, rows + cinfo.output_scanline,
+                             cinfo.output_height - cinfo.output_scanline);
+    }
+    jpeg_finish_decompress (&cinfo);
+    jpeg_destroy_decompress (&cinfo);
+    fclose (fp);
+
+    uint32_t *data = mem_new ((size_t) width * height * sizeof (uint32_t));
+    for (int i = 0; i < width * height; i++) {
+        data[i] = 0xff000000 | (uint32_t) rgb[i * 3] << 16
+            | (uint32_t) rgb[i * 3 + 1] << 8 | rgb[i * 3 + 2];
+    }
+    mem_free (rows);
+    mem_free (rgb);
+    *width_ret = width;
+    *height_ret = height;
+    return data;
+}
+
+/**
+ * Test JPEG sample of width x height at every reduction, the streamed
+ * decode must match libjpeg decoding all scanlines at once.
+ */
+void
+test_jpeg (const char *dir, int width, int height, int gray)
+{
+    char path[256];
+    snprintf (path, sizeof (path), "%s/%dx%d%s.jpg", dir, width, height,
+              gray ? "-gray" : "");
+    uint32_t *data = test_image (width, height, 0);
+    if (! test_write_jpeg (path, data, width, height, gray)) {
+        printf ("%s: failed to write sample\n", path);
+        ERRORS++;
+        mem_free (data);
+        return;
+    }
+    mem_free (data);
+
+    for (int reduce = 1; reduce <= DECODE_JPEG_MAX_REDUCE; reduce *= 2) {
+        int width_exp, height_exp, width_got, height_got, has_alpha;
+        int reduce_got = reduce;
+        uint32_t *expected =
+            test_read_jpeg (path, reduce, &width_exp, &height_exp);
+        uint32_t *got = decode_image (path, &reduce_got, &width_got,
+                                      &height_got, &has_alpha);
+        if (expected == NULL || got == NULL || reduce_got != reduce
+            || has_alpha || width_exp != width_got
+            || height_exp != height_got
+            || width_got != (width + reduce - 1) / reduce
+            || height_got != (height + reduce - 1) / reduce) {
+            printf ("%s: reduce %d size mismatch\n", path, reduce);
+            ERRORS++;
+        } else {
+            test_compare (path, "decode", expected, got,
+                          width_got, height_got, 0);
+        }
+        mem_free (expected);
+        mem_free (got);
+        test_render (path, reduce);
+    }
+    unlink (path);
+}
+
+#endif /* HAVE_JPEG */
+
+#ifdef HAVE_PNG
+
+/**
+ * Write data as PNG image of color_type to path, returns 0 on failure.
+ */
+int
+test_write_png (const char *path, const uint32_t *data, int width,
+                int height, int color_type)
+{
+    FILE *fp = fopen (path, "wb");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    png_structp png =
+        png_create_write_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png_create_info_struct (png);
+    if (setjmp (png_jmpbuf (png))) {
+        png_destroy_write_struct (&png, &info);
+        fclose (fp);
+        return 0;
+    }
+    png_init_io (png, fp);
+    png_set_IHDR (png, info, width, height, 8, color_type,
+                  PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                  PNG_FILTER_TYPE_DEFAULT);
+    png_write_info (png, info);
+
+    png_bytep row = mem_new ((size_t) width * 4);
+    for (int y = 0; y < height; y++) {
+        png_bytep p = row;
+        for (int x = 0; x < width; x++) {
+            uint32_t pixel = data[y * width + x];
+            if (color_type == PNG_COLOR_TYPE_GRAY) {
+                *p++ = (pixel >> 8) & 0xff;
+                continue;
+            }
+            *p++ = (pixel >> 16) & 0xff;
+            *p++ = (pixel >> 8) & 0xff;
+            *p++ = pixel & 0xff;
+            if (color_type == PNG_COLOR_TYPE_RGB_ALPHA) {
+                *p++ = pixel >> 24;
+            }
+        }
+        png_write_row (png, row);
+    }
+    mem_free (row);
+
+    png_write_end (png, info);
+    png_destroy_write_struct (&png, &info);
+    return fclose (fp) == 0;
+}
+
+/**
+ * Test PNG sample of width x height, PNG is lossless so the streamed
+ * decode must match the pixels written.
+ */
+void
+test_png (const char *dir, int width, int height, int color_type)
+{
+    char path[256];
+    snprintf (path, sizeof (path), "%s/%dx%d-%d.png", dir, width, height,
+              color_type);
+    uint32_t *data =
+        test_image (width, height, color_type == PNG_COLOR_TYPE_RGB_ALPHA);
+    if (color_type == PNG_COLOR_TYPE_GRAY) {
+        for (int i = 0; i < width * height; i++) {
+            uint32_t g = (data[i] >> 8) & 0xff;
+            data[i] = 0xff000000 | g << 16 | g << 8 | g;
+        }
+    }
+    if (! test_write_png (path, data, width, height, color_type)) {
+        printf ("%s: failed to write sample\n", path);
+        ERRORS++;
+        mem_free (data);
+        return;
+    }
+
+    /* PNG images can not be reduced, decoded at full size. */
+    int reduce = 2, width_got, height_got, has_alpha;
+    uint32_t *got = decode_image (path, &reduce, &width_got, &height_got,
+                                  &has_alpha);
+    if (got == NULL || reduce != 1 || width_got != width
+        || height_got != height) {
+        printf ("%s: size mismatch\n", path);
+        ERRORS++;
+    } else {
+        test_compare (path, "decode", data, got, width, height, 0);
+    }
+    mem_free (got);
+    mem_free (data);
+
+    test_render (path, 1);
+    unlink (path);
+}
+
+#endif /* HAVE_PNG */
@@ -0,0 +1,279 @@
+/*
+ * kernel_test.c for wallpaperd
+ * Copyright (C) 2010-2020 Claes Nästén <pekdon@gmail.com>
+ *
+ * This program is licensed under the MIT license.
+ * See the LICENSE file for more information.
+ *
+ * Compare the output of every SIMD kernel supported by the CPU with
+ * the scalar reference.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernel.h"
+#include "util.h"
+
+/** Widths covering the SIMD bodies and every tail length. */
+static const int WIDTHS[] = {
+    1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 63, 67, 1001
+};
+#define NUM_WIDTHS ((int) (sizeof (WIDTHS) / sizeof (WIDTHS[0])))
+#define MAX_WIDTH 1001
+
+static const int ALPHAS[] = { 0, 1, 127, 128, 255, 256 };
+#define NUM_ALPHAS ((int) (sizeof (ALPHAS) / sizeof (ALPHAS[0])))
+
+static const char *KERNELS[] = { "sse2", "avx2", "neon", NULL };
+
+static int ERRORS = 0;
+
+static uint32_t test_pixel (void);
+static void test_row (uint32_t *row, int width);
+static void test_check (const struct kernel *kernel, const char *op,
+                        int width, const void *expected, const void *got,
+                        size_t size);
+static void test_fill (const struct kernel *kernel);
+static void test_blit (const struct kernel *kernel);
+static void test_blend (const struct kernel *kernel);
+static void test_scale_row (const struct kernel *kernel);
+static void test_scale_col (const struct kernel *kernel);
+static void test_gradient (const struct kernel *kernel);
+static void test_mix (const struct kernel *kernel);
+static void test_rgb565 (const struct kernel *kernel);
+
+int
+main (void)
+{
+    srand (1);
+    int num = 0;
+    for (int i = 0; KERNELS[i]; i++) {
+        const struct kernel *kernel = kernel_from_str (KERNELS[i]);
+        if (kernel == NULL) {
+            printf ("%s: not supported, skipped\n", KERNELS[i]);
+            continue;
+        }
+
+        test_fill (kernel);
+        test_blit (kernel);
+        test_blend (kernel);
+        test_scale_row (kernel);
+        test_scale_col (kernel);
+        test_gradient (kernel);
+        test_mix (kernel);
+        test_rgb565 (kernel);
+        printf ("%s: tested\n", kernel->name);
+        num++;
+    }
+
+    if (num == 0) {
+        printf ("no SIMD kernels supported, nothing to compare\n");
+    }
+    return ERRORS ? 1 : 0;
+}
+
+/**
+ * Random pixel, alpha is fully transparent, opaque or random.
+ */
+uint32_t
+test_pixel (void)
+{
+    uint32_t rgb = ((uint32_t) rand () << 16 ^ (uint32_t) rand ())
+        & 0xffffff;
+    switch (rand () % 3) {
+    case 0:
+        return rgb;
+    case 1:
+        return 0xff000000 | rgb;
+    default:
+        return (uint32_t) (rand () & 0xff) << 24 | rgb;
+    }
+}
+
+/**
+ * Fill row with width random pixels.
+ */
+void
+test_row (uint32_t *row, int width)
+{
+    for (int x = 0; x < width; x++) {
+        row[x] = test_pixel ();
+    }
+}
+
+/**
+ * Report a difference between the scalar and kernel output.
+ */
+void
+test_check (const struct kernel *kernel, const char *op, int width,
+            const void *expected, const void *got, size_t size)
+{
+    if (memcmp (expected, got, size)) {
+        fprintf (stderr, "%s: %s differs from scalar at width %d\n",
+                 kernel->name, op, width);
+        ERRORS++;
+    }
+}
+
+void
+test_fill (const struct kernel *kernel)
+{
+    uint32_t expected[MAX_WIDTH], got[MAX_WIDTH];
+    for (int i = 0; i < NUM_WIDTHS; i++) {
+        uint32_t pixel = test_pixel ();
+        KERNEL_SCALAR.fill (expected, pixel, WIDTHS[i]);
+        kernel->fill (got, pixel, WIDTHS[i]);
+        test_check (kernel, "fill", WIDTHS[i], expected, got,
+                    WIDTHS[i] * sizeof (uint32_t));
+    }
+}
+
+void
+test_blit (const struct kernel *kernel)
+{
+    uint32_t src[MAX_WIDTH], expected[MAX_WIDTH], got[MAX_WIDTH];
+    for (int i = 0; i < NUM_WIDTHS; i++) {
+        test_row (src, WIDTHS[i]);
+        KERNEL_SCALAR.blit (expected, src, WIDTHS[i]);
+        kernel->blit (got, src, WIDTHS[i]);
+        test_check (kernel, "blit", WIDTHS[i], expected, got,
+                    WIDTHS[i] * sizeof (uint32_t));
+    }
+}
+
+void
+test_blend (const struct kernel *kernel)
+{
+    uint32_t src[MAX_WIDTH], expected[MAX_WIDTH], got[MAX_WIDTH];
+    for (int i = 0; i < NUM_WIDTHS; i++) {
+        test_row (src, WIDTHS[i]);
+        test_row (expected, WIDTHS[i]);
+        memcpy (got, expected, WIDTHS[i] * sizeof (uint32_t));
+        KERNEL_SCALAR.blend (expected, src, WIDTHS[i]);
+        kernel->blend (got, src, WIDTHS[i]);
+        test_check (kernel, "blend", WIDTHS[i], expected, got,
+                    WIDTHS[i] * sizeof (uint32_t));
+    }
+}
+
+void
+test_scale_row (const struct kernel *kernel)
+{
+    static const int SRC_SIZES[] = { 3, 17, 640, 1920 };
+    uint32_t src[1920], expected[MAX_WIDTH], got[MAX_WIDTH];
+    for (int type = KERNEL_FILTER_BILINEAR; type <= KERNEL_FILTER_BICUBIC;
+         type++) {
+        for (int s = 0; s < 4; s++) {
+            test_row (src, SRC_SIZES[s]);
+            for (int i = 0; i < NUM_WIDTHS; i++) {
+                int width = WIDTHS[i];
+                struct kernel_filter *filter =
+                    kernel_filter_get (SRC_SIZES[s], width + 3, type);
+                KERNEL_SCALAR.scale_row (expected, src, filter, 3, width);
+                kernel->scale_row (got, src, filter, 3, width);
+                test_check (kernel, "scale_row", width, expected, got,
+                            width * sizeof (uint32_t));
+                kernel_filter_release (filter);
+            }
+        }
+    }
+}
+
+void
+test_scale_col (const struct kernel *kernel)
+{
+    static const int SRC_SIZES[] = { 3, 17, 640, 1920 };
+    uint32_t expected[MAX_WIDTH], got[MAX_WIDTH];
+    uint32_t *src = mem_new (sizeof (uint32_t) * MAX_WIDTH * 1920);
+    const uint32_t **rows = mem_new (sizeof (uint32_t*) * 1920);
+    for (int type = KERNEL_FILTER_BILINEAR; type <= KERNEL_FILTER_BICUBIC;
+         type++) {
+        for (int s = 0; s < 4; s++) {
+            int height = SRC_SIZES[s];
+            test_row (src, MAX_WIDTH * height);
+            struct kernel_filter *filter =
+                kernel_filter_get (height, 37, type);
+            for (int y = 0; y < filter->dest_size; y++) {
+                int width = WIDTHS[y % NUM_WIDTHS];
+                for (int i = 0; i < filter->count[y]; i++) {
+                    rows[i] = src
+                        + (size_t) (filter->start[y] + i) * MAX_WIDTH;
+                }
+                const int16_t *weights =
+                    filter->weights + (size_t) y * filter->max_count;
+                KERNEL_SCALAR.scale_col (expected, rows, weights,
+                                         filter->count[y], width);
+                kernel->scale_col (got, rows, weights, filter->count[y],
+                                   width);
+                test_check (kernel, "scale_col", width, expected, got,
+                            width * sizeof (uint32_t));
+            }
+            kernel_filter_release (filter);
+        }
+    }
+    mem_free (rows);
+    mem_free (src);
+}
+
+void
+test_gradient (const struct kernel *kernel)
+{
+    uint32_t expected[MAX_WIDTH], got[MAX_WIDTH];
+    int32_t start[4], step[4], dither[16];
+    for (int n = 0; n < 16; n++) {
+        for (int c = 0; c < 4; c++) {
+            start[c] = (rand () % 256) << KERNEL_GRADIENT_SHIFT;
+            step[c] = rand () % 2048 - 1024;
+        }
+        for (int i = 0; i < 16; i++) {
+            dither[i] = n & 1 ? rand () % (1 << KERNEL_GRADIENT_SHIFT) : 0;
+        }
+        int width = WIDTHS[n];
+        KERNEL_SCALAR.gradient (expected, start, step, dither, width);
+        kernel->gradient (got, start, step, dither, width);
+        test_check (kernel, "gradient", width, expected, got,
+                    width * sizeof (uint32_t));
+    }
+}
+
+void
+test_mix (const struct kernel *kernel)
+{
+    uint32_t a[MAX_WIDTH], b[MAX_WIDTH];
+    uint32_t expected[MAX_WIDTH], got[MAX_WIDTH];
+    for (int n = 0; n < NUM_ALPHAS; n++) {
+        for (int i = 0; i < NUM_WIDTHS; i++) {
+            test_row (a, WIDTHS[i]);
+            test_row (b, WIDTHS[i]);
+            KERNEL_SCALAR.mix (expected, a, b, ALPHAS[n], WIDTHS[i]);
+            kernel->mix (got, a, b, ALPHAS[n], WIDTHS[i]);
+            test_check (kernel, "mix", WIDTHS[i], expected, got,
+                        WIDTHS[i] * sizeof (uint32_t));
+        }
+    }
+}
+
+void
+test_rgb565 (const struct kernel *kernel)
+{
+    uint32_t src[MAX_WIDTH];
+    uint16_t expected[MAX_WIDTH], got[MAX_WIDTH];
+    uint8_t dither[16];
+    for (int n = 0; n < 3; n++) {
+        for (int i = 0; i < 16; i++) {
+            /* No, ordered and saturating dither. */
+            dither[i] = n == 0 ? 0 : (n == 1 ? rand () % 8 : rand () % 256);
+        }
+        for (int i = 0; i < NUM_WIDTHS; i++) {
+            test_row (src, WIDTHS[i]);
+            KERNEL_SCALAR.rgb565 (expected, src, dither, WIDTHS[i]);
+            kernel->rgb565 (got, src, dither, WIDTHS[i]);
+            test_check (kernel, "rgb565", WIDTHS[i], expected, got,
+                        WIDTHS[i] * sizeof (uint16_t));
+        }
+    }
+}